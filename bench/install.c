@@ -0,0 +1,209 @@
+
+#define _DEFAULT_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include "rimraf/rimraf.h"
+#include "clib-package.h"
+#include "mock-registry.h"
+
+/**
+ * End-to-end install benchmark: every scenario installs the
+ * graph served by a local mock registry, in a fresh process,
+ * and reports wall time, requests, bytes, peak RSS and peak
+ * thread count.
+ *
+ *   bench/install [--json] [scenario...]
+ */
+
+typedef struct {
+  const char *name;
+  mock_registry_shape_t shape;
+} scenario_t;
+
+static scenario_t scenarios[] = {
+  // name          depth fan  diamonds files size       latency bandwidth errors
+  { "flat",       { 1,   16,  0.0,     2,    4 << 10,   0,      0,        0.0 } },
+  { "deep",       { 8,   1,   0.0,     2,    4 << 10,   0,      0,        0.0 } },
+  { "tree",       { 3,   4,   0.0,     2,    4 << 10,   0,      0,        0.0 } },
+  { "diamonds",   { 3,   4,   0.6,     2,    4 << 10,   0,      0,        0.0 } },
+  { "many-files", { 1,   4,   0.0,     32,   2 << 10,   0,      0,        0.0 } },
+  { "big-files",  { 1,   4,   0.0,     2,    4 << 20,   0,      0,        0.0 } },
+  { "latency",    { 2,   4,   0.0,     2,    4 << 10,   50,     0,        0.0 } },
+  { "slow-link",  { 1,   4,   0.0,     2,    256 << 10, 0,      1 << 20,  0.0 } },
+  { "flaky",      { 2,   4,   0.0,     2,    4 << 10,   0,      0,        0.05 } },
+};
+
+struct result {
+  int rc;
+  double wall_ms;
+  long peak_rss_kb;
+  int peak_threads;
+};
+
+static volatile int sampling = 0;
+static int peak_threads = 0;
+
+static double
+now_ms(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000.0 + ts.tv_nsec / 1e6;
+}
+
+static int
+thread_count(void) {
+  char line[256];
+  int threads = 0;
+  FILE *status = fopen("/proc/self/status", "r");
+  if (!status) return 0;
+  while (fgets(line, sizeof(line), status)) {
+    if (1 == sscanf(line, "Threads: %d", &threads)) break;
+  }
+  fclose(status);
+  return threads;
+}
+
+static void *
+sample_threads(void *arg) {
+  (void) arg;
+  while (sampling) {
+    int threads = thread_count();
+    if (threads > peak_threads) peak_threads = threads;
+    usleep(1000);
+  }
+  return NULL;
+}
+
+/**
+ * Install `bench/p0` from the registry on `port` into a
+ * scratch directory.  Runs in its own process.
+ */
+
+static void
+run_install(int port, struct result *result) {
+  char dir[] = "/tmp/clib-package-bench-XXXXXX";
+  char cfg[128];
+  pthread_t sampler;
+  struct rusage usage;
+
+  if (!mkdtemp(dir) || 0 != chdir(dir)) {
+    result->rc = -1;
+    return;
+  }
+  // the install path is chatty
+  if (!freopen("/dev/null", "w", stdout)) result->rc = -1;
+
+  snprintf(cfg, sizeof(cfg), "{ \"api_endpoints\": [\"http://127.0.0.1:%d/\"] }", port);
+
+  sampling = 1;
+  pthread_create(&sampler, NULL, sample_threads, NULL);
+
+  clib_package_ctx_t *ctx = clib_package_ctx_new(cfg);
+  double start = now_ms();
+  clib_package_t *pkg = clib_package_new_from_slug("bench/p0", 0, ctx);
+  result->rc = pkg ? clib_package_install(pkg, "deps", 0) : -1;
+  result->wall_ms = now_ms() - start;
+
+  sampling = 0;
+  pthread_join(sampler, NULL);
+  result->peak_threads = peak_threads - 1; // not the sampler
+  if (pkg) clib_package_free(pkg);
+  clib_package_ctx_free(ctx);
+
+  getrusage(RUSAGE_SELF, &usage);
+  result->peak_rss_kb = usage.ru_maxrss;
+
+  if (0 == chdir("/")) rimraf(dir);
+}
+
+static int
+run_scenario(scenario_t *scenario, int json) {
+  struct result result;
+  int fds[2];
+  pid_t pid;
+
+  mock_registry_t *registry = mock_registry_start(&scenario->shape);
+  if (!registry) {
+    fprintf(stderr, "%s: unable to start the mock registry\n", scenario->name);
+    return -1;
+  }
+
+  memset(&result, 0, sizeof(result));
+  result.rc = -1;
+  if (0 != pipe(fds) || (pid = fork()) < 0) {
+    mock_registry_stop(registry);
+    return -1;
+  }
+
+  if (0 == pid) {
+    close(fds[0]);
+    run_install(mock_registry_port(registry), &result);
+    if (sizeof(result) != write(fds[1], &result, sizeof(result))) _exit(1);
+    _exit(0);
+  }
+
+  close(fds[1]);
+  if (sizeof(result) != read(fds[0], &result, sizeof(result))) result.rc = -1;
+  close(fds[0]);
+  waitpid(pid, NULL, 0);
+
+  if (json) {
+    printf("{ \"scenario\": \"%s\", \"packages\": %d, \"rc\": %d, \"wall_ms\": %.1f,"
+      " \"requests\": %lu, \"bytes\": %llu, \"peak_rss_kb\": %ld, \"peak_threads\": %d }\n"
+      , scenario->name
+      , mock_registry_packages(registry)
+      , result.rc
+      , result.wall_ms
+      , mock_registry_requests(registry)
+      , mock_registry_bytes(registry)
+      , result.peak_rss_kb
+      , result.peak_threads);
+  } else {
+    printf("%-12s %6d %10.1f %9lu %12llu %12ld %8d %4d\n"
+      , scenario->name
+      , mock_registry_packages(registry)
+      , result.wall_ms
+      , mock_registry_requests(registry)
+      , mock_registry_bytes(registry)
+      , result.peak_rss_kb
+      , result.peak_threads
+      , result.rc);
+  }
+  fflush(stdout);
+
+  mock_registry_stop(registry);
+  return result.rc;
+}
+
+int
+main(int argc, char **argv) {
+  int json = 0;
+  int selected = 0;
+  int failures = 0;
+
+  for (int i = 1; i < argc; i++) {
+    if (0 == strcmp("--json", argv[i])) json = 1;
+    else selected++;
+  }
+
+  if (!json) {
+    printf("%-12s %6s %10s %9s %12s %12s %8s %4s\n"
+      , "scenario", "pkgs", "wall ms", "requests", "bytes", "peak rss kb", "threads", "rc");
+  }
+
+  for (size_t s = 0; s < sizeof(scenarios) / sizeof(scenarios[0]); s++) {
+    int wanted = !selected;
+    for (int i = 1; i < argc; i++) {
+      if (0 == strcmp(scenarios[s].name, argv[i])) wanted = 1;
+    }
+    if (wanted && 0 != run_scenario(&scenarios[s], json)) failures++;
+  }
+
+  return failures ? 1 : 0;
+}
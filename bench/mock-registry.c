@@ -0,0 +1,376 @@
+
+#define _DEFAULT_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include "mock-registry.h"
+
+/**
+ * A small HTTP server imitating the GitHub endpoints used by
+ * `clib_package_new_from_slug()` and `fetch_package_file()`:
+ *
+ *   GET /repos/:owner/:name
+ *   GET /repos/:owner/:name/contents/:file
+ *   GET /raw/:owner/:name/:file
+ *
+ * It runs in its own process so it does not skew the RSS and
+ * thread counts of the install being measured.
+ */
+
+#define MAX_PACKAGES 4096
+#define MAX_DEPS 64
+#define OWNER "bench"
+
+struct package {
+  int ndeps;
+  int deps[MAX_DEPS];
+};
+
+// shared with the server process
+struct counters {
+  unsigned long requests;
+  unsigned long long bytes;
+};
+
+struct mock_registry {
+  mock_registry_shape_t shape;
+  struct package *packages;
+  int npackages;
+  int fd;
+  int port;
+  pid_t pid;
+  struct counters *counters;
+};
+
+struct connection {
+  mock_registry_t *registry;
+  int fd;
+  unsigned int seed;
+};
+
+static double
+random01(unsigned int *seed) {
+  return (double) rand_r(seed) / ((double) RAND_MAX + 1);
+}
+
+/**
+ * Build a graph `depth` levels deep where each package has
+ * `fanout` dependencies, a `diamonds` fraction of which are
+ * shared with other packages of the same level.
+ */
+
+static void
+build_graph(mock_registry_t *self) {
+  unsigned int seed = 42;
+  int fanout = self->shape.fanout < MAX_DEPS ? self->shape.fanout : MAX_DEPS;
+  int level_start = 0;
+
+  self->npackages = 1;
+  for (int level = 0; level < self->shape.depth; level++) {
+    int level_end = self->npackages;
+    int next_start = self->npackages;
+
+    for (int p = level_start; p < level_end; p++) {
+      struct package *pkg = &self->packages[p];
+      for (int k = 0; k < fanout; k++) {
+        int child = -1;
+        int existing = self->npackages - next_start;
+
+        if (existing > 0 && random01(&seed) < self->shape.diamonds) {
+          child = next_start + rand_r(&seed) % existing;
+          for (int d = 0; d < pkg->ndeps; d++) {
+            if (pkg->deps[d] == child) child = -1;
+          }
+        }
+        if (child < 0) {
+          if (self->npackages >= MAX_PACKAGES) break;
+          child = self->npackages++;
+        }
+        pkg->deps[pkg->ndeps++] = child;
+      }
+    }
+
+    level_start = next_start;
+  }
+}
+
+static void
+send_all(mock_registry_t *self, int fd, const char *buf, size_t len) {
+  size_t bandwidth = self->shape.bandwidth;
+  // throttled links send a 50ms share at a time
+  size_t chunk = bandwidth ? bandwidth / 20 : len;
+  if (0 == chunk) chunk = 1;
+
+  while (len) {
+    ssize_t n = send(fd, buf, len < chunk ? len : chunk, MSG_NOSIGNAL);
+    if (n <= 0) return;
+    __atomic_fetch_add(&self->counters->bytes, (unsigned long long) n, __ATOMIC_RELAXED);
+    buf += n;
+    len -= n;
+    if (bandwidth && len) usleep(50 * 1000);
+  }
+}
+
+static void
+respond(mock_registry_t *self, int fd, int status, const char *body, size_t len) {
+  char head[512];
+  int n = snprintf(head, sizeof(head)
+    , "HTTP/1.1 %d %s\r\n"
+      "Content-Length: %lu\r\n"
+      "X-RateLimit-Remaining: 5000\r\n"
+      "X-RateLimit-Reset: %ld\r\n"
+      "Connection: close\r\n"
+      "\r\n"
+    , status
+    , 200 == status ? "OK" : 404 == status ? "Not Found" : "Service Unavailable"
+    , (unsigned long) len
+    , (long) time(NULL) + 3600);
+  send_all(self, fd, head, n);
+  send_all(self, fd, body, len);
+}
+
+/**
+ * Parse `p<index>` into a package index, or -1.
+ */
+
+static int
+package_index(mock_registry_t *self, const char *name, size_t len) {
+  char *end = NULL;
+  if (len < 2 || 'p' != name[0]) return -1;
+  long index = strtol(name + 1, &end, 10);
+  if (end != name + len || index < 0 || index >= self->npackages) return -1;
+  return (int) index;
+}
+
+static char *
+package_json(mock_registry_t *self, int index) {
+  size_t cap = 256 + (size_t) self->shape.files * 32 + MAX_DEPS * 32;
+  char *json = malloc(cap);
+  size_t n = 0;
+  struct package *pkg = &self->packages[index];
+
+  n += snprintf(json + n, cap - n
+    , "{ \"name\": \"p%d\", \"version\": \"1.0.0\", \"repo\": \"" OWNER "/p%d\", \"src\": ["
+    , index
+    , index);
+  for (int k = 0; k < self->shape.files; k++) {
+    n += snprintf(json + n, cap - n, "%s\"p%d-%d.c\"", k ? ", " : "", index, k);
+  }
+  n += snprintf(json + n, cap - n, "], \"dependencies\": {");
+  for (int d = 0; d < pkg->ndeps; d++) {
+    n += snprintf(json + n, cap - n
+      , "%s\"" OWNER "/p%d\": \"1.0.0\""
+      , d ? ", " : ""
+      , pkg->deps[d]);
+  }
+  snprintf(json + n, cap - n, "} }");
+  return json;
+}
+
+static char *
+source_file(mock_registry_t *self, const char *name, size_t *len) {
+  size_t size = self->shape.file_size;
+  char *source = malloc(size + 1);
+  size_t n = snprintf(source, size + 1, "/* %s */\n", name);
+  if (n > size) n = size;
+  while (n < size) {
+    size_t line = size - n < 64 ? size - n : 64;
+    memset(source + n, '/', line - 1);
+    source[n + line - 1] = '\n';
+    n += line;
+  }
+  source[size] = '\0';
+  *len = size;
+  return source;
+}
+
+static void
+serve(mock_registry_t *self, int fd, unsigned int *seed) {
+  char request[8192];
+  char body[1024];
+  size_t n = 0;
+  ssize_t r = 0;
+
+  while (n < sizeof(request) - 1 && (r = recv(fd, request + n, sizeof(request) - 1 - n, 0)) > 0) {
+    n += r;
+    request[n] = '\0';
+    if (strstr(request, "\r\n\r\n")) break;
+  }
+  if (0 != strncmp(request, "GET ", 4)) return;
+
+  __atomic_fetch_add(&self->counters->requests, 1, __ATOMIC_RELAXED);
+  if (self->shape.latency_ms) usleep(self->shape.latency_ms * 1000);
+  if (random01(seed) < self->shape.error_rate) {
+    respond(self, fd, 503, "", 0);
+    return;
+  }
+
+  char *target = request + 4;
+  target[strcspn(target, " ?")] = '\0';
+
+  int raw = 0 == strncmp(target, "/raw/" OWNER "/", 5 + sizeof(OWNER));
+  int api = 0 == strncmp(target, "/repos/" OWNER "/", 7 + sizeof(OWNER));
+  if (!raw && !api) {
+    respond(self, fd, 404, "", 0);
+    return;
+  }
+
+  char *name = target + (raw ? 5 : 7) + sizeof(OWNER);
+  size_t name_len = strcspn(name, "/");
+  int index = package_index(self, name, name_len);
+  char *rest = name[name_len] ? name + name_len + 1 : NULL;
+  if (-1 == index) {
+    respond(self, fd, 404, "", 0);
+    return;
+  }
+
+  if (api && !rest) {
+    n = snprintf(body, sizeof(body), "{ \"name\": \"p%d\" }", index);
+    respond(self, fd, 200, body, n);
+  } else if (api && 0 == strncmp(rest, "contents/", 9)) {
+    const char *file = rest + 9;
+    unsigned long hash = 5381;
+    for (const char *c = file; *c; c++) hash = hash * 33 + *c;
+    n = snprintf(body, sizeof(body)
+      , "{ \"download_url\": \"http://127.0.0.1:%d/raw/" OWNER "/p%d/%s\","
+        " \"sha\": \"%08x%08lx\" }"
+      , self->port
+      , index
+      , file
+      , (unsigned int) index
+      , hash);
+    respond(self, fd, 200, body, n);
+  } else if (raw && rest && 0 == strcmp(rest, "package.json")) {
+    char *json = package_json(self, index);
+    respond(self, fd, 200, json, strlen(json));
+    free(json);
+  } else if (raw && rest) {
+    size_t len = 0;
+    char *source = source_file(self, rest, &len);
+    respond(self, fd, 200, source, len);
+    free(source);
+  } else {
+    respond(self, fd, 404, "", 0);
+  }
+}
+
+static void *
+connection_thread(void *arg) {
+  struct connection *conn = arg;
+  serve(conn->registry, conn->fd, &conn->seed);
+  shutdown(conn->fd, SHUT_WR);
+  close(conn->fd);
+  free(conn);
+  return NULL;
+}
+
+static void
+accept_loop(mock_registry_t *self) {
+  unsigned int seed = 7;
+  for (;;) {
+    int fd = accept(self->fd, NULL, NULL);
+    if (fd < 0) continue;
+
+    struct connection *conn = malloc(sizeof(struct connection));
+    pthread_t thread;
+    conn->registry = self;
+    conn->fd = fd;
+    conn->seed = rand_r(&seed);
+    if (0 != pthread_create(&thread, NULL, connection_thread, conn)) {
+      close(fd);
+      free(conn);
+      continue;
+    }
+    pthread_detach(thread);
+  }
+}
+
+/**
+ * Start a registry serving a graph of the given `shape` on an
+ * ephemeral port of 127.0.0.1.  The root package is `bench/p0`.
+ */
+
+mock_registry_t *
+mock_registry_start(const mock_registry_shape_t *shape) {
+  struct sockaddr_in addr;
+  socklen_t addr_len = sizeof(addr);
+  mock_registry_t *self = calloc(1, sizeof(mock_registry_t));
+  if (!self) return NULL;
+
+  self->shape = *shape;
+  self->packages = calloc(MAX_PACKAGES, sizeof(struct package));
+  self->counters = mmap(NULL, sizeof(struct counters)
+    , PROT_READ | PROT_WRITE
+    , MAP_SHARED | MAP_ANONYMOUS
+    , -1
+    , 0);
+  if (!self->packages || MAP_FAILED == self->counters) goto error;
+  memset(self->counters, 0, sizeof(struct counters));
+  build_graph(self);
+
+  memset(&addr, 0, sizeof(addr));
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  addr.sin_port = 0;
+  if ((self->fd = socket(AF_INET, SOCK_STREAM, 0)) < 0) goto error;
+  if (0 != bind(self->fd, (struct sockaddr *) &addr, sizeof(addr))) goto error;
+  if (0 != listen(self->fd, 512)) goto error;
+  if (0 != getsockname(self->fd, (struct sockaddr *) &addr, &addr_len)) goto error;
+  self->port = ntohs(addr.sin_port);
+
+  if ((self->pid = fork()) < 0) goto error;
+  if (0 == self->pid) {
+    accept_loop(self);
+    _exit(0);
+  }
+
+  close(self->fd);
+  return self;
+
+error:
+  if (self->fd > 0) close(self->fd);
+  if (self->counters && MAP_FAILED != self->counters) {
+    munmap(self->counters, sizeof(struct counters));
+  }
+  free(self->packages);
+  free(self);
+  return NULL;
+}
+
+int
+mock_registry_port(mock_registry_t *self) {
+  return self->port;
+}
+
+int
+mock_registry_packages(mock_registry_t *self) {
+  return self->npackages;
+}
+
+unsigned long
+mock_registry_requests(mock_registry_t *self) {
+  return __atomic_load_n(&self->counters->requests, __ATOMIC_RELAXED);
+}
+
+unsigned long long
+mock_registry_bytes(mock_registry_t *self) {
+  return __atomic_load_n(&self->counters->bytes, __ATOMIC_RELAXED);
+}
+
+void
+mock_registry_stop(mock_registry_t *self) {
+  kill(self->pid, SIGTERM);
+  waitpid(self->pid, NULL, 0);
+  munmap(self->counters, sizeof(struct counters));
+  free(self->packages);
+  free(self);
+}
@@ -0,0 +1,43 @@
+
+#ifndef MOCK_REGISTRY_H
+#define MOCK_REGISTRY_H 1
+
+#include <stddef.h>
+
+/**
+ * Shape of the synthetic dependency graph served by the mock
+ * registry, and the network conditions it imitates.
+ */
+
+typedef struct {
+  int depth;          // levels of dependencies below the root
+  int fanout;         // dependencies per package
+  double diamonds;    // chance a dependency is shared with another package
+  int files;          // source files per package
+  size_t file_size;   // bytes per source file
+  int latency_ms;     // delay before every response
+  size_t bandwidth;   // bytes per second per connection, 0 for unlimited
+  double error_rate;  // fraction of requests answered with a 503
+} mock_registry_shape_t;
+
+typedef struct mock_registry mock_registry_t;
+
+mock_registry_t *
+mock_registry_start(const mock_registry_shape_t *);
+
+int
+mock_registry_port(mock_registry_t *);
+
+int
+mock_registry_packages(mock_registry_t *);
+
+unsigned long
+mock_registry_requests(mock_registry_t *);
+
+unsigned long long
+mock_registry_bytes(mock_registry_t *);
+
+void
+mock_registry_stop(mock_registry_t *);
+
+#endif
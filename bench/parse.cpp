@@ -0,0 +1,237 @@
+
+//
+// Microbenchmarks for package parsing and the slug/URL builders.
+//
+// The library is compiled into this translation unit so the
+// static helpers (`parse_package_deps()`, `clib_package_slug()`,
+// `clib_package_repo()`) can be measured directly.
+//
+//   bench/parse [--json] [corpus-dir]
+//
+
+#include <dirent.h>
+#include <malloc.h>
+#include <vector>
+#include "clib-package.cpp"
+
+extern "C" {
+  void *__libc_malloc(size_t);
+  void *__libc_calloc(size_t, size_t);
+  void *__libc_realloc(void *, size_t);
+  void __libc_free(void *);
+}
+
+/**
+ * Count every allocation made while a benchmark runs.
+ */
+
+static unsigned long _allocs = 0;
+static unsigned long long _alloc_bytes = 0;
+
+extern "C" void *
+malloc(size_t size) {
+  __atomic_fetch_add(&_allocs, 1, __ATOMIC_RELAXED);
+  __atomic_fetch_add(&_alloc_bytes, size, __ATOMIC_RELAXED);
+  return __libc_malloc(size);
+}
+
+extern "C" void *
+calloc(size_t n, size_t size) {
+  __atomic_fetch_add(&_allocs, 1, __ATOMIC_RELAXED);
+  __atomic_fetch_add(&_alloc_bytes, n * size, __ATOMIC_RELAXED);
+  return __libc_calloc(n, size);
+}
+
+extern "C" void *
+realloc(void *ptr, size_t size) {
+  __atomic_fetch_add(&_allocs, 1, __ATOMIC_RELAXED);
+  __atomic_fetch_add(&_alloc_bytes, size, __ATOMIC_RELAXED);
+  return __libc_realloc(ptr, size);
+}
+
+extern "C" void
+free(void *ptr) {
+  __libc_free(ptr);
+}
+
+#define BENCH_MIN_NS 200000000LL // run each benchmark for at least 200ms
+
+struct input {
+  std::string name;
+  std::string json;
+};
+
+static int _json = 0;
+
+static long long
+now_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (long long) ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+/**
+ * Run `op(arg)` until `BENCH_MIN_NS` passed and report the
+ * time and allocations per op.
+ */
+
+static void
+bench(const char *name, const char *input, void (*op)(void *), void *arg) {
+  unsigned long long iterations = 0;
+  unsigned long long batch = 1;
+  long long elapsed = 0;
+
+  op(arg); // warm up
+
+  unsigned long allocs = __atomic_load_n(&_allocs, __ATOMIC_RELAXED);
+  unsigned long long bytes = __atomic_load_n(&_alloc_bytes, __ATOMIC_RELAXED);
+  long long start = now_ns();
+  while (elapsed < BENCH_MIN_NS) {
+    for (unsigned long long i = 0; i < batch; i++) op(arg);
+    iterations += batch;
+    batch *= 2;
+    elapsed = now_ns() - start;
+  }
+  allocs = __atomic_load_n(&_allocs, __ATOMIC_RELAXED) - allocs;
+  bytes = __atomic_load_n(&_alloc_bytes, __ATOMIC_RELAXED) - bytes;
+
+  double ns_per_op = (double) elapsed / iterations;
+  double allocs_per_op = (double) allocs / iterations;
+  double bytes_per_op = (double) bytes / iterations;
+
+  if (_json) {
+    printf("{ \"bench\": \"%s\", \"input\": \"%s\", \"iterations\": %llu,"
+      " \"ns_per_op\": %.1f, \"allocs_per_op\": %.2f, \"bytes_per_op\": %.1f }\n"
+      , name, input, iterations, ns_per_op, allocs_per_op, bytes_per_op);
+  } else {
+    printf("%-28s %-24s %12.1f %10.2f %12.1f\n"
+      , name, input, ns_per_op, allocs_per_op, bytes_per_op);
+  }
+  fflush(stdout);
+}
+
+static void
+op_package_new(void *arg) {
+  struct input *in = (struct input *) arg;
+  clib_package_t *pkg = clib_package_new(in->json.c_str(), 0, NULL);
+  if (pkg) clib_package_free(pkg);
+}
+
+static void
+op_parse_package_deps(void *arg) {
+  JSON_Object *deps = (JSON_Object *) arg;
+  list_t *list = parse_package_deps(deps);
+  if (list) list_destroy(list);
+}
+
+static void
+op_dependency_new(void *arg) {
+  (void) arg;
+  clib_package_dependency_t *dep = clib_package_dependency_new("stephenmathieson/case.c", "0.1.3");
+  clib_package_dependency_free(dep);
+}
+
+static void
+op_slug(void *arg) {
+  (void) arg;
+  free(clib_package_slug("stephenmathieson", "case.c", "0.1.3"));
+}
+
+static void
+op_repo(void *arg) {
+  (void) arg;
+  free(clib_package_repo("stephenmathieson", "case.c"));
+}
+
+static void
+op_url(void *arg) {
+  (void) arg;
+  free(clib_package_url("stephenmathieson", "case.c", "0.1.3"));
+}
+
+static void
+op_url_from_repo(void *arg) {
+  (void) arg;
+  free(clib_package_url_from_repo("stephenmathieson/case.c", "0.1.3"));
+}
+
+/**
+ * A manifest with `n` dependencies and `n` source files.
+ */
+
+static struct input
+synthetic(int n) {
+  struct input in;
+  in.name = "synthetic-" + std::to_string(n);
+  in.json = "{ \"name\": \"synthetic\", \"version\": \"1.0.0\", \"repo\": \"bench/synthetic\", \"src\": [";
+  for (int i = 0; i < n; i++) {
+    in.json += (i ? ", \"src/file-" : "\"src/file-") + std::to_string(i) + ".c\"";
+  }
+  in.json += "], \"dependencies\": {";
+  for (int i = 0; i < n; i++) {
+    in.json += (i ? ", \"owner-" : "\"owner-") + std::to_string(i % 17)
+      + "/dep-" + std::to_string(i) + ".c\": \"" + std::to_string(i % 5) + ".1.0\"";
+  }
+  in.json += "} }";
+  return in;
+}
+
+static std::vector<struct input>
+load_corpus(const char *dir) {
+  std::vector<struct input> inputs;
+  struct dirent *entry = NULL;
+  DIR *d = opendir(dir);
+
+  while (d && (entry = readdir(d))) {
+    std::string name(entry->d_name);
+    if (name.size() < 5 || 0 != name.compare(name.size() - 5, 5, ".json")) continue;
+    struct input in;
+    in.name = name;
+    if (0 == file_read_all((std::string(dir) + "/" + name).c_str(), &in.json)) {
+      inputs.push_back(in);
+    }
+  }
+  if (d) closedir(d);
+
+  int sizes[] = { 0, 10, 100, 1000 };
+  for (size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+    inputs.push_back(synthetic(sizes[i]));
+  }
+  return inputs;
+}
+
+int
+main(int argc, char **argv) {
+  const char *corpus = "bench/corpus";
+
+  for (int i = 1; i < argc; i++) {
+    if (0 == strcmp("--json", argv[i])) _json = 1;
+    else corpus = argv[i];
+  }
+
+  std::vector<struct input> inputs = load_corpus(corpus);
+
+  if (!_json) {
+    printf("%-28s %-24s %12s %10s %12s\n"
+      , "benchmark", "input", "ns/op", "allocs/op", "bytes/op");
+  }
+
+  for (size_t i = 0; i < inputs.size(); i++) {
+    bench("clib_package_new", inputs[i].name.c_str(), op_package_new, &inputs[i]);
+  }
+
+  for (size_t i = 0; i < inputs.size(); i++) {
+    JSON_Value *root = json_parse_string(inputs[i].json.c_str());
+    JSON_Object *deps = json_object_get_object(json_value_get_object(root), "dependencies");
+    if (deps) bench("parse_package_deps", inputs[i].name.c_str(), op_parse_package_deps, deps);
+    if (root) json_value_free(root);
+  }
+
+  bench("clib_package_dependency_new", "-", op_dependency_new, NULL);
+  bench("clib_package_slug", "-", op_slug, NULL);
+  bench("clib_package_repo", "-", op_repo, NULL);
+  bench("clib_package_url", "-", op_url, NULL);
+  bench("clib_package_url_from_repo", "-", op_url_from_repo, NULL);
+
+  return 0;
+}
@@ -0,0 +1,418 @@
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <limits.h>
+#include <unistd.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include "fs/fs.h"
+#include "clib-package.h"
+
+/**
+ * Install daemon: keeps one session (connection pool, endpoint
+ * and manifest caches) warm and serves installs over a Unix
+ * domain socket, so repeated installs start hot.
+ *
+ *   daemon serve <socket> [config.json]
+ *   daemon install <socket> <dir> <slug>...
+ *   daemon stats <socket>
+ *
+ * The protocol is one request line per connection, its fields
+ * separated by tabs (so that directories may hold spaces):
+ *
+ *   install <dir> <slug>...   progress lines, then "ok" or "error ..."
+ *   stats                     one JSON line of counters
+ *   ping                      "pong"
+ *
+ * Progress lines are `<event> <slug> <detail>`.  Closing the
+ * connection cancels the install.  Installs run packages'
+ * install commands, so the socket is only for its owner.
+ */
+
+#define DAEMON_MANIFEST_TTL 300
+
+#define DAEMON_LINE_MAX 8192
+
+static clib_package_ctx_t *ctx = NULL;
+
+static int
+send_line(int fd, const char *line) {
+  size_t len = strlen(line);
+  while (len > 0) {
+    ssize_t n = send(fd, line, len, MSG_NOSIGNAL);
+    if (n < 0 && EINTR == errno) continue;
+    if (n <= 0) return -1;
+    line += n;
+    len -= n;
+  }
+  return 0;
+}
+
+struct client {
+  int fd;
+  clib_package_cancel_t *cancel;
+  pthread_mutex_t mutex;
+  int stop[2]; // written to when the install is over
+};
+
+static void
+on_progress(const char *event, const char *slug, const char *detail, void *data) {
+  struct client *client = (struct client *) data;
+  char line[1024];
+  snprintf(line, sizeof(line), "%s %s %s\n", event, slug ? slug : "-", detail ? detail : "-");
+
+  pthread_mutex_lock(&client->mutex);
+  int rc = send_line(client->fd, line);
+  pthread_mutex_unlock(&client->mutex);
+
+  // nobody is listening any more
+  if (-1 == rc) clib_package_cancel(client->cancel, CLIB_PACKAGE_ECANCELED, NULL, "client went away");
+}
+
+/**
+ * Cancel the install of `arg` as soon as its client hangs up,
+ * rather than at the next progress line it fails to send.
+ */
+
+static void *
+watch_client(void *arg) {
+  struct client *client = (struct client *) arg;
+  struct pollfd fds[2];
+  char buf[256];
+
+  fds[0].fd = client->fd;
+  fds[0].events = POLLIN | POLLRDHUP;
+  fds[1].fd = client->stop[0];
+  fds[1].events = POLLIN;
+  for (;;) {
+    fds[0].revents = fds[1].revents = 0;
+    if (-1 == poll(fds, 2, -1)) {
+      if (EINTR == errno) continue;
+      break;
+    }
+    if (fds[1].revents) break;
+    if (fds[0].revents & (POLLHUP | POLLRDHUP | POLLERR)) {
+      clib_package_cancel(client->cancel, CLIB_PACKAGE_ECANCELED, NULL, "client went away");
+      break;
+    }
+    // anything sent after the request is ignored
+    ssize_t n = recv(client->fd, buf, sizeof(buf), MSG_DONTWAIT);
+    if (0 == n) {
+      clib_package_cancel(client->cancel, CLIB_PACKAGE_ECANCELED, NULL, "client went away");
+      break;
+    }
+  }
+  return NULL;
+}
+
+static void
+serve_install(struct client *client, char *args) {
+  char *save = NULL;
+  char *dir = strtok_r(args, "\t", &save);
+  char *slug = NULL;
+  char line[1024];
+  pthread_t watcher;
+  int watching = 0;
+  int rc = 0;
+
+  if (!dir) {
+    send_line(client->fd, "error 0 - usage: install <dir> <slug>...\n");
+    return;
+  }
+
+  client->cancel = clib_package_cancel_new(0);
+  clib_package_cancel_set_progress(client->cancel, on_progress, client);
+  if (0 == pipe(client->stop)) {
+    watching = 0 == pthread_create(&watcher, NULL, watch_client, client);
+    if (!watching) {
+      close(client->stop[0]);
+      close(client->stop[1]);
+    }
+  }
+
+  while ((slug = strtok_r(NULL, "\t", &save))) {
+    on_progress("resolve", slug, NULL, client);
+    clib_package_t *pkg = clib_package_resolve(slug, 0, ctx, client->cancel);
+    if (!pkg) {
+      clib_package_cancel(client->cancel, CLIB_PACKAGE_ERESOLVE, slug, "unable to resolve package");
+      rc = -1;
+      break;
+    }
+    pkg->cancel = client->cancel;
+    rc = clib_package_install(pkg, dir, 0);
+    clib_package_free(pkg);
+    if (0 != rc) break;
+  }
+
+  if (watching) {
+    while (-1 == write(client->stop[1], "", 1) && EINTR == errno) {}
+    pthread_join(watcher, NULL);
+    close(client->stop[0]);
+    close(client->stop[1]);
+  }
+
+  const clib_package_error_t *err = clib_package_cancel_error(client->cancel);
+  if (err) {
+    snprintf(line, sizeof(line), "error %d %s %s\n"
+      , (int) err->code
+      , err->slug ? err->slug : "-"
+      , err->message ? err->message : "install failed");
+  } else if (0 != rc) {
+    snprintf(line, sizeof(line), "error 0 %s install failed\n", slug ? slug : "-");
+  } else {
+    snprintf(line, sizeof(line), "ok\n");
+  }
+  pthread_mutex_lock(&client->mutex);
+  send_line(client->fd, line);
+  pthread_mutex_unlock(&client->mutex);
+
+  clib_package_cancel_free(client->cancel);
+  client->cancel = NULL;
+}
+
+static void
+serve_stats(struct client *client) {
+  clib_package_stats_t stats;
+  char line[1024];
+
+  clib_package_stats(ctx, &stats);
+  snprintf(line, sizeof(line)
+    , "{ \"packages_resolved\": %lu, \"packages_deduplicated\": %lu,"
+      " \"packages_skipped\": %lu, \"packages_built\": %lu, \"files_fetched\": %lu, \"files_linked\": %lu,"
+      " \"files_unchanged\": %lu, \"requests\": %lu,"
+      " \"retries\": %lu, \"bytes_wire\": %llu, \"store_lookups\": %lu,"
+      " \"store_hits\": %lu, \"manifest_lookups\": %lu, \"manifest_hits\": %lu,"
+      " \"downloads_resumed\": %lu, \"revalidations\": %lu, \"not_modified\": %lu,"
+      " \"cache_evicted\": %lu, \"bytes_reclaimed\": %llu,"
+      " \"latency_p50_ms\": %.3f, \"latency_p99_ms\": %.3f }\n"
+    , stats.packages_resolved
+    , stats.packages_deduplicated
+    , stats.packages_skipped
+    , stats.packages_built
+    , stats.files_fetched
+    , stats.files_linked
+    , stats.files_unchanged
+    , stats.requests
+    , stats.retries
+    , stats.bytes_wire
+    , stats.store_lookups
+    , stats.store_hits
+    , stats.manifest_lookups
+    , stats.manifest_hits
+    , stats.downloads_resumed
+    , stats.revalidations
+    , stats.not_modified
+    , stats.cache_evicted
+    , stats.bytes_reclaimed
+    , stats.latency_p50_ms
+    , stats.latency_p99_ms);
+  send_line(client->fd, line);
+}
+
+static void *
+serve_client(void *arg) {
+  struct client *client = (struct client *) arg;
+  char line[DAEMON_LINE_MAX];
+  size_t len = 0;
+
+  // read one request line
+  while (len < sizeof(line) - 1) {
+    ssize_t n = recv(client->fd, line + len, sizeof(line) - 1 - len, 0);
+    if (n < 0 && EINTR == errno) continue;
+    if (n <= 0) break;
+    len += n;
+    if (memchr(line, '\n', len)) break;
+  }
+  line[len] = '\0';
+  // a request that does not fit is refused, not cut short
+  int whole = len < sizeof(line) - 1 || memchr(line, '\n', len);
+  line[strcspn(line, "\r\n")] = '\0';
+
+  if (!whole) {
+    send_line(client->fd, "error 0 - request too long\n");
+  } else if (0 == strncmp(line, "install\t", 8)) {
+    serve_install(client, line + 8);
+  } else if (0 == strcmp(line, "stats")) {
+    serve_stats(client);
+  } else if (0 == strcmp(line, "ping")) {
+    send_line(client->fd, "pong\n");
+  } else {
+    send_line(client->fd, "error 0 - unknown request\n");
+  }
+
+  close(client->fd);
+  pthread_mutex_destroy(&client->mutex);
+  free(client);
+  return NULL;
+}
+
+static int
+socket_address(const char *path, struct sockaddr_un *addr) {
+  memset(addr, 0, sizeof(*addr));
+  addr->sun_family = AF_UNIX;
+  if (strlen(path) >= sizeof(addr->sun_path)) return -1;
+  strcpy(addr->sun_path, path);
+  return 0;
+}
+
+/**
+ * Whether the peer of `fd` runs as the same user as we do.
+ */
+
+static int
+peer_trusted(int fd) {
+  struct ucred cred;
+  socklen_t len = sizeof(cred);
+  if (-1 == getsockopt(fd, SOL_SOCKET, SO_PEERCRED, &cred, &len)) return 0;
+  return cred.uid == geteuid();
+}
+
+static int
+serve(const char *path, const char *config) {
+  struct sockaddr_un addr;
+  char *cfg = NULL;
+  mode_t mask;
+  int fd = -1;
+  int rc = 0;
+
+  if (config && !(cfg = fs_read(config))) {
+    fprintf(stderr, "unable to read %s\n", config);
+    return 1;
+  }
+  ctx = clib_package_ctx_new(cfg);
+  free(cfg);
+  if (!ctx) return 1;
+  clib_package_set_manifest_ttl(ctx, DAEMON_MANIFEST_TTL);
+
+  if (-1 == socket_address(path, &addr)) return 1;
+  if (-1 == (fd = socket(AF_UNIX, SOCK_STREAM, 0))) return 1;
+  unlink(path);
+  // no window in which others may connect
+  mask = umask(0177);
+  rc = bind(fd, (struct sockaddr *) &addr, sizeof(addr));
+  umask(mask);
+  if (-1 == rc || -1 == chmod(path, 0600) || -1 == listen(fd, 64)) {
+    perror("daemon");
+    close(fd);
+    return 1;
+  }
+  signal(SIGPIPE, SIG_IGN);
+
+  for (;;) {
+    int conn = accept(fd, NULL, NULL);
+    if (-1 == conn) {
+      if (EINTR == errno) continue;
+      perror("accept");
+      break;
+    }
+    if (!peer_trusted(conn)) {
+      close(conn);
+      continue;
+    }
+
+    struct client *client = (struct client *) calloc(1, sizeof(struct client));
+    pthread_t thread;
+    if (!client) {
+      close(conn);
+      continue;
+    }
+    client->fd = conn;
+    pthread_mutex_init(&client->mutex, NULL);
+    if (0 != pthread_create(&thread, NULL, serve_client, client)) {
+      close(conn);
+      pthread_mutex_destroy(&client->mutex);
+      free(client);
+      continue;
+    }
+    pthread_detach(thread);
+  }
+
+  close(fd);
+  clib_package_ctx_free(ctx);
+  return 1;
+}
+
+/**
+ * Thin client: send `request`, echo what comes back.
+ *
+ * Returns 0 unless the daemon reported an error.
+ */
+
+static int
+request(const char *path, const char *request) {
+  struct sockaddr_un addr;
+  char buf[4096];
+  int rc = 0;
+  int fd = -1;
+
+  if (-1 == socket_address(path, &addr)) return 1;
+  if (-1 == (fd = socket(AF_UNIX, SOCK_STREAM, 0))) return 1;
+  if (-1 == connect(fd, (struct sockaddr *) &addr, sizeof(addr))
+      || -1 == send_line(fd, request)) {
+    perror("daemon");
+    close(fd);
+    return 1;
+  }
+
+  FILE *in = fdopen(fd, "r");
+  if (!in) {
+    close(fd);
+    return 1;
+  }
+  while (fgets(buf, sizeof(buf), in)) {
+    fputs(buf, stdout);
+    if (0 == strncmp(buf, "error ", 6)) rc = 2;
+  }
+  fclose(in);
+  return rc;
+}
+
+int
+main(int argc, char **argv) {
+  char line[DAEMON_LINE_MAX];
+  char dir[PATH_MAX];
+
+  if (argc >= 3 && 0 == strcmp("serve", argv[1])) {
+    return serve(argv[2], argc > 3 ? argv[3] : NULL);
+  }
+
+  if (argc >= 5 && 0 == strcmp("install", argv[1])) {
+    // the daemon does not share our working directory
+    if (!realpath(argv[3], dir)) {
+      perror(argv[3]);
+      return 1;
+    }
+    for (int i = 3; i < argc; i++) {
+      if (strpbrk(3 == i ? dir : argv[i], "\t\n")) {
+        fprintf(stderr, "%s: tabs and newlines cannot be sent\n", 3 == i ? dir : argv[i]);
+        return 1;
+      }
+    }
+    size_t len = snprintf(line, sizeof(line), "install\t%s", dir);
+    for (int i = 4; i < argc && len < sizeof(line); i++) {
+      len += snprintf(line + len, sizeof(line) - len, "\t%s", argv[i]);
+    }
+    if (len + 1 >= sizeof(line)) {
+      fprintf(stderr, "request longer than %d bytes\n", DAEMON_LINE_MAX - 1);
+      return 1;
+    }
+    strcat(line, "\n");
+    return request(argv[2], line);
+  }
+
+  if (argc == 3 && 0 == strcmp("stats", argv[1])) {
+    return request(argv[2], "stats\n");
+  }
+
+  fprintf(stderr, "usage: %s serve <socket> [config.json]\n", argv[0]);
+  fprintf(stderr, "       %s install <socket> <dir> <slug>...\n", argv[0]);
+  fprintf(stderr, "       %s stats <socket>\n", argv[0]);
+  return 1;
+}
@@ -1,15 +1,125 @@
 
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "fs/fs.h"
 #include "clib-package.h"
 
-int main(int argc, char const *argv[]) {
-  for (int i = 1; i < argc; ++i) {
-    clib_package_t *pkg = clib_package_new_from_slug(argv[i], 1);
+static int
+install(clib_package_ctx_t *ctx, int argc, char const *argv[]) {
+  for (int i = 0; i < argc; ++i) {
+    clib_package_t *pkg = clib_package_new_from_slug(argv[i], 1, ctx);
     if (!pkg) return 1;
     int rc = clib_package_install(pkg, "./deps", 1);
     clib_package_free(pkg);
     if (0 != rc) return 2;
   }
+  return 0;
+}
+
+static int
+outdated(clib_package_ctx_t *ctx, const char *dir) {
+  list_t *packages = clib_package_outdated(dir, ctx, NULL);
+  list_node_t *node = NULL;
+  int failed = 0;
+  if (!packages) return 1;
+
+  list_iterator_t *it = list_iterator_new(packages, LIST_HEAD);
+  while ((node = list_iterator_next(it))) {
+    clib_package_outdated_t *pkg = node->val;
+    if (pkg->error) {
+      printf("%s %s: %s\n", pkg->repo, pkg->installed, pkg->error);
+      failed = 1;
+      continue;
+    }
+    printf("%s %s -> %s%s\n"
+      , pkg->repo
+      , pkg->installed
+      , pkg->latest
+      , pkg->newer ? "" : " (changed)");
+  }
+  list_iterator_destroy(it);
+  int rc = failed ? 2 : packages->len ? 3 : 0;
+  list_destroy(packages);
+  return rc;
+}
+
+static int
+export(clib_package_ctx_t *ctx, int argc, char const *argv[]) {
+  if (argc < 2) return 1;
+  return 0 == clib_package_mirror_export(argv[0], (const char **) argv + 1, argc - 1, ctx, NULL)
+    ? 0
+    : 2;
+}
+
+/**
+ * Pack ./deps into, or restore it from, a bundle keyed by
+ * ./package.json.
+ */
 
+static int
+bundle(const char *command, const char *file) {
+  char *manifest = fs_read("package.json");
+  char *key = manifest ? clib_package_bundle_key(manifest) : NULL;
+  free(manifest);
+  if (!key) return 1;
+
+  int rc = 0 == strcmp("pack", command)
+    ? clib_package_bundle_pack("./deps", key, file)
+    : clib_package_bundle_unpack(file, "./deps", key, 0);
+  free(key);
+  return 0 == rc ? 0 : 2;
+}
+
+static int
+gc(clib_package_ctx_t *ctx) {
+  clib_package_store_stats_t stats;
+  if (0 != clib_package_store_gc(ctx, &stats)) return 1;
+  printf("%lu blobs, %llu bytes (%llu on disk, %llu shared, %.1f%% fragmented)\n"
+    , stats.blobs
+    , stats.bytes
+    , stats.bytes_allocated
+    , stats.bytes_shared
+    , stats.fragmentation * 100);
+  printf("evicted %lu (%llu bytes), skipped %lu in use, removed %lu stale\n"
+    , stats.evicted
+    , stats.bytes_reclaimed
+    , stats.skipped
+    , stats.stale);
   return 0;
 }
+
+int main(int argc, char const *argv[]) {
+  // a first argument that is not a readable file is not a config
+  char *cfg = argc > 1 ? fs_read(argv[1]) : NULL;
+  int arg = cfg ? 2 : 1;
+  if (argc <= arg) {
+    free(cfg);
+    fprintf(stderr, "usage: %s [config.json] <slug>...\n", argv[0]);
+    fprintf(stderr, "       %s [config.json] outdated [dir]\n", argv[0]);
+    fprintf(stderr, "       %s [config.json] export <mirror> <slug>...\n", argv[0]);
+    fprintf(stderr, "       %s [config.json] pack|unpack <bundle>\n", argv[0]);
+    fprintf(stderr, "       %s [config.json] gc\n", argv[0]);
+    return 1;
+  }
+
+  clib_package_ctx_t *ctx = clib_package_ctx_new(cfg);
+  free(cfg);
+  if (!ctx) return 1;
+
+  int rc = 0;
+  const char *command = argv[arg];
+  if (0 == strcmp("outdated", command)) {
+    rc = outdated(ctx, argc > arg + 1 ? argv[arg + 1] : "./deps");
+  } else if (argc > arg + 1 && (0 == strcmp("pack", command) || 0 == strcmp("unpack", command))) {
+    rc = bundle(command, argv[arg + 1]);
+  } else if (0 == strcmp("gc", command)) {
+    rc = gc(ctx);
+  } else if (0 == strcmp("export", command)) {
+    rc = export(ctx, argc - arg - 1, argv + arg + 1);
+  } else {
+    rc = install(ctx, argc - arg, argv + arg);
+  }
+  clib_package_ctx_free(ctx);
+  return rc;
+}
@@ -6,20 +6,39 @@
 //
 
 #include <stdlib.h>
+#include <ctype.h>
+#include <fcntl.h>
 #include <libgen.h>
 #include <stdarg.h>
 #include <string.h>
 #include <sys/stat.h>
+#include <unistd.h>
 #include <errno.h>
 #include <stdio.h>
+#include <strings.h>
+#include <time.h>
+#include <stdint.h>
+#include <sys/syscall.h>
+#include <sys/ioctl.h>
+#include <sys/file.h>
+#include <sys/wait.h>
+#include <poll.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <dirent.h>
+#ifdef __linux__
+#include <linux/fs.h>
+#endif
+#include <curl/curl.h>
 extern "C" {
     #include "strdup/strdup.h"
     #include "str-concat/str-concat.h"
     #include "str-replace/str-replace.h"
     #include "parson/parson.h"
     #include "substr/substr.h"
-    #include "http-get/http-get.h"
     #include "mkdirp/mkdirp.h"
+    #include "rimraf/rimraf.h"
     #include "fs/fs.h"
     #include "path-join/path-join.h"
     #include "logger/logger.h"
@@ -28,7 +47,11 @@ extern "C" {
     #include "semver/semver.h"
 }
 #include <pthread.h>
+#include <algorithm>
+#include <map>
+#include <set>
 #include <string>
+#include <vector>
 
 #include "clib-package.h"
 #include "config.h"
@@ -43,13 +66,161 @@ extern "C" {
 
 #define GITHUB_CONTENT_URL "https://raw.githubusercontent.com/"
 
+#ifndef CLIB_PACKAGE_USER_AGENT
+#define CLIB_PACKAGE_USER_AGENT "clib-package"
+#endif
+
+#ifndef CLIB_PACKAGE_MIN_CONCURRENCY
+#define CLIB_PACKAGE_MIN_CONCURRENCY 1
+#endif
+
+#ifndef CLIB_PACKAGE_MAX_CONCURRENCY
+#define CLIB_PACKAGE_MAX_CONCURRENCY 64
+#endif
+
+#ifndef CLIB_PACKAGE_INITIAL_CONCURRENCY
+#define CLIB_PACKAGE_INITIAL_CONCURRENCY 8
+#endif
+
+// requests slower than this count as congestion
+#ifndef CLIB_PACKAGE_TARGET_LATENCY_MS
+#define CLIB_PACKAGE_TARGET_LATENCY_MS 3000
+#endif
+
+// start pacing once this few API requests are left in the window
+#ifndef CLIB_PACKAGE_RATELIMIT_LOW_WATER
+#define CLIB_PACKAGE_RATELIMIT_LOW_WATER 50
+#endif
+
+#ifndef CLIB_PACKAGE_MAX_RETRIES
+#define CLIB_PACKAGE_MAX_RETRIES 4
+#endif
+
+#ifndef CLIB_PACKAGE_BACKOFF_BASE_MS
+#define CLIB_PACKAGE_BACKOFF_BASE_MS 250
+#endif
+
+#ifndef CLIB_PACKAGE_BACKOFF_MAX_MS
+#define CLIB_PACKAGE_BACKOFF_MAX_MS 30000
+#endif
+
+// how often to retry a package lock another install holds
+#ifndef CLIB_PACKAGE_LOCK_POLL_MS
+#define CLIB_PACKAGE_LOCK_POLL_MS 50
+#endif
+
+// submission queue depth of the io_uring writer
+#ifndef CLIB_PACKAGE_URING_DEPTH
+#define CLIB_PACKAGE_URING_DEPTH 64
+#endif
+
+// parson DOMs take several times the size of the source text
+#ifndef CLIB_PACKAGE_PARSE_FACTOR
+#define CLIB_PACKAGE_PARSE_FACTOR 8
+#endif
+
+// how often a running post-install command is checked on
+#ifndef CLIB_PACKAGE_BUILD_POLL_MS
+#define CLIB_PACKAGE_BUILD_POLL_MS 20
+#endif
+
+// least time between background collections of a capped store
+#ifndef CLIB_PACKAGE_GC_INTERVAL_MS
+#define CLIB_PACKAGE_GC_INTERVAL_MS 60000
+#endif
+
+// blobs evicted per hold of the store's exclusive lock
+#ifndef CLIB_PACKAGE_GC_BATCH
+#define CLIB_PACKAGE_GC_BATCH 64
+#endif
+
+// age after which a temporary file in the store is abandoned
+#ifndef CLIB_PACKAGE_GC_STALE_S
+#define CLIB_PACKAGE_GC_STALE_S 3600
+#endif
+
+// uncompressed bytes per independently decodable bundle frame
+#ifndef CLIB_PACKAGE_BUNDLE_FRAME
+#define CLIB_PACKAGE_BUNDLE_FRAME (1 << 20)
+#endif
+
+// zstd level of bundle frames
+#ifndef CLIB_PACKAGE_BUNDLE_LEVEL
+#define CLIB_PACKAGE_BUNDLE_LEVEL 9
+#endif
+
+// most threads a bundle is unpacked with
+#ifndef CLIB_PACKAGE_BUNDLE_THREADS
+#define CLIB_PACKAGE_BUNDLE_THREADS 16
+#endif
+
+// source bytes of small packages grouped into one unity translation unit
+#ifndef CLIB_PACKAGE_UNITY_BYTES
+#define CLIB_PACKAGE_UNITY_BYTES (64 * 1024)
+#endif
+
 debug_t _debugger;
 
-#define _debug(...) ({                                         \
-  if (!(_debugger.name)) debug_init(&_debugger, "clib-package"); \
-  debug(&_debugger, __VA_ARGS__);                               \
+static pthread_once_t _debugger_once = PTHREAD_ONCE_INIT;
+
+static void
+debugger_init(void) {
+  debug_init(&_debugger, "clib-package");
+}
+
+#define _debug(...) ({                             \
+  pthread_once(&_debugger_once, debugger_init);     \
+  debug(&_debugger, __VA_ARGS__);                   \
 })
 
+/**
+ * USDT probes for bpftrace and perf, compiled in with
+ * `-DCLIB_PACKAGE_USDT`.  Each has a semaphore the tracer
+ * raises while it is attached; until then a probe is a test
+ * of it, and its arguments are not evaluated:
+ *
+ *   resolve__start(slug)              resolve__done(slug, ok)
+ *   request__start(url)               request__done(url, status, bytes, us)
+ *   file__start(repo, file)           file__done(repo, file, rc)
+ *   file__written(path, bytes)        package__parse(repo, bytes)
+ *   task__start(slug)                 task__done(slug, rc)
+ */
+
+#ifdef CLIB_PACKAGE_IO_URING
+#include <liburing.h>
+#endif
+
+#ifdef CLIB_PACKAGE_ZSTD
+#include <zstd.h>
+#endif
+
+#ifdef CLIB_PACKAGE_USDT
+#define _SDT_HAS_SEMAPHORES 1
+#include <sys/sdt.h>
+
+#define _probe_semaphore(name) \
+  unsigned short clib_package_##name##_semaphore __attribute__((unused, section(".probes")))
+
+_probe_semaphore(resolve__start);
+_probe_semaphore(resolve__done);
+_probe_semaphore(request__start);
+_probe_semaphore(request__done);
+_probe_semaphore(file__start);
+_probe_semaphore(file__done);
+_probe_semaphore(file__written);
+_probe_semaphore(package__parse);
+_probe_semaphore(task__start);
+_probe_semaphore(task__done);
+
+#define _probe_enabled(name) __builtin_expect(0 != clib_package_##name##_semaphore, 0)
+#define _probe(name, ...) do {                              \
+  if (_probe_enabled(name)) STAP_PROBEV(clib_package, name, __VA_ARGS__); \
+} while (0)
+#else
+#define _probe_enabled(name) 0
+#define _probe(...) do {} while (0)
+#endif
+
 /**
  * Pre-declare prototypes.
  */
@@ -73,7 +244,31 @@ static inline list_t *
 parse_package_deps(JSON_Object *);
 
 static inline int
-install_packages(list_t *, const char *, int, const char *);
+install_packages(list_t *, const char *, int, clib_package_ctx_t *, clib_package_cancel_t *);
+
+static clib_package_response_t *
+http_request(clib_package_ctx_t *, const char *, const char *, const char *, clib_package_cancel_t *);
+
+static clib_package_response_t *
+http_request_retry(clib_package_ctx_t *, const char *, const char *, const char *, int, clib_package_cancel_t *);
+
+static void
+http_response_free(clib_package_response_t *);
+
+static clib_package_transport_t *
+curl_transport_pooled(void);
+
+static int
+store_manifest_get(clib_package_ctx_t *, const char *, std::string *);
+
+static void
+store_manifest_put(clib_package_ctx_t *, const char *, const std::string &);
+
+static void
+store_gc_kick(clib_package_ctx_t *);
+
+static void
+store_gc_join(clib_package_ctx_t *);
 
 
 /**
@@ -207,701 +402,6785 @@ done:
   return list;
 }
 
-struct dependency {
-    pthread_t threadid;
-    char * slug;
-    clib_package_t * pkg;
-    int verbose;
-    const char * cfg;
-};
+struct memory_budget;
 
-struct file_info {
-    clib_package_t * pkg;
-    const char * dir;
-    char * file;
-    int verbose;
+/**
+ * Memory reserved against a session's budget, see
+ * `budget_reserve()`.
+ */
+
+struct budget_lease {
+  struct memory_budget *budget; // NULL to not account
+  unsigned long ticket;
+  size_t held;
 };
 
-static int
-fetch_package_file(
-    clib_package_t *pkg
-    , const char *dir
-    , char *file
-    , int verbose
-    );
+/**
+ * Response of a single HTTP request.  Besides the body we keep
+ * the headers the concurrency controller needs to see.
+ */
 
-void * fetch_package_file_threaded(void * param)
-{
-    struct file_info * finfo = (struct file_info *)param;
-    fetch_package_file(finfo->pkg, finfo->dir, finfo->file, finfo->verbose);
-    return NULL;
+struct clib_package_response {
+  long status;
+  int ok;
+  char *data;
+  size_t size;
+  long ratelimit_remaining; // -1 when not sent
+  long ratelimit_reset;     // unix time, 0 when not sent
+  long retry_after;         // seconds, -1 when not sent
+  char *etag;
+  const char *if_none_match; // validator of a conditional request
+  curl_off_t bytes_wire;    // headers plus body as transferred
+  curl_off_t bytes_decoded; // body after content decoding
+  FILE *file;               // set while streaming a 2xx body to disk
+  struct budget_lease lease; // memory held by `data`
+  clib_package_cancel_t *cancel;
+};
 
-}
-pthread_t create_fetch_package_file_threaded(clib_package_t * pkg, const char * dir, char * file, int verbose)
-{
-    struct file_info * finfo = (struct file_info*)malloc(sizeof(struct file_info));
-    finfo->pkg = pkg;
-    finfo->dir = dir;
-    finfo->file = file;
-    finfo->verbose = verbose;
-    pthread_t id;
-    pthread_create(&id, NULL, fetch_package_file_threaded, finfo);
-    return id;
-}
+static pthread_once_t _curl_once = PTHREAD_ONCE_INIT;
 
-void * clib_package_new_from_slug_threaded(void * param)
-{
-    struct dependency * depend = (struct dependency *)param;
-    depend->pkg = clib_package_new_from_slug(depend->slug, depend->verbose, depend->cfg);
-    return NULL;
+static void
+curl_init_once(void) {
+  curl_global_init(CURL_GLOBAL_ALL);
 }
 
-static inline int
-install_packages(list_t *list, const char *dir, int verbose, const char * cfg) {
-  list_node_t *node = NULL;
-  list_iterator_t *iterator = NULL;
-  int rc = -1;
+/**
+ * Milliseconds on the monotonic clock.
+ */
 
-  int depcount = 0;
-  struct dependency dependencies[255];
+static long long
+now_ms(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (long long) ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
 
-  if (!list || !dir) goto cleanup;
+/**
+ * Turn a monotonic `ms` timestamp into an absolute
+ * `CLOCK_REALTIME` deadline for `pthread_cond_timedwait()`.
+ */
 
-  iterator = list_iterator_new(list, LIST_HEAD);
-  if (NULL == iterator) goto cleanup;
+static struct timespec
+deadline_from_ms(long long ms) {
+  struct timespec ts;
+  long long delta = ms - now_ms();
+  if (delta < 0) delta = 0;
+  clock_gettime(CLOCK_REALTIME, &ts);
+  ts.tv_sec += delta / 1000;
+  ts.tv_nsec += (delta % 1000) * 1000000;
+  if (ts.tv_nsec >= 1000000000) {
+    ts.tv_sec++;
+    ts.tv_nsec -= 1000000000;
+  }
+  return ts;
+}
 
-  depcount = 0;
-  while ((node = list_iterator_next(iterator))) {
-      clib_package_dependency_t *dep = NULL;
-      char *slug = NULL;
-      int error = 1;
-      struct dependency * depend = &dependencies[depcount];
+/**
+ * A post-install command: the `install` field of a package
+ * installed into `dir`, run there once the commands of its
+ * `deps` are done.
+ */
 
-      dep = (clib_package_dependency_t *)node->val;
-      slug = clib_package_slug(dep->author, dep->name, dep->version);
-      printf("installing slug: %s\n", slug);
+struct build_step {
+  std::string key; // `<deps dir>/<name>`
+  std::string repo;
+  std::string dir;
+  std::string command;
+  std::vector<std::string> deps;
+  int state; // 0 waiting, 1 running, 2 done
+};
 
-      depend->slug = slug;
-      depend->verbose = verbose;
-      depend->cfg = cfg;
-      pthread_create(&depend->threadid, NULL, clib_package_new_from_slug_threaded, depend);
-      depcount++;
-  }
-  for (int i = 0; i < depcount; i++)
-  {
-      clib_package_t *pkg = NULL;
-      struct dependency * depend = &dependencies[i];
-      pthread_join(depend->threadid, NULL);
-      pkg = depend->pkg;
-      if (NULL == pkg)
-      {
-          printf("failed pkg\n");
-      }
-      else
-      {
-          if (-1 == clib_package_install(pkg, dir, verbose))
-              printf("failed\n");
-      }
+/**
+ * Cancellation token shared by everything one install does.
+ * The first hard failure (or the deadline) wins; it wakes
+ * every transfer, backoff and controller wait so the whole
+ * install unwinds within milliseconds.
+ */
 
-      if (depend->slug) free(depend->slug);
-      if (depend->pkg) clib_package_free(depend->pkg);
-  }
+struct clib_package_cancel {
+  pthread_mutex_t mutex;
+  pthread_cond_t cond;
+  int cancelled;
+  long long deadline_ms; // monotonic, 0 for none
+  clib_package_error_t error;
+  CURLM **transfers;     // in-flight transfers to wake up
+  size_t ntransfers;
+  size_t ctransfers;
+  std::set<std::string> *claimed; // packages this install took on
+  std::vector<struct build_step> *steps; // post-install commands not run yet
+  std::map<std::string, struct index_batch *> *indexes; // per deps dir, written when done
+  int depth; // nesting of install calls using the token
+  std::multiset<struct concurrency_controller *> *waiting; // controllers to wake up
+  clib_package_progress_fn progress;
+  void *progress_data;
+};
 
-  rc = 0;
+static void
+controller_wake(struct concurrency_controller *);
 
-cleanup:
-  if (iterator) list_iterator_destroy(iterator);
-  return rc;
-}
+static void
+index_batches_free(std::map<std::string, struct index_batch *> *);
 
 /**
- * Create a new clib package from the given `json`
+ * Whether `cancel` was cancelled or its deadline passed.
+ * Does not record anything, so it is safe under any lock.
  */
 
-clib_package_t *
-clib_package_new(const char *json, int verbose, const char * cfg) {
-  clib_package_t *pkg = NULL;
-  JSON_Value *root = NULL, *cfg_root = NULL;
-  JSON_Object *json_object = NULL, *cfg_object = NULL;
-  JSON_Array *src = NULL;
-  JSON_Object *deps = NULL;
-  JSON_Object *devs = NULL;
-  int error = 1;
-
-  if (!json) goto cleanup;
-  if (!(root = json_parse_string(json))) {
-    logger_error("error", "unable to parse json");
-    goto cleanup;
-  }
-  if (!(json_object = json_value_get_object(root))) {
-    logger_error("error", "invalid package.json");
-    goto cleanup;
-  }
-  if (!(pkg = (clib_package_t*)malloc(sizeof(clib_package_t)))) goto cleanup;
+static int
+cancel_expired(clib_package_cancel_t *cancel) {
+  if (!cancel) return 0;
+  if (__atomic_load_n(&cancel->cancelled, __ATOMIC_ACQUIRE)) return 1;
+  return cancel->deadline_ms && now_ms() >= cancel->deadline_ms;
+}
 
-  memset(pkg, '\0', sizeof(clib_package_t));
+/**
+ * Like `cancel_expired()`, but turns a passed deadline into
+ * an `CLIB_PACKAGE_ETIMEOUT` error.
+ */
 
-  pkg->json = strdup(json);
-  pkg->name = json_object_get_string_safe(json_object, "name");
-  pkg->repo = json_object_get_string_safe(json_object, "repo");
-  pkg->version = json_object_get_string_safe(json_object, "version");
-  pkg->license = json_object_get_string_safe(json_object, "license");
-  pkg->description = json_object_get_string_safe(json_object, "description");
-  pkg->install = json_object_get_string_safe(json_object, "install");
-  pkg->makefile = json_object_get_string_safe(json_object, "makefile");
-  pkg->cfg = cfg;
+static int
+cancel_check(clib_package_cancel_t *cancel) {
+  if (!cancel_expired(cancel)) return 0;
+  clib_package_cancel(cancel
+    , CLIB_PACKAGE_ETIMEOUT
+    , NULL
+    , "install deadline exceeded");
+  return 1;
+}
 
-  _debug("creating package: %s", pkg->repo);
+/**
+ * Milliseconds until `cancel`'s deadline, capped at `cap`.
+ */
 
-  // TODO npm-style "repository" (thlorenz/gumbo-parser.c#1)
-  if (pkg->repo) {
-    pkg->author = parse_repo_owner(pkg->repo, DEFAULT_REPO_OWNER);
-    // repo name may not be package name (thing.c -> thing)
-    pkg->repo_name = parse_repo_name(pkg->repo);
-  } else {
-    if (verbose) logger_warn("warning", "missing repo in package.json");
-    pkg->author = NULL;
-    pkg->repo_name = NULL;
-  }
+static long long
+cancel_remaining_ms(clib_package_cancel_t *cancel, long long cap) {
+  if (!cancel || !cancel->deadline_ms) return cap;
+  long long left = cancel->deadline_ms - now_ms();
+  if (left < 0) left = 0;
+  return left < cap ? left : cap;
+}
 
-  if ((src = json_object_get_array(json_object, "src"))) {
-    if (!(pkg->src = list_new())) goto cleanup;
-    pkg->src->free = free;
-    for (unsigned int i = 0; i < json_array_get_count(src); i++) {
-      char *file = json_array_get_string_safe(src, i);
-      _debug("file: %s", file);
-      if (!file) goto cleanup;
-      if (!(list_rpush(pkg->src, list_node_new(file)))) goto cleanup;
+static void
+cancel_watch(clib_package_cancel_t *cancel, CURLM *multi) {
+  if (!cancel) return;
+  pthread_mutex_lock(&cancel->mutex);
+  if (cancel->ntransfers == cancel->ctransfers) {
+    size_t cap = cancel->ctransfers ? cancel->ctransfers * 2 : 8;
+    CURLM **transfers = (CURLM **) realloc(cancel->transfers, cap * sizeof(CURLM *));
+    if (transfers) {
+      cancel->transfers = transfers;
+      cancel->ctransfers = cap;
     }
-  } else {
-    _debug("no src files listed in package.json");
-    pkg->src = NULL;
   }
-
-  if ((deps = json_object_get_object(json_object, "dependencies"))) {
-    if (!(pkg->dependencies = parse_package_deps(deps))) {
-      goto cleanup;
-    }
-  } else {
-    _debug("no dependencies listed in package.json");
-    pkg->dependencies = NULL;
+  // without room the transfer still notices within its poll interval
+  if (cancel->ntransfers < cancel->ctransfers) {
+    cancel->transfers[cancel->ntransfers++] = multi;
   }
+  pthread_mutex_unlock(&cancel->mutex);
+}
 
-  if ((devs = json_object_get_object(json_object, "development"))) {
-    if (!(pkg->development = parse_package_deps(devs))) {
-      goto cleanup;
+static void
+cancel_unwatch(clib_package_cancel_t *cancel, CURLM *multi) {
+  if (!cancel) return;
+  pthread_mutex_lock(&cancel->mutex);
+  for (size_t i = 0; i < cancel->ntransfers; i++) {
+    if (cancel->transfers[i] == multi) {
+      cancel->transfers[i] = cancel->transfers[--cancel->ntransfers];
+      break;
     }
-  } else {
-    _debug("no development dependencies listed in package.json");
-    pkg->development = NULL;
   }
+  pthread_mutex_unlock(&cancel->mutex);
+}
 
-  error = 0;
+/**
+ * Have `cancel` wake the controller `c` while a request waits
+ * on it.  Must not be called with `c`'s mutex held.
+ */
 
-cleanup:
-  if (root) json_value_free(root);
-  if (error && pkg) {
-    clib_package_free(pkg);
-    pkg = NULL;
-  }
-  return pkg;
+static void
+cancel_watch_controller(clib_package_cancel_t *cancel, struct concurrency_controller *c) {
+  if (!cancel) return;
+  pthread_mutex_lock(&cancel->mutex);
+  if (!cancel->waiting) cancel->waiting = new std::multiset<struct concurrency_controller *>();
+  cancel->waiting->insert(c);
+  pthread_mutex_unlock(&cancel->mutex);
 }
 
-static const char *
-clib_package_find_api_endpoint(const char * author, const char * name, const char *cfg)
-{
-  http_get_response_t *res = NULL;
-  if(!cfg) {
-    return NULL;
-  }
-
-  JSON_Value *cfg_root = NULL;
-  JSON_Object *cfg_object = NULL;
-  if(!(cfg_root = json_parse_string(cfg))) {
-    logger_error("error", "unable to parse config.json file");
-    return NULL;
-  }
-  if(!(cfg_object = json_value_get_object(cfg_root))) {
-    logger_error("error", "invalid config.json file");
-    return NULL;
-  }
+static void
+cancel_unwatch_controller(clib_package_cancel_t *cancel, struct concurrency_controller *c) {
+  if (!cancel) return;
+  pthread_mutex_lock(&cancel->mutex);
+  cancel->waiting->erase(cancel->waiting->find(c));
+  pthread_mutex_unlock(&cancel->mutex);
+}
 
-  JSON_Array *src = json_object_get_array(cfg_object, "api_endpoints");
-  if(src)
-  {
-    for (unsigned int i = 0; i < json_array_get_count(src); i++) {
-      char *url = json_array_get_string_safe(src, i);
-      std::string try_url = url;
-      try_url += std::string("repos/");
-      try_url += std::string(author);
-      try_url += std::string("/");
-      try_url += std::string(name);
+/**
+ * Sleep `ms` unless `cancel` fires first.
+ *
+ * Returns -1 when cancelled.
+ */
 
-//      printf("trying API base at %s\n", try_url.c_str());
-      res = http_get(try_url.c_str());
-      if( res && res->ok) {
-        return url;
-      }
-    }
+static int
+cancel_sleep(clib_package_cancel_t *cancel, long long ms) {
+  long long until = now_ms() + ms;
+  if (!cancel) {
+    struct timespec ts = { (time_t) (ms / 1000), (long) (ms % 1000) * 1000000 };
+    while (-1 == nanosleep(&ts, &ts) && EINTR == errno);
+    return 0;
   }
 
-  return NULL;
+  pthread_mutex_lock(&cancel->mutex);
+  while (!cancel->cancelled && now_ms() < until) {
+    long long wake = cancel->deadline_ms && cancel->deadline_ms < until
+      ? cancel->deadline_ms
+      : until;
+    struct timespec ts = deadline_from_ms(wake);
+    pthread_cond_timedwait(&cancel->cond, &cancel->mutex, &ts);
+    if (cancel->deadline_ms && now_ms() >= cancel->deadline_ms) break;
+  }
+  pthread_mutex_unlock(&cancel->mutex);
+  return cancel_check(cancel) ? -1 : 0;
 }
 
 /**
- * Create a package from the given repo `slug`
+ * Create a cancellation token.  A positive `timeout_ms` sets
+ * a wall-clock deadline for everything using the token.
  */
-clib_package_t *
-clib_package_new_from_slug(const char *slug, int verbose, const char * cfg) {
-  char *author = NULL;
+
+clib_package_cancel_t *
+clib_package_cancel_new(long timeout_ms) {
+  clib_package_cancel_t *cancel = (clib_package_cancel_t *) malloc(sizeof(clib_package_cancel_t));
+  if (!cancel) return NULL;
+  memset(cancel, '\0', sizeof(clib_package_cancel_t));
+  pthread_mutex_init(&cancel->mutex, NULL);
+  pthread_cond_init(&cancel->cond, NULL);
+  if (timeout_ms > 0) cancel->deadline_ms = now_ms() + timeout_ms;
+  return cancel;
+}
+
+/**
+ * Cancel everything using `cancel`, recording `code`, the
+ * failing `slug` (may be NULL) and `message` as the error.
+ * Only the first call is recorded.
+ */
+
+void
+clib_package_cancel(clib_package_cancel_t *cancel
+    , clib_package_error_code_t code
+    , const char *slug
+    , const char *message) {
+  if (!cancel) return;
+
+  pthread_mutex_lock(&cancel->mutex);
+  if (!cancel->cancelled) {
+    cancel->error.code = code;
+    cancel->error.slug = slug ? strdup(slug) : NULL;
+    cancel->error.message = message ? strdup(message) : NULL;
+    __atomic_store_n(&cancel->cancelled, 1, __ATOMIC_RELEASE);
+    _debug("cancelled: %s", message);
+    for (size_t i = 0; i < cancel->ntransfers; i++) {
+      curl_multi_wakeup(cancel->transfers[i]);
+    }
+    if (cancel->waiting) {
+      std::multiset<struct concurrency_controller *>::iterator it;
+      for (it = cancel->waiting->begin(); it != cancel->waiting->end(); ++it) {
+        controller_wake(*it);
+      }
+    }
+    pthread_cond_broadcast(&cancel->cond);
+  }
+  pthread_mutex_unlock(&cancel->mutex);
+}
+
+/**
+ * Report the progress of the install using `cancel` to `fn`,
+ * called with `data` from whichever thread made progress.
+ */
+
+void
+clib_package_cancel_set_progress(clib_package_cancel_t *cancel
+    , clib_package_progress_fn fn
+    , void *data) {
+  if (!cancel) return;
+  cancel->progress = fn;
+  cancel->progress_data = data;
+}
+
+static void
+progress(clib_package_cancel_t *cancel, const char *event, const char *slug, const char *detail) {
+  if (cancel && cancel->progress) {
+    cancel->progress(event, slug, detail, cancel->progress_data);
+  }
+}
+
+int
+clib_package_cancelled(clib_package_cancel_t *cancel) {
+  return cancel_check(cancel);
+}
+
+/**
+ * Get the error that cancelled `cancel`, or NULL.
+ */
+
+const clib_package_error_t *
+clib_package_cancel_error(clib_package_cancel_t *cancel) {
+  if (!cancel_check(cancel)) return NULL;
+  return &cancel->error;
+}
+
+void
+clib_package_cancel_free(clib_package_cancel_t *cancel) {
+  if (!cancel) return;
+  pthread_mutex_destroy(&cancel->mutex);
+  pthread_cond_destroy(&cancel->cond);
+  free(cancel->error.slug);
+  free(cancel->error.message);
+  free(cancel->transfers);
+  delete cancel->claimed;
+  delete cancel->steps;
+  index_batches_free(cancel->indexes);
+  delete cancel->waiting;
+  free(cancel);
+}
+
+/**
+ * Claim `key` for the install `cancel` belongs to, so each
+ * package version is installed once however often it is
+ * depended on.
+ *
+ * Returns 0 if it was already claimed.
+ */
+
+static int
+cancel_claim(clib_package_cancel_t *cancel, const std::string &key) {
+  int claimed = 1;
+  if (!cancel) return 1;
+  pthread_mutex_lock(&cancel->mutex);
+  if (!cancel->claimed) cancel->claimed = new std::set<std::string>();
+  claimed = cancel->claimed->insert(key).second ? 1 : 0;
+  pthread_mutex_unlock(&cancel->mutex);
+  return claimed;
+}
+
+/**
+ * In-flight memory budget of a session.  Buffered responses
+ * and JSON parses reserve from it before growing and wait
+ * while it is exhausted, which backs transfers up into TCP
+ * flow control.  To always make progress, the thread that has
+ * held memory the longest may overdraw the budget.
+ */
+
+struct memory_budget {
+  pthread_mutex_t mutex;
+  pthread_cond_t cond;
+  size_t limit; // 0 for unlimited
+  size_t used;
+  size_t peak;
+  // threads holding leases, oldest first, with their lease count
+  std::map<unsigned long, int> holders;
+};
+
+// process wide, so a thread keeps its age across sessions
+static unsigned long _budget_tickets = 0;
+
+static __thread unsigned long _budget_ticket = 0;
+
+/**
+ * Concurrency controller shared by every request path of a
+ * session.
+ *
+ * The in-flight limit follows AIMD: it grows by roughly one
+ * request per round trip while requests succeed within
+ * `CLIB_PACKAGE_TARGET_LATENCY_MS`, and halves (at most once
+ * per round trip) on throttling, server errors or slow
+ * responses.  API requests are additionally paced against
+ * `X-RateLimit-Remaining` and held back by `Retry-After`.
+ */
+
+struct concurrency_controller {
+  pthread_mutex_t mutex;
+  pthread_cond_t cond;
+  double limit;
+  int in_flight;
+  long remaining;          // API requests left in the window, -1 unknown
+  long long reset_ms;      // monotonic time the window refills
+  long long not_before_ms; // no API request may start before this
+  long long next_slot_ms;  // earliest start of the next paced request
+  long long decreased_ms;  // last multiplicative decrease
+};
+
+/**
+ * Span tracing in Chrome trace event format, viewable in
+ * chrome://tracing or Perfetto.  Off unless a trace file is
+ * open; every span is then written as one complete ("X")
+ * event as it ends.
+ */
+
+struct trace_writer {
+  pthread_mutex_t mutex;
+  FILE *file;
+  int events;
+  long long origin_us;
+};
+
+struct session_stats {
+  pthread_mutex_t mutex;
+  clib_package_stats_t counters;
+};
+
+/**
+ * Everything one install session shares: its configuration,
+ * transport, concurrency controller, memory budget, trace and
+ * counters.  Sessions are independent of each other.
+ */
+
+struct manifest_entry {
+  std::string json;
+  std::string sha;
+  const char *api_endpoint;
+  long long fetched_ms;
+};
+
+struct clib_package_ctx {
+  std::vector<std::string> api_endpoints;
+  long install_timeout_ms; // 0 for none
+  int install_jobs;        // post-install commands run at once, 0 to not run them
+  unsigned outputs;        // CLIB_PACKAGE_OUTPUT_* written besides deps.mk
+  std::set<std::string> outputs_synced; // install directories whose outputs were rebuilt
+  clib_package_transport_t *transport; // NULL for libcurl
+  clib_package_transport_t *curl;      // libcurl with a connection pool
+  struct memory_budget budget;
+  struct concurrency_controller controller;
+  struct trace_writer trace;
+  struct session_stats stats;
+  // warm caches, keyed by `author/name` and by slug
+  pthread_mutex_t cache_mutex;
+  std::map<std::string, const char *> endpoints;
+  std::map<std::string, struct manifest_entry> manifests;
+  long long manifest_ttl_ms; // 0 to not keep manifests
+  std::string store; // content store directory, empty for none
+  unsigned long long store_limit; // bytes the store may keep, 0 for no cap
+  pthread_mutex_t store_mutex;
+  int store_lock;  // shared flock while `store_users` are in the store
+  int store_users;
+  pthread_t gc_thread;
+  int gc_state;    // 0 never started, 1 running, 2 finished
+  int gc_stop;
+  long long gc_last_ms;
+  clib_package_transport_t *offline; // mirror directory, NULL when online
+};
+
+/**
+ * Create a session configured by the JSON `cfg` (may be
+ * NULL): `api_endpoints`, `install_timeout` (seconds),
+ * `install_jobs` (see `clib_package_set_install_jobs()`),
+ * `memory_budget` (bytes), `manifest_ttl` (seconds to
+ * reuse a resolved package.json, off by default), `store`
+ * (content store directory shared between installs),
+ * `store_limit` (bytes, see `clib_package_set_store_limit()`),
+ * `offline` (mirror directory to install from, see
+ * `clib_package_set_offline()`), `ninja`,
+ * `compile_commands` and `unity` (booleans, see
+ * `clib_package_set_outputs()`).
+ *
+ * Returns NULL if `cfg` is not a JSON object.
+ */
+
+clib_package_ctx_t *
+clib_package_ctx_new(const char *cfg) {
+  JSON_Value *root = NULL;
+  JSON_Object *obj = NULL;
+  clib_package_ctx_t *ctx = NULL;
+
+  if (cfg) {
+    if (!(root = json_parse_string(cfg))) {
+      logger_error("error", "unable to parse config.json file");
+      return NULL;
+    }
+    if (!(obj = json_value_get_object(root))) {
+      logger_error("error", "invalid config.json file");
+      json_value_free(root);
+      return NULL;
+    }
+  }
+
+  ctx = new clib_package_ctx_t;
+  ctx->install_timeout_ms = 0;
+  ctx->install_jobs = 0;
+  ctx->outputs = 0;
+  ctx->transport = NULL;
+  ctx->curl = curl_transport_pooled();
+  ctx->offline = NULL;
+  pthread_mutex_init(&ctx->cache_mutex, NULL);
+  ctx->store_limit = 0;
+  pthread_mutex_init(&ctx->store_mutex, NULL);
+  ctx->store_lock = -1;
+  ctx->store_users = 0;
+  ctx->gc_state = 0;
+  ctx->gc_stop = 0;
+  ctx->gc_last_ms = 0;
+  ctx->manifest_ttl_ms = 0;
+
+  pthread_mutex_init(&ctx->budget.mutex, NULL);
+  pthread_cond_init(&ctx->budget.cond, NULL);
+  ctx->budget.limit = 0;
+  ctx->budget.used = 0;
+  ctx->budget.peak = 0;
+
+  pthread_mutex_init(&ctx->controller.mutex, NULL);
+  pthread_cond_init(&ctx->controller.cond, NULL);
+  ctx->controller.limit = CLIB_PACKAGE_INITIAL_CONCURRENCY;
+  ctx->controller.in_flight = 0;
+  ctx->controller.remaining = -1;
+  ctx->controller.reset_ms = 0;
+  ctx->controller.not_before_ms = 0;
+  ctx->controller.next_slot_ms = 0;
+  ctx->controller.decreased_ms = 0;
+
+  pthread_mutex_init(&ctx->trace.mutex, NULL);
+  ctx->trace.file = NULL;
+  ctx->trace.events = 0;
+  ctx->trace.origin_us = 0;
+
+  pthread_mutex_init(&ctx->stats.mutex, NULL);
+  memset(&ctx->stats.counters, 0, sizeof(ctx->stats.counters));
+
+  if (obj) {
+    JSON_Array *endpoints = json_object_get_array(obj, "api_endpoints");
+    for (unsigned int i = 0; endpoints && i < json_array_get_count(endpoints); i++) {
+      const char *url = json_array_get_string(endpoints, i);
+      if (url) ctx->api_endpoints.push_back(url);
+    }
+    ctx->install_timeout_ms = (long) (json_object_get_number(obj, "install_timeout") * 1000);
+    ctx->install_jobs = (int) json_object_get_number(obj, "install_jobs");
+    if (1 == json_object_get_boolean(obj, "ninja")) ctx->outputs |= CLIB_PACKAGE_OUTPUT_NINJA;
+    if (1 == json_object_get_boolean(obj, "compile_commands")) {
+      ctx->outputs |= CLIB_PACKAGE_OUTPUT_COMPILE_COMMANDS;
+    }
+    if (1 == json_object_get_boolean(obj, "unity")) ctx->outputs |= CLIB_PACKAGE_OUTPUT_UNITY;
+    ctx->manifest_ttl_ms = (long long) (json_object_get_number(obj, "manifest_ttl") * 1000);
+    const char *store = json_object_get_string(obj, "store");
+    if (store) ctx->store = store;
+    double store_limit = json_object_get_number(obj, "store_limit");
+    if (store_limit > 0) ctx->store_limit = (unsigned long long) store_limit;
+    const char *offline = json_object_get_string(obj, "offline");
+    if (offline) ctx->offline = clib_package_transport_directory(offline);
+    double budget = json_object_get_number(obj, "memory_budget");
+    if (budget > 0) ctx->budget.limit = (size_t) budget;
+    json_value_free(root);
+  }
+
+  return ctx;
+}
+
+/**
+ * Free `ctx`, closing its trace.  Packages created with it
+ * must be freed first; a transport set on it is not freed.
+ */
+
+void
+clib_package_ctx_free(clib_package_ctx_t *ctx) {
+  if (!ctx) return;
+  store_gc_join(ctx);
+  if (-1 != ctx->store_lock) close(ctx->store_lock);
+  pthread_mutex_destroy(&ctx->store_mutex);
+  clib_package_trace_close(ctx);
+  pthread_mutex_destroy(&ctx->budget.mutex);
+  pthread_cond_destroy(&ctx->budget.cond);
+  pthread_mutex_destroy(&ctx->controller.mutex);
+  pthread_cond_destroy(&ctx->controller.cond);
+  pthread_mutex_destroy(&ctx->trace.mutex);
+  pthread_mutex_destroy(&ctx->stats.mutex);
+  pthread_mutex_destroy(&ctx->cache_mutex);
+  clib_package_transport_free(ctx->curl);
+  clib_package_transport_free(ctx->offline);
+  delete ctx;
+}
+
+
+static pthread_once_t _default_ctx_once = PTHREAD_ONCE_INIT;
+
+static clib_package_ctx_t *_default_ctx = NULL;
+
+static void
+default_ctx_init(void) {
+  _default_ctx = clib_package_ctx_new(NULL);
+}
+
+/**
+ * Resolve `ctx`, falling back to a process wide session (with
+ * no configuration) for callers that pass NULL.
+ */
+
+static clib_package_ctx_t *
+ctx_get(clib_package_ctx_t *ctx) {
+  if (ctx) return ctx;
+  pthread_once(&_default_ctx_once, default_ctx_init);
+  return _default_ctx;
+}
+
+/**
+ * Reuse a resolved package.json for `seconds` (0 to never),
+ * which a long running session wants to make repeated
+ * installs cheap.
+ */
+
+void
+clib_package_set_manifest_ttl(clib_package_ctx_t *ctx, long seconds) {
+  ctx = ctx_get(ctx);
+  pthread_mutex_lock(&ctx->cache_mutex);
+  ctx->manifest_ttl_ms = seconds > 0 ? (long long) seconds * 1000 : 0;
+  if (!ctx->manifest_ttl_ms) ctx->manifests.clear();
+  pthread_mutex_unlock(&ctx->cache_mutex);
+}
+
+/**
+ * Share fetched files through the content store at `dir`
+ * (NULL to stop).  Set it before installing.
+ */
+
+void
+clib_package_set_store(clib_package_ctx_t *ctx, const char *dir) {
+  ctx = ctx_get(ctx);
+  store_gc_join(ctx);
+  pthread_mutex_lock(&ctx->store_mutex);
+  if (-1 != ctx->store_lock) close(ctx->store_lock);
+  ctx->store_lock = -1;
+  ctx->store = dir ? dir : "";
+  pthread_mutex_unlock(&ctx->store_mutex);
+}
+
+/**
+ * Run the `install` commands of installed packages, in
+ * dependency order and `jobs` at a time (-1 for one per CPU,
+ * 0 to not run them, the default).  Under `make -jN` the
+ * jobserver of make bounds them instead.
+ */
+
+void
+clib_package_set_install_jobs(clib_package_ctx_t *ctx, int jobs) {
+  ctx_get(ctx)->install_jobs = jobs;
+}
+
+/**
+ * Build files to write besides `deps.mk`, a mask of
+ * CLIB_PACKAGE_OUTPUT_*: a `<name>.ninja` fragment per
+ * package included from `deps.ninja`, the package's
+ * entries in `compile_commands.json`, and a unity build
+ * (see `unity_update()`) listed in `deps-unity.mk`.  They
+ * live next to the install directory, like `deps.mk`.
+ */
+
+void
+clib_package_set_outputs(clib_package_ctx_t *ctx, unsigned outputs) {
+  ctx = ctx_get(ctx);
+  pthread_mutex_lock(&ctx->cache_mutex);
+  ctx->outputs = outputs;
+  ctx->outputs_synced.clear();
+  pthread_mutex_unlock(&ctx->cache_mutex);
+}
+
+/**
+ * Cap the content store at `bytes` (0 for no cap).  Installs
+ * then collect it in the background, evicting the blobs used
+ * longest ago, at most every CLIB_PACKAGE_GC_INTERVAL_MS.
+ */
+
+void
+clib_package_set_store_limit(clib_package_ctx_t *ctx, unsigned long long bytes) {
+  ctx_get(ctx)->store_limit = bytes;
+}
+
+/**
+ * Serve every request of `ctx` from the mirror directory
+ * `dir`, as written by `clib_package_mirror_export()`, and
+ * never touch the network (NULL to go back online).  A URL
+ * missing from the mirror is a plain 404: it is neither
+ * paced nor retried, so a miss fails the install at once.
+ * Set it before installing.
+ */
+
+int
+clib_package_set_offline(clib_package_ctx_t *ctx, const char *dir) {
+  clib_package_transport_t *mirror = NULL;
+  ctx = ctx_get(ctx);
+  if (dir && !(mirror = clib_package_transport_directory(dir))) return -1;
+  clib_package_transport_free(ctx->offline);
+  ctx->offline = mirror;
+  return 0;
+}
+
+struct trace_span {
+  struct trace_writer *writer;
+  const char *name;
+  long long start_us;
+};
+
+static long long
+now_us(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (long long) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static int
+trace_enabled(struct trace_writer *trace) {
+  return NULL != __atomic_load_n(&trace->file, __ATOMIC_ACQUIRE);
+}
+
+/**
+ * Start a span called `name`.  Spans started while tracing
+ * is off are never written.
+ */
+
+static struct trace_span
+trace_begin(struct trace_writer *trace, const char *name) {
+  struct trace_span span = { trace, name, 0 };
+  if (trace_enabled(trace)) span.start_us = now_us();
+  return span;
+}
+
+static void
+trace_escape(std::string *out, const char *str) {
+  for (; str && *str; str++) {
+    unsigned char c = (unsigned char) *str;
+    if ('"' == c || '\\' == c) {
+      *out += '\\';
+      *out += (char) c;
+    } else if (c < 0x20) {
+      char hex[8];
+      snprintf(hex, sizeof(hex), "\\u%04x", c);
+      *out += hex;
+    } else {
+      *out += (char) c;
+    }
+  }
+}
+
+/**
+ * End `span`, attaching whichever of `slug`, `url`, `status`
+ * (when >= 0) and `bytes` (when >= 0) apply.
+ */
+
+static void
+trace_end(const struct trace_span *span
+    , const char *category
+    , const char *slug
+    , const char *url
+    , long status
+    , long long bytes) {
+  struct trace_writer *trace = span->writer;
+  if (!span->start_us || !trace_enabled(trace)) return;
+  long long end = now_us();
+
+  std::string event = "{\"name\":\"";
+  trace_escape(&event, span->name);
+  event += "\",\"cat\":\"";
+  trace_escape(&event, category);
+  event += "\",\"ph\":\"X\",\"pid\":" + std::to_string((long) getpid());
+  event += ",\"tid\":" + std::to_string((long) syscall(SYS_gettid));
+  event += ",\"ts\":";
+  std::string args = ",\"args\":{\"latency_ms\":" + std::to_string((end - span->start_us) / 1000);
+  if (slug) {
+    args += ",\"slug\":\"";
+    trace_escape(&args, slug);
+    args += "\"";
+  }
+  if (url) {
+    args += ",\"url\":\"";
+    trace_escape(&args, url);
+    args += "\"";
+  }
+  if (status >= 0) args += ",\"status\":" + std::to_string(status);
+  if (bytes >= 0) args += ",\"bytes\":" + std::to_string(bytes);
+  args += "}}";
+
+  pthread_mutex_lock(&trace->mutex);
+  if (trace->file) {
+    fprintf(trace->file, "%s\n%s%lld,\"dur\":%lld%s"
+      , trace->events++ ? "," : ""
+      , event.c_str()
+      , span->start_us - trace->origin_us
+      , end - span->start_us
+      , args.c_str());
+  }
+  pthread_mutex_unlock(&trace->mutex);
+}
+
+/**
+ * Start writing a trace of every request and install phase
+ * to `path`, replacing any trace already open.
+ *
+ * Returns 0 on success.
+ */
+
+int
+clib_package_trace_open(clib_package_ctx_t *ctx, const char *path) {
+  struct trace_writer *trace = &ctx_get(ctx)->trace;
+  FILE *file = NULL;
+  if (!path || !(file = fopen(path, "w"))) return -1;
+  clib_package_trace_close(ctx);
+
+  fputs("{\"displayTimeUnit\":\"ms\",\"traceEvents\":[", file);
+  pthread_mutex_lock(&trace->mutex);
+  trace->events = 0;
+  trace->origin_us = now_us();
+  __atomic_store_n(&trace->file, file, __ATOMIC_RELEASE);
+  pthread_mutex_unlock(&trace->mutex);
+  return 0;
+}
+
+/**
+ * Finish and close the open trace, if any.
+ */
+
+void
+clib_package_trace_close(clib_package_ctx_t *ctx) {
+  struct trace_writer *trace = &ctx_get(ctx)->trace;
+  pthread_mutex_lock(&trace->mutex);
+  FILE *file = trace->file;
+  __atomic_store_n(&trace->file, (FILE *) NULL, __ATOMIC_RELEASE);
+  pthread_mutex_unlock(&trace->mutex);
+  if (!file) return;
+  fputs("\n]}\n", file);
+  fclose(file);
+}
+
+/**
+ * Bump the counter `field` of the session `stats` by `n`.
+ */
+
+#define stats_add(stats, field, n) ({       \
+  pthread_mutex_lock(&(stats)->mutex);     \
+  (stats)->counters.field += (n);          \
+  pthread_mutex_unlock(&(stats)->mutex);   \
+})
+
+static int
+stats_bucket(long long us) {
+  if (us < 4) return us < 0 ? 0 : (int) us;
+  int high = 63 - __builtin_clzll((unsigned long long) us);
+  int index = 4 * (high - 1) + (int) ((us >> (high - 2)) & 3);
+  return index < CLIB_PACKAGE_STATS_BUCKETS ? index : CLIB_PACKAGE_STATS_BUCKETS - 1;
+}
+
+double
+clib_package_stats_bucket_ms(int index) {
+  if (index < 0) return 0;
+  if (index < 4) return (index + 1) / 1000.0;
+  int high = index / 4 + 1;
+  return (double) ((long long) (4 + index % 4 + 1) << (high - 2)) / 1000.0;
+}
+
+/**
+ * Account for one HTTP attempt that took `us` microseconds.
+ */
+
+static void
+stats_request(struct session_stats *stats, clib_package_response_t *res, long long us) {
+  long status = res->status;
+  int status_class = status >= 100 && status < 600 ? (int) (status / 100) : 0;
+
+  pthread_mutex_lock(&stats->mutex);
+  stats->counters.requests++;
+  stats->counters.requests_by_class[status_class]++;
+  stats->counters.bytes_wire += res->bytes_wire;
+  stats->counters.bytes_decoded += res->bytes_decoded;
+  stats->counters.latency_buckets[stats_bucket(us)]++;
+  pthread_mutex_unlock(&stats->mutex);
+}
+
+static double
+stats_percentile(const clib_package_stats_t *stats, double p) {
+  unsigned long long seen = 0;
+  unsigned long long rank = (unsigned long long) (p * stats->requests + 0.5);
+  if (0 == stats->requests) return 0;
+  if (rank < 1) rank = 1;
+  for (int i = 0; i < CLIB_PACKAGE_STATS_BUCKETS; i++) {
+    seen += stats->latency_buckets[i];
+    if (seen >= rank) return clib_package_stats_bucket_ms(i);
+  }
+  return clib_package_stats_bucket_ms(CLIB_PACKAGE_STATS_BUCKETS - 1);
+}
+
+/**
+ * Copy the counters `ctx` gathered since the last reset into
+ * `stats`.  Percentiles are bucket upper bounds.
+ */
+
+void
+clib_package_stats(clib_package_ctx_t *ctx, clib_package_stats_t *stats) {
+  struct session_stats *session = &ctx_get(ctx)->stats;
+  if (!stats) return;
+  pthread_mutex_lock(&session->mutex);
+  *stats = session->counters;
+  pthread_mutex_unlock(&session->mutex);
+  stats->latency_p50_ms = stats_percentile(stats, 0.50);
+  stats->latency_p95_ms = stats_percentile(stats, 0.95);
+  stats->latency_p99_ms = stats_percentile(stats, 0.99);
+}
+
+void
+clib_package_stats_reset(clib_package_ctx_t *ctx) {
+  struct session_stats *session = &ctx_get(ctx)->stats;
+  pthread_mutex_lock(&session->mutex);
+  memset(&session->counters, 0, sizeof(session->counters));
+  pthread_mutex_unlock(&session->mutex);
+}
+
+static void
+budget_account(struct memory_budget *b, size_t bytes) {
+  b->used += bytes;
+  if (b->used > b->peak) b->peak = b->used;
+}
+
+/**
+ * Grow `lease` by `bytes` against its budget, waiting while
+ * the budget is spent.
+ *
+ * Returns -1 if `cancel` fires while waiting.
+ */
+
+static int
+budget_reserve(struct budget_lease *lease, size_t bytes, clib_package_cancel_t *cancel) {
+  struct memory_budget *b = lease->budget;
+  if (!b) return 0;
+  pthread_mutex_lock(&b->mutex);
+
+  if (!lease->ticket) {
+    if (!_budget_ticket || !b->holders.count(_budget_ticket)) {
+      _budget_ticket = __atomic_add_fetch(&_budget_tickets, 1, __ATOMIC_RELAXED);
+    }
+    lease->ticket = _budget_ticket;
+    b->holders[lease->ticket]++;
+  }
+
+  while (b->limit
+      && b->used + bytes > b->limit
+      && b->holders.begin()->first != lease->ticket) {
+    if (cancel_expired(cancel)) {
+      pthread_mutex_unlock(&b->mutex);
+      cancel_check(cancel);
+      return -1;
+    }
+    struct timespec ts = deadline_from_ms(now_ms() + cancel_remaining_ms(cancel, 1000));
+    pthread_cond_timedwait(&b->cond, &b->mutex, &ts);
+  }
+
+  budget_account(b, bytes);
+  lease->held += bytes;
+  pthread_mutex_unlock(&b->mutex);
+  return 0;
+}
+
+static void
+budget_release(struct budget_lease *lease) {
+  struct memory_budget *b = lease->budget;
+  if (!b || !lease->ticket) return;
+
+  pthread_mutex_lock(&b->mutex);
+  b->used -= lease->held;
+  if (0 == --b->holders[lease->ticket]) {
+    b->holders.erase(lease->ticket);
+  }
+  pthread_cond_broadcast(&b->cond);
+  pthread_mutex_unlock(&b->mutex);
+
+  lease->ticket = 0;
+  lease->held = 0;
+}
+
+/**
+ * Account for long lived memory (such as `pkg->json`) without
+ * waiting; it counts against what transfers may reserve.
+ */
+
+static void
+budget_charge(struct memory_budget *b, size_t bytes) {
+  pthread_mutex_lock(&b->mutex);
+  budget_account(b, bytes);
+  pthread_mutex_unlock(&b->mutex);
+}
+
+static void
+budget_uncharge(struct memory_budget *b, size_t bytes) {
+  pthread_mutex_lock(&b->mutex);
+  b->used -= bytes < b->used ? bytes : b->used;
+  pthread_cond_broadcast(&b->cond);
+  pthread_mutex_unlock(&b->mutex);
+}
+
+/**
+ * Limit the memory held by `ctx`'s in-flight transfers and
+ * parses to `bytes`, or lift the limit with 0.
+ */
+
+void
+clib_package_set_memory_budget(clib_package_ctx_t *ctx, size_t bytes) {
+  struct memory_budget *b = &ctx_get(ctx)->budget;
+  pthread_mutex_lock(&b->mutex);
+  b->limit = bytes;
+  pthread_cond_broadcast(&b->cond);
+  pthread_mutex_unlock(&b->mutex);
+}
+
+/**
+ * Get the most memory `ctx` ever held against its budget.
+ */
+
+size_t
+clib_package_memory_peak(clib_package_ctx_t *ctx) {
+  struct memory_budget *b = &ctx_get(ctx)->budget;
+  pthread_mutex_lock(&b->mutex);
+  size_t peak = b->peak;
+  pthread_mutex_unlock(&b->mutex);
+  return peak;
+}
+
+/**
+ * Feed one raw response header `line` (`Name: value` or a
+ * status line) of `len` bytes into `res`.
+ */
+
+void
+clib_package_response_header(clib_package_response_t *res, const char *line, size_t len) {
+  std::string header(line, len);
+
+  // a new status line means a redirect; forget the previous headers
+  if (0 == header.compare(0, 5, "HTTP/")) {
+    res->ratelimit_remaining = -1;
+    res->ratelimit_reset = 0;
+    res->retry_after = -1;
+    free(res->etag);
+    res->etag = NULL;
+    return;
+  }
+
+  size_t colon = header.find(':');
+  if (std::string::npos == colon) return;
+  std::string name = header.substr(0, colon + 1);
+  std::string value = header.substr(colon + 1);
+  value.erase(0, value.find_first_not_of(" \t"));
+  value.erase(value.find_last_not_of("\r\n") + 1);
+  const char *v = value.c_str();
+
+  if (0 == strcasecmp(name.c_str(), "etag:")) {
+    free(res->etag);
+    res->etag = strdup(v);
+  } else if (0 == strcasecmp(name.c_str(), "x-ratelimit-remaining:")) {
+    res->ratelimit_remaining = strtol(v, NULL, 10);
+  } else if (0 == strcasecmp(name.c_str(), "x-ratelimit-reset:")) {
+    res->ratelimit_reset = strtol(v, NULL, 10);
+  } else if (0 == strcasecmp(name.c_str(), "retry-after:")) {
+    char *end = NULL;
+    long secs = strtol(v, &end, 10);
+    if (end == v) {
+      // HTTP-date form
+      time_t when = curl_getdate(v, NULL);
+      secs = -1 == when ? -1 : (long) (when - time(NULL));
+      if (secs < 0 && -1 != when) secs = 0;
+    }
+    res->retry_after = secs;
+  }
+}
+
+/**
+ * Set the status of `res`.
+ */
+
+void
+clib_package_response_status(clib_package_response_t *res, long status) {
+  res->status = status;
+  res->ok = status >= 200 && status < 300;
+}
+
+/**
+ * Append `len` bytes of body to `res`, reserving them from the
+ * memory budget first.
+ *
+ * Returns 0 on success.
+ */
+
+int
+clib_package_response_write(clib_package_response_t *res, const char *ptr, size_t len) {
+  res->bytes_decoded += len;
+  if (res->file) return len == fwrite(ptr, 1, len, res->file) ? 0 : -1;
+
+  if (-1 == budget_reserve(&res->lease, len, res->cancel)) return -1;
+
+  char *data = (char *) realloc(res->data, res->size + len + 1);
+  if (!data) return -1;
+  memcpy(data + res->size, ptr, len);
+  res->data = data;
+  res->size += len;
+  res->data[res->size] = '\0';
+  return 0;
+}
+
+static size_t
+http_header_cb(char *buffer, size_t size, size_t nitems, void *userdata) {
+  clib_package_response_header((clib_package_response_t *) userdata, buffer, size * nitems);
+  return size * nitems;
+}
+
+static size_t
+http_write_cb(char *ptr, size_t size, size_t nmemb, void *userdata) {
+  clib_package_response_t *res = (clib_package_response_t *) userdata;
+  size_t len = size * nmemb;
+  return 0 == clib_package_response_write(res, ptr, len) ? len : 0;
+}
+
+/**
+ * Downloads to disk go through `<path>.part`, which is only
+ * renamed into place once complete.  A leftover `.part` is
+ * resumed with a `Range` request; `<path>.part.meta` keeps the
+ * validators (content SHA and ETag) proving it belongs to the
+ * same content.
+ */
+
+static std::string
+download_part_path(const char *path) {
+  return std::string(path) + ".part";
+}
+
+static std::string
+download_meta_path(const char *path) {
+  return std::string(path) + ".part.meta";
+}
+
+static void
+download_meta_read(const char *path, std::string *sha, std::string *etag) {
+  char line[1024];
+  FILE *meta = fopen(download_meta_path(path).c_str(), "r");
+  if (!meta) return;
+  while (fgets(line, sizeof(line), meta)) {
+    std::string value(line);
+    value.erase(value.find_last_not_of("\r\n") + 1);
+    if (0 == value.compare(0, 4, "sha ")) *sha = value.substr(4);
+    if (0 == value.compare(0, 5, "etag ")) *etag = value.substr(5);
+  }
+  fclose(meta);
+}
+
+static int
+download_meta_write(const char *path, const std::string &sha, const std::string &etag) {
+  FILE *meta = fopen(download_meta_path(path).c_str(), "w");
+  if (!meta) return -1;
+  if (!sha.empty()) fprintf(meta, "sha %s\n", sha.c_str());
+  if (!etag.empty()) fprintf(meta, "etag %s\n", etag.c_str());
+  return fclose(meta);
+}
+
+static void
+download_discard(const char *path) {
+  unlink(download_part_path(path).c_str());
+  unlink(download_meta_path(path).c_str());
+}
+
+/**
+ * Make sure a leftover partial download of `path` is for the
+ * content identified by `sha`, dropping it otherwise.
+ */
+
+static void
+download_prepare(const char *path, const char *sha) {
+  std::string part_sha, etag;
+  download_meta_read(path, &part_sha, &etag);
+  if (sha && part_sha == sha) return;
+  download_discard(path);
+  if (sha) download_meta_write(path, sha, "");
+}
+
+/**
+ * Stream 2xx bodies straight to the `.part` file; keep
+ * anything else in memory so error bodies never end up in a
+ * source file and can be inspected for rate limit messages.
+ */
+
+struct http_file_sink {
+  clib_package_response_t *res;
+  CURL *curl;
+  const char *path;
+  std::string part;
+  long offset;
+  int opened;
+};
+
+static size_t
+http_file_write_cb(char *ptr, size_t size, size_t nmemb, void *userdata) {
+  struct http_file_sink *sink = (struct http_file_sink *) userdata;
+  if (!sink->opened) {
+    long status = 0;
+    curl_easy_getinfo(sink->curl, CURLINFO_RESPONSE_CODE, &status);
+    sink->opened = 1;
+    if (status >= 200 && status < 300) {
+      // anything but 206 is the whole body again
+      const char *mode = 206 == status ? "ab" : "wb";
+      if (!(sink->res->file = fopen(sink->part.c_str(), mode))) return 0;
+      if (sink->res->etag) {
+        std::string sha, etag;
+        download_meta_read(sink->path, &sha, &etag);
+        download_meta_write(sink->path, sha, sink->res->etag);
+      }
+    }
+  }
+  return http_write_cb(ptr, size, nmemb, sink->res);
+}
+
+/**
+ * Drive `curl` to completion on its own multi handle, so
+ * `cancel` can interrupt it from another thread.
+ */
+
+static CURLcode
+http_perform(CURL *curl, clib_package_cancel_t *cancel) {
+  CURLcode code = CURLE_OK;
+  CURLM *multi = NULL;
+  CURLMsg *msg = NULL;
+  int running = 1;
+  int queued = 0;
+
+  if (!cancel) return curl_easy_perform(curl);
+  if (cancel_check(cancel)) return CURLE_ABORTED_BY_CALLBACK;
+  if (!(multi = curl_multi_init())) return CURLE_OUT_OF_MEMORY;
+
+  curl_multi_add_handle(multi, curl);
+  cancel_watch(cancel, multi);
+
+  while (running) {
+    if (CURLM_OK != curl_multi_perform(multi, &running)) {
+      code = CURLE_RECV_ERROR;
+      break;
+    }
+    if (!running) break;
+    if (cancel_check(cancel)) {
+      code = CURLE_ABORTED_BY_CALLBACK;
+      break;
+    }
+    curl_multi_poll(multi, NULL, 0, (int) cancel_remaining_ms(cancel, 1000), NULL);
+  }
+
+  while (running == 0 && (msg = curl_multi_info_read(multi, &queued))) {
+    if (CURLMSG_DONE == msg->msg) code = msg->data.result;
+  }
+
+  cancel_unwatch(cancel, multi);
+  curl_multi_remove_handle(multi, curl);
+  curl_multi_cleanup(multi);
+  return code;
+}
+
+static clib_package_response_t *
+http_response_new(struct memory_budget *budget) {
+  clib_package_response_t *res = (clib_package_response_t *) malloc(sizeof(clib_package_response_t));
+  if (!res) return NULL;
+  memset(res, '\0', sizeof(clib_package_response_t));
+  res->lease.budget = budget;
+  res->ratelimit_remaining = -1;
+  res->retry_after = -1;
+  return res;
+}
+
+/**
+ * Drop whatever `res` received so far.
+ */
+
+static void
+http_response_reset(clib_package_response_t *res) {
+  free(res->data);
+  free(res->etag);
+  budget_release(&res->lease);
+  res->data = NULL;
+  res->etag = NULL;
+  res->size = 0;
+  res->status = 0;
+  res->ok = 0;
+  res->ratelimit_remaining = -1;
+  res->ratelimit_reset = 0;
+  res->retry_after = -1;
+  res->bytes_wire = 0;
+  res->bytes_decoded = 0;
+}
+
+/**
+ * Connections, DNS answers and TLS sessions shared by all of
+ * a session's transfers.
+ */
+
+struct curl_pool {
+  CURLSH *share;
+  pthread_mutex_t locks[CURL_LOCK_DATA_LAST];
+};
+
+static void
+curl_pool_lock(CURL *curl, curl_lock_data data, curl_lock_access access, void *userptr) {
+  (void) curl;
+  (void) access;
+  pthread_mutex_lock(&((struct curl_pool *) userptr)->locks[data]);
+}
+
+static void
+curl_pool_unlock(CURL *curl, curl_lock_data data, void *userptr) {
+  (void) curl;
+  pthread_mutex_unlock(&((struct curl_pool *) userptr)->locks[data]);
+}
+
+/**
+ * libcurl transport: GET `url` for real.  When `path` is given,
+ * a successful body is written there instead of being buffered,
+ * resuming an earlier partial download if there is one.
+ *
+ * Returns 0 when a response was received.
+ */
+
+static int
+curl_transport_get(clib_package_transport_t *self
+    , const char *url
+    , const char *path
+    , clib_package_cancel_t *cancel
+    , clib_package_response_t *res) {
+  struct http_file_sink sink;
+  struct curl_slist *headers = NULL;
+  CURL *curl = NULL;
+  CURLcode code = CURLE_OK;
+
+  pthread_once(&_curl_once, curl_init_once);
+
+restart:
+  if (!(curl = curl_easy_init())) return -1;
+
+  curl_easy_setopt(curl, CURLOPT_URL, url);
+  curl_easy_setopt(curl, CURLOPT_USERAGENT, CLIB_PACKAGE_USER_AGENT);
+  curl_easy_setopt(curl, CURLOPT_FOLLOWLOCATION, 1L);
+  curl_easy_setopt(curl, CURLOPT_NOSIGNAL, 1L);
+  curl_easy_setopt(curl, CURLOPT_HEADERFUNCTION, http_header_cb);
+  curl_easy_setopt(curl, CURLOPT_HEADERDATA, res);
+
+  sink.offset = 0;
+  if (path) {
+    struct stat st;
+    std::string sha, etag;
+
+    sink.res = res;
+    sink.curl = curl;
+    sink.path = path;
+    sink.part = download_part_path(path);
+    sink.offset = 0 == stat(sink.part.c_str(), &st) ? (long) st.st_size : 0;
+    sink.opened = 0;
+
+    if (sink.offset > 0) {
+      std::string range = "Range: bytes=" + std::to_string(sink.offset) + "-";
+      download_meta_read(path, &sha, &etag);
+      headers = curl_slist_append(headers, range.c_str());
+      if (!etag.empty()) {
+        headers = curl_slist_append(headers, ("If-Range: " + etag).c_str());
+      }
+      curl_easy_setopt(curl, CURLOPT_HTTPHEADER, headers);
+      _debug("resuming %s at %ld bytes", path, sink.offset);
+    }
+
+    curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, http_file_write_cb);
+    curl_easy_setopt(curl, CURLOPT_WRITEDATA, &sink);
+  } else {
+    if (res->if_none_match) {
+      headers = curl_slist_append(headers, (std::string("If-None-Match: ") + res->if_none_match).c_str());
+      curl_easy_setopt(curl, CURLOPT_HTTPHEADER, headers);
+    }
+    curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, http_write_cb);
+    curl_easy_setopt(curl, CURLOPT_WRITEDATA, res);
+  }
+
+  // offer every encoding libcurl was built with (gzip, br, zstd)
+  // and let it decode while streaming.  Ranges count encoded
+  // bytes, so a resume asks for the identity encoding instead.
+  if (0 == sink.offset) {
+    curl_easy_setopt(curl, CURLOPT_ACCEPT_ENCODING, "");
+  }
+
+  if (self->data) {
+    curl_easy_setopt(curl, CURLOPT_SHARE, ((struct curl_pool *) self->data)->share);
+  }
+
+  code = http_perform(curl, cancel);
+  if (res->file) {
+    if (0 != fclose(res->file)) code = CURLE_WRITE_ERROR;
+    res->file = NULL;
+  }
+
+  {
+    curl_off_t body = 0;
+    long header = 0;
+    curl_easy_getinfo(curl, CURLINFO_SIZE_DOWNLOAD_T, &body);
+    curl_easy_getinfo(curl, CURLINFO_HEADER_SIZE, &header);
+    res->bytes_wire = body + header;
+  }
+
+  if (CURLE_OK == code) {
+    long status = 0;
+    curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &status);
+    clib_package_response_status(res, status);
+    _debug("GET %s: %ld (%ld bytes on wire, %ld decoded)"
+      , url
+      , res->status
+      , (long) res->bytes_wire
+      , (long) res->bytes_decoded);
+  } else {
+    _debug("GET %s: %s", url, curl_easy_strerror(code));
+  }
+
+  curl_slist_free_all(headers);
+  headers = NULL;
+  curl_easy_cleanup(curl);
+
+  if (path && 416 == res->status && sink.offset > 0) {
+    // the partial file is no good; start over in place
+    _debug("range not satisfiable for %s, restarting", path);
+    download_discard(path);
+    http_response_reset(res);
+    goto restart;
+  }
+
+  if (path && res->ok) {
+    // an empty 2xx body never opened the file
+    if (!sink.opened) {
+      FILE *empty = fopen(sink.part.c_str(), "wb");
+      if (!empty || 0 != fclose(empty)) res->ok = 0;
+    }
+    if (res->ok && 0 != rename(sink.part.c_str(), path)) res->ok = 0;
+    if (res->ok) unlink(download_meta_path(path).c_str());
+  }
+
+  return CURLE_OK == code ? 0 : -1;
+}
+
+static clib_package_transport_t _curl_transport = {
+    curl_transport_get
+  , NULL
+  , NULL
+};
+
+static void
+curl_pool_transport_free(clib_package_transport_t *self) {
+  struct curl_pool *pool = (struct curl_pool *) self->data;
+  curl_share_cleanup(pool->share);
+  for (int i = 0; i < CURL_LOCK_DATA_LAST; i++) {
+    pthread_mutex_destroy(&pool->locks[i]);
+  }
+  free(pool);
+  free(self);
+}
+
+/**
+ * A libcurl transport keeping connections alive between
+ * requests.
+ *
+ * Returns NULL if the pool cannot be set up.
+ */
+
+static clib_package_transport_t *
+curl_transport_pooled(void) {
+  clib_package_transport_t *transport = NULL;
+  struct curl_pool *pool = NULL;
+
+  pthread_once(&_curl_once, curl_init_once);
+  if (!(transport = (clib_package_transport_t *) malloc(sizeof(clib_package_transport_t)))) goto error;
+  if (!(pool = (struct curl_pool *) malloc(sizeof(struct curl_pool)))) goto error;
+  if (!(pool->share = curl_share_init())) goto error;
+  for (int i = 0; i < CURL_LOCK_DATA_LAST; i++) {
+    pthread_mutex_init(&pool->locks[i], NULL);
+  }
+  curl_share_setopt(pool->share, CURLSHOPT_LOCKFUNC, curl_pool_lock);
+  curl_share_setopt(pool->share, CURLSHOPT_UNLOCKFUNC, curl_pool_unlock);
+  curl_share_setopt(pool->share, CURLSHOPT_USERDATA, pool);
+  curl_share_setopt(pool->share, CURLSHOPT_SHARE, CURL_LOCK_DATA_CONNECT);
+  curl_share_setopt(pool->share, CURLSHOPT_SHARE, CURL_LOCK_DATA_DNS);
+  curl_share_setopt(pool->share, CURLSHOPT_SHARE, CURL_LOCK_DATA_SSL_SESSION);
+
+  transport->get = curl_transport_get;
+  transport->free = curl_pool_transport_free;
+  transport->data = pool;
+  return transport;
+
+error:
+  free(pool);
+  free(transport);
+  return NULL;
+}
+
+/**
+ * Hand a whole `body` to `res` the way a transport would have
+ * streamed it: into `path` (atomically) for a 2xx download,
+ * into memory otherwise.
+ *
+ * Returns 0 on success.
+ */
+
+static int
+response_deliver(clib_package_response_t *res
+    , const char *path
+    , long status
+    , const char *body
+    , size_t size) {
+  clib_package_response_status(res, status);
+  res->bytes_wire += size;
+  if (!path || !res->ok) return clib_package_response_write(res, body, size);
+
+  std::string part = download_part_path(path);
+  if (!(res->file = fopen(part.c_str(), "wb"))) return -1;
+  int rc = clib_package_response_write(res, body, size);
+  if (0 != fclose(res->file)) rc = -1;
+  res->file = NULL;
+  if (0 == rc) rc = rename(part.c_str(), path);
+  if (0 != rc) res->ok = 0;
+  return rc;
+}
+
+/**
+ * In-memory transport: answers from a fixed map of URLs,
+ * with 404 for anything else.
+ */
+
+struct memory_response {
+  long status;
+  std::string body;
+};
+
+struct memory_transport {
+  pthread_mutex_t mutex;
+  std::map<std::string, struct memory_response> responses;
+};
+
+static int
+memory_transport_get(clib_package_transport_t *self
+    , const char *url
+    , const char *path
+    , clib_package_cancel_t *cancel
+    , clib_package_response_t *res) {
+  struct memory_transport *memory = (struct memory_transport *) self->data;
+  struct memory_response found = { 404, "" };
+
+  if (cancel_check(cancel)) return -1;
+
+  pthread_mutex_lock(&memory->mutex);
+  std::map<std::string, struct memory_response>::iterator it = memory->responses.find(url);
+  if (it != memory->responses.end()) found = it->second;
+  pthread_mutex_unlock(&memory->mutex);
+
+  if (404 == found.status) _debug("memory transport: no response for %s", url);
+  if (200 == found.status) {
+    // an ETag of the body (FNV-1a), as a server would send
+    unsigned long long hash = 14695981039346656037ULL;
+    char etag[40];
+    for (size_t i = 0; i < found.body.size(); i++) {
+      hash = (hash ^ (unsigned char) found.body[i]) * 1099511628211ULL;
+    }
+    int n = snprintf(etag, sizeof(etag), "ETag: \"%016llx\"\r\n", hash);
+    clib_package_response_header(res, etag, n);
+  }
+  response_deliver(res, path, found.status, found.body.data(), found.body.size());
+  return 0;
+}
+
+static void
+memory_transport_free(clib_package_transport_t *self) {
+  struct memory_transport *memory = (struct memory_transport *) self->data;
+  pthread_mutex_destroy(&memory->mutex);
+  delete memory;
+  free(self);
+}
+
+/**
+ * Create an empty in-memory transport.
+ */
+
+clib_package_transport_t *
+clib_package_transport_memory(void) {
+  clib_package_transport_t *transport = NULL;
+  if (!(transport = (clib_package_transport_t *) malloc(sizeof(clib_package_transport_t)))) {
+    return NULL;
+  }
+  struct memory_transport *memory = new struct memory_transport;
+  pthread_mutex_init(&memory->mutex, NULL);
+  transport->get = memory_transport_get;
+  transport->free = memory_transport_free;
+  transport->data = memory;
+  return transport;
+}
+
+/**
+ * Answer GETs of `url` with `status` and the `size` bytes of
+ * `body`.  Only valid for transports made by
+ * `clib_package_transport_memory()` or `_replay()`.
+ *
+ * Returns 0 on success.
+ */
+
+int
+clib_package_transport_memory_add(clib_package_transport_t *transport
+    , const char *url
+    , long status
+    , const char *body
+    , size_t size) {
+  if (!transport || memory_transport_get != transport->get || !url) return -1;
+  struct memory_transport *memory = (struct memory_transport *) transport->data;
+  struct memory_response response = { status, std::string(body ? body : "", body ? size : 0) };
+  pthread_mutex_lock(&memory->mutex);
+  memory->responses[url] = response;
+  pthread_mutex_unlock(&memory->mutex);
+  return 0;
+}
+
+/**
+ * Read all of the file at `path` into `out`.
+ *
+ * Returns 0 on success.
+ */
+
+static int
+file_read_all(const char *path, std::string *out) {
+  char buffer[16384];
+  size_t n = 0;
+  FILE *in = fopen(path, "rb");
+  if (!in) return -1;
+  out->clear();
+  while ((n = fread(buffer, 1, sizeof(buffer), in)) > 0) out->append(buffer, n);
+  int rc = ferror(in) ? -1 : 0;
+  fclose(in);
+  return rc;
+}
+
+/**
+ * Record/replay files are a sequence of entries:
+ *
+ *   <status> <size> <url>\n
+ *   <size bytes of body>\n
+ */
+
+struct record_transport {
+  clib_package_transport_t *inner;
+  pthread_mutex_t mutex;
+  FILE *file;
+};
+
+static int
+record_transport_get(clib_package_transport_t *self
+    , const char *url
+    , const char *path
+    , clib_package_cancel_t *cancel
+    , clib_package_response_t *res) {
+  struct record_transport *record = (struct record_transport *) self->data;
+  std::string body;
+
+  int rc = record->inner->get(record->inner, url, path, cancel, res);
+  if (0 != rc) return rc;
+
+  if (path && res->ok) {
+    if (0 != file_read_all(path, &body)) return 0;
+  } else if (res->data) {
+    body.assign(res->data, res->size);
+  }
+
+  pthread_mutex_lock(&record->mutex);
+  fprintf(record->file, "%ld %lu %s\n", res->status, (unsigned long) body.size(), url);
+  fwrite(body.data(), 1, body.size(), record->file);
+  fputc('\n', record->file);
+  fflush(record->file);
+  pthread_mutex_unlock(&record->mutex);
+  return 0;
+}
+
+static void
+record_transport_free(clib_package_transport_t *self) {
+  struct record_transport *record = (struct record_transport *) self->data;
+  fclose(record->file);
+  pthread_mutex_destroy(&record->mutex);
+  free(record);
+  free(self);
+}
+
+/**
+ * Create a transport passing requests on to `inner` and
+ * appending every response to the record file at `file`.
+ * `inner` still belongs to the caller.
+ */
+
+clib_package_transport_t *
+clib_package_transport_record(clib_package_transport_t *inner, const char *file) {
+  clib_package_transport_t *transport = NULL;
+  struct record_transport *record = NULL;
+
+  if (!inner || !file) return NULL;
+  transport = (clib_package_transport_t *) malloc(sizeof(clib_package_transport_t));
+  record = (struct record_transport *) malloc(sizeof(struct record_transport));
+  if (!transport || !record || !(record->file = fopen(file, "ab"))) {
+    free(transport);
+    free(record);
+    return NULL;
+  }
+
+  record->inner = inner;
+  pthread_mutex_init(&record->mutex, NULL);
+  transport->get = record_transport_get;
+  transport->free = record_transport_free;
+  transport->data = record;
+  return transport;
+}
+
+/**
+ * Create an in-memory transport answering with the responses
+ * in the record file at `file`; later entries win.
+ */
+
+clib_package_transport_t *
+clib_package_transport_replay(const char *file) {
+  clib_package_transport_t *transport = NULL;
+  char line[4096];
+  FILE *in = NULL;
+
+  if (!file || !(in = fopen(file, "rb"))) return NULL;
+  if (!(transport = clib_package_transport_memory())) {
+    fclose(in);
+    return NULL;
+  }
+
+  while (fgets(line, sizeof(line), in)) {
+    long status = 0;
+    unsigned long size = 0;
+    int consumed = 0;
+    if (2 != sscanf(line, "%ld %lu %n", &status, &size, &consumed)) break;
+
+    std::string url(line + consumed);
+    url.erase(url.find_last_not_of("\r\n") + 1);
+    std::string body(size, '\0');
+    if (size && size != fread(&body[0], 1, size, in)) break;
+    fgetc(in);
+
+    clib_package_transport_memory_add(transport, url.c_str(), status, body.data(), body.size());
+  }
+
+  fclose(in);
+  return transport;
+}
+
+/**
+ * Map `url` to its file in the mirror directory `dir`:
+ * the scheme is dropped, `?` is escaped, and `.body` is
+ * appended so that `repos/a/b` and `repos/a/b/...` can both
+ * exist.  URLs come from API responses, so one with an empty,
+ * `.` or `..` segment, which could name a file outside `dir`,
+ * has no file.
+ *
+ * Returns an empty string then.
+ */
+
+static std::string
+mirror_path(const char *dir, const char *url) {
+  std::string mapped(url);
+  size_t scheme = mapped.find("://");
+  if (std::string::npos != scheme) mapped.erase(0, scheme + 3);
+
+  size_t query = mapped.find('?');
+  if (std::string::npos != query) mapped.replace(query, 1, "%3F");
+
+  for (size_t start = 0; start <= mapped.size();) {
+    size_t end = mapped.find('/', start);
+    if (std::string::npos == end) end = mapped.size();
+    std::string segment = mapped.substr(start, end - start);
+    if (segment.empty() || "." == segment || ".." == segment) return std::string();
+    start = end + 1;
+  }
+
+  return std::string(dir) + "/" + mapped + ".body";
+}
+
+static int
+directory_transport_get(clib_package_transport_t *self
+    , const char *url
+    , const char *path
+    , clib_package_cancel_t *cancel
+    , clib_package_response_t *res) {
+  const char *dir = (const char *) self->data;
+  std::string file = mirror_path(dir, url);
+  FILE *in = NULL;
+  char buffer[16384];
+  size_t n = 0;
+  int rc = 0;
+
+  if (cancel_check(cancel)) return -1;
+
+  if (file.empty() || !(in = fopen(file.c_str(), "rb"))) {
+    _debug("mirror: no %s", file.c_str());
+    return response_deliver(res, NULL, 404, "", 0);
+  }
+
+  clib_package_response_status(res, 200);
+  std::string part;
+  if (path) {
+    part = download_part_path(path);
+    if (!(res->file = fopen(part.c_str(), "wb"))) rc = -1;
+  }
+
+  while (0 == rc && (n = fread(buffer, 1, sizeof(buffer), in)) > 0) {
+    res->bytes_wire += n;
+    rc = clib_package_response_write(res, buffer, n);
+  }
+  if (ferror(in)) rc = -1;
+  fclose(in);
+
+  if (res->file) {
+    if (0 != fclose(res->file)) rc = -1;
+    res->file = NULL;
+    if (0 == rc) rc = rename(part.c_str(), path);
+  }
+  if (0 != rc) {
+    res->ok = 0;
+    if (!part.empty()) unlink(part.c_str());
+  }
+  return 0;
+}
+
+static void
+directory_transport_free(clib_package_transport_t *self) {
+  free(self->data);
+  free(self);
+}
+
+/**
+ * Create a transport serving every URL from a local mirror
+ * directory `dir` (see `mirror_path()` for the layout), with
+ * 404 for anything missing.
+ */
+
+clib_package_transport_t *
+clib_package_transport_directory(const char *dir) {
+  clib_package_transport_t *transport = NULL;
+  if (!dir) return NULL;
+  if (!(transport = (clib_package_transport_t *) malloc(sizeof(clib_package_transport_t)))) {
+    return NULL;
+  }
+  transport->get = directory_transport_get;
+  transport->free = directory_transport_free;
+  transport->data = strdup(dir);
+  return transport;
+}
+
+/**
+ * Write `body` to `file` (creating its directory) under a
+ * temporary name and rename it into place, so that readers
+ * never see a partial file.
+ */
+
+static int
+file_write_atomic(const std::string &file, const std::string &body) {
+  std::string dir = file.substr(0, file.rfind('/'));
+  char suffix[64];
+  int rc = -1;
+
+  if (-1 == mkdirp(dir.c_str(), 0777)) return -1;
+  snprintf(suffix, sizeof(suffix), ".%ld.%ld.tmp", (long) getpid(), (long) syscall(SYS_gettid));
+  std::string staged = file + suffix;
+  FILE *out = fopen(staged.c_str(), "wb");
+  if (!out) return -1;
+  if (body.size() == fwrite(body.data(), 1, body.size(), out)) rc = 0;
+  if (0 != fclose(out)) rc = -1;
+  if (0 == rc) rc = rename(staged.c_str(), file.c_str());
+  if (0 != rc) unlink(staged.c_str());
+  return rc;
+}
+
+struct mirror_transport {
+  clib_package_transport_t *inner;
+  char *dir;
+};
+
+static int
+mirror_transport_get(clib_package_transport_t *self
+    , const char *url
+    , const char *path
+    , clib_package_cancel_t *cancel
+    , clib_package_response_t *res) {
+  struct mirror_transport *mirror = (struct mirror_transport *) self->data;
+  std::string body;
+
+  int rc = mirror->inner->get(mirror->inner, url, path, cancel, res);
+  if (0 != rc || !res->ok) return rc;
+
+  if (path) {
+    if (0 != file_read_all(path, &body)) return 0;
+  } else if (res->data) {
+    body.assign(res->data, res->size);
+  }
+
+  std::string file = mirror_path(mirror->dir, url);
+  if (file.empty()) {
+    _debug("mirror: not mirroring %s", url);
+  } else if (0 != file_write_atomic(file, body)) {
+    _debug("mirror: unable to write %s", url);
+  }
+  return 0;
+}
+
+static void
+mirror_transport_free(clib_package_transport_t *self) {
+  struct mirror_transport *mirror = (struct mirror_transport *) self->data;
+  free(mirror->dir);
+  free(mirror);
+  free(self);
+}
+
+/**
+ * Create a transport passing requests on to `inner` and
+ * copying every 2xx response into the mirror directory `dir`,
+ * for `clib_package_transport_directory()` to serve later.
+ * `inner` still belongs to the caller.
+ */
+
+clib_package_transport_t *
+clib_package_transport_mirror(clib_package_transport_t *inner, const char *dir) {
+  clib_package_transport_t *transport = NULL;
+  struct mirror_transport *mirror = NULL;
+
+  if (!inner || !dir) return NULL;
+  transport = (clib_package_transport_t *) malloc(sizeof(clib_package_transport_t));
+  mirror = (struct mirror_transport *) malloc(sizeof(struct mirror_transport));
+  if (!transport || !mirror || !(mirror->dir = strdup(dir))) {
+    free(transport);
+    free(mirror);
+    return NULL;
+  }
+
+  mirror->inner = inner;
+  transport->get = mirror_transport_get;
+  transport->free = mirror_transport_free;
+  transport->data = mirror;
+  return transport;
+}
+
+void
+clib_package_transport_free(clib_package_transport_t *transport) {
+  if (transport && transport->free) transport->free(transport);
+}
+
+/**
+ * Send every request of `ctx` through `transport`, or back
+ * through libcurl when NULL.  The transport still belongs to
+ * the caller and must outlive the requests using it.
+ */
+
+void
+clib_package_set_transport(clib_package_ctx_t *ctx, clib_package_transport_t *transport) {
+  ctx_get(ctx)->transport = transport;
+}
+
+/**
+ * The transport requests of `ctx` go through: its mirror
+ * when offline, else the one set on it, else libcurl.
+ */
+
+static clib_package_transport_t *
+ctx_transport(clib_package_ctx_t *ctx) {
+  if (ctx->offline) return ctx->offline;
+  if (ctx->transport) return ctx->transport;
+  return ctx->curl ? ctx->curl : &_curl_transport;
+}
+
+/**
+ * Perform a single GET of `url` through the configured
+ * transport, downloading into `path` if given.
+ *
+ * Returns NULL only when out of memory; transport errors are
+ * reported with a `status` of 0.
+ */
+
+static clib_package_response_t *
+http_request(clib_package_ctx_t *ctx
+    , const char *url
+    , const char *path
+    , const char *if_none_match
+    , clib_package_cancel_t *cancel) {
+  clib_package_response_t *res = NULL;
+  clib_package_transport_t *transport = ctx_transport(ctx);
+
+  if (!(res = http_response_new(&ctx->budget))) return NULL;
+  res->cancel = cancel;
+  res->if_none_match = if_none_match;
+  if (!url) return res;
+
+  struct trace_span span = trace_begin(&ctx->trace, "GET");
+  long long start = now_us();
+  _probe(request__start, url);
+  if (0 != transport->get(transport, url, path, cancel, res)) {
+    res->status = 0;
+    res->ok = 0;
+  }
+  if (res->file) {
+    fclose(res->file);
+    res->file = NULL;
+  }
+  trace_end(&span, "http", NULL, url, res->status, (long long) res->bytes_wire);
+  stats_request(&ctx->stats, res, now_us() - start);
+  _probe(request__done, url, res->status, (long long) res->bytes_wire, now_us() - start);
+  // a resumed download reuses what is already on disk
+  if (path && 206 == res->status) stats_add(&ctx->stats, downloads_resumed, 1);
+  return res;
+}
+
+static void
+http_response_free(clib_package_response_t *res) {
+  if (!res) return;
+  free(res->data);
+  free(res->etag);
+  budget_release(&res->lease);
+  free(res);
+}
+
+/**
+ * Whether `res` failed in a way worth retrying: transport
+ * errors, 429, 5xx and GitHub's primary or secondary rate
+ * limit 403s.
+ */
+
+static int
+http_transient(clib_package_response_t *res) {
+  if (!res) return 0;
+  if (0 == res->status || 429 == res->status) return 1;
+  if (res->status >= 500) return 1;
+  if (403 == res->status) {
+    if (0 == res->ratelimit_remaining || res->retry_after >= 0) return 1;
+    if (res->data && strstr(res->data, "rate limit")) return 1;
+  }
+  return 0;
+}
+
+static void
+controller_wake(struct concurrency_controller *c) {
+  pthread_mutex_lock(&c->mutex);
+  pthread_cond_broadcast(&c->cond);
+  pthread_mutex_unlock(&c->mutex);
+}
+
+/**
+ * Wait for a request slot.  `paced` requests (those hitting
+ * the rate limited API) also wait for the rate budget.
+ *
+ * Returns -1 if `cancel` fires while waiting.
+ */
+
+static int
+controller_acquire(struct concurrency_controller *c, int paced, clib_package_cancel_t *cancel) {
+  cancel_watch_controller(cancel, c);
+  pthread_mutex_lock(&c->mutex);
+  for (;;) {
+    long long now = now_ms();
+    long long wait_until = 0;
+
+    if (cancel_expired(cancel)) {
+      pthread_mutex_unlock(&c->mutex);
+      cancel_unwatch_controller(cancel, c);
+      cancel_check(cancel);
+      return -1;
+    }
+
+    if (c->in_flight >= (int) c->limit) {
+      wait_until = now + cancel_remaining_ms(cancel, 60 * 1000);
+      struct timespec ts = deadline_from_ms(wait_until);
+      pthread_cond_timedwait(&c->cond, &c->mutex, &ts);
+      continue;
+    }
+
+    if (paced) {
+      if (now < c->not_before_ms) {
+        wait_until = c->not_before_ms;
+      } else if (c->remaining >= 0
+          && c->remaining <= CLIB_PACKAGE_RATELIMIT_LOW_WATER
+          && now < c->next_slot_ms) {
+        wait_until = c->next_slot_ms;
+      }
+    }
+
+    if (0 == wait_until) break;
+    if (cancel && cancel->deadline_ms && cancel->deadline_ms < wait_until) {
+      wait_until = cancel->deadline_ms;
+    }
+    struct timespec ts = deadline_from_ms(wait_until);
+    pthread_cond_timedwait(&c->cond, &c->mutex, &ts);
+  }
+
+  c->in_flight++;
+  if (paced && c->remaining >= 0) {
+    long long now = now_ms();
+    if (c->remaining > 0) c->remaining--;
+    if (c->remaining <= CLIB_PACKAGE_RATELIMIT_LOW_WATER) {
+      // spread what is left of the budget over the rest of the window
+      long long window = c->reset_ms > now ? c->reset_ms - now : 0;
+      long long interval = window / (c->remaining + 1);
+      c->next_slot_ms = (c->next_slot_ms > now ? c->next_slot_ms : now) + interval;
+    }
+  }
+  pthread_mutex_unlock(&c->mutex);
+  cancel_unwatch_controller(cancel, c);
+  return 0;
+}
+
+/**
+ * Return a request slot and feed the outcome of `res`, which
+ * took `latency` milliseconds, back into the controller.
+ */
+
+static void
+controller_release(struct concurrency_controller *c
+    , clib_package_response_t *res
+    , long long latency
+    , int paced) {
+  long long now = now_ms();
+  int congested = http_transient(res) || latency > CLIB_PACKAGE_TARGET_LATENCY_MS;
+
+  pthread_mutex_lock(&c->mutex);
+  c->in_flight--;
+
+  if (congested) {
+    // one decrease per round trip, however many requests saw it
+    if (now - c->decreased_ms > latency) {
+      c->limit /= 2;
+      if (c->limit < CLIB_PACKAGE_MIN_CONCURRENCY) {
+        c->limit = CLIB_PACKAGE_MIN_CONCURRENCY;
+      }
+      c->decreased_ms = now;
+      _debug("concurrency limit: %d", (int) c->limit);
+    }
+  } else {
+    c->limit += 1 / c->limit;
+    if (c->limit > CLIB_PACKAGE_MAX_CONCURRENCY) {
+      c->limit = CLIB_PACKAGE_MAX_CONCURRENCY;
+    }
+  }
+
+  if (paced && res) {
+    if (res->ratelimit_remaining >= 0) {
+      c->remaining = res->ratelimit_remaining;
+      if (res->ratelimit_reset > 0) {
+        long long left = ((long long) res->ratelimit_reset - time(NULL)) * 1000;
+        c->reset_ms = now + (left > 0 ? left : 0);
+      }
+      if (0 == c->remaining && c->reset_ms > c->not_before_ms) {
+        c->not_before_ms = c->reset_ms;
+      }
+    }
+    if (res->retry_after >= 0) {
+      long long until = now + (long long) res->retry_after * 1000;
+      if (until > c->not_before_ms) c->not_before_ms = until;
+    }
+  }
+
+  pthread_cond_broadcast(&c->cond);
+  pthread_mutex_unlock(&c->mutex);
+}
+
+/**
+ * Full jitter backoff for the given retry `attempt`.
+ */
+
+static long long
+backoff_ms(int attempt, clib_package_response_t *res) {
+  static __thread unsigned int seed = 0;
+  if (0 == seed) seed = (unsigned int) now_ms() ^ (unsigned int) (size_t) &seed;
+
+  long long cap = (long long) CLIB_PACKAGE_BACKOFF_BASE_MS << attempt;
+  if (cap > CLIB_PACKAGE_BACKOFF_MAX_MS) cap = CLIB_PACKAGE_BACKOFF_MAX_MS;
+  long long delay = rand_r(&seed) % (cap + 1);
+  if (res && res->retry_after >= 0 && res->retry_after * 1000LL > delay) {
+    delay = res->retry_after * 1000LL;
+  }
+  return delay;
+}
+
+/**
+ * GET `url` (into `path` if given) through the concurrency
+ * controller, retrying transient failures with jittered
+ * backoff.  The slot is given back while backing off, so
+ * other requests keep flowing.
+ *
+ * Returns NULL if `cancel` fires.
+ */
+
+static clib_package_response_t *
+http_request_retry(clib_package_ctx_t *ctx
+    , const char *url
+    , const char *path
+    , const char *if_none_match
+    , int paced
+    , clib_package_cancel_t *cancel) {
+  clib_package_response_t *res = NULL;
+  if (!url) return NULL;
+
+  // a mirror answers at once or not at all
+  if (ctx->offline) {
+    if (cancel_check(cancel)) return NULL;
+    res = http_request(ctx, url, path, if_none_match, cancel);
+    if (cancel_check(cancel)) {
+      http_response_free(res);
+      return NULL;
+    }
+    return res;
+  }
+
+  for (int attempt = 0; ; attempt++) {
+    if (-1 == controller_acquire(&ctx->controller, paced, cancel)) return NULL;
+    long long start = now_ms();
+    res = http_request(ctx, url, path, if_none_match, cancel);
+    if (cancel_expired(cancel)) {
+      // an aborted transfer says nothing about congestion
+      controller_release(&ctx->controller, NULL, 0, paced);
+    } else {
+      controller_release(&ctx->controller, res, now_ms() - start, paced);
+    }
+
+    if (cancel_check(cancel)) {
+      http_response_free(res);
+      return NULL;
+    }
+    if (!http_transient(res) || attempt >= CLIB_PACKAGE_MAX_RETRIES) break;
+
+    long long delay = backoff_ms(attempt, res);
+    stats_add(&ctx->stats, retries, 1);
+    _debug("retrying %s (status %ld) in %lldms", url, res->status, delay);
+    http_response_free(res);
+    res = NULL;
+
+    if (-1 == cancel_sleep(cancel, delay)) return NULL;
+  }
+
+  return res;
+}
+
+/**
+ * Filesystem writes of one package stage.  Directories known
+ * to exist are cached, so files sharing a directory cost no
+ * extra syscalls.  Directories are created a level at a time
+ * and small files (package.json, the .mk file) are queued and
+ * written together by `fs_batch_flush()`.  With
+ * `-DCLIB_PACKAGE_IO_URING` a level or a flush is a single
+ * io_uring submission; without it, or where the kernel says
+ * no, plain syscalls do the same work.  Renames stay plain
+ * syscalls, and nothing is fsynced.
+ */
+
+struct fs_batch_file {
+  std::string path;
+  std::string data;
+};
+
+struct fs_batch {
+  pthread_mutex_t mutex;
+  std::set<std::string> dirs;
+  std::vector<struct fs_batch_file> files;
+  // every file fetched into the stage, with its blob sha
+  std::vector<std::pair<std::string, std::string> > fetched;
+  // the installed copy being upgraded and its files' blob shas
+  std::string previous_dir;
+  std::map<std::string, std::string> previous;
+#ifdef CLIB_PACKAGE_IO_URING
+  struct io_uring ring;
+  int ring_state; // 0 untried, 1 usable, -1 unavailable
+#endif
+};
+
+static void
+fs_batch_init(struct fs_batch *batch) {
+  pthread_mutex_init(&batch->mutex, NULL);
+#ifdef CLIB_PACKAGE_IO_URING
+  batch->ring_state = 0;
+#endif
+}
+
+static void
+fs_batch_destroy(struct fs_batch *batch) {
+#ifdef CLIB_PACKAGE_IO_URING
+  if (1 == batch->ring_state) io_uring_queue_exit(&batch->ring);
+#endif
+  pthread_mutex_destroy(&batch->mutex);
+}
+
+static int
+fd_write_all(int fd, const char *data, size_t len) {
+  while (len > 0) {
+    ssize_t n = write(fd, data, len);
+    if (n < 0 && EINTR == errno) continue;
+    if (n <= 0) return -1;
+    data += n;
+    len -= n;
+  }
+  return 0;
+}
+
+#ifdef CLIB_PACKAGE_IO_URING
+
+static int
+uring_get(struct fs_batch *batch) {
+  if (0 == batch->ring_state) {
+    batch->ring_state = -1;
+    if (0 == io_uring_queue_init(CLIB_PACKAGE_URING_DEPTH, &batch->ring, 0)) {
+      // direct descriptors let a write follow its open in one link
+      if (0 == io_uring_register_files_sparse(&batch->ring, CLIB_PACKAGE_URING_DEPTH)) {
+        batch->ring_state = 1;
+      } else {
+        io_uring_queue_exit(&batch->ring);
+      }
+    }
+  }
+  return 1 == batch->ring_state;
+}
+
+/**
+ * Stop using the ring of `batch`: after a failed submit or
+ * wait it may hold queued entries or completions that belong
+ * to no caller.
+ */
+
+static void
+uring_drop(struct fs_batch *batch) {
+  io_uring_queue_exit(&batch->ring);
+  batch->ring_state = -1;
+}
+
+/**
+ * Submit what is queued and reap a completion for each of
+ * the `n` entries, even after one fails, so none is left for
+ * the next run.  Writes carry their expected length + 1 as
+ * user data, so short writes fail too.
+ *
+ * Returns 0, or the first failure (-errno) other than `ok`.
+ */
+
+static int
+uring_run(struct fs_batch *batch, unsigned n, int ok) {
+  struct io_uring *ring = &batch->ring;
+  struct io_uring_cqe *cqe = NULL;
+  int submitted = io_uring_submit(ring);
+  int rc = 0;
+
+  if (submitted < 0 || (unsigned) submitted != n) rc = submitted < 0 ? submitted : -EAGAIN;
+  for (int i = 0; i < submitted; i++) {
+    int err = 0;
+    while (-EINTR == (err = io_uring_wait_cqe(ring, &cqe))) {}
+    if (err < 0) {
+      // completions can no longer be told apart from the next run's
+      uring_drop(batch);
+      return err;
+    }
+    if (cqe->res < 0 && cqe->res != ok && 0 == rc) rc = cqe->res;
+    if (cqe->res >= 0 && cqe->user_data && (uint64_t) cqe->res != cqe->user_data - 1 && 0 == rc) {
+      rc = -EIO;
+    }
+    io_uring_cqe_seen(ring, cqe);
+  }
+  // entries still queued would go out with the next submit
+  if (submitted < 0 || (unsigned) submitted != n) uring_drop(batch);
+  return rc;
+}
+
+static int
+uring_mkdirs(struct fs_batch *batch, const std::vector<std::string> &dirs) {
+  size_t i = 0;
+  while (i < dirs.size()) {
+    unsigned n = 0;
+    for (; i < dirs.size() && n < CLIB_PACKAGE_URING_DEPTH; i++, n++) {
+      struct io_uring_sqe *sqe = io_uring_get_sqe(&batch->ring);
+      io_uring_prep_mkdirat(sqe, AT_FDCWD, dirs[i].c_str(), 0777);
+      io_uring_sqe_set_data64(sqe, 0);
+    }
+    if (0 != uring_run(batch, n, -EEXIST)) return -1;
+  }
+  return 0;
+}
+
+static int
+uring_write_files(struct fs_batch *batch, const std::vector<struct fs_batch_file> &files) {
+  size_t i = 0;
+  while (i < files.size()) {
+    unsigned n = 0;
+    // open -> write -> close, linked, per file
+    for (unsigned slot = 0; i < files.size() && n + 3 <= CLIB_PACKAGE_URING_DEPTH; i++, slot++, n += 3) {
+      const struct fs_batch_file *file = &files[i];
+      struct io_uring_sqe *sqe = io_uring_get_sqe(&batch->ring);
+      io_uring_prep_openat_direct(sqe, AT_FDCWD, file->path.c_str()
+        , O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0666, slot);
+      sqe->flags |= IOSQE_IO_LINK;
+      io_uring_sqe_set_data64(sqe, 0);
+      sqe = io_uring_get_sqe(&batch->ring);
+      io_uring_prep_write(sqe, slot, file->data.data(), file->data.size(), 0);
+      sqe->flags |= IOSQE_FIXED_FILE | IOSQE_IO_LINK;
+      io_uring_sqe_set_data64(sqe, file->data.size() + 1);
+      sqe = io_uring_get_sqe(&batch->ring);
+      io_uring_prep_close_direct(sqe, slot);
+      io_uring_sqe_set_data64(sqe, 0);
+    }
+    if (0 != uring_run(batch, n, 0)) return -1;
+  }
+  return 0;
+}
+
+#endif
+
+/**
+ * Make sure the directories in `wanted` (and their parents)
+ * exist, creating the missing ones shallowest level first.
+ */
+
+static int
+fs_batch_mkdirs(struct fs_batch *batch, const std::vector<std::string> &wanted) {
+  std::map<size_t, std::vector<std::string> > levels;
+  std::set<std::string> missing;
+  int rc = 0;
+
+  pthread_mutex_lock(&batch->mutex);
+  for (size_t i = 0; i < wanted.size(); i++) {
+    std::string dir = wanted[i];
+    while (!dir.empty() && !batch->dirs.count(dir) && missing.insert(dir).second) {
+      levels[std::count(dir.begin(), dir.end(), '/')].push_back(dir);
+      size_t slash = dir.rfind('/');
+      dir = std::string::npos == slash ? "" : dir.substr(0, slash);
+    }
+  }
+
+  for (std::map<size_t, std::vector<std::string> >::iterator level = levels.begin()
+      ; 0 == rc && level != levels.end()
+      ; ++level) {
+#ifdef CLIB_PACKAGE_IO_URING
+    if (uring_get(batch) && 0 == uring_mkdirs(batch, level->second)) continue;
+#endif
+    for (size_t i = 0; 0 == rc && i < level->second.size(); i++) {
+      if (-1 == mkdir(level->second[i].c_str(), 0777) && EEXIST != errno) rc = -1;
+    }
+  }
+  if (0 == rc) batch->dirs.insert(missing.begin(), missing.end());
+  pthread_mutex_unlock(&batch->mutex);
+  return rc;
+}
+
+/**
+ * Make sure the directory `path` is in exists.
+ */
+
+static int
+fs_batch_parent(struct fs_batch *batch, const char *path) {
+  const char *slash = strrchr(path, '/');
+  if (!slash) return 0;
+  std::vector<std::string> dir(1, std::string(path, slash - path));
+  if (!batch) return mkdirp(dir[0].c_str(), 0777);
+  return fs_batch_mkdirs(batch, dir);
+}
+
+static void
+fs_batch_record(struct fs_batch *batch, const char *file, const char *sha) {
+  pthread_mutex_lock(&batch->mutex);
+  batch->fetched.push_back(std::make_pair(std::string(file), std::string(sha ? sha : "")));
+  pthread_mutex_unlock(&batch->mutex);
+}
+
+/**
+ * Find `file` in the installed copy being upgraded, provided
+ * it is still the blob `sha`.
+ */
+
+static int
+fs_batch_previous(struct fs_batch *batch, const char *file, const char *sha, std::string *path) {
+  int rc = -1;
+  pthread_mutex_lock(&batch->mutex);
+  std::map<std::string, std::string>::iterator it = batch->previous.find(file);
+  if (it != batch->previous.end() && !it->second.empty() && it->second == sha) {
+    *path = batch->previous_dir + "/" + file;
+    rc = 0;
+  }
+  pthread_mutex_unlock(&batch->mutex);
+  return rc;
+}
+
+/**
+ * Queue `data` to be written to `path` on the next flush.
+ */
+
+static void
+fs_batch_write(struct fs_batch *batch, const char *path, const std::string &data) {
+  struct fs_batch_file file = { path, data };
+  pthread_mutex_lock(&batch->mutex);
+  batch->files.push_back(file);
+  pthread_mutex_unlock(&batch->mutex);
+}
+
+static int
+fs_batch_flush(struct fs_batch *batch) {
+  int rc = 0;
+  pthread_mutex_lock(&batch->mutex);
+#ifdef CLIB_PACKAGE_IO_URING
+  if (uring_get(batch) && 0 == uring_write_files(batch, batch->files)) goto done;
+#endif
+  for (size_t i = 0; 0 == rc && i < batch->files.size(); i++) {
+    const struct fs_batch_file *file = &batch->files[i];
+    int fd = open(file->path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0666);
+    if (-1 == fd) {
+      rc = -1;
+      continue;
+    }
+    if (-1 == fd_write_all(fd, file->data.data(), file->data.size())) rc = -1;
+    if (0 != close(fd)) rc = -1;
+  }
+#ifdef CLIB_PACKAGE_IO_URING
+done:
+#endif
+  batch->files.clear();
+  pthread_mutex_unlock(&batch->mutex);
+  return rc;
+}
+
+/**
+ * Where `file` of a package ends up under `dir`: `@` paths
+ * keep their directories, anything else lands flat.
+ */
+
+static char *
+package_file_path(const char *dir, const char *file) {
+  if ('@' == file[0]) return path_join(dir, &file[1]);
+  const char *slash = strrchr(file, '/');
+  return path_join(dir, slash ? slash + 1 : file);
+}
+
+struct dependency {
+    pthread_t threadid;
+    int threaded;
+    char * slug;
+    clib_package_t * pkg;
+    int verbose;
+    clib_package_ctx_t * ctx;
+    clib_package_cancel_t * cancel;
+};
+
+struct file_info {
+    pthread_t threadid;
+    int threaded;
+    clib_package_t * pkg;
+    const char * dir;
+    char * file;
+    struct fs_batch * batch;
+    int verbose;
+    int rc;
+};
+
+static int
+fetch_package_file(
+    clib_package_t *pkg
+    , const char *dir
+    , char *file
+    , struct fs_batch *batch
+    , int verbose
+    );
+
+static clib_package_t *
+package_new_from_slug(const char *, int, clib_package_ctx_t *, clib_package_cancel_t *);
+
+void * fetch_package_file_threaded(void * param)
+{
+    struct file_info * finfo = (struct file_info *)param;
+    finfo->rc = fetch_package_file(finfo->pkg, finfo->dir, finfo->file, finfo->batch, finfo->verbose);
+    return NULL;
+
+}
+
+void * clib_package_new_from_slug_threaded(void * param)
+{
+    struct dependency * depend = (struct dependency *)param;
+    depend->pkg = package_new_from_slug(depend->slug, depend->verbose, depend->ctx, depend->cancel);
+    return NULL;
+}
+
+/**
+ * Fetch all of `pkg`'s sources into `dir` in parallel, after
+ * creating every directory they need in one go.
+ *
+ * Returns 0 on success; the first failure cancels `pkg->cancel`.
+ */
+
+static int
+fetch_package_sources(clib_package_t *pkg, const char *dir, struct fs_batch *batch, int verbose) {
+  list_node_t *source = NULL;
+  list_iterator_t *iterator = NULL;
+  struct file_info *files = NULL;
+  std::vector<std::string> dirs;
+  int count = 0;
+  int rc = 0;
+
+  if (!(files = (struct file_info *) calloc(pkg->src->len + 1, sizeof(struct file_info)))) {
+    return -1;
+  }
+  if (!(iterator = list_iterator_new(pkg->src, LIST_HEAD))) {
+    free(files);
+    return -1;
+  }
+
+  while ((source = list_iterator_next(iterator))) {
+    char *path = package_file_path(dir, (char *) source->val);
+    const char *slash = path ? strrchr(path, '/') : NULL;
+    if (slash) dirs.push_back(std::string(path, slash - path));
+    free(path);
+  }
+  if (-1 == fs_batch_mkdirs(batch, dirs)) {
+    clib_package_cancel(pkg->cancel, CLIB_PACKAGE_EWRITE, pkg->repo, "unable to create directory");
+    list_iterator_destroy(iterator);
+    free(files);
+    return -1;
+  }
+  list_iterator_destroy(iterator);
+  if (!(iterator = list_iterator_new(pkg->src, LIST_HEAD))) {
+    free(files);
+    return -1;
+  }
+
+  while ((source = list_iterator_next(iterator))) {
+      struct file_info * finfo = &files[count++];
+      finfo->pkg = pkg;
+      finfo->dir = dir;
+      finfo->file = (char *)source->val;
+      finfo->batch = batch;
+      finfo->verbose = verbose;
+      finfo->threaded = 0 == pthread_create(&finfo->threadid, NULL, fetch_package_file_threaded, finfo);
+      if (!finfo->threaded) fetch_package_file_threaded(finfo);
+  }
+  for (int i = 0; i < count; i++)
+  {
+      if (files[i].threaded) pthread_join(files[i].threadid, NULL);
+      if (0 != files[i].rc) rc = -1;
+  }
+
+  list_iterator_destroy(iterator);
+  free(files);
+  return rc;
+}
+
+/**
+ * Resolve every dependency in `list` in parallel, then install
+ * them into `dir`.  The first failure cancels `cancel`, which
+ * aborts everything still in flight.
+ *
+ * Returns 0 on success.
+ */
+
+static inline int
+install_packages(list_t *list
+    , const char *dir
+    , int verbose
+    , clib_package_ctx_t *ctx
+    , clib_package_cancel_t *cancel) {
+  list_node_t *node = NULL;
+  list_iterator_t *iterator = NULL;
+  int rc = -1;
+
+  int depcount = 0;
+  struct dependency *dependencies = NULL;
+
+  if (!list || !dir) goto cleanup;
+
+  iterator = list_iterator_new(list, LIST_HEAD);
+  if (NULL == iterator) goto cleanup;
+
+  dependencies = (struct dependency *) calloc(list->len + 1, sizeof(struct dependency));
+  if (NULL == dependencies) goto cleanup;
+
+  depcount = 0;
+  while ((node = list_iterator_next(iterator))) {
+      clib_package_dependency_t *dep = NULL;
+      char *slug = NULL;
+      struct dependency * depend = &dependencies[depcount];
+
+      dep = (clib_package_dependency_t *)node->val;
+      // versions are claimed apart, so that of two versions of
+      // a package the newer still reaches the upgrade check
+      std::string claim = std::string(dir) + "/" + (dep->author ? dep->author : "")
+        + "/" + (dep->name ? dep->name : "") + "@" + (dep->version ? dep->version : "");
+      if (!cancel_claim(cancel, claim)) {
+        _debug("already installing %s/%s@%s", dep->author, dep->name, dep->version);
+        stats_add(&ctx->stats, packages_deduplicated, 1);
+        continue;
+      }
+      slug = clib_package_slug(dep->author, dep->name, dep->version);
+      _debug("installing slug: %s", slug);
+      progress(cancel, "resolve", slug, NULL);
+
+      depend->slug = slug;
+      depend->verbose = verbose;
+      depend->ctx = ctx;
+      depend->cancel = cancel;
+      _probe(task__start, slug);
+      depend->threaded = 0 == pthread_create(&depend->threadid, NULL, clib_package_new_from_slug_threaded, depend);
+      if (!depend->threaded) clib_package_new_from_slug_threaded(depend);
+      depcount++;
+  }
+  for (int i = 0; i < depcount; i++)
+  {
+      clib_package_t *pkg = NULL;
+      struct dependency * depend = &dependencies[i];
+      if (depend->threaded) pthread_join(depend->threadid, NULL);
+      pkg = depend->pkg;
+      if (NULL == pkg)
+      {
+          if (!cancel_check(cancel)) stats_add(&ctx->stats, packages_failed, 1);
+          clib_package_cancel(cancel
+            , CLIB_PACKAGE_ERESOLVE
+            , depend->slug
+            , "unable to resolve package");
+      }
+      else if (!cancel_check(cancel))
+      {
+          pkg->cancel = cancel;
+          // not every failure cancels; make sure this one does
+          if (0 != clib_package_install(pkg, dir, verbose) && !cancel_check(cancel)) {
+            stats_add(&ctx->stats, packages_failed, 1);
+            clib_package_cancel(cancel, CLIB_PACKAGE_EWRITE, depend->slug, "install failed");
+          }
+      }
+      _probe(task__done, depend->slug, cancel_check(cancel) ? -1 : 0);
+
+      if (depend->slug) free(depend->slug);
+      if (depend->pkg) clib_package_free(depend->pkg);
+  }
+
+  rc = cancel_check(cancel) ? -1 : 0;
+
+cleanup:
+  if (iterator) list_iterator_destroy(iterator);
+  free(dependencies);
+  return rc;
+}
+
+/**
+ * Create a new clib package from the given `json`
+ */
+
+clib_package_t *
+clib_package_new(const char *json, int verbose, clib_package_ctx_t *ctx) {
+  clib_package_t *pkg = NULL;
+  JSON_Value *root = NULL;
+  JSON_Object *json_object = NULL;
+  JSON_Array *src = NULL;
+  JSON_Object *deps = NULL;
+  JSON_Object *devs = NULL;
+  ctx = ctx_get(ctx);
+  struct budget_lease parse = { &ctx->budget, 0, 0 };
+  struct trace_span span = trace_begin(&ctx->trace, "parse");
+  int error = 1;
+
+  if (!json) goto cleanup;
+  budget_reserve(&parse, strlen(json) * CLIB_PACKAGE_PARSE_FACTOR, NULL);
+  if (!(root = json_parse_string(json))) {
+    logger_error("error", "unable to parse json");
+    goto cleanup;
+  }
+  if (!(json_object = json_value_get_object(root))) {
+    logger_error("error", "invalid package.json");
+    goto cleanup;
+  }
+  if (!(pkg = (clib_package_t*)malloc(sizeof(clib_package_t)))) goto cleanup;
+
+  memset(pkg, '\0', sizeof(clib_package_t));
+
+  pkg->ctx = ctx;
+  pkg->json = strdup(json);
+  if (pkg->json) budget_charge(&ctx->budget, strlen(pkg->json) + 1);
+  pkg->name = json_object_get_string_safe(json_object, "name");
+  pkg->repo = json_object_get_string_safe(json_object, "repo");
+  pkg->version = json_object_get_string_safe(json_object, "version");
+  pkg->license = json_object_get_string_safe(json_object, "license");
+  pkg->description = json_object_get_string_safe(json_object, "description");
+  pkg->install = json_object_get_string_safe(json_object, "install");
+  pkg->makefile = json_object_get_string_safe(json_object, "makefile");
+
+  _debug("creating package: %s", pkg->repo);
+
+  // TODO npm-style "repository" (thlorenz/gumbo-parser.c#1)
+  if (pkg->repo) {
+    pkg->author = parse_repo_owner(pkg->repo, DEFAULT_REPO_OWNER);
+    // repo name may not be package name (thing.c -> thing)
+    pkg->repo_name = parse_repo_name(pkg->repo);
+  } else {
+    if (verbose) logger_warn("warning", "missing repo in package.json");
+    pkg->author = NULL;
+    pkg->repo_name = NULL;
+  }
+
+  if ((src = json_object_get_array(json_object, "src"))) {
+    if (!(pkg->src = list_new())) goto cleanup;
+    pkg->src->free = free;
+    for (unsigned int i = 0; i < json_array_get_count(src); i++) {
+      char *file = json_array_get_string_safe(src, i);
+      _debug("file: %s", file);
+      if (!file) goto cleanup;
+      if (!(list_rpush(pkg->src, list_node_new(file)))) goto cleanup;
+    }
+  } else {
+    _debug("no src files listed in package.json");
+    pkg->src = NULL;
+  }
+
+  if ((deps = json_object_get_object(json_object, "dependencies"))) {
+    if (!(pkg->dependencies = parse_package_deps(deps))) {
+      goto cleanup;
+    }
+  } else {
+    _debug("no dependencies listed in package.json");
+    pkg->dependencies = NULL;
+  }
+
+  if ((devs = json_object_get_object(json_object, "development"))) {
+    if (!(pkg->development = parse_package_deps(devs))) {
+      goto cleanup;
+    }
+  } else {
+    _debug("no development dependencies listed in package.json");
+    pkg->development = NULL;
+  }
+
+  error = 0;
+
+cleanup:
+  if (root) json_value_free(root);
+  budget_release(&parse);
+  trace_end(&span, "parse", pkg ? pkg->repo : NULL, NULL, -1, json ? (long long) strlen(json) : -1);
+  _probe(package__parse, pkg ? pkg->repo : NULL, json ? (long long) strlen(json) : 0);
+  if (error && pkg) {
+    clib_package_free(pkg);
+    pkg = NULL;
+  }
+  return pkg;
+}
+
+/**
+ * Find the first of `ctx`'s API endpoints that knows
+ * `author`/`name`, remembering it for the session.  The
+ * result belongs to `ctx`.
+ */
+
+static const char *
+clib_package_find_api_endpoint(const char * author
+    , const char * name
+    , clib_package_ctx_t *ctx
+    , clib_package_cancel_t *cancel)
+{
+  clib_package_response_t *res = NULL;
+  const char *found = NULL;
+  std::string repo = std::string(author) + "/" + name;
+
+  pthread_mutex_lock(&ctx->cache_mutex);
+  std::map<std::string, const char *>::iterator memo = ctx->endpoints.find(repo);
+  if (memo != ctx->endpoints.end()) found = memo->second;
+  pthread_mutex_unlock(&ctx->cache_mutex);
+  if (found) return found;
+
+  struct trace_span span = trace_begin(&ctx->trace, "endpoint discovery");
+
+  for (size_t i = 0; !found && i < ctx->api_endpoints.size(); i++) {
+    const std::string &url = ctx->api_endpoints[i];
+    std::string try_url = url;
+    try_url += std::string("repos/");
+    try_url += std::string(author);
+    try_url += std::string("/");
+    try_url += std::string(name);
+
+    res = http_request_retry(ctx, try_url.c_str(), NULL, NULL, 1, cancel);
+    if (res && res->ok) found = url.c_str();
+    http_response_free(res);
+  }
+
+  if (found) {
+    pthread_mutex_lock(&ctx->cache_mutex);
+    ctx->endpoints[repo] = found;
+    pthread_mutex_unlock(&ctx->cache_mutex);
+  }
+  trace_end(&span, "resolve", repo.c_str(), found, found ? 200 : -1, -1);
+  return found;
+}
+
+/**
+ * Look up a package.json `ctx` resolved for `key` less than
+ * its manifest TTL ago.
+ *
+ * Returns 1 on a hit, filling `json`, `sha` and `api_endpoint`.
+ */
+
+static int
+manifest_lookup(clib_package_ctx_t *ctx
+    , const std::string &key
+    , std::string *json
+    , std::string *sha
+    , const char **api_endpoint) {
+  int hit = 0;
+  pthread_mutex_lock(&ctx->cache_mutex);
+  std::map<std::string, struct manifest_entry>::iterator it = ctx->manifests.find(key);
+  if (it != ctx->manifests.end()) {
+    if (now_ms() - it->second.fetched_ms < ctx->manifest_ttl_ms) {
+      *json = it->second.json;
+      *sha = it->second.sha;
+      *api_endpoint = it->second.api_endpoint;
+      hit = 1;
+    } else {
+      ctx->manifests.erase(it);
+    }
+  }
+  pthread_mutex_unlock(&ctx->cache_mutex);
+  stats_add(&ctx->stats, manifest_lookups, 1);
+  if (hit) stats_add(&ctx->stats, manifest_hits, 1);
+  return hit;
+}
+
+static void
+manifest_store(clib_package_ctx_t *ctx
+    , const std::string &key
+    , const std::string &json
+    , const std::string &sha
+    , const char *api_endpoint) {
+  pthread_mutex_lock(&ctx->cache_mutex);
+  if (ctx->manifest_ttl_ms) {
+    struct manifest_entry &entry = ctx->manifests[key];
+    entry.json = json;
+    entry.sha = sha;
+    entry.api_endpoint = api_endpoint;
+    entry.fetched_ms = now_ms();
+  }
+  pthread_mutex_unlock(&ctx->cache_mutex);
+}
+
+/**
+ * Create a package from the given repo `slug`, giving up
+ * as soon as `cancel` fires.
+ */
+
+static clib_package_t *
+package_new_from_slug(const char *slug
+    , int verbose
+    , clib_package_ctx_t *ctx
+    , clib_package_cancel_t *cancel) {
+  char *author = NULL;
   char *name = NULL;
   char *version = NULL;
   char *url = NULL;
-  char *json_url = NULL;
-  char *repo = NULL;
-  http_get_response_t *res = NULL;
-  clib_package_t *pkg = NULL;
-  JSON_Value * root  = NULL;
-  JSON_Object * obj = NULL;
-  char * download_url = NULL;
-  const char * api_endpoint = NULL;
+  char *json_url = NULL;
+  char *repo = NULL;
+  clib_package_response_t *res = NULL;
+  clib_package_t *pkg = NULL;
+  JSON_Value * root  = NULL;
+  JSON_Object * obj = NULL;
+  char * download_url = NULL;
+  const char * api_endpoint = NULL;
+  struct trace_span manifest = { NULL, NULL, 0 };
+  std::string key;
+  std::string json;
+  std::string sha;
+
+  // parse chunks
+  ctx = ctx_get(ctx);
+  if (!slug) goto error;
+  _debug("creating package: %s", slug);
+  _probe(resolve__start, slug);
+  if (!(author = parse_repo_owner(slug, DEFAULT_REPO_OWNER))) goto error;
+  if (!(name = parse_repo_name(slug))) goto error;
+  if (!(version = parse_repo_version(slug, DEFAULT_REPO_VERSION))) goto error;
+
+  key = std::string(author) + "/" + name + "@" + version;
+  if (ctx->manifest_ttl_ms && manifest_lookup(ctx, key, &json, &sha, &api_endpoint)) {
+    _debug("manifest of %s is cached", key.c_str());
+    free(name);
+    name = NULL;
+    goto build;
+  }
+
+  // given an author and name, attempt to find the api endpoint
+  api_endpoint = clib_package_find_api_endpoint(author, name, ctx, cancel);
+  if(!api_endpoint) {
+    if (!cancel_check(cancel)) logger_error("error", "failed to find api endpoint");
+    goto error;
+  }
+
+  // if not master then Query the API for tags
+  if(std::string(version) != "master") {
+
+  }
+
+  _debug("resolve: %s:%s:%s", author, name, version);
+  manifest = trace_begin(&ctx->trace, "fetch package.json");
+  {
+    std::string try_url = api_endpoint;
+    try_url += std::string("repos/");
+    try_url += std::string(author);
+    try_url += std::string("/");
+    try_url += std::string(name);
+    try_url += std::string("/contents/package.json?ref=");
+    try_url += std::string(version);
+
+    res = http_request_retry(ctx, try_url.c_str(), NULL, NULL, 1, cancel);
+  }
+  if(!res || !res->ok) {
+    if (!cancel_check(cancel)) {
+      logger_error("error", "unable to fetch %s/%s:package.json", author, name);
+    }
+    goto error;
+  }
+
+  // Parse the API response
+  root = json_parse_string(res->data);
+  obj = json_value_get_object(root);
+  download_url = json_object_get_string_safe(obj, "download_url");
+  if (json_object_get_string(obj, "sha")) sha = json_object_get_string(obj, "sha");
+  json_value_free(root);
+  http_response_free(res);
+  res = NULL;
+
+  // the blob may be in the content store already
+  if (sha.empty() || 0 != store_manifest_get(ctx, sha.c_str(), &json)) {
+    res = http_request_retry(ctx, download_url, NULL, NULL, 0, cancel);
+    if (!res || !res->ok) {
+      free(download_url);
+      if (!cancel_check(cancel)) {
+        logger_error("error", "unable to fetch %s/%s:package.json", author, name);
+      }
+      goto error;
+    }
+    json.assign(res->data, res->size);
+    store_manifest_put(ctx, sha.c_str(), json);
+  }
+  free(download_url);
+
+  trace_end(&manifest, "resolve", slug, NULL, res ? res->status : 200, (long long) json.size());
+  free(name);
+  name = NULL;
+  http_response_free(res);
+  res = NULL;
+  manifest_store(ctx, key, json, sha, api_endpoint);
+
+build:
+  pkg = clib_package_new(json.c_str(), verbose, ctx);
+  if (!pkg) goto error;
+  pkg->api_endpoint = api_endpoint;
+  pkg->cancel = cancel;
+  if (!sha.empty()) pkg->sha = strdup(sha.c_str());
+
+  // force version number
+  if (pkg->version) {
+    if (version) {
+      if (0 != strcmp(version, DEFAULT_REPO_VERSION)) {
+        _debug("forcing version number: %s (%s)", version, pkg->version);
+        free(pkg->version);
+        pkg->version = version;
+      } else {
+        free(version);
+      }
+    }
+  } else {
+    pkg->version = version;
+  }
+
+  // force package author (don't know how this could fail)
+  if (pkg->author) {
+    if (0 != strcmp(author, pkg->author)) {
+      free(pkg->author);
+      pkg->author = author;
+    } else {
+      free(author);
+    }
+  } else {
+    pkg->author = author;
+  }
+
+  if (!(repo = clib_package_repo(pkg->author, pkg->name))) goto error;
+
+  if (pkg->repo) {
+    if (0 != strcmp(repo, pkg->repo)) {
+      free(url);
+      if (!(url = clib_package_url_from_repo(pkg->repo, pkg->version)))
+        goto error;
+    }
+    free(repo);
+    repo = NULL;
+  } else {
+    pkg->repo = repo;
+  }
+
+  pkg->url = url;
+  stats_add(&ctx->stats, packages_resolved, 1);
+  progress(cancel, "resolved", pkg->repo, pkg->version);
+  _probe(resolve__done, slug, 1);
+  return pkg;
+
+error:
+  free(author);
+  free(name);
+  free(version);
+  free(url);
+  free(json_url);
+  free(repo);
+  http_response_free(res);
+  if (pkg) clib_package_free(pkg);
+  _probe(resolve__done, slug, 0);
+  return NULL;
+}
+
+/**
+ * Create a package from the given repo `slug`
+ */
+
+clib_package_t *
+clib_package_new_from_slug(const char *slug, int verbose, clib_package_ctx_t *ctx) {
+  return package_new_from_slug(slug, verbose, ctx, NULL);
+}
+
+/**
+ * Create a package from the given repo `slug` as part of the
+ * install using `cancel`.
+ */
+
+clib_package_t *
+clib_package_resolve(const char *slug
+    , int verbose
+    , clib_package_ctx_t *ctx
+    , clib_package_cancel_t *cancel) {
+  return package_new_from_slug(slug, verbose, ctx, cancel);
+}
+
+/**
+ * Get a slug for the package `author/name@version`
+ */
+
+char *
+clib_package_url(const char *author, const char *name, const char *version) {
+  if (!author || !name || !version) return NULL;
+  int size =
+      strlen(GITHUB_CONTENT_URL)
+    + strlen(author)
+    + 1 // /
+    + strlen(name)
+    + 1 // /
+    + strlen(version)
+    + 1 // \0
+    ;
+
+  char *slug = (char*)malloc(size);
+  if (slug) {
+    memset(slug, '\0', size);
+    sprintf(slug
+      , GITHUB_CONTENT_URL "%s/%s/%s"
+      , author
+      , name
+      , version);
+    if (!strncmp(version, "https", 5)) {
+        sprintf(slug, "%s", version);
+    }
+  }
+  return slug;
+}
+
+char *
+clib_package_url_from_repo(const char *repo, const char *version) {
+  if (!repo || !version) return NULL;
+  int size =
+      strlen(GITHUB_CONTENT_URL)
+    + strlen(repo)
+    + 1 // /
+    + strlen(version)
+    + 1 // \0
+    ;
+
+  char *slug = (char *)malloc(size);
+  if (slug) {
+    memset(slug, '\0', size);
+    sprintf(slug
+      , GITHUB_CONTENT_URL "%s/%s"
+      , repo
+      , version);
+  }
+  return slug;
+}
+
+/**
+ * Parse the package author from the given `slug`
+ */
+
+char *
+clib_package_parse_author(const char *slug) {
+  return parse_repo_owner(slug, DEFAULT_REPO_OWNER);
+}
+
+/**
+ * Parse the package version from the given `slug`
+ */
+
+char *
+clib_package_parse_version(const char *slug) {
+  return parse_repo_version(slug, DEFAULT_REPO_VERSION);
+}
+
+/**
+ * Parse the package name from the given `slug`
+ */
+char *
+clib_package_parse_name(const char *slug) {
+  return parse_repo_name(slug);
+}
+
+/**
+ * Create a new package dependency from the given `repo` and `version`
+ */
+
+clib_package_dependency_t *
+clib_package_dependency_new(const char *repo, const char *version) {
+  if (!repo || !version) return NULL;
+
+  clib_package_dependency_t *dep = (clib_package_dependency_t*)malloc(sizeof(clib_package_dependency_t));
+  if (!dep) {
+    return NULL;
+  }
+
+  dep->version = 0 == strcmp("*", version)
+    ? strdup(DEFAULT_REPO_VERSION)
+    : strdup(version);
+  dep->name = clib_package_parse_name(repo);
+  dep->author = clib_package_parse_author(repo);
+
+  _debug("dependency: %s/%s@%s", dep->author, dep->name, dep->version);
+  return dep;
+}
+
+/**
+ * SHA-1, just enough of it to name git blobs: the store
+ * checks every file it is given against the sha the contents
+ * API reported for it.
+ */
+
+struct sha1 {
+  uint32_t h[5];
+  uint64_t len;
+  unsigned char buf[64];
+  size_t used;
+};
+
+static void
+sha1_init(struct sha1 *s) {
+  s->h[0] = 0x67452301u;
+  s->h[1] = 0xefcdab89u;
+  s->h[2] = 0x98badcfeu;
+  s->h[3] = 0x10325476u;
+  s->h[4] = 0xc3d2e1f0u;
+  s->len = 0;
+  s->used = 0;
+}
+
+#define SHA1_ROL(x, n) (((x) << (n)) | ((x) >> (32 - (n))))
+
+static void
+sha1_block(struct sha1 *s, const unsigned char *p) {
+  uint32_t w[80];
+  for (int i = 0; i < 16; i++) {
+    w[i] = (uint32_t) p[4 * i] << 24 | (uint32_t) p[4 * i + 1] << 16
+      | (uint32_t) p[4 * i + 2] << 8 | (uint32_t) p[4 * i + 3];
+  }
+  for (int i = 16; i < 80; i++) w[i] = SHA1_ROL(w[i - 3] ^ w[i - 8] ^ w[i - 14] ^ w[i - 16], 1);
+
+  uint32_t a = s->h[0], b = s->h[1], c = s->h[2], d = s->h[3], e = s->h[4];
+  for (int i = 0; i < 80; i++) {
+    uint32_t f, k;
+    if (i < 20) {
+      f = (b & c) | (~b & d);
+      k = 0x5a827999u;
+    } else if (i < 40) {
+      f = b ^ c ^ d;
+      k = 0x6ed9eba1u;
+    } else if (i < 60) {
+      f = (b & c) | (b & d) | (c & d);
+      k = 0x8f1bbcdcu;
+    } else {
+      f = b ^ c ^ d;
+      k = 0xca62c1d6u;
+    }
+    uint32_t t = SHA1_ROL(a, 5) + f + e + k + w[i];
+    e = d;
+    d = c;
+    c = SHA1_ROL(b, 30);
+    b = a;
+    a = t;
+  }
+  s->h[0] += a;
+  s->h[1] += b;
+  s->h[2] += c;
+  s->h[3] += d;
+  s->h[4] += e;
+}
+
+static void
+sha1_update(struct sha1 *s, const void *data, size_t len) {
+  const unsigned char *p = (const unsigned char *) data;
+  s->len += len;
+  while (len) {
+    size_t n = std::min(len, sizeof(s->buf) - s->used);
+    memcpy(s->buf + s->used, p, n);
+    s->used += n;
+    p += n;
+    len -= n;
+    if (sizeof(s->buf) == s->used) {
+      sha1_block(s, s->buf);
+      s->used = 0;
+    }
+  }
+}
+
+static void
+sha1_hex(struct sha1 *s, char hex[41]) {
+  uint64_t bits = s->len * 8;
+  unsigned char pad = 0x80;
+  unsigned char len[8];
+
+  sha1_update(s, &pad, 1);
+  pad = 0;
+  while (56 != s->used) sha1_update(s, &pad, 1);
+  for (int i = 0; i < 8; i++) len[i] = (unsigned char) (bits >> (56 - 8 * i));
+  sha1_update(s, len, 8);
+  for (int i = 0; i < 5; i++) snprintf(hex + 8 * i, 9, "%08x", s->h[i]);
+}
+
+#undef SHA1_ROL
+
+static void
+blob_sha_init(struct sha1 *s, long long size) {
+  char header[32];
+  sha1_init(s);
+  sha1_update(s, header, snprintf(header, sizeof(header), "blob %lld", size) + 1);
+}
+
+/**
+ * Whether the contents of the open `fd` are the git blob
+ * `sha` (the SHA-1 of `blob <size>\0` and the contents).
+ */
+
+static int
+blob_sha_matches(int fd, const char *sha) {
+  struct stat st;
+  struct sha1 s;
+  char buf[65536];
+  char hex[41];
+  ssize_t n = 0;
+
+  if (40 != strlen(sha) || -1 == fstat(fd, &st) || -1 == lseek(fd, 0, SEEK_SET)) return 0;
+  blob_sha_init(&s, (long long) st.st_size);
+  while ((n = read(fd, buf, sizeof(buf))) != 0) {
+    if (n < 0) {
+      if (EINTR != errno) return 0;
+      continue;
+    }
+    sha1_update(&s, buf, n);
+  }
+  sha1_hex(&s, hex);
+  return 0 == strcasecmp(hex, sha);
+}
+
+static int
+blob_sha_matches(const std::string &data, const char *sha) {
+  struct sha1 s;
+  char hex[41];
+
+  if (40 != strlen(sha)) return 0;
+  blob_sha_init(&s, (long long) data.size());
+  sha1_update(&s, data.data(), data.size());
+  sha1_hex(&s, hex);
+  return 0 == strcasecmp(hex, sha);
+}
+
+/**
+ * Content store: file contents keyed by their git blob sha
+ * (`<store>/ab/cdef...`), shared by every deps/ installed
+ * with it.  Blobs are copies (reflinks where the filesystem
+ * supports them) of files whose contents hash to their sha,
+ * made read-only.  Files are materialized as reflinks, as
+ * hardlinks of read-only blobs only, and copied as a last
+ * resort; editing a linked file means making it writable
+ * first, which a read-only blob does not allow by accident.
+ */
+
+static int
+store_key_valid(const char *sha) {
+  size_t len = strlen(sha);
+  if (len < 4) return 0;
+  for (size_t i = 0; i < len; i++) {
+    if (!isxdigit((unsigned char) sha[i])) return 0;
+  }
+  return 1;
+}
+
+static std::string
+store_blob_path(const std::string &store, const char *sha) {
+  std::string blob = store;
+  if ('/' != blob[blob.size() - 1]) blob += "/";
+  blob += std::string(sha, 2);
+  blob += "/";
+  blob += sha + 2;
+  return blob;
+}
+
+#ifdef FICLONE
+static int
+file_clone(const char *from, const char *to) {
+  int rc = -1;
+  int in = open(from, O_RDONLY);
+  if (-1 == in) return -1;
+  int out = open(to, O_WRONLY | O_CREAT | O_EXCL, 0666);
+  if (-1 != out) {
+    rc = ioctl(out, FICLONE, in);
+    close(out);
+    if (-1 == rc) unlink(to);
+  }
+  close(in);
+  return rc;
+}
+#endif
+
+static int
+file_copy(const char *from, const char *to) {
+  char buf[65536];
+  ssize_t n = 0;
+  int rc = 0;
+  int in = open(from, O_RDONLY);
+  if (-1 == in) return -1;
+  int out = open(to, O_WRONLY | O_CREAT | O_EXCL, 0666);
+  if (-1 == out) {
+    close(in);
+    return -1;
+  }
+  while (0 == rc && (n = read(in, buf, sizeof(buf))) != 0) {
+    if (n < 0) {
+      if (EINTR != errno) rc = -1;
+      continue;
+    }
+    rc = fd_write_all(out, buf, n);
+  }
+  if (0 != close(out)) rc = -1;
+  close(in);
+  if (-1 == rc) unlink(to);
+  return rc;
+}
+
+/**
+ * Copy `from` to `to`, sharing its extents where the
+ * filesystem can.
+ */
+
+static int
+file_duplicate(const char *from, const char *to) {
+#ifdef FICLONE
+  if (0 == file_clone(from, to)) return 0;
+#endif
+  return file_copy(from, to);
+}
+
+/**
+ * Put the contents of `from` at `to`, replacing it.  Only a
+ * read-only `from` is hardlinked, so that `to` is never an
+ * inode somebody may write through.
+ */
+
+static int
+store_materialize(const char *from, const char *to) {
+  struct stat st;
+  unlink(to);
+#ifdef FICLONE
+  if (0 == file_clone(from, to)) return 0;
+#endif
+  if (0 == stat(from, &st) && 0 == (st.st_mode & 0222) && 0 == link(from, to)) return 0;
+  return file_copy(from, to);
+}
+
+/**
+ * Add a copy of the freshly fetched `path` to the store as
+ * `sha`, if its contents are that blob.  The copy is staged,
+ * checked, made read-only and renamed into place, so
+ * concurrent installs only ever see whole, verified files.
+ *
+ * Returns -1 if `path` is not stored.
+ */
+
+static int
+store_add(const std::string &store, const char *sha, const char *path) {
+  std::string blob = store_blob_path(store, sha);
+  std::string dir = blob.substr(0, blob.rfind('/'));
+  char suffix[64];
+  int rc = -1;
+  int fd = -1;
+
+  if (-1 == mkdirp(dir.c_str(), 0777)) return -1;
+  snprintf(suffix, sizeof(suffix), ".%ld.%ld.tmp", (long) getpid(), (long) syscall(SYS_gettid));
+  std::string staged = blob + suffix;
+  if (0 == file_duplicate(path, staged.c_str())
+      && -1 != (fd = open(staged.c_str(), O_RDONLY | O_CLOEXEC))
+      && blob_sha_matches(fd, sha)
+      && 0 == fchmod(fd, 0444)) {
+    rc = rename(staged.c_str(), blob.c_str());
+  }
+  if (-1 != fd) close(fd);
+  unlink(staged.c_str());
+  return rc;
+}
+
+/**
+ * Installs pin the store while they look a blob up or add
+ * one: a shared flock on `<store>/.lock`, held for as long as
+ * any thread of the session is in the store.  The collector
+ * evicts under the exclusive lock, so a blob never goes away
+ * between being found and being materialized.
+ *
+ * Returns -1 if the store cannot be locked (then use it
+ * unpinned, as it is only a cache).
+ */
+
+static int
+store_pin(clib_package_ctx_t *ctx) {
+  int rc = 0;
+  pthread_mutex_lock(&ctx->store_mutex);
+  if (0 == ctx->store_users) {
+    if (-1 == ctx->store_lock) {
+      std::string lock = ctx->store + "/.lock";
+      if (0 == mkdirp(ctx->store.c_str(), 0777)) {
+        ctx->store_lock = open(lock.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0666);
+      }
+    }
+    if (-1 == ctx->store_lock) {
+      rc = -1;
+    } else {
+      while (-1 == (rc = flock(ctx->store_lock, LOCK_SH)) && EINTR == errno) {}
+    }
+  }
+  if (0 == rc) ctx->store_users++;
+  pthread_mutex_unlock(&ctx->store_mutex);
+  return rc;
+}
+
+static void
+store_unpin(clib_package_ctx_t *ctx, int pinned) {
+  if (0 != pinned) return;
+  pthread_mutex_lock(&ctx->store_mutex);
+  if (0 == --ctx->store_users) flock(ctx->store_lock, LOCK_UN);
+  pthread_mutex_unlock(&ctx->store_mutex);
+}
+
+/**
+ * Mark `blob` as just used.  The access time is set
+ * explicitly, so LRU order holds on `noatime` and `relatime`
+ * mounts too.
+ */
+
+static void
+store_touch(const std::string &blob) {
+  struct timespec times[2];
+  times[0].tv_sec = 0;
+  times[0].tv_nsec = UTIME_NOW;
+  times[1].tv_sec = 0;
+  times[1].tv_nsec = UTIME_OMIT;
+  utimensat(AT_FDCWD, blob.c_str(), times, 0);
+}
+
+/**
+ * Read the package.json blob `sha` from the store of `ctx`.
+ *
+ * Returns 0 on a hit.
+ */
+
+static int
+store_manifest_get(clib_package_ctx_t *ctx, const char *sha, std::string *json) {
+  if (ctx->store.empty() || !sha || !store_key_valid(sha)) return -1;
+  std::string blob = store_blob_path(ctx->store, sha);
+  stats_add(&ctx->stats, store_lookups, 1);
+
+  int pinned = store_pin(ctx);
+  int rc = file_read_all(blob.c_str(), json);
+  if (0 == rc) store_touch(blob);
+  store_unpin(ctx, pinned);
+
+  if (0 == rc) stats_add(&ctx->stats, store_hits, 1);
+  return rc;
+}
+
+static void
+store_manifest_put(clib_package_ctx_t *ctx, const char *sha, const std::string &json) {
+  if (ctx->store.empty() || !sha || !store_key_valid(sha)) return;
+  if (!blob_sha_matches(json, sha)) return;
+  int pinned = store_pin(ctx);
+  file_write_atomic(store_blob_path(ctx->store, sha), json);
+  store_unpin(ctx, pinned);
+}
+
+struct store_blob {
+  std::string path;
+  long long atime_ns;
+  unsigned long long allocated;
+};
+
+static bool
+store_blob_older(const struct store_blob &a, const struct store_blob &b) {
+  return a.atime_ns < b.atime_ns;
+}
+
+static long long
+stat_atime_ns(const struct stat *st) {
+  return (long long) st->st_atim.tv_sec * 1000000000LL + st->st_atim.tv_nsec;
+}
+
+/**
+ * Walk the fan-out directories of `store`, removing abandoned
+ * temporary files and adding up what is there.  Blobs only
+ * the store links to are eviction `candidates`; the others
+ * are hard linked into installed trees, so evicting them
+ * would not free anything.
+ */
+
+static void
+store_scan(const std::string &store
+    , std::vector<struct store_blob> *candidates
+    , clib_package_store_stats_t *stats) {
+  DIR *top = opendir(store.c_str());
+  struct dirent *ent = NULL;
+  time_t now = time(NULL);
+  if (!top) return;
+
+  while ((ent = readdir(top))) {
+    if ('.' == ent->d_name[0]) continue;
+    std::string fanout = store + "/" + ent->d_name;
+    DIR *dir = opendir(fanout.c_str());
+    struct dirent *blob = NULL;
+    if (!dir) continue;
+
+    while ((blob = readdir(dir))) {
+      if ('.' == blob->d_name[0]) continue;
+      std::string path = fanout + "/" + blob->d_name;
+      struct stat st;
+      if (-1 == lstat(path.c_str(), &st) || !S_ISREG(st.st_mode)) continue;
+
+      if (strstr(blob->d_name, ".tmp")) {
+        if (now - st.st_mtime > CLIB_PACKAGE_GC_STALE_S && 0 == unlink(path.c_str())) {
+          stats->stale++;
+        }
+        continue;
+      }
+
+      unsigned long long allocated = (unsigned long long) st.st_blocks * 512;
+      stats->blobs++;
+      stats->bytes += (unsigned long long) st.st_size;
+      stats->bytes_allocated += allocated;
+      if (st.st_nlink > 1) {
+        stats->bytes_shared += allocated;
+        continue;
+      }
+
+      struct store_blob candidate;
+      candidate.path = path;
+      candidate.atime_ns = stat_atime_ns(&st);
+      candidate.allocated = allocated;
+      candidates->push_back(candidate);
+    }
+    closedir(dir);
+  }
+  closedir(top);
+}
+
+/**
+ * Collect the store of `ctx` down to its limit, oldest access
+ * first, CLIB_PACKAGE_GC_BATCH blobs per hold of the exclusive
+ * lock so that installs are only ever held up briefly.  A
+ * blob used or linked since the scan is skipped.  Stops early
+ * once `*stop` is set.
+ */
+
+static int
+store_collect(clib_package_ctx_t *ctx, clib_package_store_stats_t *stats, const int *stop) {
+  std::vector<struct store_blob> candidates;
+  std::string store = ctx->store;
+  unsigned long long limit = ctx->store_limit;
+  unsigned long long held = 0;
+  int lock = -1;
+
+  memset(stats, 0, sizeof(*stats));
+  if (store.empty()) return -1;
+  store_scan(store, &candidates, stats);
+  held = stats->bytes_allocated - stats->bytes_shared;
+
+  if (limit && held > limit) {
+    std::sort(candidates.begin(), candidates.end(), store_blob_older);
+    lock = open((store + "/.lock").c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0666);
+    if (-1 == lock) return -1;
+  }
+
+  for (size_t i = 0; -1 != lock && held > limit && i < candidates.size();) {
+    if (stop && __atomic_load_n(stop, __ATOMIC_RELAXED)) break;
+    if (-1 == flock(lock, LOCK_EX)) {
+      if (EINTR == errno) continue;
+      break;
+    }
+
+    for (size_t n = 0; n < CLIB_PACKAGE_GC_BATCH && held > limit && i < candidates.size(); n++, i++) {
+      const struct store_blob &blob = candidates[i];
+      struct stat st;
+      if (-1 == lstat(blob.path.c_str(), &st)) continue;
+      if (stat_atime_ns(&st) != blob.atime_ns || 1 != st.st_nlink) {
+        stats->skipped++;
+        continue;
+      }
+      if (0 != unlink(blob.path.c_str())) continue;
+      stats->evicted++;
+      stats->bytes_reclaimed += blob.allocated;
+      stats->blobs--;
+      stats->bytes -= (unsigned long long) st.st_size;
+      stats->bytes_allocated -= blob.allocated;
+      held -= blob.allocated;
+      // drop the fan-out directory once it empties
+      rmdir(blob.path.substr(0, blob.path.rfind('/')).c_str());
+    }
+
+    flock(lock, LOCK_UN);
+  }
+  if (-1 != lock) close(lock);
+
+  if (stats->bytes_allocated > stats->bytes) {
+    stats->fragmentation = (double) (stats->bytes_allocated - stats->bytes) / stats->bytes_allocated;
+  }
+  return 0;
+}
+
+/**
+ * Collect the content store of `ctx` now: remove abandoned
+ * temporary files and, with a limit set, evict the blobs used
+ * longest ago until the store is within it.  Blobs in use by
+ * concurrent installs, in this process or another, are left
+ * alone.  `stats` (may be NULL) is filled with what was
+ * reclaimed and what is left.
+ *
+ * Returns -1 if `ctx` has no store.
+ */
+
+int
+clib_package_store_gc(clib_package_ctx_t *ctx, clib_package_store_stats_t *stats) {
+  clib_package_store_stats_t local;
+  ctx = ctx_get(ctx);
+  if (!stats) stats = &local;
+  int rc = store_collect(ctx, stats, NULL);
+  if (0 == rc) {
+    stats_add(&ctx->stats, cache_evicted, stats->evicted);
+    stats_add(&ctx->stats, bytes_reclaimed, stats->bytes_reclaimed);
+  }
+  return rc;
+}
+
+static void *
+store_gc_run(void *arg) {
+  clib_package_ctx_t *ctx = (clib_package_ctx_t *) arg;
+  clib_package_store_stats_t stats;
+
+  // the install comes first
+  setpriority(PRIO_PROCESS, (id_t) syscall(SYS_gettid), 10);
+  struct trace_span span = trace_begin(&ctx->trace, "store gc");
+  if (0 == store_collect(ctx, &stats, &ctx->gc_stop)) {
+    stats_add(&ctx->stats, cache_evicted, stats.evicted);
+    stats_add(&ctx->stats, bytes_reclaimed, stats.bytes_reclaimed);
+    _debug("store gc: evicted %lu, reclaimed %llu bytes", stats.evicted, stats.bytes_reclaimed);
+  }
+  trace_end(&span, "gc", ctx->store.c_str(), NULL, -1, (long long) stats.bytes_reclaimed);
+
+  pthread_mutex_lock(&ctx->cache_mutex);
+  ctx->gc_state = 2;
+  pthread_mutex_unlock(&ctx->cache_mutex);
+  return NULL;
+}
+
+/**
+ * Start a background collection of a capped store, unless one
+ * is running or ran less than CLIB_PACKAGE_GC_INTERVAL_MS ago.
+ */
+
+static void
+store_gc_kick(clib_package_ctx_t *ctx) {
+  if (ctx->store.empty() || 0 == ctx->store_limit) return;
+
+  pthread_mutex_lock(&ctx->cache_mutex);
+  long long now = now_ms();
+  int start = 1 != ctx->gc_state
+    && (0 == ctx->gc_state || now - ctx->gc_last_ms >= CLIB_PACKAGE_GC_INTERVAL_MS);
+  if (start) {
+    if (2 == ctx->gc_state) pthread_join(ctx->gc_thread, NULL);
+    ctx->gc_state = 1;
+    ctx->gc_last_ms = now;
+    if (0 != pthread_create(&ctx->gc_thread, NULL, store_gc_run, ctx)) ctx->gc_state = 0;
+  }
+  pthread_mutex_unlock(&ctx->cache_mutex);
+}
+
+/**
+ * Stop and reap the background collection, if any.
+ */
+
+static void
+store_gc_join(clib_package_ctx_t *ctx) {
+  pthread_mutex_lock(&ctx->cache_mutex);
+  int started = 0 != ctx->gc_state;
+  pthread_mutex_unlock(&ctx->cache_mutex);
+  if (!started) return;
+
+  __atomic_store_n(&ctx->gc_stop, 1, __ATOMIC_RELAXED);
+  pthread_join(ctx->gc_thread, NULL);
+  ctx->gc_stop = 0;
+  ctx->gc_state = 0;
+}
+
+/**
+ * Fetch a file associated with the given `pkg`.
+ *
+ * Returns 0 on success.  Failures cancel `pkg->cancel`.
+ */
+
+static int
+fetch_package_file(
+      clib_package_t *pkg
+    , const char *dir
+    , char *file
+    , struct fs_batch *batch
+    , int verbose
+  ) {
+  char *url = NULL;
+  char *path = NULL;
+  int rc = 0;
+  clib_package_response_t *res = NULL;
+  char *download_url = NULL;
+  char *sha = NULL;
+  const char *failure = "unable to fetch file";
+  const char *category = "fetch";
+  std::string store = pkg->ctx->store;
+  std::string blob;
+  std::string previous;
+
+  if (cancel_check(pkg->cancel)) return 1;
+  _debug("fetch file: %s/%s", pkg->repo, file);
+  struct trace_span span = trace_begin(&pkg->ctx->trace, "fetch file");
+  _probe(file__start, pkg->repo, file);
+
+  std::string try_url = pkg->api_endpoint;
+  try_url += std::string("repos/");
+  try_url += std::string(pkg->author);
+  try_url += std::string("/");
+  try_url += std::string(pkg->name);
+  try_url += std::string("/contents/");
+  try_url += std::string(file[0] == '@' ? &file[1] : file);
+  try_url += std::string("?ref=master");
+  //try_url += std::string(pkg->version);
+  _debug("GET %s", try_url.c_str());
+
+  res = http_request_retry(pkg->ctx, try_url.c_str(), NULL, NULL, 1, pkg->cancel);
+  if (!res || !res->ok) {
+    rc = 1;
+    goto cleanup;
+  }
+
+  {
+    JSON_Value * root = json_parse_string(res->data);
+    JSON_Object * obj = json_value_get_object(root);
+    download_url = json_object_get_string_safe(obj, "download_url");
+    sha = json_object_get_string_safe(obj, "sha");
+    json_value_free(root);
+    http_response_free(res);
+    res = NULL;
+  }
+
+  if (!(path = package_file_path(dir, file))) {
+    rc = 1;
+    goto cleanup;
+  }
+  if ('@' == file[0]) {
+    file = &file[1];
+  } else if (strrchr(file, '/')) {
+    file = strrchr(file, '/') + 1;
+  }
+  if (-1 == fs_batch_parent(batch, path)) {
+    failure = "unable to create directory";
+    rc = 1;
+    goto cleanup;
+  }
+
+  if (sha && batch && 0 == fs_batch_previous(batch, file, sha, &previous)
+      && 0 == store_materialize(previous.c_str(), path)) {
+    if (verbose) logger_info("keep", "%s -> %s", previous.c_str(), path);
+    download_discard(path);
+    stats_add(&pkg->ctx->stats, files_unchanged, 1);
+    progress(pkg->cancel, "link", pkg->repo, file);
+    fs_batch_record(batch, file, sha);
+    category = "delta";
+    goto cleanup;
+  }
+
+  if (sha && !store.empty() && store_key_valid(sha)) {
+    blob = store_blob_path(store, sha);
+    stats_add(&pkg->ctx->stats, store_lookups, 1);
+    int pinned = store_pin(pkg->ctx);
+    int hit = 0 == access(blob.c_str(), R_OK) && 0 == store_materialize(blob.c_str(), path);
+    if (hit) store_touch(blob);
+    store_unpin(pkg->ctx, pinned);
+    if (hit) {
+      if (verbose) logger_info("link", "%s -> %s", blob.c_str(), path);
+      download_discard(path);
+      stats_add(&pkg->ctx->stats, store_hits, 1);
+      stats_add(&pkg->ctx->stats, files_linked, 1);
+      progress(pkg->cancel, "link", pkg->repo, file);
+      if (batch) fs_batch_record(batch, file, sha);
+      category = "store";
+      goto cleanup;
+    }
+  }
+
+  if(verbose) logger_info("fetch", "%s -> %s(%s)", url, path, file);
+
+  // keep a partial download only if it is of this very blob
+  download_prepare(path, sha);
+  res = http_request_retry(pkg->ctx, download_url, path, NULL, 0, pkg->cancel);
+  if (!res || !res->ok) {
+    rc = 1;
+    goto cleanup;
+  }
+
+  if (verbose) logger_info("save", path);
+  stats_add(&pkg->ctx->stats, files_fetched, 1);
+  progress(pkg->cancel, "fetch", pkg->repo, file);
+  if (batch) fs_batch_record(batch, file, sha);
+  if (!blob.empty()) {
+    int pinned = store_pin(pkg->ctx);
+    int stored = store_add(store, sha, path);
+    store_unpin(pkg->ctx, pinned);
+    if (-1 == stored && verbose) logger_warn("store", "%s is not the blob %s, not stored", path, sha);
+  }
+  _probe(file__written, path, (long long) res->bytes_decoded);
+
+cleanup:
+  if (rc && !cancel_check(pkg->cancel)) {
+    logger_error("error", "unable to fetch %s:%s", pkg->repo, file);
+    std::string message = failure;
+    message += ": ";
+    message += file;
+    clib_package_cancel(pkg->cancel
+      , 0 == strcmp(failure, "unable to fetch file")
+        ? CLIB_PACKAGE_EFETCH
+        : CLIB_PACKAGE_EWRITE
+      , pkg->repo
+      , message.c_str());
+  }
+  trace_end(&span, category, pkg->repo
+    , download_url ? download_url : try_url.c_str()
+    , res ? res->status : 0
+    , res ? (long long) res->bytes_wire : -1);
+  _probe(file__done, pkg->repo, file, rc);
+  http_response_free(res);
+  free(download_url);
+  free(sha);
+  free(path);
+  return rc;
+}
+
+/**
+ * Advisory locks let installs in several processes share one
+ * deps tree.  Each package has its own lock file, so only
+ * installs of the same package wait for each other.
+ *
+ * Returns the locked descriptor, or -1.
+ */
+
+static int
+lock_acquire(const char *path, clib_package_cancel_t *cancel) {
+  int fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0666);
+  if (-1 == fd) return -1;
+  while (-1 == flock(fd, LOCK_EX | LOCK_NB)) {
+    if (EINTR == errno) continue;
+    if (EWOULDBLOCK != errno || -1 == cancel_sleep(cancel, CLIB_PACKAGE_LOCK_POLL_MS)) {
+      close(fd);
+      return -1;
+    }
+  }
+  return fd;
+}
+
+static void
+lock_release(int fd) {
+  if (-1 != fd) close(fd);
+}
+
+/**
+ * Replace the directory `target` with `staged` in one step
+ * where the kernel can swap them, moving the old copy aside
+ * to `old` otherwise.
+ */
+
+static int
+dir_publish(const char *staged, const char *target, const char *old) {
+#if defined(SYS_renameat2) && defined(RENAME_EXCHANGE)
+  if (0 == syscall(SYS_renameat2, AT_FDCWD, staged, AT_FDCWD, target, RENAME_EXCHANGE)) {
+    rimraf(staged);
+    return 0;
+  }
+#endif
+  if (0 == rename(staged, target)) return 0;
+  rimraf(old);
+  if (-1 == rename(target, old)) return -1;
+  if (-1 == rename(staged, target)) {
+    rename(old, target);
+    return -1;
+  }
+  rimraf(old);
+  return 0;
+}
+
+/**
+ * Write `body` to `file` unless it holds that already, so
+ * that build tools do not see it change.
+ */
+
+static int
+file_write_changed(const std::string &file, const std::string &body) {
+  char *current = fs_read(file.c_str());
+  int same = current && body == current;
+  free(current);
+  return same ? 0 : file_write_atomic(file, body);
+}
+
+/**
+ * Make the `file` next to `dir` (deps.mk, deps.ninja) include
+ * each of `lines`, starting it with `preamble` if it is new.
+ * It is rewritten under a lock and renamed into place, so
+ * parallel installs neither lose lines nor see it torn.
+ */
+
+static int
+deps_include_update(const char *dir
+    , const char *file
+    , const char *preamble
+    , const std::vector<std::string> &lines
+    , clib_package_cancel_t *cancel) {
+  std::string root = std::string(dir) + "/..";
+  std::string path = root + "/" + file;
+  std::set<std::string> wanted(lines.begin(), lines.end());
+  std::string out;
+  char *current = NULL;
+  int rc = -1;
+
+  int lock = lock_acquire((root + "/." + file + ".lock").c_str(), cancel);
+  if (-1 == lock) return -1;
+
+  // keep every other include
+  if ((current = fs_read(path.c_str()))) {
+    for (const char *p = current; *p;) {
+      const char *end = strchr(p, '\n');
+      size_t len = end ? (size_t) (end - p) : strlen(p);
+      if (!wanted.count(std::string(p, len))) {
+        out.append(p, len);
+        out += "\n";
+      }
+      p += len + (end ? 1 : 0);
+    }
+    free(current);
+  } else if (preamble) {
+    out = preamble;
+  }
+  for (size_t i = 0; i < lines.size(); i++) out += lines[i] + "\n";
+
+  rc = file_write_changed(path, out);
+  lock_release(lock);
+  return rc;
+}
+
+/**
+ * Point the `deps.mk` next to `dir` at `name`'s .mk file.
+ */
+
+static int
+deps_mk_update(const char *dir, const char *name, clib_package_cancel_t *cancel) {
+  std::vector<std::string> line(1, std::string("include $(top_srcdir)/deps/") + name + "/" + name + ".mk");
+  return deps_include_update(dir, "deps.mk", NULL, line, cancel);
+}
+
+/**
+ * `deps.ninja` defines the rule the fragments build with;
+ * the build.ninja including it provides `top_srcdir`,
+ * `builddir`, `cc` and `cflags`.
+ */
+
+static const char *_deps_ninja_preamble =
+  "# generated by clib-package; include it from build.ninja after\n"
+  "# setting top_srcdir, builddir, cc and cflags\n"
+  "rule deps_cc\n"
+  "  command = $cc -MMD -MF $out.d $cflags -I$top_srcdir/deps -c $in -o $out\n"
+  "  depfile = $out.d\n"
+  "  deps = gcc\n"
+  "  description = CC $out\n";
+
+static int
+deps_ninja_update(const char *dir, const std::vector<std::string> &names, clib_package_cancel_t *cancel) {
+  std::vector<std::string> lines;
+  for (size_t i = 0; i < names.size(); i++) {
+    lines.push_back("include $top_srcdir/deps/" + names[i] + "/" + names[i] + ".ninja");
+  }
+  return deps_include_update(dir, "deps.ninja", _deps_ninja_preamble, lines, cancel);
+}
+
+static int
+source_compiled(const std::string &source) {
+  size_t len = source.size();
+  return len > 2 && 0 == source.compare(len - 2, 2, ".c");
+}
+
+/**
+ * Append the sources of `pkg`, installed as `name`, to
+ * `sources` as paths relative to the top of the project.
+ */
+
+static void
+package_sources(clib_package_t *pkg, const char *name, std::vector<std::string> *sources) {
+  list_node_t *source;
+  if (!pkg->src) return;
+  list_iterator_t *iterator = list_iterator_new(pkg->src, LIST_HEAD);
+  while ((source = list_iterator_next(iterator))) {
+    char *fname = strdup((char *) source->val);
+    char *fmod = ('@' == fname[0]) ? &fname[1] : basename(fname);
+    sources->push_back(std::string("deps/") + name + "/" + fmod);
+    free(fname);
+  }
+  list_iterator_destroy(iterator);
+}
+
+/**
+ * Read the repo and sources of the package installed in
+ * `dir` as `name` from its package.json.
+ *
+ * Returns -1 if there is none.
+ */
+
+static int
+installed_sources(clib_package_ctx_t *ctx
+    , const char *dir
+    , const char *name
+    , std::string *repo
+    , std::vector<std::string> *sources) {
+  std::string path = std::string(dir) + "/" + name + "/package.json";
+  char *json = fs_read(path.c_str());
+  if (!json) return -1;
+  clib_package_t *pkg = clib_package_new(json, 0, ctx);
+  free(json);
+  if (!pkg) return -1;
+  if (repo) *repo = pkg->repo ? pkg->repo : name;
+  package_sources(pkg, name, sources);
+  clib_package_free(pkg);
+  return 0;
+}
+
+/**
+ * The Ninja fragment of package `name` with `sources` (paths
+ * relative to the top of the project): an object per C file
+ * and a `deps_<name>` target for all of them.
+ */
+
+static std::string
+ninja_fragment(const char *repo, const char *name, const std::vector<std::string> &sources) {
+  std::string out = std::string("# ") + repo + "\n";
+  std::string objects;
+  for (size_t i = 0; i < sources.size(); i++) {
+    if (!source_compiled(sources[i])) continue;
+    std::string object = "$builddir/" + sources[i].substr(0, sources[i].size() - 2) + ".o";
+    out += "build " + object + ": deps_cc $top_srcdir/" + sources[i] + "\n";
+    objects += " " + object;
+  }
+  out += std::string("build deps_") + name + ": phony" + objects + "\n";
+  return out;
+}
+
+static void
+compile_command_put(std::string *out
+    , const std::string &directory
+    , const char *file
+    , const std::vector<std::string> &arguments) {
+  if (out->size() > 2) *out += ",\n";
+  *out += "  { \"directory\": \"";
+  trace_escape(out, directory.c_str());
+  *out += "\", \"file\": \"";
+  trace_escape(out, file);
+  *out += "\", \"arguments\": [";
+  for (size_t i = 0; i < arguments.size(); i++) {
+    *out += i ? ", \"" : "\"";
+    trace_escape(out, arguments[i].c_str());
+    *out += "\"";
+  }
+  *out += "] }";
+}
+
+/**
+ * Replace the entries of each package of `packages` (its name
+ * and sources) in the `compile_commands.json` next to `dir`
+ * with one per C file of its sources, for clangd and other
+ * tools to index the dependencies.  Entries of other packages
+ * are kept.
+ */
+
+static int
+compile_commands_update(const char *dir
+    , const std::map<std::string, std::vector<std::string> > &packages
+    , clib_package_cancel_t *cancel) {
+  std::string root = std::string(dir) + "/..";
+  std::string path = root + "/compile_commands.json";
+  std::map<std::string, std::vector<std::string> >::const_iterator it;
+  std::string out = "[\n";
+  char resolved[PATH_MAX];
+  int rc = -1;
+
+  std::string directory = realpath(root.c_str(), resolved) ? resolved : root;
+  int lock = lock_acquire((root + "/.compile_commands.json.lock").c_str(), cancel);
+  if (-1 == lock) return -1;
+
+  JSON_Value *current = json_parse_file(path.c_str());
+  JSON_Array *entries = json_value_get_array(current);
+  for (size_t i = 0; entries && i < json_array_get_count(entries); i++) {
+    JSON_Object *entry = json_array_get_object(entries, i);
+    const char *file = json_object_get_string(entry, "file");
+    const char *at = json_object_get_string(entry, "directory");
+    JSON_Array *arguments = json_object_get_array(entry, "arguments");
+    if (!file || !at || !arguments) continue;
+    // deps/<name>/...
+    const char *name = 0 == strncmp(file, "deps/", 5) ? file + 5 : NULL;
+    const char *slash = name ? strchr(name, '/') : NULL;
+    if (slash && packages.count(std::string(name, slash - name))) continue;
+    std::vector<std::string> args;
+    for (size_t k = 0; k < json_array_get_count(arguments); k++) {
+      const char *arg = json_array_get_string(arguments, k);
+      if (arg) args.push_back(arg);
+    }
+    compile_command_put(&out, at, file, args);
+  }
+  if (current) json_value_free(current);
+
+  for (it = packages.begin(); it != packages.end(); it++) {
+    const std::vector<std::string> &sources = it->second;
+    for (size_t i = 0; i < sources.size(); i++) {
+      if (!source_compiled(sources[i])) continue;
+      std::vector<std::string> args;
+      args.push_back("cc");
+      args.push_back("-Ideps");
+      args.push_back("-c");
+      args.push_back(sources[i]);
+      args.push_back("-o");
+      args.push_back(sources[i].substr(0, sources[i].size() - 2) + ".o");
+      compile_command_put(&out, directory, sources[i].c_str(), args);
+    }
+  }
+  out += "\n]\n";
+
+  rc = file_write_changed(path, out);
+  lock_release(lock);
+  return rc;
+}
+
+/**
+ * Whether the macro `name` selects what system headers
+ * declare, and so only works ahead of the first of them.
+ */
+
+static int
+unity_feature_test(const std::string &name) {
+  static const char *names[] = {
+    "_FILE_OFFSET_BITS", "_TIME_BITS", "_REENTRANT", "_THREAD_SAFE", "__EXTENSIONS__", NULL
+  };
+  size_t n = name.size();
+  // _GNU_SOURCE, _POSIX_C_SOURCE, _XOPEN_SOURCE, _DEFAULT_SOURCE...
+  if (n > 7 && '_' == name[0] && 0 == name.compare(n - 7, 7, "_SOURCE")) return 1;
+  for (size_t i = 0; names[i]; i++) {
+    if (name == names[i]) return 1;
+  }
+  return 0;
+}
+
+/**
+ * Collect the names a C source `p` defines at file scope that
+ * would clash when it shares a translation unit with another
+ * file: static functions and variables, typedefs, struct,
+ * union and enum tags and enumerators.  Its macros go in
+ * `macros` instead, to be undefined after it.  `alone` is set
+ * when it defines a feature-test macro before its first
+ * `#include`, which a unit would see too late.  This is a
+ * lexical scan, so when unsure it takes a name too many; a
+ * false clash only costs a file its place in a unity unit.
+ */
+
+static void
+unity_symbols(const char *p, std::set<std::string> *symbols, std::set<std::string> *macros, int *alone) {
+  int included = 0;
+  int depth = 0;
+  int parens = 0;
+  int decl = 0;  // in a file scope static or typedef, 2 for typedef
+  int named = 0; // its declarator was taken
+  int inner = 0; // its name is the first inside the parens
+  int enumerators = 0; // in a file scope enum, 2 when a name is next
+  int bol = 1;
+  std::string last;
+  std::string tag;
+
+  while (*p) {
+    char c = *p;
+    if ('\n' == c) {
+      bol = 1;
+      p++;
+      continue;
+    }
+    if (isspace((unsigned char) c)) {
+      p++;
+      continue;
+    }
+
+    if (bol && '#' == c) {
+      p++;
+      while (' ' == *p || '\t' == *p) p++;
+      if (0 == strncmp(p, "include", 7)) included = 1;
+      if (0 == strncmp(p, "define", 6) && (' ' == p[6] || '\t' == p[6])) {
+        p += 6;
+        while (' ' == *p || '\t' == *p) p++;
+        const char *start = p;
+        while ('_' == *p || isalnum((unsigned char) *p)) p++;
+        std::string name(start, p - start);
+        if (!name.empty()) macros->insert(name);
+        if (!included && unity_feature_test(name)) *alone = 1;
+      }
+      // to the end of the directive, continuations included
+      while (*p && ('\n' != *p || '\\' == p[-1])) p++;
+      continue;
+    }
+    bol = 0;
+
+    if ('/' == c && '*' == p[1]) {
+      const char *end = strstr(p + 2, "*/");
+      p = end ? end + 2 : p + strlen(p);
+      continue;
+    }
+    if ('/' == c && '/' == p[1]) {
+      while (*p && '\n' != *p) p++;
+      continue;
+    }
+    if ('"' == c || '\'' == c) {
+      for (p++; *p && c != *p && '\n' != *p; p++) {
+        if ('\\' == *p && p[1]) p++;
+      }
+      if (*p) p++;
+      continue;
+    }
+
+    if ('_' == c || isalpha((unsigned char) c)) {
+      const char *start = p;
+      while ('_' == *p || isalnum((unsigned char) *p)) p++;
+      std::string word(start, p - start);
+      if (enumerators && 1 == depth && 0 == parens) {
+        if (2 == enumerators) symbols->insert(word);
+        enumerators = 1;
+        continue;
+      }
+      if (inner && 0 == depth && 1 == parens
+          && "const" != word && "volatile" != word && "restrict" != word) {
+        symbols->insert(word);
+        named = 1;
+        inner = 0;
+        continue;
+      }
+      if (0 != depth || 0 != parens) continue;
+      if (!tag.empty() && tag.find(' ') == std::string::npos) {
+        tag += " " + word;
+      } else {
+        tag = ("struct" == word || "union" == word || "enum" == word) ? word : "";
+      }
+      if (!decl && ("static" == word || "typedef" == word)) {
+        decl = "typedef" == word ? 2 : 1;
+        named = 0;
+        last.clear();
+      } else if (decl) {
+        last = word;
+      }
+      continue;
+    }
 
-  // parse chunks
-  if (!slug) goto error;
-  _debug("creating package: %s", slug);
-  if (!(author = parse_repo_owner(slug, DEFAULT_REPO_OWNER))) goto error;
-  if (!(name = parse_repo_name(slug))) goto error;
-  if (!(version = parse_repo_version(slug, DEFAULT_REPO_VERSION))) goto error;
+    int top = 0 == depth && 0 == parens;
+    switch (c) {
+      case '(':
+        // pointers to functions are named inside the parens,
+        // functions before them
+        if (top && decl && !named && "__attribute__" != last) {
+          const char *next = p + 1;
+          while (isspace((unsigned char) *next)) next++;
+          if ('*' == *next || '(' == *next) {
+            inner = 1;
+          } else if (!last.empty()) {
+            symbols->insert(last);
+            named = 1;
+          }
+        }
+        parens++;
+        break;
+      case ')':
+        if (parens > 0) parens--;
+        break;
+      case '=':
+      case '[':
+      case ',':
+      case ';':
+        if (enumerators && 1 == depth && 0 == parens && ',' == c) enumerators = 2;
+        if (top && decl && !named && !last.empty()) {
+          symbols->insert(last);
+          named = 1;
+        }
+        if (top) inner = 0;
+        if (top && ',' == c) {
+          named = 0;
+          last.clear();
+        }
+        if (top && ';' == c) decl = 0;
+        break;
+      case '{':
+        if (top && tag.find(' ') != std::string::npos) symbols->insert(tag);
+        if (top && 0 == tag.compare(0, 4, "enum")) enumerators = 2;
+        depth++;
+        break;
+      case '}':
+        if (depth > 0) depth--;
+        if (0 == depth) enumerators = 0;
+        // the end of a static function
+        if (0 == depth && 0 == parens && 1 == decl && named) decl = 0;
+        break;
+    }
+    tag.clear();
+    p++;
+  }
+}
 
-  // given an author and name, attempt to find the api endpoint
-  api_endpoint = clib_package_find_api_endpoint(author, name, cfg);
-  if(!api_endpoint) {
-    logger_error("error", "failed to find api endpoint");
-    goto error;
+struct unity_source {
+  std::string file; // relative to the top of the project
+  size_t bytes;
+  std::set<std::string> symbols;
+  std::set<std::string> macros;
+  int alone;
+};
+
+// first line of deps-unity/.sources; any other is rescanned
+#define UNITY_STATE_VERSION "# unity 2"
+
+/**
+ * Regroup the unity build next to `dir` after each package
+ * of `packages` (its name and sources) was installed.
+ * Packages are taken in name order, and whole packages are
+ * put in one translation unit `deps-unity/unity-<n>.c` until
+ * it holds CLIB_PACKAGE_UNITY_BYTES of source; a larger
+ * package gets one of its own.  Each `#include` of a unit is
+ * followed by an `#undef` of every macro the file defines.
+ * A file that defines a name already in its unit, or a
+ * feature-test macro ahead of its includes, is compiled on
+ * its own instead, as is the only file of a unit.
+ * `deps-unity.mk` lists what to compile, in place of
+ * `deps.mk`.
+ *
+ * What was found in each file is kept in
+ * `deps-unity/.sources`, so only `packages` and installed
+ * packages not seen before are scanned, and files that are
+ * gone are dropped.  Units whose contents are unchanged are
+ * not rewritten, so they do not rebuild.
+ */
+
+static int
+unity_update(clib_package_ctx_t *ctx
+    , const char *dir
+    , const std::map<std::string, std::vector<std::string> > &scan
+    , clib_package_cancel_t *cancel) {
+  std::string root = std::string(dir) + "/..";
+  std::string state = root + "/deps-unity/.sources";
+  std::map<std::string, std::vector<struct unity_source> > packages;
+  std::map<std::string, std::vector<std::string> > wanted(scan);
+  std::map<std::string, std::vector<std::string> >::const_iterator want;
+  std::vector<std::vector<const struct unity_source *> > units;
+  std::vector<std::string> alone;
+  std::string mk = "deps__a_SOURCES +=";
+  std::string out = UNITY_STATE_VERSION "\n";
+  char *current = NULL;
+  DIR *deps = NULL;
+  struct dirent *entry = NULL;
+  int rc = -1;
+
+  int lock = lock_acquire((root + "/.deps-unity.lock").c_str(), cancel);
+  if (-1 == lock) return -1;
+
+  // <package> \t <file> \t <bytes> [\t <symbol>]..., with an
+  // empty file for a package without C files; macros are
+  // `#<name>` and `!` marks a file compiled on its own
+  current = fs_read(state.c_str());
+  if (current && 0 == strncmp(current, UNITY_STATE_VERSION "\n", strlen(UNITY_STATE_VERSION) + 1)) {
+    for (char *save = NULL, *line = strtok_r(current, "\n", &save); line; line = strtok_r(NULL, "\n", &save)) {
+      std::vector<std::string> fields;
+      for (char *at = line;;) {
+        char *tab = strchr(at, '\t');
+        fields.push_back(tab ? std::string(at, tab - at) : std::string(at));
+        if (!tab) break;
+        at = tab + 1;
+      }
+      if (fields.size() < 3 || wanted.count(fields[0])) continue;
+      if (fields[1].empty()) {
+        if (0 == access((std::string(dir) + "/" + fields[0] + "/package.json").c_str(), F_OK)) {
+          packages[fields[0]];
+        }
+        continue;
+      }
+      if (0 != access((root + "/" + fields[1]).c_str(), F_OK)) continue;
+      struct unity_source source;
+      source.file = fields[1];
+      source.bytes = strtoul(fields[2].c_str(), NULL, 10);
+      source.alone = 0;
+      for (size_t i = 3; i < fields.size(); i++) {
+        if ("!" == fields[i]) {
+          source.alone = 1;
+        } else if ('#' == fields[i][0]) {
+          source.macros.insert(fields[i].substr(1));
+        } else {
+          source.symbols.insert(fields[i]);
+        }
+      }
+      packages[fields[0]].push_back(source);
+    }
+  }
+  free(current);
+
+  // packages installed before the unity build was on
+  if ((deps = opendir(dir))) {
+    while ((entry = readdir(deps))) {
+      std::vector<std::string> sources;
+      if ('.' == entry->d_name[0] || packages.count(entry->d_name) || wanted.count(entry->d_name)) continue;
+      if (0 == installed_sources(ctx, dir, entry->d_name, NULL, &sources)) wanted[entry->d_name] = sources;
+    }
+    closedir(deps);
+  }
+
+  for (want = wanted.begin(); want != wanted.end(); want++) {
+    const std::vector<std::string> &sources = want->second;
+    packages[want->first];
+    for (size_t i = 0; i < sources.size(); i++) {
+      if (!source_compiled(sources[i])) continue;
+      struct unity_source source;
+      char *text = fs_read((root + "/" + sources[i]).c_str());
+      if (!text) goto cleanup;
+      source.file = sources[i];
+      source.bytes = strlen(text);
+      source.alone = 0;
+      unity_symbols(text, &source.symbols, &source.macros, &source.alone);
+      free(text);
+      packages[want->first].push_back(source);
+    }
+  }
+
+  {
+    std::set<std::string> symbols;
+    size_t bytes = 0;
+    std::map<std::string, std::vector<struct unity_source> >::const_iterator it;
+    units.push_back(std::vector<const struct unity_source *>());
+    for (it = packages.begin(); it != packages.end(); it++) {
+      size_t size = 0;
+      for (size_t i = 0; i < it->second.size(); i++) size += it->second[i].bytes;
+      if (!units.back().empty() && bytes + size > CLIB_PACKAGE_UNITY_BYTES) {
+        units.push_back(std::vector<const struct unity_source *>());
+        symbols.clear();
+        bytes = 0;
+      }
+      for (size_t i = 0; i < it->second.size(); i++) {
+        const struct unity_source *source = &it->second[i];
+        int clash = 0;
+        std::set<std::string>::const_iterator sym;
+        for (sym = source->symbols.begin(); !clash && sym != source->symbols.end(); sym++) {
+          clash = symbols.count(*sym);
+        }
+        if (clash || source->alone) {
+          alone.push_back(source->file);
+          continue;
+        }
+        symbols.insert(source->symbols.begin(), source->symbols.end());
+        units.back().push_back(source);
+        bytes += source->bytes;
+      }
+
+      if (it->second.empty()) out += it->first + "\t\t0\n";
+      for (size_t i = 0; i < it->second.size(); i++) {
+        const struct unity_source *source = &it->second[i];
+        std::set<std::string>::const_iterator sym;
+        out += it->first + "\t" + source->file + "\t" + std::to_string((unsigned long long) source->bytes);
+        if (source->alone) out += "\t!";
+        for (sym = source->symbols.begin(); sym != source->symbols.end(); sym++) out += "\t" + *sym;
+        for (sym = source->macros.begin(); sym != source->macros.end(); sym++) out += "\t#" + *sym;
+        out += "\n";
+      }
+    }
+  }
+  if (-1 == file_write_atomic(state, out)) goto cleanup;
+
+  {
+    size_t n = 0;
+    for (size_t u = 0; u < units.size(); u++) {
+      if (units[u].size() < 2) {
+        for (size_t i = 0; i < units[u].size(); i++) alone.push_back(units[u][i]->file);
+        continue;
+      }
+      std::string unit = "/* generated by clib-package */\n";
+      for (size_t i = 0; i < units[u].size(); i++) {
+        const struct unity_source *source = units[u][i];
+        std::set<std::string>::const_iterator macro;
+        unit += "#include \"../" + source->file + "\"\n";
+        // the next file starts with none of its macros
+        for (macro = source->macros.begin(); macro != source->macros.end(); macro++) {
+          unit += "#undef " + *macro + "\n";
+        }
+      }
+      std::string file = "deps-unity/unity-" + std::to_string((unsigned long long) n++) + ".c";
+      if (-1 == file_write_changed(root + "/" + file, unit)) goto cleanup;
+      mk += " " + file;
+    }
+    // drop units left from a larger build
+    while (0 == unlink((root + "/deps-unity/unity-" + std::to_string((unsigned long long) n++) + ".c").c_str()));
+  }
+  for (size_t i = 0; i < alone.size(); i++) mk += " " + alone[i];
+  mk += "\n";
+  if (-1 == file_write_changed(root + "/deps-unity.mk", mk)) goto cleanup;
+  rc = 0;
+
+cleanup:
+  lock_release(lock);
+  return rc;
+}
+
+/**
+ * Rebuild the outputs of `ctx` next to `dir` from every
+ * package installed there, once per session and directory,
+ * so that packages installed before an output was turned on
+ * (and skipped since, being up to date) are in it too.
+ */
+
+static int
+outputs_sync(clib_package_ctx_t *ctx, const char *dir, clib_package_cancel_t *cancel) {
+  std::map<std::string, std::vector<std::string> > packages;
+  std::vector<std::string> names;
+  DIR *deps = NULL;
+  struct dirent *entry = NULL;
+  unsigned outputs = 0;
+  int rc = 0;
+
+  pthread_mutex_lock(&ctx->cache_mutex);
+  outputs = ctx->outputs;
+  int first = outputs && ctx->outputs_synced.insert(dir).second;
+  pthread_mutex_unlock(&ctx->cache_mutex);
+  if (!first) return 0;
+
+  if ((deps = opendir(dir))) {
+    while (0 == rc && (entry = readdir(deps))) {
+      std::vector<std::string> sources;
+      std::string repo;
+      if ('.' == entry->d_name[0]) continue;
+      if (0 != installed_sources(ctx, dir, entry->d_name, &repo, &sources) || sources.empty()) continue;
+      if (outputs & CLIB_PACKAGE_OUTPUT_NINJA) {
+        std::string ninja = std::string(dir) + "/" + entry->d_name + "/" + entry->d_name + ".ninja";
+        rc = file_write_changed(ninja, ninja_fragment(repo.c_str(), entry->d_name, sources));
+      }
+      names.push_back(entry->d_name);
+      packages[entry->d_name] = sources;
+    }
+    closedir(deps);
+  }
+
+  if (0 == rc && (outputs & CLIB_PACKAGE_OUTPUT_NINJA)) rc = deps_ninja_update(dir, names, cancel);
+  if (0 == rc && (outputs & CLIB_PACKAGE_OUTPUT_COMPILE_COMMANDS)) {
+    rc = compile_commands_update(dir, packages, cancel);
+  }
+  if (0 == rc && (outputs & CLIB_PACKAGE_OUTPUT_UNITY)) {
+    rc = unity_update(ctx, dir, std::map<std::string, std::vector<std::string> >(), cancel);
+  }
+
+  // try again on the next install
+  if (0 != rc) {
+    pthread_mutex_lock(&ctx->cache_mutex);
+    ctx->outputs_synced.erase(dir);
+    pthread_mutex_unlock(&ctx->cache_mutex);
+  }
+  return rc;
+}
+
+/**
+ * Installed state index: `<dir>/.index` holds a record per
+ * installed package with its name, version, the sha of its
+ * package.json, its files (with their blob shas and stats)
+ * and the stat of its installed package.json.  Records are
+ * hashed by name and the file is memory mapped, so telling
+ * whether a package is up to date costs a stat rather than
+ * reading and parsing its package.json.  A record whose stat
+ * no longer matches is stale; the install then falls back to
+ * the package.json and rewrites the record.  Likewise an
+ * upgrade reuses an installed file only while its stat is
+ * the one recorded, so a file edited in deps/ is fetched.
+ * An install maps the index once and keeps the records it
+ * changes in memory, writing them all in one rewrite when
+ * its outermost call returns.
+ *
+ *   header   "CLPI", version, count, buckets (uint32_t each)
+ *   table    buckets x uint32_t record offset (0 for empty)
+ *   records  ino, size, mtime_ns (uint64_t), then uint16_t
+ *            lengths and bytes of name, version, sha and
+ *            each (path, sha) of the files, each followed by
+ *            its ino, size and mtime_ns
+ */
+
+#define INDEX_MAGIC "CLPI"
+#define INDEX_VERSION 2
+#define INDEX_HEADER 16
+
+struct index_stamp {
+  uint64_t ino;
+  uint64_t size;
+  uint64_t mtime_ns;
+};
+
+struct index_file {
+  std::string path;
+  std::string sha;
+  struct index_stamp stamp;
+};
+
+struct index_record {
+  std::string name;
+  std::string version;
+  std::string sha;
+  std::vector<struct index_file> files;
+  struct index_stamp stamp;
+};
+
+struct index_map {
+  const char *data;
+  size_t size;
+  uint32_t count;
+  uint32_t buckets;
+};
+
+static uint32_t
+index_hash(const char *str, size_t len) {
+  uint32_t hash = 2166136261u;
+  for (size_t i = 0; i < len; i++) {
+    hash ^= (unsigned char) str[i];
+    hash *= 16777619u;
+  }
+  return hash;
+}
+
+static uint32_t
+index_u32(const char *p) {
+  uint32_t n;
+  memcpy(&n, p, sizeof(n));
+  return n;
+}
+
+static int
+index_stat(const char *path, struct index_stamp *stamp) {
+  struct stat st;
+  if (-1 == stat(path, &st)) return -1;
+  stamp->ino = (uint64_t) st.st_ino;
+  stamp->size = (uint64_t) st.st_size;
+  stamp->mtime_ns = (uint64_t) st.st_mtim.tv_sec * 1000000000ull + (uint64_t) st.st_mtim.tv_nsec;
+  return 0;
+}
+
+static int
+index_stamp_equal(const struct index_stamp *a, const struct index_stamp *b) {
+  return a->ino == b->ino && a->size == b->size && a->mtime_ns == b->mtime_ns;
+}
+
+static int
+index_open(const char *path, struct index_map *map) {
+  struct stat st;
+  void *data = NULL;
+  int fd = open(path, O_RDONLY | O_CLOEXEC);
+  if (-1 == fd) return -1;
+  if (-1 == fstat(fd, &st) || (size_t) st.st_size < INDEX_HEADER) {
+    close(fd);
+    return -1;
+  }
+  data = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+  if (MAP_FAILED == data) return -1;
+
+  map->data = (const char *) data;
+  map->size = st.st_size;
+  map->count = index_u32(map->data + 8);
+  map->buckets = index_u32(map->data + 12);
+  if (0 != memcmp(map->data, INDEX_MAGIC, 4)
+      || INDEX_VERSION != index_u32(map->data + 4)
+      || 0 == map->buckets
+      || 0 != (map->buckets & (map->buckets - 1))
+      || INDEX_HEADER + (size_t) map->buckets * 4 > map->size) {
+    munmap(data, map->size);
+    return -1;
+  }
+  return 0;
+}
+
+static void
+index_close(struct index_map *map) {
+  munmap((void *) map->data, map->size);
+}
+
+static const char *
+index_string(const char *p, const char *end, std::string *out) {
+  uint16_t len;
+  if (!p || p + 2 > end) return NULL;
+  memcpy(&len, p, 2);
+  p += 2;
+  if (p + len > end) return NULL;
+  if (out) out->assign(p, len);
+  return p + len;
+}
+
+/**
+ * Decode the record at `offset`, only as far as its name
+ * unless `rec` wants all of it.
+ */
+
+static int
+index_decode(const struct index_map *map, uint32_t offset, std::string *name, struct index_record *rec) {
+  const char *end = map->data + map->size;
+  const char *p = map->data + offset;
+  uint16_t nfiles;
+  if (offset < INDEX_HEADER || p + 26 > end) return -1;
+  if (rec) memcpy(&rec->stamp, p, 24);
+  memcpy(&nfiles, p + 24, 2);
+  if (!(p = index_string(p + 26, end, name))) return -1;
+  if (!rec) return 0;
+  rec->name = *name;
+  p = index_string(p, end, &rec->version);
+  p = index_string(p, end, &rec->sha);
+  rec->files.clear();
+  for (uint16_t i = 0; p && i < nfiles; i++) {
+    struct index_file file;
+    p = index_string(p, end, &file.path);
+    p = index_string(p, end, &file.sha);
+    if (!p || p + 24 > end) return -1;
+    memcpy(&file.stamp, p, 24);
+    p += 24;
+    rec->files.push_back(file);
+  }
+  return p ? 0 : -1;
+}
+
+/**
+ * Find `name` in `map`.
+ *
+ * Returns 0 and fills `rec` when found.
+ */
+
+static int
+index_find(const struct index_map *map, const char *name, struct index_record *rec) {
+  size_t len = strlen(name);
+  uint32_t mask = map->buckets - 1;
+  uint32_t slot = index_hash(name, len) & mask;
+  std::string found;
+  for (uint32_t probe = 0; probe < map->buckets; probe++, slot = (slot + 1) & mask) {
+    uint32_t offset = index_u32(map->data + INDEX_HEADER + slot * 4);
+    if (0 == offset) return -1;
+    if (0 != index_decode(map, offset, &found, NULL)) return -1;
+    if (found.size() == len && 0 == memcmp(found.data(), name, len)) {
+      return index_decode(map, offset, &found, rec);
+    }
+  }
+  return -1;
+}
+
+static void
+index_put_string(std::string *out, const std::string &str) {
+  uint16_t len = (uint16_t) std::min(str.size(), (size_t) UINT16_MAX);
+  out->append((const char *) &len, 2);
+  out->append(str.data(), len);
+}
+
+static void
+index_encode(std::string *out, const struct index_record *rec) {
+  uint16_t nfiles = (uint16_t) std::min(rec->files.size(), (size_t) UINT16_MAX);
+  out->append((const char *) &rec->stamp, 24);
+  out->append((const char *) &nfiles, 2);
+  index_put_string(out, rec->name);
+  index_put_string(out, rec->version);
+  index_put_string(out, rec->sha);
+  for (uint16_t i = 0; i < nfiles; i++) {
+    index_put_string(out, rec->files[i].path);
+    index_put_string(out, rec->files[i].sha);
+    out->append((const char *) &rec->files[i].stamp, 24);
+  }
+}
+
+/**
+ * The index of one deps dir as seen by the install using a
+ * token: mapped when first looked at, with the records the
+ * install changed on top until `index_flush()`.
+ */
+
+struct index_batch {
+  struct index_map map;
+  int mapped;
+  std::map<std::string, struct index_record> records;
+};
+
+/**
+ * Get the index of `dir` for `cancel`, mapping it the first
+ * time.  Call with `cancel->mutex` held.
+ */
+
+static struct index_batch *
+index_batch_get(clib_package_cancel_t *cancel, const char *dir) {
+  if (!cancel->indexes) cancel->indexes = new std::map<std::string, struct index_batch *>();
+  struct index_batch *&batch = (*cancel->indexes)[dir];
+  if (!batch) {
+    batch = new struct index_batch;
+    batch->mapped = 0 == index_open((std::string(dir) + "/.index").c_str(), &batch->map);
+  }
+  return batch;
+}
+
+static void
+index_batches_free(std::map<std::string, struct index_batch *> *batches) {
+  if (!batches) return;
+  std::map<std::string, struct index_batch *>::iterator it;
+  for (it = batches->begin(); it != batches->end(); ++it) {
+    if (it->second->mapped) index_close(&it->second->map);
+    delete it->second;
+  }
+  delete batches;
+}
+
+/**
+ * Look up the installed `name` in `dir` for the install using
+ * `cancel`, trusting the index only while `package_json` is
+ * the file it saw.
+ *
+ * Returns 0 on a fresh hit, filling `rec`.
+ */
+
+static int
+index_lookup(clib_package_cancel_t *cancel
+    , const char *dir
+    , const char *name
+    , const char *package_json
+    , struct index_record *rec) {
+  struct index_stamp now;
+  int found = -1;
+
+  pthread_mutex_lock(&cancel->mutex);
+  struct index_batch *batch = index_batch_get(cancel, dir);
+  std::map<std::string, struct index_record>::const_iterator it = batch->records.find(name);
+  if (it != batch->records.end()) {
+    *rec = it->second;
+    found = 0;
+  } else if (batch->mapped) {
+    found = index_find(&batch->map, name, rec);
+  }
+  pthread_mutex_unlock(&cancel->mutex);
+
+  if (0 != found || 0 != index_stat(package_json, &now)) return -1;
+  return index_stamp_equal(&rec->stamp, &now) ? 0 : -1;
+}
+
+/**
+ * Put `rec` in the index of `dir` for the install using
+ * `cancel`, replacing its previous record.  Nothing is
+ * written before `index_flush()`.
+ */
+
+static void
+index_update(clib_package_cancel_t *cancel, const char *dir, const struct index_record *rec) {
+  pthread_mutex_lock(&cancel->mutex);
+  index_batch_get(cancel, dir)->records[rec->name] = *rec;
+  pthread_mutex_unlock(&cancel->mutex);
+}
+
+/**
+ * Put `records` in the index of `dir`, replacing those of
+ * the same names.  The index is rewritten under a lock and
+ * renamed into place, so readers always map a whole file.
+ */
+
+static int
+index_write(const char *dir
+    , const std::map<std::string, struct index_record> &records
+    , clib_package_cancel_t *cancel) {
+  std::string path = std::string(dir) + "/.index";
+  std::string staged = path + ".tmp";
+  std::vector<std::string> encoded;
+  std::string out;
+  struct index_map map;
+  int rc = -1;
+
+  int lock = lock_acquire((path + ".lock").c_str(), cancel);
+  if (-1 == lock) return -1;
+
+  // whatever other installs wrote since, minus ours
+  if (0 == index_open(path.c_str(), &map)) {
+    for (uint32_t slot = 0; slot < map.buckets; slot++) {
+      struct index_record old;
+      std::string name;
+      uint32_t offset = index_u32(map.data + INDEX_HEADER + slot * 4);
+      if (0 == offset || 0 != index_decode(&map, offset, &name, &old)) continue;
+      if (records.count(name)) continue;
+      encoded.push_back(std::string());
+      index_encode(&encoded.back(), &old);
+    }
+    index_close(&map);
+  }
+  std::map<std::string, struct index_record>::const_iterator it;
+  for (it = records.begin(); it != records.end(); ++it) {
+    encoded.push_back(std::string());
+    index_encode(&encoded.back(), &it->second);
+  }
+
+  // keep the table at most half full
+  uint32_t buckets = 8;
+  while (buckets < encoded.size() * 2) buckets <<= 1;
+  uint32_t count = (uint32_t) encoded.size();
+  uint32_t version = INDEX_VERSION;
+  std::vector<uint32_t> table(buckets, 0);
+  uint32_t offset = INDEX_HEADER + buckets * 4;
+  std::string body;
+  for (size_t i = 0; i < encoded.size(); i++) {
+    std::string name;
+    index_string(encoded[i].data() + 26, encoded[i].data() + encoded[i].size(), &name);
+    uint32_t slot = index_hash(name.data(), name.size()) & (buckets - 1);
+    while (table[slot]) slot = (slot + 1) & (buckets - 1);
+    table[slot] = offset + (uint32_t) body.size();
+    body += encoded[i];
+  }
+
+  out.append(INDEX_MAGIC, 4);
+  out.append((const char *) &version, 4);
+  out.append((const char *) &count, 4);
+  out.append((const char *) &buckets, 4);
+  out.append((const char *) &table[0], buckets * 4);
+  out += body;
+
+  int fd = open(staged.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0666);
+  if (-1 != fd) {
+    rc = fd_write_all(fd, out.data(), out.size());
+    if (0 != close(fd)) rc = -1;
+    if (0 == rc) rc = rename(staged.c_str(), path.c_str());
+    if (0 != rc) unlink(staged.c_str());
+  }
+  lock_release(lock);
+  return rc;
+}
+
+/**
+ * Write what the install using `cancel` changed in each
+ * index, once per deps dir, and let go of their mappings.
+ * Done even after a failure, for the packages that made it.
+ */
+
+static void
+index_flush(clib_package_cancel_t *cancel) {
+  std::map<std::string, struct index_batch *> *batches = NULL;
+  pthread_mutex_lock(&cancel->mutex);
+  batches = cancel->indexes;
+  cancel->indexes = NULL;
+  pthread_mutex_unlock(&cancel->mutex);
+  if (!batches) return;
+
+  std::map<std::string, struct index_batch *>::iterator it;
+  for (it = batches->begin(); it != batches->end(); ++it) {
+    if (it->second->mapped) index_close(&it->second->map);
+    it->second->mapped = 0;
+    if (it->second->records.empty()) continue;
+    // the lock is short-lived; wait for it even once cancelled
+    if (0 != index_write(it->first.c_str(), it->second->records, cancel_expired(cancel) ? NULL : cancel)) {
+      _debug("unable to write %s/.index", it->first.c_str());
+    }
+  }
+  index_batches_free(batches);
+}
+
+/**
+ * Give `pkg` a cancellation token for the duration of an
+ * install unless the caller already set one.
+ *
+ * Returns 1 if the token is ours to release.
+ */
+
+static int
+cancel_adopt(clib_package_t *pkg) {
+  if (pkg->cancel) return 0;
+  pkg->cancel = clib_package_cancel_new(pkg->ctx->install_timeout_ms);
+  return NULL != pkg->cancel;
+}
+
+static int
+cancel_release(clib_package_t *pkg, int owned, int rc) {
+  const clib_package_error_t *err = clib_package_cancel_error(pkg->cancel);
+  if (err) rc = -1;
+  if (owned) {
+    if (err) {
+      logger_error("error", "%s%s%s"
+        , err->slug ? err->slug : ""
+        , err->slug ? ": " : ""
+        , err->message ? err->message : "install failed");
+    }
+    clib_package_cancel_free(pkg->cancel);
+    pkg->cancel = NULL;
+  }
+  return rc;
+}
+
+/**
+ * Client side of the GNU make jobserver: with make's
+ * `--jobserver-auth` (or the older `--jobserver-fds`) in
+ * MAKEFLAGS, every job beyond the one make gave us takes a
+ * token from the jobserver and hands it back when done.
+ * Tokens are read from a descriptor of our own, non-blocking,
+ * so a wait can be cancelled without touching make's pipe.
+ */
+
+struct jobserver {
+  int read_fd;  // -1 without a jobserver
+  int write_fd;
+  int owned;    // whether we opened `read_fd` and `write_fd`
+};
+
+static void
+jobserver_open(struct jobserver *js, int *under_make) {
+  const char *flags = getenv("MAKEFLAGS");
+  const char *auth = NULL;
+  const char *p = NULL;
+  char path[64];
+  int r = -1;
+  int w = -1;
+
+  js->read_fd = js->write_fd = -1;
+  js->owned = 0;
+  *under_make = NULL != flags && NULL != getenv("MAKELEVEL");
+  if (!flags) return;
+
+  // the last one wins, as in make
+  for (p = flags; (p = strstr(p, "--jobserver-")); p++) auth = p;
+  if (!auth || !(auth = strchr(auth, '='))) return;
+  auth++;
+
+  if (0 == strncmp(auth, "fifo:", 5)) {
+    std::string fifo(auth + 5, strcspn(auth + 5, " "));
+    js->read_fd = open(fifo.c_str(), O_RDONLY | O_NONBLOCK | O_CLOEXEC);
+    js->write_fd = open(fifo.c_str(), O_WRONLY | O_NONBLOCK | O_CLOEXEC);
+    js->owned = 1;
+  } else if (2 == sscanf(auth, "%d,%d", &r, &w) && r >= 0 && w >= 0) {
+    // make only passes the pipe to recipes marked `+`
+    if (-1 == fcntl(r, F_GETFD) || -1 == fcntl(w, F_GETFD)) return;
+    snprintf(path, sizeof(path), "/proc/self/fd/%d", r);
+    js->read_fd = open(path, O_RDONLY | O_NONBLOCK | O_CLOEXEC);
+    js->write_fd = dup(w);
+    js->owned = 1;
+    if (-1 == js->read_fd) {
+      // no /proc: poll make's descriptor and read it as is
+      js->read_fd = r;
+      if (-1 != js->write_fd) close(js->write_fd);
+      js->write_fd = w;
+      js->owned = 0;
+    }
+  }
+
+  if (-1 == js->read_fd || -1 == js->write_fd) {
+    if (js->owned) {
+      if (-1 != js->read_fd) close(js->read_fd);
+      if (-1 != js->write_fd) close(js->write_fd);
+    }
+    js->read_fd = js->write_fd = -1;
+  }
+}
+
+static void
+jobserver_close(struct jobserver *js) {
+  if (!js->owned) return;
+  if (-1 != js->read_fd) close(js->read_fd);
+  if (-1 != js->write_fd) close(js->write_fd);
+}
+
+/**
+ * Take a token if one comes free within a poll interval.
+ *
+ * Returns the token, -1 if there was none, or -2 once make is
+ * gone.
+ */
+
+static int
+jobserver_try(struct jobserver *js) {
+  struct pollfd pfd;
+  unsigned char token = 0;
+
+  pfd.fd = js->read_fd;
+  pfd.events = POLLIN;
+  // make's own descriptor blocks: only read what poll saw
+  if (!js->owned && 1 != poll(&pfd, 1, CLIB_PACKAGE_BUILD_POLL_MS)) return -1;
+
+  ssize_t n = read(js->read_fd, &token, 1);
+  if (1 == n) return token;
+  if (0 == n) return -2;
+  if (EINTR == errno) return -1;
+  if (EAGAIN != errno && EWOULDBLOCK != errno) return -2;
+  if (js->owned) poll(&pfd, 1, CLIB_PACKAGE_BUILD_POLL_MS);
+  return -1;
+}
+
+static void
+jobserver_release(struct jobserver *js, int token) {
+  unsigned char byte = (unsigned char) token;
+  while (-1 == write(js->write_fd, &byte, 1) && EINTR == errno) {}
+}
+
+struct build_run {
+  clib_package_ctx_t *ctx;
+  clib_package_cancel_t *cancel;
+  std::vector<struct build_step> steps;
+  std::map<std::string, size_t> keys;
+  pthread_mutex_t mutex;
+  pthread_cond_t cond;
+  size_t done;
+  int running;
+  int failed;
+  int implicit; // the job slot make gave us is free
+  struct jobserver js;
+  int verbose;
+};
+
+/**
+ * Whether every dependency of `step` that has a command in
+ * this run is done.
+ */
+
+static int
+build_ready(struct build_run *run, const struct build_step &step) {
+  if (0 != step.state) return 0;
+  for (size_t i = 0; i < step.deps.size(); i++) {
+    std::map<std::string, size_t>::iterator it = run->keys.find(step.deps[i]);
+    if (it != run->keys.end() && 2 != run->steps[it->second].state) return 0;
+  }
+  return 1;
+}
+
+/**
+ * Run `step`'s command with `sh -c` in its directory.
+ *
+ * Returns 0 if it exited 0.
+ */
+
+static int
+build_exec(const struct build_step &step, clib_package_cancel_t *cancel) {
+  const char *dir = step.dir.c_str();
+  const char *command = step.command.c_str();
+  int status = 0;
+
+  pid_t pid = fork();
+  if (-1 == pid) return -1;
+  if (0 == pid) {
+    if (0 != chdir(dir)) _exit(127);
+    execl("/bin/sh", "sh", "-c", command, (char *) NULL);
+    _exit(127);
+  }
+
+  for (;;) {
+    pid_t done = waitpid(pid, &status, WNOHANG);
+    if (done == pid) return WIFEXITED(status) && 0 == WEXITSTATUS(status) ? 0 : -1;
+    if (-1 == done && EINTR != errno) return -1;
+    if (-1 == cancel_sleep(cancel, CLIB_PACKAGE_BUILD_POLL_MS)) {
+      kill(pid, SIGTERM);
+      while (-1 == waitpid(pid, &status, 0) && EINTR == errno) {}
+      return -1;
+    }
+  }
+}
+
+/**
+ * Worker of the executor: take the next step whose
+ * dependencies are done, get a job slot for it, run it.
+ */
+
+static void *
+build_worker(void *arg) {
+  struct build_run *run = (struct build_run *) arg;
+
+  pthread_mutex_lock(&run->mutex);
+  for (;;) {
+    if (run->failed || cancel_expired(run->cancel) || run->done == run->steps.size()) break;
+
+    size_t next = run->steps.size();
+    for (size_t i = 0; i < run->steps.size() && next == run->steps.size(); i++) {
+      if (build_ready(run, run->steps[i])) next = i;
+    }
+    // nothing ready and nothing running is a cycle: break it
+    for (size_t i = 0; next == run->steps.size() && 0 == run->running && i < run->steps.size(); i++) {
+      if (0 == run->steps[i].state) next = i;
+    }
+    if (next == run->steps.size()) {
+      struct timespec ts = deadline_from_ms(now_ms() + CLIB_PACKAGE_BUILD_POLL_MS);
+      pthread_cond_timedwait(&run->cond, &run->mutex, &ts);
+      continue;
+    }
+
+    struct build_step &step = run->steps[next];
+    step.state = 1;
+    run->running++;
+
+    // a slot: the one make gave us when it is free, else a
+    // jobserver token, whichever comes first
+    int rc = 0;
+    int token = -3; // no jobserver: the pool size bounds us
+    for (;;) {
+      if (run->implicit) {
+        run->implicit = 0;
+        token = -2;
+        break;
+      }
+      if (-1 == run->js.read_fd) break;
+      pthread_mutex_unlock(&run->mutex);
+      token = jobserver_try(&run->js);
+      pthread_mutex_lock(&run->mutex);
+      if (token >= 0) break;
+      if (-2 == token || cancel_check(run->cancel)) {
+        token = -3;
+        rc = -1;
+        break;
+      }
+    }
+    pthread_mutex_unlock(&run->mutex);
+
+    if (0 == rc) {
+      struct trace_span span = trace_begin(&run->ctx->trace, "build");
+      progress(run->cancel, "build", step.repo.c_str(), step.command.c_str());
+      if (run->verbose) logger_info("build", "%s: %s", step.repo.c_str(), step.command.c_str());
+      rc = build_exec(step, run->cancel);
+      trace_end(&span, "build", step.repo.c_str(), step.command.c_str(), -1, -1);
+    }
+    if (token >= 0) jobserver_release(&run->js, token);
+
+    if (0 == rc) {
+      stats_add(&run->ctx->stats, packages_built, 1);
+      progress(run->cancel, "built", step.repo.c_str(), NULL);
+    } else if (!cancel_check(run->cancel)) {
+      std::string message = "install command failed: " + step.command;
+      clib_package_cancel(run->cancel, CLIB_PACKAGE_EBUILD, step.repo.c_str(), message.c_str());
+    }
+
+    pthread_mutex_lock(&run->mutex);
+    if (-2 == token) run->implicit = 1;
+    step.state = 2;
+    run->done++;
+    run->running--;
+    if (0 != rc) run->failed = 1;
+    pthread_cond_broadcast(&run->cond);
+  }
+  pthread_mutex_unlock(&run->mutex);
+  return NULL;
+}
+
+/**
+ * Run the post-install commands `cancel` collected, each once
+ * the commands of its dependencies are done, on up to
+ * `ctx->install_jobs` threads.  Under make, its jobserver
+ * hands out the slots (a single slot if make has none).
+ *
+ * Returns 0 if every command succeeded.
+ */
+
+static int
+build_run(clib_package_ctx_t *ctx, clib_package_cancel_t *cancel, int verbose) {
+  struct build_run run;
+  std::vector<pthread_t> workers;
+  int under_make = 0;
+
+  pthread_mutex_lock(&cancel->mutex);
+  if (cancel->steps) run.steps.swap(*cancel->steps);
+  pthread_mutex_unlock(&cancel->mutex);
+  if (run.steps.empty()) return 0;
+
+  run.ctx = ctx;
+  run.cancel = cancel;
+  run.done = 0;
+  run.running = 0;
+  run.failed = 0;
+  run.implicit = 1;
+  run.verbose = verbose;
+  for (size_t i = 0; i < run.steps.size(); i++) run.keys[run.steps[i].key] = i;
+  pthread_mutex_init(&run.mutex, NULL);
+  pthread_cond_init(&run.cond, NULL);
+  jobserver_open(&run.js, &under_make);
+
+  long jobs = ctx->install_jobs;
+  if (jobs < 0) jobs = sysconf(_SC_NPROCESSORS_ONLN);
+  // make without a jobserver means -j1
+  if (under_make && -1 == run.js.read_fd) jobs = 1;
+  if (jobs < 1) jobs = 1;
+  if ((size_t) jobs > run.steps.size()) jobs = (long) run.steps.size();
+
+  for (long i = 1; i < jobs; i++) {
+    pthread_t thread;
+    if (0 != pthread_create(&thread, NULL, build_worker, &run)) break;
+    workers.push_back(thread);
   }
+  build_worker(&run);
+  for (size_t i = 0; i < workers.size(); i++) pthread_join(workers[i], NULL);
 
-  // if not master then Query the API for tags
-  if(std::string(version) != "master") {
+  jobserver_close(&run.js);
+  pthread_mutex_destroy(&run.mutex);
+  pthread_cond_destroy(&run.cond);
+  return run.failed || cancel_check(cancel) ? -1 : 0;
+}
+
+/**
+ * Queue the `install` command of the just installed `pkg`
+ * (in `dir`) to run once the install is complete.
+ */
+
+static void
+build_queue(clib_package_t *pkg, const char *dir, const char *pkg_dir) {
+  struct build_step step;
+  list_node_t *node = NULL;
 
+  if (!pkg->install || !*pkg->install || 0 == pkg->ctx->install_jobs) return;
+  step.key = std::string(dir) + "/" + pkg->name;
+  step.repo = pkg->repo ? pkg->repo : pkg->name;
+  step.dir = pkg_dir;
+  step.command = pkg->install;
+  step.state = 0;
+  if (pkg->dependencies) {
+    list_iterator_t *it = list_iterator_new(pkg->dependencies, LIST_HEAD);
+    while (it && (node = list_iterator_next(it))) {
+      clib_package_dependency_t *dep = (clib_package_dependency_t *) node->val;
+      if (dep->name) step.deps.push_back(std::string(dir) + "/" + dep->name);
+    }
+    if (it) list_iterator_destroy(it);
   }
 
-  printf("%s:%s:%s\n", author, name, version);
-  {
-    std::string try_url = api_endpoint;
-    try_url += std::string("repos/");
-    try_url += std::string(author);
-    try_url += std::string("/");
-    try_url += std::string(name);
-    try_url += std::string("/contents/package.json?");
-    try_url += std::string(version);
+  pthread_mutex_lock(&pkg->cancel->mutex);
+  if (!pkg->cancel->steps) pkg->cancel->steps = new std::vector<struct build_step>();
+  pkg->cancel->steps->push_back(step);
+  pthread_mutex_unlock(&pkg->cancel->mutex);
+}
+
+/**
+ * Install calls nest (a package installs its dependencies);
+ * the outermost one writes the indexes they changed and runs
+ * the commands they queued, once everything they depend on
+ * is on disk.
+ */
+
+static void
+build_enter(clib_package_cancel_t *cancel) {
+  pthread_mutex_lock(&cancel->mutex);
+  cancel->depth++;
+  pthread_mutex_unlock(&cancel->mutex);
+}
+
+static int
+build_leave(clib_package_ctx_t *ctx, clib_package_cancel_t *cancel, int rc, int verbose) {
+  pthread_mutex_lock(&cancel->mutex);
+  int outermost = 0 == --cancel->depth;
+  pthread_mutex_unlock(&cancel->mutex);
+  if (!outermost) return rc;
+  index_flush(cancel);
+  if (0 != rc || clib_package_cancel_error(cancel)) return rc;
+  return build_run(ctx, cancel, verbose);
+}
+
+/**
+ * Install the given `pkg` in `dir`.
+ *
+ * The package is assembled in `dir/.<name>.staging`, with its
+ * package.json written last, and swapped in as `dir/<name>`
+ * in one rename, all under `dir/.<name>.lock`.  An installed
+ * package.json thus always means a complete install, and other
+ * processes may install into the same `dir` concurrently.
+ *
+ * Returns 0 on success.  The install stops at the first hard
+ * failure, or when `pkg->cancel` fires; that token then holds
+ * the error.
+ */
+
+int
+clib_package_install(clib_package_t *pkg, const char *dir, int verbose) {
+  char *pkg_dir = NULL;
+  char *package_json = NULL;
+  int rc = -1;
+  int owned = 0;
+  int entered = 0;
+  int lock = -1;
+  char * fname, *mkfile;
+  char * localjson = NULL;
+  std::string hidden;
+  std::string staging;
+  std::string mk;
+  std::string installed;
+  std::vector<std::string> sources;
+  struct index_record record;
+  struct fs_batch batch;
+  struct trace_span span = { NULL, NULL, 0 };
+  struct trace_span phase = { NULL, NULL, 0 };
+
+  if (!pkg || !dir) return -1;
+  fs_batch_init(&batch);
+  span = trace_begin(&pkg->ctx->trace, "install");
+  owned = cancel_adopt(pkg);
+  if (!pkg->cancel) goto cleanup;
+  build_enter(pkg->cancel);
+  entered = 1;
+  if (cancel_check(pkg->cancel)) goto cleanup;
+  store_gc_kick(pkg->ctx);
+  if (!(pkg_dir = path_join(dir, pkg->name))) goto cleanup;
+  hidden = std::string(dir) + "/." + pkg->name;
+  staging = hidden + ".staging";
 
-    res = http_get(try_url.c_str());
+  _debug("mkdir -p %s", dir);
+  if (-1 == mkdirp(dir, 0777)) {
+    clib_package_cancel(pkg->cancel, CLIB_PACKAGE_EWRITE, pkg->repo, "unable to create directory");
+    goto cleanup;
   }
-  if(!res || !res->ok) {
-    logger_error("error", "unable to fetch %s/%s:package.json", author, name);
-    goto error;
+
+  _debug("lock: %s.lock", hidden.c_str());
+  if (-1 == (lock = lock_acquire((hidden + ".lock").c_str(), pkg->cancel))) {
+    if (!cancel_check(pkg->cancel)) {
+      clib_package_cancel(pkg->cancel, CLIB_PACKAGE_EWRITE, pkg->repo, "unable to lock package");
+    }
+    goto cleanup;
   }
 
-  // Parse the API response
-  root = json_parse_string(res->data);
-  obj = json_value_get_object(root);
-  download_url = json_object_get_string_safe(obj, "download_url");
-  json_value_free(root);
+  if (NULL == pkg->url) {
+    pkg->url = clib_package_url(pkg->author
+      , pkg->repo_name
+      , pkg->version);
+    if (NULL == pkg->url) goto cleanup;
+  }
 
-  http_get_free(res);
-  res = http_get(download_url);
-  if (!res || !res->ok) {
-    logger_error("error", "unable to fetch %s/%s:package.json", author, name);
-    goto error;
+  if (!(package_json = path_join(pkg_dir, "package.json"))) goto cleanup;
+
+  if (0 == index_lookup(pkg->cancel, dir, pkg->name, package_json, &record)) {
+    installed = record.version;
+    _debug("%s is indexed at v%s", pkg->name, installed.c_str());
+    // an upgrade keeps whichever files did not change, upstream
+    // nor here
+    batch.previous_dir = pkg_dir;
+    for (size_t i = 0; i < record.files.size(); i++) {
+      struct index_stamp now;
+      std::string file = std::string(pkg_dir) + "/" + record.files[i].path;
+      if (0 == index_stat(file.c_str(), &now) && index_stamp_equal(&record.files[i].stamp, &now)) {
+        batch.previous[record.files[i].path] = record.files[i].sha;
+      }
+    }
+  } else if ((localjson = fs_read(package_json))) {
+    // not indexed (or stale): read the package.json and index it
+    _debug("reading local package.json");
+    clib_package_t *localpkg = clib_package_new(localjson, verbose, pkg->ctx);
+    free(localjson);
+    localjson = NULL;
+    if (localpkg && localpkg->version) {
+      installed = localpkg->version;
+      record.name = pkg->name;
+      record.version = installed;
+      if (0 == index_stat(package_json, &record.stamp)) index_update(pkg->cancel, dir, &record);
+    }
+    if (localpkg) clib_package_free(localpkg);
   }
 
-  free(name);
-  name = NULL;
+  if (!installed.empty() && pkg->version) {
+      semver_t current_version = {};
+      semver_t compare_version = {};
+      semver_parse(installed.c_str(), &current_version);
+      semver_parse(pkg->version, &compare_version);
 
-  // build package
-  pkg = clib_package_new(res->data, verbose, cfg);
-  pkg->api_endpoint = api_endpoint;
-  http_get_free(res);
-  res = NULL;
-  if (!pkg) goto error;
+      int resolution = semver_compare(compare_version, current_version);
+      semver_free(&current_version);
+      semver_free(&compare_version);
 
-  // force version number
-  if (pkg->version) {
-    if (version) {
-      if (0 != strcmp(version, DEFAULT_REPO_VERSION)) {
-        _debug("forcing version number: %s (%s)", version, pkg->version);
-        free(pkg->version);
-        pkg->version = version;
-      } else {
-        free(version);
+      if (resolution == 0 || resolution == -1) {
+          if (verbose) logger_info("skipping", "new v%s is equal or lower than installed v%s for %s", pkg->version, installed.c_str(), pkg->repo);
+          stats_add(&pkg->ctx->stats, packages_skipped, 1);
+          stats_add(&pkg->ctx->stats, files_skipped, pkg->src ? pkg->src->len : 0);
+          progress(pkg->cancel, "skip", pkg->repo, installed.c_str());
+          lock_release(lock);
+          lock = -1;
+          if (-1 == outputs_sync(pkg->ctx, dir, pkg->cancel)) {
+            if (!cancel_check(pkg->cancel)) {
+              clib_package_cancel(pkg->cancel, CLIB_PACKAGE_EWRITE, pkg->repo, "unable to update the build files");
+            }
+            goto cleanup;
+          }
+          rc = 0;
+          goto cleanup;
       }
-    }
-  } else {
-    pkg->version = version;
   }
 
-  // force package author (don't know how this could fail)
-  if (pkg->author) {
-    if (0 != strcmp(author, pkg->author)) {
-      free(pkg->author);
-      pkg->author = author;
-    } else {
-      free(author);
+  // start from a clean stage; whatever an interrupted install
+  // left there is of unknown version
+  _debug("mkdir -p %s", staging.c_str());
+  rimraf(staging.c_str());
+  if (-1 == mkdirp(staging.c_str(), 0777)) {
+    clib_package_cancel(pkg->cancel, CLIB_PACKAGE_EWRITE, pkg->repo, "unable to create directory");
+    goto cleanup;
+  }
+  batch.dirs.insert(staging);
+
+  // fetch makefile
+  if (pkg->makefile) {
+    _debug("fetch: %s/%s", pkg->repo, pkg->makefile);
+    if (0 != fetch_package_file(pkg, staging.c_str(), pkg->makefile, &batch, verbose)) {
+      goto cleanup;
     }
+  }
+
+  // if no sources are listed, just publish
+  if (NULL == pkg->src) goto publish;
+
+  if (0 != fetch_package_sources(pkg, staging.c_str(), &batch, verbose)) goto cleanup;
+
+  /* Create a .mk file for the project */
+  phase = trace_begin(&pkg->ctx->trace, "write .mk");
+  fname = concat(pkg->name, ".mk");
+  mkfile = path_join(staging.c_str(), fname);
+  mk = "deps__a_SOURCES += ";
+  package_sources(pkg, pkg->name, &sources);
+  for (size_t i = 0; i < sources.size(); i++) mk += sources[i] + " ";
+  mk += "\n";
+  fs_batch_write(&batch, mkfile, mk);
+  free(fname);
+  free(mkfile);
+  if (pkg->ctx->outputs & CLIB_PACKAGE_OUTPUT_NINJA) {
+    std::string ninja = staging + "/" + pkg->name + ".ninja";
+    fs_batch_write(&batch, ninja.c_str(), ninja_fragment(pkg->repo, pkg->name, sources));
+  }
+  trace_end(&phase, "write", pkg->repo, NULL, -1, (long long) mk.size());
+
+publish:
+  // the .mk file and package.json go out in one batch; the
+  // publish below is what marks the install complete
+  free(package_json);
+  if (!(package_json = path_join(staging.c_str(), "package.json"))) goto cleanup;
+  _debug("write: %s", package_json);
+  phase = trace_begin(&pkg->ctx->trace, "write package.json");
+  fs_batch_write(&batch, package_json, pkg->json);
+  if (-1 == fs_batch_flush(&batch)) {
+    logger_error("error", "Failed to write %s", package_json);
+    clib_package_cancel(pkg->cancel, CLIB_PACKAGE_EWRITE, pkg->repo, "unable to write package files");
+    goto cleanup;
+  }
+  trace_end(&phase, "write", pkg->repo, NULL, -1, (long long) strlen(pkg->json));
+  _probe(file__written, package_json, (long long) strlen(pkg->json));
+
+  _debug("publish: %s", pkg_dir);
+  phase = trace_begin(&pkg->ctx->trace, "publish");
+  if (-1 == dir_publish(staging.c_str(), pkg_dir, (hidden + ".old").c_str())) {
+    clib_package_cancel(pkg->cancel, CLIB_PACKAGE_EWRITE, pkg->repo, "unable to publish package");
+    goto cleanup;
+  }
+  trace_end(&phase, "write", pkg->repo, NULL, -1, -1);
+
+  // still under the package lock, so the stat is of our copy
+  free(package_json);
+  if (!(package_json = path_join(pkg_dir, "package.json"))) goto cleanup;
+  record.name = pkg->name;
+  record.version = pkg->version ? pkg->version : "";
+  record.sha = pkg->sha ? pkg->sha : "";
+  record.files.clear();
+  for (size_t i = 0; i < batch.fetched.size(); i++) {
+    struct index_file file;
+    file.path = batch.fetched[i].first;
+    file.sha = batch.fetched[i].second;
+    std::string path = std::string(pkg_dir) + "/" + file.path;
+    if (0 != index_stat(path.c_str(), &file.stamp)) continue;
+    record.files.push_back(file);
+  }
+  if (0 == index_stat(package_json, &record.stamp)) {
+    index_update(pkg->cancel, dir, &record);
   } else {
-    pkg->author = author;
+    _debug("unable to index %s", pkg->name);
   }
+  lock_release(lock);
+  lock = -1;
 
-  if (!(repo = clib_package_repo(pkg->author, pkg->name))) goto error;
+  // packages installed before the outputs were on
+  if (-1 == outputs_sync(pkg->ctx, dir, pkg->cancel)) {
+    if (!cancel_check(pkg->cancel)) {
+      clib_package_cancel(pkg->cancel, CLIB_PACKAGE_EWRITE, pkg->repo, "unable to update the build files");
+    }
+    goto cleanup;
+  }
 
-  if (pkg->repo) {
-    if (0 != strcmp(repo, pkg->repo)) {
-      free(url);
-      if (!(url = clib_package_url_from_repo(pkg->repo, pkg->version)))
-        goto error;
+  if (pkg->src) {
+    // deps.mk lives next to `dir`, not in the working directory,
+    // which a long running process shares between installs
+    std::map<std::string, std::vector<std::string> > built;
+    built[pkg->name] = sources;
+    phase = trace_begin(&pkg->ctx->trace, "update deps.mk");
+    if (-1 == deps_mk_update(dir, pkg->name, pkg->cancel)) {
+      if (!cancel_check(pkg->cancel)) {
+        clib_package_cancel(pkg->cancel, CLIB_PACKAGE_EWRITE, pkg->repo, "unable to update deps.mk");
+      }
+      goto cleanup;
     }
-    free(repo);
-    repo = NULL;
-  } else {
-    pkg->repo = repo;
+    if ((pkg->ctx->outputs & CLIB_PACKAGE_OUTPUT_NINJA)
+        && -1 == deps_ninja_update(dir, std::vector<std::string>(1, pkg->name), pkg->cancel)) {
+      if (!cancel_check(pkg->cancel)) {
+        clib_package_cancel(pkg->cancel, CLIB_PACKAGE_EWRITE, pkg->repo, "unable to update deps.ninja");
+      }
+      goto cleanup;
+    }
+    if ((pkg->ctx->outputs & CLIB_PACKAGE_OUTPUT_COMPILE_COMMANDS)
+        && -1 == compile_commands_update(dir, built, pkg->cancel)) {
+      if (!cancel_check(pkg->cancel)) {
+        clib_package_cancel(pkg->cancel, CLIB_PACKAGE_EWRITE, pkg->repo, "unable to update compile_commands.json");
+      }
+      goto cleanup;
+    }
+    if ((pkg->ctx->outputs & CLIB_PACKAGE_OUTPUT_UNITY)
+        && -1 == unity_update(pkg->ctx, dir, built, pkg->cancel)) {
+      if (!cancel_check(pkg->cancel)) {
+        clib_package_cancel(pkg->cancel, CLIB_PACKAGE_EWRITE, pkg->repo, "unable to update the unity build");
+      }
+      goto cleanup;
+    }
+    trace_end(&phase, "write", pkg->repo, NULL, -1, -1);
   }
 
-  pkg->url = url;
-  return pkg;
+  build_queue(pkg, dir, pkg_dir);
 
-error:
-  free(author);
-  free(name);
-  free(version);
-  free(url);
-  free(json_url);
-  free(repo);
-  http_get_free(res);
-  if (pkg) clib_package_free(pkg);
-  return NULL;
+  // dependencies take their own locks
+  rc = clib_package_install_dependencies(pkg, dir, verbose);
+  if (0 == rc) progress(pkg->cancel, "installed", pkg->repo, pkg->version);
+
+cleanup:
+  if (-1 != lock) {
+    if (!staging.empty()) rimraf(staging.c_str());
+    lock_release(lock);
+  }
+  if (pkg_dir) free(pkg_dir);
+  if (package_json) free(package_json);
+  if (owned && verbose) {
+    logger_info("memory", "peak %lu bytes", (unsigned long) clib_package_memory_peak(pkg->ctx));
+  }
+  fs_batch_destroy(&batch);
+  trace_end(&span, "install", pkg->repo, pkg->url, -1, -1);
+  if (entered) rc = build_leave(pkg->ctx, pkg->cancel, rc, verbose);
+  return cancel_release(pkg, owned, rc);
 }
 
 /**
- * Get a slug for the package `author/name@version`
+ * Install the given `pkg`'s dependencies in `dir`
  */
 
-char *
-clib_package_url(const char *author, const char *name, const char *version) {
-  if (!author || !name || !version) return NULL;
-  int size =
-      strlen(GITHUB_CONTENT_URL)
-    + strlen(author)
-    + 1 // /
-    + strlen(name)
-    + 1 // /
-    + strlen(version)
-    + 1 // \0
-    ;
+int
+clib_package_install_dependencies(clib_package_t *pkg
+    , const char *dir
+    , int verbose) {
+  if (!pkg || !dir) return -1;
+  if (NULL == pkg->dependencies) return 0;
 
-  char *slug = (char*)malloc(size);
-  if (slug) {
-    memset(slug, '\0', size);
-    sprintf(slug
-      , GITHUB_CONTENT_URL "%s/%s/%s"
-      , author
-      , name
-      , version);
-    if (!strncmp(version, "https", 5)) {
-        sprintf(slug, "%s", version);
+  int owned = cancel_adopt(pkg);
+  if (!pkg->cancel) return -1;
+  build_enter(pkg->cancel);
+  int rc = install_packages(pkg->dependencies, dir, verbose, pkg->ctx, pkg->cancel);
+  rc = build_leave(pkg->ctx, pkg->cancel, rc, verbose);
+  return cancel_release(pkg, owned, rc);
+}
+
+/**
+ * Install the given `pkg`'s development dependencies in `dir`
+ */
+
+int
+clib_package_install_development(clib_package_t *pkg
+    , const char *dir
+    , int verbose) {
+  if (!pkg || !dir) return -1;
+  if (NULL == pkg->development) return 0;
+
+  int owned = cancel_adopt(pkg);
+  if (!pkg->cancel) return -1;
+  build_enter(pkg->cancel);
+  int rc = install_packages(pkg->development, dir, verbose, pkg->ctx, pkg->cancel);
+  rc = build_leave(pkg->ctx, pkg->cancel, rc, verbose);
+  return cancel_release(pkg, owned, rc);
+}
+
+/**
+ * Snapshot the dependency graphs of the `count` root `slugs`
+ * into the mirror directory `dir`: each root is installed
+ * into a scratch `deps/` under `dir`, by a private session
+ * copying `ctx`'s configuration whose requests are copied
+ * into the mirror on their way through.  The mirror holds
+ * every response an install of the same roots needs, so
+ * `clib_package_set_offline()` can install them anywhere it
+ * is copied to.  The content store is left out, as a store
+ * hit would keep a file out of the mirror.
+ *
+ * Returns 0 on success.  Failures cancel `cancel` (may be
+ * NULL).
+ */
+
+int
+clib_package_mirror_export(const char *dir
+    , const char **slugs
+    , int count
+    , clib_package_ctx_t *ctx
+    , clib_package_cancel_t *cancel) {
+  clib_package_ctx_t *session = NULL;
+  clib_package_transport_t *mirror = NULL;
+  clib_package_cancel_t *owned = NULL;
+  std::string scratch;
+  int rc = -1;
+
+  if (!dir || (count > 0 && !slugs)) return -1;
+  ctx = ctx_get(ctx);
+  if (-1 == mkdirp(dir, 0777)) return -1;
+  if (!cancel && !(cancel = owned = clib_package_cancel_new(ctx->install_timeout_ms))) {
+    return -1;
+  }
+  if (!(session = clib_package_ctx_new(NULL))) goto cleanup;
+  if (!(mirror = clib_package_transport_mirror(ctx_transport(ctx), dir))) goto cleanup;
+  session->api_endpoints = ctx->api_endpoints;
+  session->budget.limit = ctx->budget.limit;
+  session->transport = mirror;
+
+  scratch = std::string(dir) + "/.export";
+  rimraf(scratch.c_str());
+  rc = 0;
+  for (int i = 0; 0 == rc && i < count; i++) {
+    clib_package_t *pkg = clib_package_resolve(slugs[i], 0, session, cancel);
+    if (!pkg) {
+      clib_package_cancel(cancel, CLIB_PACKAGE_ERESOLVE, slugs[i], "unable to resolve package");
+      rc = -1;
+      break;
     }
+    pkg->cancel = cancel;
+    rc = clib_package_install(pkg, (scratch + "/deps").c_str(), 0);
+    clib_package_free(pkg);
   }
-  return slug;
+  if (clib_package_cancel_error(cancel)) rc = -1;
+  rimraf(scratch.c_str());
+
+cleanup:
+  clib_package_ctx_free(session);
+  clib_package_transport_free(mirror);
+  if (owned) clib_package_cancel_free(owned);
+  return rc;
 }
 
-char *
-clib_package_url_from_repo(const char *repo, const char *version) {
-  if (!repo || !version) return NULL;
-  int size =
-      strlen(GITHUB_CONTENT_URL)
-    + strlen(repo)
-    + 1 // /
-    + strlen(version)
-    + 1 // \0
-    ;
+/**
+ * A bundle packs an installed `deps/` tree, with the
+ * `deps.mk` next to it, into one file for CI to cache:
+ *
+ *   "CLPB", u32 version, u32 key length, key
+ *   frames
+ *   index: u32 frame count, then per frame u64 offset,
+ *          u32 stored size, u32 size, u32 codec; u32 file
+ *          count, then per file u32 frame, u32 offset in the
+ *          frame, u32 size, u32 mode, u8 base, u16 path
+ *          length, path
+ *   u64 index offset, u32 index size, "CLPB"
+ *
+ * Files are packed whole into frames of about
+ * CLIB_PACKAGE_BUNDLE_FRAME bytes, each compressed on its own
+ * (zstd with `-DCLIB_PACKAGE_ZSTD`, else stored), so the
+ * trailing index lets a reader seek to any file and decode
+ * frames in parallel.  A `base` of 1 marks a path relative to
+ * the parent of `deps/` (deps.mk) rather than `deps/` itself.
+ */
 
-  char *slug = (char *)malloc(size);
-  if (slug) {
-    memset(slug, '\0', size);
-    sprintf(slug
-      , GITHUB_CONTENT_URL "%s/%s"
-      , repo
-      , version);
-  }
-  return slug;
+#define BUNDLE_MAGIC "CLPB"
+#define BUNDLE_VERSION 1
+#define BUNDLE_STORED 0
+#define BUNDLE_ZSTD 1
+
+struct bundle_frame {
+  uint64_t offset;
+  uint32_t stored;
+  uint32_t size;
+  uint32_t codec;
+};
+
+struct bundle_entry {
+  uint32_t frame;
+  uint32_t offset;
+  uint32_t size;
+  uint32_t mode;
+  uint8_t base;
+  std::string path;
+};
+
+struct bundle_writer {
+  FILE *out;
+  uint64_t offset;
+  std::string raw; // the frame being filled
+  std::vector<struct bundle_frame> frames;
+  std::vector<struct bundle_entry> entries;
+#ifdef CLIB_PACKAGE_ZSTD
+  ZSTD_CCtx *cctx;
+#endif
+};
+
+static void
+bundle_put(std::string *out, uint64_t n, size_t width) {
+  // little endian, whatever the host
+  for (size_t i = 0; i < width; i++) out->push_back((char) ((n >> (8 * i)) & 0xff));
+}
+
+static int
+bundle_get(const char **p, const char *end, uint64_t *n, size_t width) {
+  if ((size_t) (end - *p) < width) return -1;
+  *n = 0;
+  for (size_t i = 0; i < width; i++) *n |= (uint64_t) (unsigned char) (*p)[i] << (8 * i);
+  *p += width;
+  return 0;
 }
 
 /**
- * Parse the package author from the given `slug`
+ * List the regular files under `dir`/`rel`, sorted so equal
+ * trees make equal bundles.  Dot entries (locks, stages, the
+ * installed index) belong to the machine and are left out.
  */
 
-char *
-clib_package_parse_author(const char *slug) {
-  return parse_repo_owner(slug, DEFAULT_REPO_OWNER);
+static int
+bundle_walk(const std::string &dir, const std::string &rel, std::vector<std::string> *files) {
+  std::string path = rel.empty() ? dir : dir + "/" + rel;
+  std::vector<std::string> names;
+  struct dirent *ent = NULL;
+  DIR *d = opendir(path.c_str());
+  if (!d) return -1;
+  while ((ent = readdir(d))) {
+    if ('.' != ent->d_name[0]) names.push_back(ent->d_name);
+  }
+  closedir(d);
+  std::sort(names.begin(), names.end());
+
+  for (size_t i = 0; i < names.size(); i++) {
+    std::string child = rel.empty() ? names[i] : rel + "/" + names[i];
+    struct stat st;
+    if (-1 == lstat((dir + "/" + child).c_str(), &st)) return -1;
+    if (S_ISDIR(st.st_mode)) {
+      if (-1 == bundle_walk(dir, child, files)) return -1;
+    } else if (S_ISREG(st.st_mode)) {
+      files->push_back(child);
+    }
+  }
+  return 0;
+}
+
+static int
+bundle_write(struct bundle_writer *w, const char *data, size_t len) {
+  if (len && len != fwrite(data, 1, len, w->out)) return -1;
+  w->offset += len;
+  return 0;
 }
 
 /**
- * Parse the package version from the given `slug`
+ * Compress and write out the frame being filled, if any.
  */
 
-char *
-clib_package_parse_version(const char *slug) {
-  return parse_repo_version(slug, DEFAULT_REPO_VERSION);
+static int
+bundle_flush(struct bundle_writer *w) {
+  struct bundle_frame frame;
+  const std::string *data = &w->raw;
+  std::string packed;
+
+  if (w->raw.empty()) return 0;
+  frame.offset = w->offset;
+  frame.size = (uint32_t) w->raw.size();
+  frame.codec = BUNDLE_STORED;
+#ifdef CLIB_PACKAGE_ZSTD
+  packed.resize(ZSTD_compressBound(w->raw.size()));
+  size_t n = ZSTD_compress2(w->cctx, &packed[0], packed.size(), w->raw.data(), w->raw.size());
+  // keep incompressible frames as they are
+  if (!ZSTD_isError(n) && n < w->raw.size()) {
+    packed.resize(n);
+    data = &packed;
+    frame.codec = BUNDLE_ZSTD;
+  }
+#endif
+  frame.stored = (uint32_t) data->size();
+  if (-1 == bundle_write(w, data->data(), data->size())) return -1;
+  w->frames.push_back(frame);
+  w->raw.clear();
+  return 0;
+}
+
+static int
+bundle_add(struct bundle_writer *w, const std::string &path, int base, const char *file) {
+  struct bundle_entry entry;
+  std::string data;
+  struct stat st;
+
+  if (-1 == stat(file, &st) || 0 != file_read_all(file, &data)) return -1;
+  if (data.size() > UINT32_MAX || path.size() > UINT16_MAX) return -1;
+  if (!w->raw.empty() && w->raw.size() + data.size() > CLIB_PACKAGE_BUNDLE_FRAME) {
+    if (-1 == bundle_flush(w)) return -1;
+  }
+
+  entry.frame = (uint32_t) w->frames.size();
+  entry.offset = (uint32_t) w->raw.size();
+  entry.size = (uint32_t) data.size();
+  entry.mode = st.st_mode & 0777;
+  entry.base = (uint8_t) base;
+  entry.path = path;
+  w->entries.push_back(entry);
+  w->raw += data;
+  return 0;
 }
 
 /**
- * Parse the package name from the given `slug`
+ * The key of a bundle for the root package.json text
+ * `manifest`: the FNV-1a 64 hash of it in hex.  Name bundles
+ * after it, so a changed manifest misses the cache.
  */
+
 char *
-clib_package_parse_name(const char *slug) {
-  return parse_repo_name(slug);
+clib_package_bundle_key(const char *manifest) {
+  uint64_t hash = 14695981039346656037ULL;
+  char *key = NULL;
+
+  if (!manifest) return NULL;
+  for (const char *p = manifest; *p; p++) {
+    hash ^= (unsigned char) *p;
+    hash *= 1099511628211ULL;
+  }
+  if (!(key = (char *) malloc(17))) return NULL;
+  snprintf(key, 17, "%016llx", (unsigned long long) hash);
+  return key;
 }
 
 /**
- * Create a new package dependency from the given `repo` and `version`
+ * Pack the installed tree `dir` and the `deps.mk` beside it
+ * into the bundle file `bundle`, tagged with `key` (see
+ * `clib_package_bundle_key()`, may be NULL).  The bundle is
+ * written aside and renamed into place.
+ *
+ * Returns 0 on success.
  */
 
-clib_package_dependency_t *
-clib_package_dependency_new(const char *repo, const char *version) {
-  if (!repo || !version) return NULL;
+int
+clib_package_bundle_pack(const char *dir, const char *key, const char *bundle) {
+  struct bundle_writer w;
+  std::vector<std::string> files;
+  std::string staged;
+  std::string out;
+  std::string deps_mk;
+  uint64_t index_offset = 0;
+  int rc = -1;
 
-  clib_package_dependency_t *dep = (clib_package_dependency_t*)malloc(sizeof(clib_package_dependency_t));
-  if (!dep) {
-    return NULL;
+  if (!dir || !bundle) return -1;
+  if (!key) key = "";
+  if (-1 == bundle_walk(dir, "", &files)) return -1;
+
+  w.offset = 0;
+#ifdef CLIB_PACKAGE_ZSTD
+  if (!(w.cctx = ZSTD_createCCtx())) return -1;
+  ZSTD_CCtx_setParameter(w.cctx, ZSTD_c_compressionLevel, CLIB_PACKAGE_BUNDLE_LEVEL);
+  ZSTD_CCtx_setParameter(w.cctx, ZSTD_c_checksumFlag, 1);
+#else
+  logger_warn("warning", "built without zstd, packing %s uncompressed", bundle);
+#endif
+  staged = std::string(bundle) + ".tmp";
+  if (!(w.out = fopen(staged.c_str(), "wb"))) goto cleanup;
+
+  out = BUNDLE_MAGIC;
+  bundle_put(&out, BUNDLE_VERSION, 4);
+  bundle_put(&out, strlen(key), 4);
+  out += key;
+  if (-1 == bundle_write(&w, out.data(), out.size())) goto cleanup;
+
+  for (size_t i = 0; i < files.size(); i++) {
+    if (-1 == bundle_add(&w, files[i], 0, (std::string(dir) + "/" + files[i]).c_str())) {
+      _debug("bundle: unable to pack %s", files[i].c_str());
+      goto cleanup;
+    }
+  }
+  deps_mk = std::string(dir) + "/../deps.mk";
+  if (0 == fs_exists(deps_mk.c_str()) && -1 == bundle_add(&w, "deps.mk", 1, deps_mk.c_str())) {
+    goto cleanup;
+  }
+  if (-1 == bundle_flush(&w)) goto cleanup;
+
+  index_offset = w.offset;
+  out.clear();
+  bundle_put(&out, w.frames.size(), 4);
+  for (size_t i = 0; i < w.frames.size(); i++) {
+    bundle_put(&out, w.frames[i].offset, 8);
+    bundle_put(&out, w.frames[i].stored, 4);
+    bundle_put(&out, w.frames[i].size, 4);
+    bundle_put(&out, w.frames[i].codec, 4);
   }
+  bundle_put(&out, w.entries.size(), 4);
+  for (size_t i = 0; i < w.entries.size(); i++) {
+    bundle_put(&out, w.entries[i].frame, 4);
+    bundle_put(&out, w.entries[i].offset, 4);
+    bundle_put(&out, w.entries[i].size, 4);
+    bundle_put(&out, w.entries[i].mode, 4);
+    bundle_put(&out, w.entries[i].base, 1);
+    bundle_put(&out, w.entries[i].path.size(), 2);
+    out += w.entries[i].path;
+  }
+  bundle_put(&out, index_offset, 8);
+  bundle_put(&out, out.size() - 8, 4);
+  out += BUNDLE_MAGIC;
+  if (-1 == bundle_write(&w, out.data(), out.size())) goto cleanup;
 
-  dep->version = 0 == strcmp("*", version)
-    ? strdup(DEFAULT_REPO_VERSION)
-    : strdup(version);
-  dep->name = clib_package_parse_name(repo);
-  dep->author = clib_package_parse_author(repo);
+  rc = 0;
 
-  _debug("dependency: %s/%s@%s", dep->author, dep->name, dep->version);
-  return dep;
+cleanup:
+  if (w.out && 0 != fclose(w.out)) rc = -1;
+  if (0 == rc && 0 != rename(staged.c_str(), bundle)) rc = -1;
+  if (0 != rc && !staged.empty()) unlink(staged.c_str());
+#ifdef CLIB_PACKAGE_ZSTD
+  ZSTD_freeCCtx(w.cctx);
+#endif
+  return rc;
 }
 
+struct bundle_reader {
+  int fd;
+  std::vector<struct bundle_frame> frames;
+  std::vector<struct bundle_entry> entries;
+  std::vector<std::vector<size_t> > by_frame;
+  std::string dir;  // the stage `deps/` is unpacked into
+  std::string root; // where base 1 files go, written as `<path>.bundle`
+  pthread_mutex_t mutex;
+  size_t next;
+  int failed;
+};
+
 /**
- * Fetch a file associated with the given `pkg`.
- *
- * Returns 0 on success.
+ * Paths come from a file someone handed us: relative, and
+ * without `..`, empty or dot components.
  */
 
 static int
-fetch_package_file(
-      clib_package_t *pkg
-    , const char *dir
-    , char *file
-    , int verbose
-  ) {
-  char *url = NULL;
-  char *path = NULL;
-  int rc = 0;
-  http_get_response_t *res = NULL;
-
-  _debug("fetch file: %s/%s", pkg->repo, file);
+bundle_path_valid(const std::string &path, int base) {
+  if (path.empty() || '/' == path[0]) return 0;
+  if (base && std::string::npos != path.find('/')) return 0;
+  for (size_t start = 0; start <= path.size();) {
+    size_t end = path.find('/', start);
+    if (std::string::npos == end) end = path.size();
+    if (end == start || '.' == path[start]) return 0;
+    start = end + 1;
+  }
+  return 1;
+}
 
-  std::string try_url = pkg->api_endpoint;
-  try_url += std::string("repos/");
-  try_url += std::string(pkg->author);
-  try_url += std::string("/");
-  try_url += std::string(pkg->name);
-  try_url += std::string("/contents/");
-  try_url += std::string(file[0] == '@' ? &file[1] : file);
-  try_url += std::string("?ref=master");
-  //try_url += std::string(pkg->version);
-  printf("Making API call at %s\n", try_url.c_str());
+static int
+bundle_read_at(int fd, std::string *out, uint64_t offset, size_t len) {
+  out->resize(len);
+  size_t done = 0;
+  while (done < len) {
+    ssize_t n = pread(fd, &(*out)[done], len - done, (off_t) (offset + done));
+    if (n < 0 && EINTR == errno) continue;
+    if (n <= 0) return -1;
+    done += n;
+  }
+  return 0;
+}
 
-  res = http_get(try_url.c_str());
-  if( res && res->ok) {
-    JSON_Value * root = json_parse_string(res->data);
-    JSON_Object * obj = json_value_get_object(root);
-    char * download_url = json_object_get_string_safe(obj, "download_url");
-    json_value_free(root);
-    http_get_free(res);
+/**
+ * Read the header and trailing index of the bundle open as
+ * `r->fd`, checking its key against `key` (if given).
+ */
 
-    char * dpart = strdup(file);
-    char * pkg_dir = path_join(dir, dirname(dpart) + (file[0] == '@' ? 1 : 0));
-    mkdirp(pkg_dir, 0777);
-    free(pkg_dir);
+static int
+bundle_read_index(struct bundle_reader *r, const char *key) {
+  std::string buf;
+  const char *p = NULL;
+  const char *end = NULL;
+  uint64_t n = 0, offset = 0, size = 0, count = 0;
+  struct stat st;
+
+  if (-1 == fstat(r->fd, &st) || st.st_size < 28) return -1;
+
+  if (-1 == bundle_read_at(r->fd, &buf, 0, 12)) return -1;
+  p = buf.data();
+  end = p + buf.size();
+  if (0 != memcmp(p, BUNDLE_MAGIC, 4)) return -1;
+  p += 4;
+  bundle_get(&p, end, &n, 4);
+  if (BUNDLE_VERSION != n) return -1;
+  bundle_get(&p, end, &size, 4);
+  if (size > (uint64_t) st.st_size) return -1;
+  std::string stored_key;
+  if (-1 == bundle_read_at(r->fd, &stored_key, 12, size)) return -1;
+  if (key && stored_key != key) {
+    _debug("bundle: key %s, wanted %s", stored_key.c_str(), key);
+    return -1;
+  }
 
-    file = (file[0] == '@') ? &file[1] : basename(file);
-    if (!(path = path_join(dir, file))) {
-      rc = 1;
-      goto cleanup;
+  if (-1 == bundle_read_at(r->fd, &buf, st.st_size - 16, 16)) return -1;
+  p = buf.data();
+  end = p + buf.size();
+  bundle_get(&p, end, &offset, 8);
+  bundle_get(&p, end, &size, 4);
+  if (0 != memcmp(p, BUNDLE_MAGIC, 4)) return -1;
+  if (offset + size + 16 != (uint64_t) st.st_size) return -1;
+  if (-1 == bundle_read_at(r->fd, &buf, offset, size)) return -1;
+
+  p = buf.data();
+  end = p + buf.size();
+  if (-1 == bundle_get(&p, end, &count, 4)) return -1;
+  for (uint64_t i = 0; i < count; i++) {
+    struct bundle_frame frame;
+    uint64_t v[4];
+    for (int k = 0; k < 4; k++) {
+      if (-1 == bundle_get(&p, end, &v[k], k ? 4 : 8)) return -1;
+    }
+    frame.offset = v[0];
+    frame.stored = (uint32_t) v[1];
+    frame.size = (uint32_t) v[2];
+    frame.codec = (uint32_t) v[3];
+    if (frame.offset + frame.stored > offset) return -1;
+    r->frames.push_back(frame);
+  }
+  r->by_frame.resize(r->frames.size());
+
+  if (-1 == bundle_get(&p, end, &count, 4)) return -1;
+  for (uint64_t i = 0; i < count; i++) {
+    struct bundle_entry entry;
+    uint64_t v[6];
+    static const size_t widths[] = { 4, 4, 4, 4, 1, 2 };
+    for (int k = 0; k < 6; k++) {
+      if (-1 == bundle_get(&p, end, &v[k], widths[k])) return -1;
     }
+    if ((uint64_t) (end - p) < v[5]) return -1;
+    entry.frame = (uint32_t) v[0];
+    entry.offset = (uint32_t) v[1];
+    entry.size = (uint32_t) v[2];
+    entry.mode = (uint32_t) v[3] & 0777;
+    entry.base = (uint8_t) v[4];
+    entry.path.assign(p, v[5]);
+    p += v[5];
+
+    if (entry.frame >= r->frames.size()) return -1;
+    if ((uint64_t) entry.offset + entry.size > r->frames[entry.frame].size) return -1;
+    if (!bundle_path_valid(entry.path, entry.base)) return -1;
+    r->by_frame[entry.frame].push_back(r->entries.size());
+    r->entries.push_back(entry);
+  }
+  return 0;
+}
 
-    if(verbose) logger_info("fetch", "%s -> %s(%s)", url, path, file);
+static int
+bundle_decode(const struct bundle_frame &frame, std::string *stored, std::string *raw) {
+  if (BUNDLE_STORED == frame.codec) {
+    if (stored->size() != frame.size) return -1;
+    raw->swap(*stored);
+    return 0;
+  }
+#ifdef CLIB_PACKAGE_ZSTD
+  if (BUNDLE_ZSTD == frame.codec) {
+    raw->resize(frame.size);
+    size_t n = ZSTD_decompress(&(*raw)[0], raw->size(), stored->data(), stored->size());
+    return ZSTD_isError(n) || n != frame.size ? -1 : 0;
+  }
+#endif
+  logger_error("error", "bundle frame codec %u not supported by this build%s"
+    , frame.codec
+    , BUNDLE_ZSTD == frame.codec ? " (built without zstd)" : "");
+  return -1;
+}
 
-    if (-1 == http_get_file(download_url, path)) {
-      logger_error("error", "unable to fetch %s:%s", pkg->repo, file);
-      rc = 1;
-      goto cleanup;
-    }
+/**
+ * Decode frame `i` and write out its files.
+ */
 
-    if (verbose) logger_info("save", path);
+static int
+bundle_unpack_frame(struct bundle_reader *r, size_t i, std::string *stored, std::string *raw, std::string *made) {
+  const struct bundle_frame &frame = r->frames[i];
+  if (-1 == bundle_read_at(r->fd, stored, frame.offset, frame.stored)) return -1;
+  if (-1 == bundle_decode(frame, stored, raw)) return -1;
+
+  for (size_t k = 0; k < r->by_frame[i].size(); k++) {
+    const struct bundle_entry &entry = r->entries[r->by_frame[i][k]];
+    std::string path = entry.base
+      ? r->root + "/" + entry.path + ".bundle"
+      : r->dir + "/" + entry.path;
+    std::string parent = path.substr(0, path.rfind('/'));
+
+    // files of a package are neighbours in the index
+    if (parent != *made) {
+      if (-1 == mkdirp(parent.c_str(), 0777)) return -1;
+      *made = parent;
+    }
+    int fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, entry.mode ? entry.mode : 0644);
+    if (-1 == fd) return -1;
+    int rc = fd_write_all(fd, raw->data() + entry.offset, entry.size);
+    if (0 != close(fd)) rc = -1;
+    if (-1 == rc) return -1;
   }
+  return 0;
+}
 
-cleanup:
-  free(path);
-  return rc;
+static void *
+bundle_unpack_worker(void *arg) {
+  struct bundle_reader *r = (struct bundle_reader *) arg;
+  std::string stored;
+  std::string raw;
+  std::string made;
+
+  for (;;) {
+    pthread_mutex_lock(&r->mutex);
+    size_t i = r->next++;
+    int failed = r->failed;
+    pthread_mutex_unlock(&r->mutex);
+    if (failed || i >= r->frames.size()) break;
+
+    if (-1 == bundle_unpack_frame(r, i, &stored, &raw, &made)) {
+      pthread_mutex_lock(&r->mutex);
+      r->failed = 1;
+      pthread_mutex_unlock(&r->mutex);
+    }
+  }
+  return NULL;
 }
 
 /**
- * Install the given `pkg` in `dir`
+ * Unpack `bundle` into `dir`, replacing what is there, and
+ * the `deps.mk` beside it, decoding frames on up to `threads`
+ * threads (0 for one per CPU).  With `key`, a bundle packed
+ * for a different manifest is refused.  The tree is unpacked
+ * aside and swapped in whole, like an install.
+ *
+ * Returns 0 on success.
  */
 
 int
-clib_package_install(clib_package_t *pkg, const char *dir, int verbose) {
-  char *pkg_dir = NULL;
-  char *package_json = NULL;
-  list_iterator_t *iterator = NULL;
+clib_package_bundle_unpack(const char *bundle, const char *dir, const char *key, int threads) {
+  struct bundle_reader r;
+  std::vector<pthread_t> workers;
+  std::string target;
+  std::string staged;
   int rc = -1;
-  pthread_t threadids[255];
-  int i = 0;
-  list_node_t *source;
-  char * fname, *mkfile;
-  FILE * it;
-  char * cmdline;
-  struct stat finfo;
-  char * localjson = NULL;
 
-  if (!pkg || !dir) goto cleanup;
-  if (!(pkg_dir = path_join(dir, pkg->name))) goto cleanup;
+  if (!bundle || !dir) return -1;
+  target = dir;
+  while (target.size() > 1 && '/' == target[target.size() - 1]) target.erase(target.size() - 1);
+  size_t slash = target.rfind('/');
+  r.root = std::string::npos == slash ? "." : 0 == slash ? "/" : target.substr(0, slash);
+  r.dir = staged = target + ".unpack";
+  r.next = 0;
+  r.failed = 0;
+  pthread_mutex_init(&r.mutex, NULL);
+
+  if (-1 == (r.fd = open(bundle, O_RDONLY | O_CLOEXEC))) goto cleanup;
+  if (-1 == bundle_read_index(&r, key)) {
+    _debug("bundle: %s is not a usable bundle", bundle);
+    goto cleanup;
+  }
 
-  _debug("mkdir -p %s", pkg_dir);
-  // create directory for pkg
-  if (-1 == mkdirp(pkg_dir, 0777)) goto cleanup;
+  rimraf(staged.c_str());
+  if (-1 == mkdirp(staged.c_str(), 0777)) goto cleanup;
 
-  if (NULL == pkg->url) {
-    pkg->url = clib_package_url(pkg->author
-      , pkg->repo_name
-      , pkg->version);
-    if (NULL == pkg->url) goto cleanup;
+  if (threads <= 0) threads = (int) sysconf(_SC_NPROCESSORS_ONLN);
+  if (threads > CLIB_PACKAGE_BUNDLE_THREADS) threads = CLIB_PACKAGE_BUNDLE_THREADS;
+  if ((size_t) threads > r.frames.size()) threads = (int) r.frames.size();
+  for (int i = 1; i < threads; i++) {
+    pthread_t thread;
+    if (0 != pthread_create(&thread, NULL, bundle_unpack_worker, &r)) break;
+    workers.push_back(thread);
   }
+  bundle_unpack_worker(&r);
+  for (size_t i = 0; i < workers.size(); i++) pthread_join(workers[i], NULL);
 
-  // write package.json
-  if (!(package_json = path_join(pkg_dir, "package.json"))) goto cleanup;
+  if (!r.failed && 0 == dir_publish(staged.c_str(), target.c_str(), (target + ".old").c_str())) {
+    rc = 0;
+  }
+  for (size_t i = 0; i < r.entries.size(); i++) {
+    if (!r.entries[i].base) continue;
+    std::string file = r.root + "/" + r.entries[i].path;
+    if (0 == rc && 0 != rename((file + ".bundle").c_str(), file.c_str())) rc = -1;
+    unlink((file + ".bundle").c_str());
+  }
 
-  _debug("reading local package.json");
-  localjson = fs_read(package_json);
-  if (NULL != localjson)
-  {
-      clib_package_t *localpkg = clib_package_new(localjson, verbose, pkg->cfg);
+cleanup:
+  if (0 != rc) rimraf(staged.c_str());
+  if (-1 != r.fd) close(r.fd);
+  pthread_mutex_destroy(&r.mutex);
+  return rc;
+}
 
-      semver_t current_version = {};
-      semver_t compare_version = {};
-      semver_parse(localpkg->version, &current_version);
-      semver_parse(pkg->version, &compare_version);
+/**
+ * What `clib_package_outdated()` remembers between runs about
+ * each package, in `<dir>/.outdated`: the endpoint serving it,
+ * the ETag and sha of its upstream head commit, the blob sha
+ * and version of the package.json there, and the commit its
+ * installed version points at.  With it a package that did
+ * not change costs one conditional request, which GitHub
+ * answers with a 304 outside the quota.
+ */
 
-      int resolution = semver_compare(compare_version, current_version);
-      semver_free(&current_version);
-      semver_free(&compare_version);
+struct outdated_memo {
+  std::string endpoint;
+  std::string etag;
+  std::string commit;
+  std::string sha;
+  std::string version;
+  std::string installed;
+  std::string installed_commit;
+};
 
-      if (resolution == 0 || resolution == -1) {
-          if (verbose) logger_info("skipping", "new v%s is equal or lower than installed v%s for %s", pkg->version, localpkg->version, pkg->repo);
-          rc = 0;
-          clib_package_free(localpkg);
-          goto cleanup;
-      }
-      clib_package_free(localpkg);
+struct outdated_check {
+  pthread_t thread;
+  int threaded;
+  clib_package_ctx_t *ctx;
+  clib_package_cancel_t *cancel;
+  std::string name;
+  std::string repo;
+  std::string installed;
+  std::string installed_sha;
+  struct outdated_memo memo;
+  std::string error;
+  int rc;
+};
+
+static void
+outdated_memo_read(const std::string &path, std::map<std::string, struct outdated_memo> *memos) {
+  char line[4096];
+  char repo[512], endpoint[512], etag[512], commit[128], sha[128], version[128];
+  char installed[128], installed_commit[128];
+  FILE *file = fopen(path.c_str(), "r");
+  if (!file) return;
+  while (fgets(line, sizeof(line), file)) {
+    if (8 != sscanf(line, "%511s %511s %511s %127s %127s %127s %127s %127s"
+          , repo, endpoint, etag, commit, sha, version, installed, installed_commit)) {
+      continue;
+    }
+    struct outdated_memo &memo = (*memos)[repo];
+    memo.endpoint = strcmp(endpoint, "-") ? endpoint : "";
+    memo.etag = strcmp(etag, "-") ? etag : "";
+    memo.commit = strcmp(commit, "-") ? commit : "";
+    memo.sha = strcmp(sha, "-") ? sha : "";
+    memo.version = strcmp(version, "-") ? version : "";
+    memo.installed = strcmp(installed, "-") ? installed : "";
+    memo.installed_commit = strcmp(installed_commit, "-") ? installed_commit : "";
   }
+  fclose(file);
+}
 
-  _debug("write: %s", package_json);
-  if (-1 == fs_write(package_json, pkg->json)) {
-    logger_error("error", "Failed to write %s", package_json);
-    goto cleanup;
+static void
+outdated_memo_write(const std::string &path, const std::vector<struct outdated_check *> &checks) {
+  std::string out;
+  std::string staged = path + ".tmp";
+  for (size_t i = 0; i < checks.size(); i++) {
+    const struct outdated_memo &memo = checks[i]->memo;
+    if (memo.version.empty() || memo.commit.empty()) continue;
+    out += checks[i]->repo + " ";
+    out += (memo.endpoint.empty() ? "-" : memo.endpoint) + " ";
+    out += (memo.etag.empty() || memo.etag.find(' ') != std::string::npos ? "-" : memo.etag) + " ";
+    out += memo.commit + " ";
+    out += (memo.sha.empty() ? "-" : memo.sha) + " ";
+    out += memo.version + " ";
+    out += (memo.installed.empty() ? "-" : memo.installed) + " ";
+    out += (memo.installed_commit.empty() ? "-" : memo.installed_commit) + "\n";
   }
+  if (-1 != fs_write(staged.c_str(), out.c_str())) rename(staged.c_str(), path.c_str());
+}
 
-  // fetch makefile
-  if (pkg->makefile) {
-    _debug("fetch: %s/%s", pkg->repo, pkg->makefile);
-    if (0 != fetch_package_file(pkg, pkg_dir, pkg->makefile, verbose)) {
-      goto cleanup;
+/**
+ * GET a JSON document from the API and read `field` of it.
+ *
+ * Returns the response, with `*value` set when it was a 200.
+ */
+
+static clib_package_response_t *
+outdated_get(struct outdated_check *check
+    , const std::string &url
+    , const char *if_none_match
+    , const char *field
+    , std::string *value) {
+  clib_package_response_t *res = http_request_retry(check->ctx, url.c_str(), NULL, if_none_match, 1, check->cancel);
+  value->clear();
+  if (res && res->ok) {
+    JSON_Value *root = json_parse_string(res->data);
+    const char *found = json_object_get_string(json_value_get_object(root), field);
+    if (found) *value = found;
+    json_value_free(root);
+  }
+  return res;
+}
+
+/**
+ * Find the upstream head commit and version of one installed
+ * package, and the commit it was installed from.  Failures
+ * are kept in `check->error` rather than canceling the other
+ * checks.
+ */
+
+static void *
+outdated_check_run(void *arg) {
+  struct outdated_check *check = (struct outdated_check *) arg;
+  clib_package_ctx_t *ctx = check->ctx;
+  clib_package_response_t *res = NULL;
+  struct outdated_memo memo = check->memo;
+  const char *endpoint = NULL;
+  char *author = NULL;
+  char *name = NULL;
+  std::string repo;
+  std::string commit;
+  std::string download_url;
+  std::string sha;
+  std::string etag;
+
+  check->rc = -1;
+  if (!(author = parse_repo_owner(check->repo.c_str(), DEFAULT_REPO_OWNER))
+      || !(name = parse_repo_name(check->repo.c_str()))) {
+    check->error = "invalid repo";
+    goto done;
+  }
+
+  // skip discovery when the remembered endpoint is still configured
+  for (size_t i = 0; i < ctx->api_endpoints.size(); i++) {
+    if (ctx->api_endpoints[i] == memo.endpoint) endpoint = ctx->api_endpoints[i].c_str();
+  }
+  if (!endpoint) memo.etag.clear();
+  if (!endpoint && !(endpoint = clib_package_find_api_endpoint(author, name, ctx, check->cancel))) {
+    check->error = "failed to find api endpoint";
+    goto done;
+  }
+  memo.endpoint = endpoint;
+  repo = std::string(endpoint) + "repos/" + author + "/" + name;
+
+  res = outdated_get(check, repo + "/commits/" + DEFAULT_REPO_VERSION
+    , memo.etag.empty() ? NULL : memo.etag.c_str()
+    , "sha", &commit);
+  if (!memo.etag.empty()) stats_add(&ctx->stats, revalidations, 1);
+  if (res && 304 == res->status && !memo.version.empty() && !memo.commit.empty()) {
+    stats_add(&ctx->stats, not_modified, 1);
+    if (check->installed == memo.installed) {
+      check->rc = 0;
+      goto done;
     }
+    commit = memo.commit;
+    etag = memo.etag;
+  } else if (!res || !res->ok || commit.empty()) {
+    check->error = "unable to fetch the head commit";
+    goto done;
+  } else if (res->etag) {
+    etag = res->etag;
   }
+  http_response_free(res);
+  res = NULL;
 
-  // if no sources are listed, just install
-  if (NULL == pkg->src) goto install;
+  // the commit the installed version points at
+  if (check->installed != memo.installed || memo.installed_commit.empty()) {
+    std::string installed_commit;
+    res = outdated_get(check, repo + "/commits/" + check->installed, NULL, "sha", &installed_commit);
+    http_response_free(res);
+    res = NULL;
+    memo.installed = check->installed;
+    memo.installed_commit = installed_commit;
+  }
 
-  iterator = list_iterator_new(pkg->src, LIST_HEAD);
+  // nothing was committed since the installed version
+  if (commit == memo.installed_commit) {
+    memo.etag = etag;
+    memo.commit = commit;
+    memo.sha = check->installed_sha;
+    memo.version = check->installed;
+    check->rc = 0;
+    goto done;
+  }
 
-  i = 0;
-  while ((source = list_iterator_next(iterator))) {
-      threadids[i++] = create_fetch_package_file_threaded(pkg, pkg_dir, (char *)source->val, verbose);
+  res = outdated_get(check, repo + "/contents/package.json?ref=" + commit, NULL, "sha", &sha);
+  if (!res || !res->ok) {
+    check->error = "unable to fetch package.json";
+    goto done;
   }
-  for (int j = 0; j < i; j++)
   {
-      pthread_join(threadids[j], NULL);
+    JSON_Value *root = json_parse_string(res->data);
+    const char *url = json_object_get_string(json_value_get_object(root), "download_url");
+    if (url) download_url = url;
+    json_value_free(root);
   }
+  http_response_free(res);
+  res = NULL;
 
-  /* Create a .mk file for the project */
-  fname = concat(pkg->name, ".mk");
-  mkfile = path_join(pkg_dir, fname);
-  it = fopen(mkfile, "w+");
-  fputs("deps_", it);
-  fputs("_a_SOURCES += ", it);
-  iterator = list_iterator_new(pkg->src, LIST_HEAD);
-  while ((source = list_iterator_next(iterator))) {
-      char * fname = strdup((char *)source->val);
-      char * fmod = (fname[0] == '@') ? &fname[1] : basename(fname);
-      fputs("deps/", it);
-      fputs(pkg->name, it);
-      fputs("/", it);
-      fputs(fmod, it);
-      fputs(" ", it);
-      free(fname);
-  }
-  fputs("\n", it);
-  fclose(it);
-  free(fname);
-  free(mkfile);
-
-  cmdline = (char*)malloc(4096);
-  sprintf(cmdline, "sed -i '/include $(top_srcdir)\\/deps\\/%s\\/%s.mk/d' deps.mk; echo 'include $(top_srcdir)/deps/%s/%s.mk' >> deps.mk",
-      pkg->name, pkg->name, pkg->name, pkg->name);
-  rc = system(cmdline);
-  free(cmdline);
+  // the same package.json as last time, or as installed
+  if (!sha.empty() && sha == memo.sha && !memo.version.empty()) {
+    memo.etag = etag;
+    memo.commit = commit;
+    check->rc = 0;
+    goto done;
+  }
+  if (!sha.empty() && sha == check->installed_sha) {
+    memo.etag = etag;
+    memo.commit = commit;
+    memo.sha = sha;
+    memo.version = check->installed;
+    check->rc = 0;
+    goto done;
+  }
 
-install:
-  rc = clib_package_install_dependencies(pkg, dir, verbose);
+  res = download_url.empty()
+    ? NULL
+    : http_request_retry(ctx, download_url.c_str(), NULL, NULL, 0, check->cancel);
+  if (!res || !res->ok) {
+    check->error = "unable to fetch package.json";
+    goto done;
+  }
+  {
+    JSON_Value *root = json_parse_string(res->data);
+    const char *version = json_object_get_string(json_value_get_object(root), "version");
+    memo.version = version ? version : "";
+    json_value_free(root);
+  }
+  if (memo.version.empty()) {
+    check->error = "package.json has no version";
+    goto done;
+  }
+  memo.etag = etag;
+  memo.commit = commit;
+  memo.sha = sha;
+  check->rc = 0;
 
-cleanup:
-  if (pkg_dir) free(pkg_dir);
-  if (package_json) free(package_json);
-  if (iterator) list_iterator_destroy(iterator);
-  return rc;
+done:
+  if (0 == check->rc) check->memo = memo;
+  http_response_free(res);
+  free(author);
+  free(name);
+  return NULL;
 }
 
 /**
- * Install the given `pkg`'s dependencies in `dir`
+ * Check every package installed in `dir` against upstream,
+ * in parallel and without installing anything.
+ *
+ * Returns a list of `clib_package_outdated_t` for the packages
+ * with a newer version or new commits upstream, and for those
+ * that could not be checked, with `error` set.  Returns NULL
+ * when `dir` cannot be read or the check was canceled
+ * (`cancel`, if given, then holds the error).
  */
 
-int
-clib_package_install_dependencies(clib_package_t *pkg
-    , const char *dir
-    , int verbose) {
-  if (!pkg || !dir) return -1;
-  if (NULL == pkg->dependencies) return 0;
+list_t *
+clib_package_outdated(const char *dir, clib_package_ctx_t *ctx, clib_package_cancel_t *cancel) {
+  std::vector<struct outdated_check *> checks;
+  std::map<std::string, struct outdated_memo> memos;
+  std::string memo_path;
+  struct index_map index;
+  struct dirent *entry = NULL;
+  list_t *outdated = NULL;
+  DIR *deps = NULL;
+  int indexed = 0;
+  int owned = 0;
+
+  if (!dir) return NULL;
+  ctx = ctx_get(ctx);
+  if (!cancel) {
+    if (!(cancel = clib_package_cancel_new(ctx->install_timeout_ms))) return NULL;
+    owned = 1;
+  }
+  if (!(deps = opendir(dir))) {
+    clib_package_cancel(cancel, CLIB_PACKAGE_ERESOLVE, NULL, "unable to read deps directory");
+    goto cleanup;
+  }
+  memo_path = std::string(dir) + "/.outdated";
+  outdated_memo_read(memo_path, &memos);
+  indexed = 0 == index_open((std::string(dir) + "/.index").c_str(), &index);
+
+  while ((entry = readdir(deps))) {
+    if ('.' == entry->d_name[0]) continue;
+    std::string package_json = std::string(dir) + "/" + entry->d_name + "/package.json";
+    char *json = fs_read(package_json.c_str());
+    if (!json) continue;
+    clib_package_t *pkg = clib_package_new(json, 0, ctx);
+    free(json);
+    if (pkg && pkg->repo && pkg->name && pkg->version) {
+      struct outdated_check *check = new struct outdated_check;
+      struct index_record rec;
+      check->threaded = 0;
+      check->ctx = ctx;
+      check->cancel = cancel;
+      check->name = pkg->name;
+      check->repo = pkg->repo;
+      check->installed = pkg->version;
+      if (indexed && 0 == index_find(&index, pkg->name, &rec)) check->installed_sha = rec.sha;
+      if (memos.count(check->repo)) check->memo = memos[check->repo];
+      check->rc = 0;
+      checks.push_back(check);
+    }
+    if (pkg) clib_package_free(pkg);
+  }
+  closedir(deps);
+  if (indexed) index_close(&index);
 
-  return install_packages(pkg->dependencies, dir, verbose, pkg->cfg);
-}
+  for (size_t i = 0; i < checks.size(); i++) {
+    checks[i]->threaded = 0 == pthread_create(&checks[i]->thread, NULL, outdated_check_run, checks[i]);
+    if (!checks[i]->threaded) outdated_check_run(checks[i]);
+  }
+  for (size_t i = 0; i < checks.size(); i++) {
+    if (checks[i]->threaded) pthread_join(checks[i]->thread, NULL);
+  }
+  if (cancel_check(cancel)) goto cleanup;
+  outdated_memo_write(memo_path, checks);
+
+  outdated = list_new();
+  outdated->free = clib_package_outdated_free;
+  for (size_t i = 0; i < checks.size(); i++) {
+    struct outdated_check *check = checks[i];
+    int newer = 0;
+    int changed = 0;
+    if (0 == check->rc) {
+      semver_t installed = {};
+      semver_t latest = {};
+      if (0 == semver_parse(check->installed.c_str(), &installed)
+          && 0 == semver_parse(check->memo.version.c_str(), &latest)) {
+        newer = 1 == semver_compare(latest, installed);
+      } else {
+        newer = check->installed != check->memo.version;
+      }
+      semver_free(&installed);
+      semver_free(&latest);
+      // without a commit for the installed version, fall back to its package.json
+      changed = check->memo.installed_commit.empty()
+        ? !check->installed_sha.empty() && check->installed_sha != check->memo.sha
+        : check->memo.commit != check->memo.installed_commit;
+      if (!newer && !changed) continue;
+    }
 
-/**
- * Install the given `pkg`'s development dependencies in `dir`
- */
+    clib_package_outdated_t *entry = (clib_package_outdated_t *) malloc(sizeof(clib_package_outdated_t));
+    if (!entry) continue;
+    entry->name = strdup(check->name.c_str());
+    entry->repo = strdup(check->repo.c_str());
+    entry->installed = strdup(check->installed.c_str());
+    entry->latest = 0 == check->rc ? strdup(check->memo.version.c_str()) : NULL;
+    entry->error = 0 == check->rc ? NULL : strdup(check->error.c_str());
+    entry->newer = newer;
+    entry->changed = changed;
+    list_rpush(outdated, list_node_new(entry));
+  }
 
-int
-clib_package_install_development(clib_package_t *pkg
-    , const char *dir
-    , int verbose) {
-  if (!pkg || !dir) return -1;
-  if (NULL == pkg->development) return 0;
+cleanup:
+  for (size_t i = 0; i < checks.size(); i++) delete checks[i];
+  if (owned) {
+    const clib_package_error_t *err = clib_package_cancel_error(cancel);
+    if (err) {
+      logger_error("error", "%s%s%s"
+        , err->slug ? err->slug : ""
+        , err->slug ? ": " : ""
+        , err->message ? err->message : "outdated check failed");
+    }
+    clib_package_cancel_free(cancel);
+  }
+  return outdated;
+}
 
-  return install_packages(pkg->development, dir, verbose, pkg->cfg);
+void
+clib_package_outdated_free(void *_entry) {
+  clib_package_outdated_t *entry = (clib_package_outdated_t *) _entry;
+  if (!entry) return;
+  free(entry->name);
+  free(entry->repo);
+  free(entry->installed);
+  free(entry->latest);
+  free(entry->error);
+  free(entry);
 }
 
 /**
@@ -913,10 +7192,12 @@ clib_package_free(clib_package_t *pkg) {
   free(pkg->author);
   free(pkg->description);
   free(pkg->install);
+  if (pkg->json) budget_uncharge(&pkg->ctx->budget, strlen(pkg->json) + 1);
   free(pkg->json);
   free(pkg->license);
   free(pkg->name);
   free(pkg->makefile);
+  free(pkg->sha);
   free(pkg->repo);
   free(pkg->repo_name);
   free(pkg->url);
@@ -9,6 +9,7 @@
 #ifndef CLIB_PACKAGE_H
 #define CLIB_PACKAGE_H 1
 
+#include <stddef.h>
 #include "list/list.h"
 
 typedef struct {
@@ -21,6 +22,150 @@ typedef struct {
   list_t * api_endpoints;
 } clib_package_cfg_t;
 
+typedef enum {
+  CLIB_PACKAGE_OK = 0,
+  CLIB_PACKAGE_ERESOLVE,  // package.json could not be resolved
+  CLIB_PACKAGE_EFETCH,    // a source file could not be fetched
+  CLIB_PACKAGE_EWRITE,    // something could not be written to disk
+  CLIB_PACKAGE_ETIMEOUT,  // the install deadline passed
+  CLIB_PACKAGE_ECANCELED, // cancelled by the caller
+  CLIB_PACKAGE_EBUILD,    // a post-install command failed
+} clib_package_error_code_t;
+
+typedef struct {
+  clib_package_error_code_t code;
+  char *slug;
+  char *message;
+} clib_package_error_t;
+
+typedef struct clib_package_cancel clib_package_cancel_t;
+
+/**
+ * Build files an install writes besides `deps.mk`, see
+ * `clib_package_set_outputs()`.
+ */
+
+#define CLIB_PACKAGE_OUTPUT_NINJA 1
+#define CLIB_PACKAGE_OUTPUT_COMPILE_COMMANDS 2
+#define CLIB_PACKAGE_OUTPUT_UNITY 4
+
+/**
+ * Progress of an install: `event` ("resolve", "resolved",
+ * "fetch", "link", "skip", "installed", "build" or
+ * "built"), the package `slug` and an event specific
+ * `detail` (may be NULL).
+ */
+
+typedef void (*clib_package_progress_fn)(const char *, const char *, const char *, void *);
+
+/**
+ * An install session: configuration, transport, concurrency
+ * controller, memory budget, trace and statistics.  Sessions
+ * are independent, so several may run in one process.  APIs
+ * given a NULL session use a shared default one.
+ */
+
+typedef struct clib_package_ctx clib_package_ctx_t;
+
+/**
+ * Request latencies are kept in log buckets, four per power
+ * of two microseconds; `clib_package_stats_bucket_ms(i)` is
+ * the upper bound of bucket `i`.  The last bucket also holds
+ * everything slower.
+ */
+
+#define CLIB_PACKAGE_STATS_BUCKETS 112
+
+typedef struct {
+  unsigned long packages_resolved;
+  unsigned long packages_deduplicated; // already claimed in this install
+  unsigned long packages_skipped;      // installed copy is as new or newer
+  unsigned long packages_failed;
+  unsigned long packages_built;        // post-install commands run
+  unsigned long files_fetched;
+  unsigned long files_linked;          // materialized from the content store
+  unsigned long files_unchanged;       // kept from the installed copy on upgrade
+  unsigned long files_skipped;         // not fetched as their package was skipped
+  unsigned long requests;
+  unsigned long requests_by_class[6];  // [0] transport errors, [n] nxx
+  unsigned long retries;
+  unsigned long long bytes_wire;
+  unsigned long long bytes_decoded;
+  unsigned long store_lookups;         // content store, sources and package.json
+  unsigned long store_hits;
+  unsigned long manifest_lookups;      // package.json cache of the session
+  unsigned long manifest_hits;
+  unsigned long downloads_resumed;     // partial downloads answered with a 206
+  unsigned long revalidations;         // conditional requests of outdated checks
+  unsigned long not_modified;          // of which answered with a 304
+  unsigned long cache_evicted;         // blobs the store collector removed
+  unsigned long long bytes_reclaimed;
+  double latency_p50_ms;
+  double latency_p95_ms;
+  double latency_p99_ms;
+  unsigned long latency_buckets[CLIB_PACKAGE_STATS_BUCKETS];
+} clib_package_stats_t;
+
+/**
+ * What a collection of the content store did and left:
+ * `bytes` is the apparent size of the blobs, `bytes_allocated`
+ * what they take on disk, of which `bytes_shared` is also
+ * linked from installed trees.  `fragmentation` is the share
+ * of allocated space lost to block rounding.
+ */
+
+typedef struct {
+  unsigned long blobs;
+  unsigned long long bytes;
+  unsigned long long bytes_allocated;
+  unsigned long long bytes_shared;
+  unsigned long evicted;
+  unsigned long long bytes_reclaimed;
+  unsigned long skipped; // used while being collected
+  unsigned long stale;   // abandoned temporary files removed
+  double fragmentation;
+} clib_package_store_stats_t;
+
+typedef struct clib_package_response clib_package_response_t;
+
+/**
+ * Network access goes through a transport.  `get` fetches
+ * `url`, into the file `path` when given and the response is
+ * a 2xx, and reports what it got with the
+ * `clib_package_response_*()` functions.  It returns 0 when a
+ * response (of any status) was received.
+ */
+
+typedef struct clib_package_transport clib_package_transport_t;
+
+struct clib_package_transport {
+  int (*get)(clib_package_transport_t *
+    , const char *
+    , const char *
+    , clib_package_cancel_t *
+    , clib_package_response_t *);
+  void (*free)(clib_package_transport_t *);
+  void *data;
+};
+
+/**
+ * An installed package that is behind upstream: `latest` is
+ * a newer version than `installed`, or upstream has `changed`
+ * with commits since the one `installed` points at.  When the
+ * package could not be checked, `error` says why and `latest`
+ * is NULL.
+ */
+
+typedef struct {
+  char *name;
+  char *repo;
+  char *installed;
+  char *latest;
+  char *error;
+  int newer;
+  int changed;
+} clib_package_outdated_t;
+
 typedef struct {
   char *author;
   char *description;
@@ -33,19 +178,51 @@ typedef struct {
   char *url;
   char *version;
   char *makefile;
+  char *sha; // blob sha of the resolved package.json, if known
   list_t *dependencies;
   list_t *development;
   list_t *src;
   clib_package_cfg_t * package_cfg;
-  const char * cfg;
+  clib_package_ctx_t * ctx;
   const char * api_endpoint;
+  clib_package_cancel_t * cancel;
 } clib_package_t;
 
+clib_package_ctx_t *
+clib_package_ctx_new(const char *);
+
+void
+clib_package_ctx_free(clib_package_ctx_t *);
+
+clib_package_t *
+clib_package_new(const char *, int, clib_package_ctx_t *);
+
+void
+clib_package_set_manifest_ttl(clib_package_ctx_t *, long);
+
+void
+clib_package_set_install_jobs(clib_package_ctx_t *, int);
+
+void
+clib_package_set_outputs(clib_package_ctx_t *, unsigned);
+
+void
+clib_package_set_store(clib_package_ctx_t *, const char *);
+
+void
+clib_package_set_store_limit(clib_package_ctx_t *, unsigned long long);
+
+int
+clib_package_store_gc(clib_package_ctx_t *, clib_package_store_stats_t *);
+
+int
+clib_package_set_offline(clib_package_ctx_t *, const char *);
+
 clib_package_t *
-clib_package_new(const char *, int, const char *);
+clib_package_new_from_slug(const char *, int, clib_package_ctx_t *);
 
 clib_package_t *
-clib_package_new_from_slug(const char *, int, const char *);
+clib_package_resolve(const char *, int, clib_package_ctx_t *, clib_package_cancel_t *);
 
 char *
 clib_package_url(const char *, const char *, const char *);
@@ -74,10 +251,111 @@ clib_package_install_dependencies(clib_package_t *, const char *, int);
 int
 clib_package_install_development(clib_package_t *, const char *, int);
 
+int
+clib_package_mirror_export(const char *
+  , const char **
+  , int
+  , clib_package_ctx_t *
+  , clib_package_cancel_t *);
+
+char *
+clib_package_bundle_key(const char *);
+
+int
+clib_package_bundle_pack(const char *, const char *, const char *);
+
+int
+clib_package_bundle_unpack(const char *, const char *, const char *, int);
+
+list_t *
+clib_package_outdated(const char *, clib_package_ctx_t *, clib_package_cancel_t *);
+
+void
+clib_package_outdated_free(void *);
+
 void
 clib_package_free(clib_package_t *);
 
 void
 clib_package_dependency_free(void *);
 
+clib_package_cancel_t *
+clib_package_cancel_new(long);
+
+void
+clib_package_cancel(clib_package_cancel_t *
+  , clib_package_error_code_t
+  , const char *
+  , const char *);
+
+void
+clib_package_cancel_set_progress(clib_package_cancel_t *, clib_package_progress_fn, void *);
+
+int
+clib_package_cancelled(clib_package_cancel_t *);
+
+const clib_package_error_t *
+clib_package_cancel_error(clib_package_cancel_t *);
+
+void
+clib_package_cancel_free(clib_package_cancel_t *);
+
+void
+clib_package_set_memory_budget(clib_package_ctx_t *, size_t);
+
+size_t
+clib_package_memory_peak(clib_package_ctx_t *);
+
+void
+clib_package_response_status(clib_package_response_t *, long);
+
+void
+clib_package_response_header(clib_package_response_t *, const char *, size_t);
+
+int
+clib_package_response_write(clib_package_response_t *, const char *, size_t);
+
+clib_package_transport_t *
+clib_package_transport_memory(void);
+
+int
+clib_package_transport_memory_add(clib_package_transport_t *
+  , const char *
+  , long
+  , const char *
+  , size_t);
+
+clib_package_transport_t *
+clib_package_transport_record(clib_package_transport_t *, const char *);
+
+clib_package_transport_t *
+clib_package_transport_replay(const char *);
+
+clib_package_transport_t *
+clib_package_transport_directory(const char *);
+
+clib_package_transport_t *
+clib_package_transport_mirror(clib_package_transport_t *, const char *);
+
+void
+clib_package_transport_free(clib_package_transport_t *);
+
+void
+clib_package_set_transport(clib_package_ctx_t *, clib_package_transport_t *);
+
+int
+clib_package_trace_open(clib_package_ctx_t *, const char *);
+
+void
+clib_package_stats(clib_package_ctx_t *, clib_package_stats_t *);
+
+void
+clib_package_stats_reset(clib_package_ctx_t *);
+
+double
+clib_package_stats_bucket_ms(int);
+
+void
+clib_package_trace_close(clib_package_ctx_t *);
+
 #endif
@@ -0,0 +1,123 @@
+
+//
+// helpers.h
+//
+// Fixtures shared by the tests: a memory transport serving
+// packages of `foo` the way the GitHub API does.  Functions
+// are inline so that tests not using some do not warn.
+//
+
+#ifndef CLIB_PACKAGE_TEST_HELPERS_H
+#define CLIB_PACKAGE_TEST_HELPERS_H 1
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+#include "describe/describe.h"
+#include "clib-package.h"
+
+#ifndef API
+#define API "https://api.test/"
+#endif
+
+#ifndef RAW
+#define RAW "https://raw.test/foo/"
+#endif
+
+static inline void
+add_status(clib_package_transport_t *transport, const char *url, long status, const char *body) {
+  assert(0 == clib_package_transport_memory_add(transport, url, status, body, strlen(body)));
+}
+
+static inline void
+add(clib_package_transport_t *transport, const char *url, const char *body) {
+  add_status(transport, url, 200, body);
+}
+
+/**
+ * Serve `json` as the package.json of foo/`name` at `version`
+ * and at master.
+ */
+
+static inline void
+add_manifest(clib_package_transport_t *transport, const char *name, const char *version, const char *json) {
+  char url[256];
+  char body[256];
+
+  snprintf(url, sizeof(url), RAW "%s/%s/package.json", name, version);
+  add(transport, url, json);
+  snprintf(body, sizeof(body), "{ \"download_url\": \"" RAW "%s/%s/package.json\" }", name, version);
+  snprintf(url, sizeof(url), API "repos/foo/%s/contents/package.json?ref=%s", name, version);
+  add(transport, url, body);
+  snprintf(url, sizeof(url), API "repos/foo/%s/contents/package.json?ref=master", name);
+  add(transport, url, body);
+}
+
+/**
+ * Serve `file` of foo/`name` with the contents `body`, as the
+ * blob `sha` when given.  A leading `@` keeps the directories
+ * of `file` on install and is not part of its path upstream.
+ */
+
+static inline void
+add_file(clib_package_transport_t *transport
+    , const char *name
+    , const char *file
+    , const char *sha
+    , const char *body) {
+  char url[512];
+  char json[512];
+  const char *path = '@' == file[0] ? file + 1 : file;
+
+  snprintf(url, sizeof(url), RAW "%s/%s/%s", name, sha ? sha : "master", path);
+  add(transport, url, body);
+  if (sha) {
+    snprintf(json, sizeof(json), "{ \"download_url\": \"%s\", \"sha\": \"%s\" }", url, sha);
+  } else {
+    snprintf(json, sizeof(json), "{ \"download_url\": \"%s\" }", url);
+  }
+  snprintf(url, sizeof(url), API "repos/foo/%s/contents/%s?ref=master", name, path);
+  add(transport, url, json);
+}
+
+/**
+ * Serve foo/`name` at version 1.0.0, with the further
+ * package.json members `fields` (may be NULL) and the sources
+ * given as pairs of file and contents, ending with NULL.
+ */
+
+static inline void
+add_package(clib_package_transport_t *transport, const char *name, const char *fields, ...) {
+  char url[256];
+  char json[2048];
+  const char *file = NULL;
+  va_list files;
+  int n = 0;
+
+  snprintf(url, sizeof(url), API "repos/foo/%s", name);
+  add(transport, url, "{}");
+
+  n = snprintf(json, sizeof(json)
+    , "{ \"name\": \"%s\", \"version\": \"1.0.0\", \"repo\": \"foo/%s\", \"src\": ["
+    , name, name);
+  va_start(files, fields);
+  for (int i = 0; (file = va_arg(files, const char *)); i++) {
+    add_file(transport, name, file, NULL, va_arg(files, const char *));
+    n += snprintf(json + n, sizeof(json) - n, "%s\"%s\"", i ? ", " : "", file);
+  }
+  va_end(files);
+  snprintf(json + n, sizeof(json) - n, "]%s%s }", fields ? ", " : "", fields ? fields : "");
+  add_manifest(transport, name, "1.0.0", json);
+}
+
+static inline int
+install(clib_package_ctx_t *ctx, const char *slug, const char *dir) {
+  clib_package_t *pkg = clib_package_new_from_slug(slug, 0, ctx);
+  assert(pkg);
+  if (!pkg) return -1;
+  int rc = clib_package_install(pkg, dir, 0);
+  clib_package_free(pkg);
+  return rc;
+}
+
+#endif
@@ -0,0 +1,86 @@
+
+#define _DEFAULT_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include "describe/describe.h"
+#include "fs/fs.h"
+#include "rimraf/rimraf.h"
+#include "clib-package.h"
+#include "helpers.h"
+
+#define LOG "./test/fixtures/build.log"
+
+int
+main() {
+  clib_package_ctx_t *ctx = clib_package_ctx_new("{ \"api_endpoints\": [\"" API "\"] }");
+  clib_package_transport_t *memory = clib_package_transport_memory();
+  clib_package_stats_t stats;
+
+  // commands run in <deps>/<name>, two levels below the log
+  add_package(memory, "app", "\"install\": \"echo app >> ../../build.log\","
+    " \"dependencies\": { \"foo/baz\": \"1.0.0\", \"foo/qux\": \"1.0.0\" }", NULL);
+  add_package(memory, "baz", "\"install\": \"sleep 0.1; echo baz >> ../../build.log\","
+    " \"dependencies\": { \"foo/qux\": \"1.0.0\" }", NULL);
+  add_package(memory, "qux", "\"install\": \"echo qux >> ../../build.log\"", NULL);
+  add_package(memory, "bad", "\"install\": \"exit 3\"", NULL);
+  clib_package_set_transport(ctx, memory);
+
+  describe("clib_package_install") {
+    it("should not run install commands unless asked to") {
+      assert(0 == install(ctx, "foo/qux", "./test/fixtures/off/"));
+      assert(-1 == fs_exists(LOG));
+    }
+
+    it("should run install commands in dependency order") {
+      clib_package_set_install_jobs(ctx, 4);
+      clib_package_stats_reset(ctx);
+      assert(0 == install(ctx, "foo/app", "./test/fixtures/on/"));
+      char *log = fs_read(LOG);
+      assert(log);
+      if (log) assert_str_equal("qux\nbaz\napp\n", log);
+      free(log);
+      clib_package_stats(ctx, &stats);
+      assert(3 == stats.packages_built);
+    }
+
+    it("should fail the install when a command fails") {
+      assert(-1 == install(ctx, "foo/bad", "./test/fixtures/bad/"));
+    }
+
+    it("should hand jobserver tokens back") {
+      int fds[2];
+      char flags[64];
+      char token = 0;
+      assert(0 == pipe(fds));
+      assert(1 == write(fds[1], "+", 1));
+      snprintf(flags, sizeof(flags), "-j2 --jobserver-auth=%d,%d", fds[0], fds[1]);
+      setenv("MAKEFLAGS", flags, 1);
+      setenv("MAKELEVEL", "1", 1);
+      unlink(LOG);
+
+      assert(0 == install(ctx, "foo/app", "./test/fixtures/make/"));
+      assert(0 == fs_exists(LOG));
+
+      fcntl(fds[0], F_SETFL, O_NONBLOCK);
+      assert(1 == read(fds[0], &token, 1));
+      assert('+' == token);
+      assert(-1 == read(fds[0], &token, 1));
+      unsetenv("MAKEFLAGS");
+      unsetenv("MAKELEVEL");
+      close(fds[0]);
+      close(fds[1]);
+    }
+  }
+
+  rimraf("./test/fixtures/off/");
+  rimraf("./test/fixtures/on/");
+  rimraf("./test/fixtures/bad/");
+  rimraf("./test/fixtures/make/");
+  unlink(LOG);
+  clib_package_ctx_free(ctx);
+  clib_package_transport_free(memory);
+  return assert_failures();
+}
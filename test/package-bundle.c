@@ -0,0 +1,84 @@
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "describe/describe.h"
+#include "fs/fs.h"
+#include "mkdirp/mkdirp.h"
+#include "rimraf/rimraf.h"
+#include "clib-package.h"
+
+#define ROOT "./test/fixtures/bundle/"
+#define BUNDLE "./test/fixtures/deps.clpb"
+
+static void
+write_file(const char *path, const char *data) {
+  assert(-1 != fs_write(path, data));
+}
+
+static void
+assert_file(const char *path, const char *data) {
+  char *got = fs_read(path);
+  assert(got);
+  if (got) assert_str_equal(data, got);
+  free(got);
+}
+
+int
+main() {
+  const char *manifest = "{ \"dependencies\": { \"foo/baz\": \"1.0.0\" } }";
+  char *key = clib_package_bundle_key(manifest);
+
+  mkdirp(ROOT "deps/baz/src", 0777);
+  mkdirp(ROOT "deps/qux", 0777);
+  write_file(ROOT "deps.mk", "include $(top_srcdir)/deps/baz/baz.mk\n");
+  write_file(ROOT "deps/baz/package.json", "{ \"name\": \"baz\" }");
+  write_file(ROOT "deps/baz/baz.mk", "CFLAGS += -Ideps/baz\n");
+  write_file(ROOT "deps/baz/src/baz.c", "int baz;\n");
+  write_file(ROOT "deps/qux/qux.c", "int qux;\n");
+  write_file(ROOT "deps/.index", "machine local");
+
+  describe("clib_package_bundle_key") {
+    it("should only depend on the manifest") {
+      char *again = clib_package_bundle_key(manifest);
+      char *other = clib_package_bundle_key("{}");
+      assert(key && again && other);
+      assert_str_equal(key, again);
+      assert(0 != strcmp(key, other));
+      free(again);
+      free(other);
+    }
+  }
+
+  describe("clib_package_bundle_pack") {
+    it("should pack the tree into one file") {
+      assert(0 == clib_package_bundle_pack(ROOT "deps", key, BUNDLE));
+      assert(0 == fs_exists(BUNDLE));
+    }
+  }
+
+  describe("clib_package_bundle_unpack") {
+    it("should refuse a bundle for another manifest") {
+      assert(-1 == clib_package_bundle_unpack(BUNDLE, ROOT "deps", "0000000000000000", 0));
+    }
+
+    it("should restore the tree and deps.mk") {
+      rimraf(ROOT);
+      mkdirp(ROOT "deps/stale", 0777);
+      assert(0 == clib_package_bundle_unpack(BUNDLE, ROOT "deps", key, 4));
+      assert_file(ROOT "deps.mk", "include $(top_srcdir)/deps/baz/baz.mk\n");
+      assert_file(ROOT "deps/baz/package.json", "{ \"name\": \"baz\" }");
+      assert_file(ROOT "deps/baz/baz.mk", "CFLAGS += -Ideps/baz\n");
+      assert_file(ROOT "deps/baz/src/baz.c", "int baz;\n");
+      assert_file(ROOT "deps/qux/qux.c", "int qux;\n");
+      assert(-1 == fs_exists(ROOT "deps/.index"));
+      assert(-1 == fs_exists(ROOT "deps/stale"));
+    }
+  }
+
+  free(key);
+  rimraf(ROOT);
+  unlink(BUNDLE);
+  return assert_failures();
+}
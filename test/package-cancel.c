@@ -0,0 +1,56 @@
+
+#define _POSIX_C_SOURCE 199309L
+#include <time.h>
+#include "describe/describe.h"
+#include "fs/fs.h"
+#include "clib-package.h"
+
+int
+main() {
+  describe("clib_package_cancel") {
+    it("should not be cancelled when new") {
+      clib_package_cancel_t *cancel = clib_package_cancel_new(0);
+      assert(cancel);
+      assert(0 == clib_package_cancelled(cancel));
+      assert(NULL == clib_package_cancel_error(cancel));
+      clib_package_cancel_free(cancel);
+    }
+
+    it("should record the first error only") {
+      clib_package_cancel_t *cancel = clib_package_cancel_new(0);
+      clib_package_cancel(cancel, CLIB_PACKAGE_EFETCH, "foo/bar", "unable to fetch file: bar.c");
+      clib_package_cancel(cancel, CLIB_PACKAGE_ERESOLVE, "foo/baz", "unable to resolve package");
+      assert(1 == clib_package_cancelled(cancel));
+      const clib_package_error_t *err = clib_package_cancel_error(cancel);
+      assert(err);
+      assert(CLIB_PACKAGE_EFETCH == err->code);
+      assert_str_equal("foo/bar", err->slug);
+      assert_str_equal("unable to fetch file: bar.c", err->message);
+      clib_package_cancel_free(cancel);
+    }
+
+    it("should time out once the deadline passes") {
+      clib_package_cancel_t *cancel = clib_package_cancel_new(10);
+      assert(0 == clib_package_cancelled(cancel));
+      struct timespec ts = { 0, 20 * 1000 * 1000 };
+      nanosleep(&ts, NULL);
+      assert(1 == clib_package_cancelled(cancel));
+      assert(CLIB_PACKAGE_ETIMEOUT == clib_package_cancel_error(cancel)->code);
+      clib_package_cancel_free(cancel);
+    }
+
+    it("should fail installs that were already cancelled") {
+      char json[] = "{ \"name\": \"foo\", \"repo\": \"foobar/foo\", \"version\": \"1.0.0\" }";
+      clib_package_t *pkg = clib_package_new(json, 0, NULL);
+      clib_package_cancel_t *cancel = clib_package_cancel_new(0);
+      clib_package_cancel(cancel, CLIB_PACKAGE_ECANCELED, NULL, "cancelled");
+      pkg->cancel = cancel;
+      assert(-1 == clib_package_install(pkg, "./test/fixtures/", 0));
+      assert(-1 == fs_exists("./test/fixtures/foo"));
+      clib_package_free(pkg);
+      clib_package_cancel_free(cancel);
+    }
+  }
+
+  return assert_failures();
+}
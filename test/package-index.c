@@ -0,0 +1,103 @@
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "describe/describe.h"
+#include "fs/fs.h"
+#include "rimraf/rimraf.h"
+#include "clib-package.h"
+#include "helpers.h"
+
+#define DEPS "./test/fixtures/"
+
+static unsigned long
+skipped_installing(clib_package_ctx_t *ctx) {
+  clib_package_stats_t stats;
+  clib_package_t *pkg = clib_package_new_from_slug("foo/baz", 0, ctx);
+  assert(pkg);
+  clib_package_stats_reset(ctx);
+  assert(0 == clib_package_install(pkg, DEPS, 0));
+  clib_package_free(pkg);
+  clib_package_stats(ctx, &stats);
+  return stats.packages_skipped;
+}
+
+static int indexed_early;
+
+static void
+on_progress(const char *event, const char *slug, const char *detail, void *data) {
+  (void) slug;
+  (void) detail;
+  (void) data;
+  if (0 == strcmp("installed", event) && 0 == fs_exists(DEPS ".index")) indexed_early = 1;
+}
+
+int
+main() {
+  clib_package_ctx_t *ctx = clib_package_ctx_new("{ \"api_endpoints\": [\"" API "\"] }");
+  clib_package_transport_t *memory = clib_package_transport_memory();
+
+  add_package(memory, "baz", NULL, "baz.c", "int x;\n", NULL);
+  add_package(memory, "app", "\"dependencies\": { \"foo/baz\": \"1.0.0\" }", "app.c", "int y;\n", NULL);
+  // with the sha of the package.json
+  add(memory, API "repos/foo/baz/contents/package.json?ref=master"
+    , "{ \"download_url\": \"" RAW "baz/1.0.0/package.json\", \"sha\": \"5ca1ab1e\" }");
+  clib_package_set_transport(ctx, memory);
+
+  describe("clib_package_new_from_slug") {
+    it("should keep the sha of the package.json") {
+      clib_package_t *pkg = clib_package_new_from_slug("foo/baz", 0, ctx);
+      assert(pkg);
+      assert_str_equal("5ca1ab1e", pkg->sha);
+      clib_package_free(pkg);
+    }
+  }
+
+  describe("installed state index") {
+    it("should be written by an install") {
+      assert(0 == skipped_installing(ctx));
+      assert(0 == fs_exists(DEPS ".index"));
+    }
+
+    it("should skip an up to date package") {
+      assert(1 == skipped_installing(ctx));
+    }
+
+    it("should fall back to the package.json when stale") {
+      // an older copy, put there behind the index's back
+      assert(-1 != fs_write(DEPS "baz/package.json"
+        , "{ \"name\": \"baz\", \"version\": \"0.9.0\", \"repo\": \"foo/baz\" }"));
+      assert(0 == skipped_installing(ctx));
+      assert(1 == skipped_installing(ctx));
+    }
+
+    it("should be rebuilt when missing") {
+      assert(0 == unlink(DEPS ".index"));
+      assert(1 == skipped_installing(ctx));
+      assert(0 == fs_exists(DEPS ".index"));
+      assert(1 == skipped_installing(ctx));
+    }
+
+    it("should be written once the whole install is done") {
+      rimraf(DEPS);
+      clib_package_cancel_t *cancel = clib_package_cancel_new(0);
+      clib_package_cancel_set_progress(cancel, on_progress, NULL);
+      clib_package_t *pkg = clib_package_resolve("foo/app", 0, ctx, cancel);
+      assert(pkg);
+      pkg->cancel = cancel;
+      assert(0 == clib_package_install(pkg, DEPS, 0));
+      clib_package_free(pkg);
+      clib_package_cancel_free(cancel);
+      assert(!indexed_early);
+      assert(0 == fs_exists(DEPS ".index"));
+      // the dependency's record went out with the root's
+      assert(1 == skipped_installing(ctx));
+    }
+  }
+
+  rimraf(DEPS);
+  clib_package_ctx_free(ctx);
+  clib_package_transport_free(memory);
+  return assert_failures();
+}
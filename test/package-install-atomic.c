@@ -0,0 +1,81 @@
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "describe/describe.h"
+#include "fs/fs.h"
+#include "rimraf/rimraf.h"
+#include "mkdirp/mkdirp.h"
+#include "clib-package.h"
+#include "helpers.h"
+
+#define DEPS "./test/fixtures/deps/"
+#define INCLUDE "include $(top_srcdir)/deps/baz/baz.mk\n"
+
+int
+main() {
+  clib_package_ctx_t *ctx = clib_package_ctx_new("{ \"api_endpoints\": [\"" API "\"] }");
+  clib_package_transport_t *memory = clib_package_transport_memory();
+
+  add_package(memory, "baz", NULL, "baz.c", "int x;\n", NULL);
+  // its source is missing upstream
+  add_package(memory, "qux", NULL, "qux.c", "int x;\n", NULL);
+  add_status(memory, RAW "qux/master/qux.c", 404, "");
+  // sources in nested directories
+  add_package(memory, "nest", NULL
+    , "@src/a/b/b.c", "int b;\n"
+    , "@src/a/a.c", "int a;\n"
+    , "flat/c.c", "int c;\n"
+    , NULL);
+  clib_package_set_transport(ctx, memory);
+  mkdirp(DEPS, 0777);
+  fs_write("./test/fixtures/deps.mk", "include $(top_srcdir)/deps/other/other.mk\n");
+
+  describe("clib_package_install") {
+    it("should publish a complete package") {
+      assert(0 == install(ctx, "foo/baz", DEPS));
+      assert(0 == fs_exists(DEPS "baz/package.json"));
+      assert(0 == fs_exists(DEPS "baz/baz.c"));
+      assert(0 == fs_exists(DEPS "baz/baz.mk"));
+      assert(-1 == fs_exists(DEPS ".baz.staging"));
+    }
+
+    it("should keep other includes in deps.mk") {
+      char *mk = fs_read("./test/fixtures/deps.mk");
+      assert(mk);
+      assert_str_equal("include $(top_srcdir)/deps/other/other.mk\n" INCLUDE, mk);
+      free(mk);
+    }
+
+    it("should list a reinstalled package once") {
+      assert(0 == rimraf(DEPS "baz"));
+      assert(0 == install(ctx, "foo/baz", DEPS));
+      char *mk = fs_read("./test/fixtures/deps.mk");
+      assert(mk);
+      assert_str_equal("include $(top_srcdir)/deps/other/other.mk\n" INCLUDE, mk);
+      free(mk);
+    }
+
+    it("should create the directories sources need") {
+      assert(0 == install(ctx, "foo/nest", DEPS));
+      assert(0 == fs_exists(DEPS "nest/src/a/b/b.c"));
+      assert(0 == fs_exists(DEPS "nest/src/a/a.c"));
+      assert(0 == fs_exists(DEPS "nest/c.c"));
+      char *mk = fs_read(DEPS "nest/nest.mk");
+      assert(mk);
+      assert_str_equal("deps__a_SOURCES += deps/nest/src/a/b/b.c deps/nest/src/a/a.c deps/nest/c.c \n", mk);
+      free(mk);
+    }
+
+    it("should not leave a partial install behind") {
+      assert(0 != install(ctx, "foo/qux", DEPS));
+      assert(-1 == fs_exists(DEPS "qux"));
+      assert(-1 == fs_exists(DEPS ".qux.staging"));
+    }
+  }
+
+  rimraf("./test/fixtures/");
+  clib_package_ctx_free(ctx);
+  clib_package_transport_free(memory);
+  return assert_failures();
+}
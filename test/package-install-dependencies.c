@@ -1,92 +1,118 @@
-
+#include <stdlib.h>
 #include "describe/describe.h"
 #include "rimraf/rimraf.h"
 #include "fs/fs.h"
 #include "clib-package.h"
+#include "helpers.h"
+
+#define DEPS "./test/fixtures/"
 
 int
 main() {
+  clib_package_ctx_t *ctx = clib_package_ctx_new("{ \"api_endpoints\": [\"" API "\"] }");
+  clib_package_transport_t *memory = clib_package_transport_memory();
+
+  // mkdirp -> path-normalize
+  add_package(memory, "mkdirp", "\"dependencies\": { \"foo/path-normalize\": \"1.0.0\" }"
+    , "mkdirp.c", "int x;\n", NULL);
+  add_package(memory, "path-normalize", NULL
+    , "path-normalize.c", "int x;\n", "path-normalize.h", "int x;\n", NULL);
+  // rimraf -> path-join -> str-ends-with, str-starts-with
+  add_package(memory, "rimraf", "\"dependencies\": { \"foo/path-join\": \"*\" }", "rimraf.c", "int x;\n", NULL);
+  add_package(memory, "path-join"
+    , "\"dependencies\": { \"foo/str-ends-with\": \"*\", \"foo/str-starts-with\": \"*\" }"
+    , "path-join.c", "int x;\n", "path-join.h", "int x;\n", NULL);
+  add_package(memory, "str-ends-with", NULL, "str-ends-with.c", "int x;\n", "str-ends-with.h", "int x;\n", NULL);
+  add_package(memory, "str-starts-with", NULL
+    , "str-starts-with.c", "int x;\n", "str-starts-with.h", "int x;\n", NULL);
+  add_package(memory, "linenoise", NULL, "linenoise.c", "int x;\n", NULL);
+  add_package(memory, "substr", NULL, "substr.c", "int x;\n", NULL);
+  clib_package_set_transport(ctx, memory);
+
   describe("clib_package_install_dependencies") {
     it("should return -1 when given a bad package") {
       assert(-1 == clib_package_install_dependencies(NULL, "./deps", 0));
     }
 
     it("should install the dep in its own directory") {
-      clib_package_t *dep = clib_package_new_from_slug("stephenmathieson/mkdirp.c", 0);
+      clib_package_t *dep = clib_package_new_from_slug("foo/mkdirp", 0, ctx);
       assert(dep);
-      assert(0 == clib_package_install_dependencies(dep, "./test/fixtures/", 0));
-      assert(0 == fs_exists("./test/fixtures/"));
-      assert(0 == fs_exists("./test/fixtures/path-normalize"));
+      assert(0 == clib_package_install_dependencies(dep, DEPS, 0));
+      assert(0 == fs_exists(DEPS));
+      assert(0 == fs_exists(DEPS "path-normalize"));
+      assert(-1 == fs_exists(DEPS "mkdirp"));
       clib_package_free(dep);
-      rimraf("./test/fixtures/");
+      rimraf(DEPS);
     }
 
     it("should install the dependency's package.json") {
-      clib_package_t *pkg = clib_package_new_from_slug("stephenmathieson/mkdirp.c", 0);
+      clib_package_t *pkg = clib_package_new_from_slug("foo/mkdirp", 0, ctx);
       assert(pkg);
-      assert(0 == clib_package_install_dependencies(pkg, "./test/fixtures/", 0));
-      assert(0 == fs_exists("./test/fixtures/path-normalize/package.json"));
+      assert(0 == clib_package_install_dependencies(pkg, DEPS, 0));
+      assert(0 == fs_exists(DEPS "path-normalize/package.json"));
       clib_package_free(pkg);
-      rimraf("./test/fixtures/");
+      rimraf(DEPS);
     }
 
     it("should install the dependency's sources") {
-      clib_package_t *pkg = clib_package_new_from_slug("stephenmathieson/mkdirp.c", 0);
+      clib_package_t *pkg = clib_package_new_from_slug("foo/mkdirp", 0, ctx);
       assert(pkg);
-      assert(0 == clib_package_install_dependencies(pkg, "./test/fixtures/", 0));
-      assert(0 == fs_exists("./test/fixtures/path-normalize/path-normalize.c"));
-      assert(0 == fs_exists("./test/fixtures/path-normalize/path-normalize.h"));
+      assert(0 == clib_package_install_dependencies(pkg, DEPS, 0));
+      assert(0 == fs_exists(DEPS "path-normalize/path-normalize.c"));
+      assert(0 == fs_exists(DEPS "path-normalize/path-normalize.h"));
       clib_package_free(pkg);
-      rimraf("./test/fixtures");
+      rimraf(DEPS);
     }
 
     it("should install the dependency's dependencies") {
-      clib_package_t *pkg = clib_package_new_from_slug("stephenmathieson/rimraf.c", 0);
+      clib_package_t *pkg = clib_package_new_from_slug("foo/rimraf", 0, ctx);
       assert(pkg);
-      assert(0 == clib_package_install_dependencies(pkg, "./test/fixtures/", 0));
+      assert(0 == clib_package_install_dependencies(pkg, DEPS, 0));
       // deps
-      assert(0 == fs_exists("./test/fixtures/path-join/"));
-      assert(0 == fs_exists("./test/fixtures/path-join/package.json"));
-      assert(0 == fs_exists("./test/fixtures/path-join/path-join.c"));
-      assert(0 == fs_exists("./test/fixtures/path-join/path-join.h"));
+      assert(0 == fs_exists(DEPS "path-join/"));
+      assert(0 == fs_exists(DEPS "path-join/package.json"));
+      assert(0 == fs_exists(DEPS "path-join/path-join.c"));
+      assert(0 == fs_exists(DEPS "path-join/path-join.h"));
       // deps' deps
-      assert(0 == fs_exists("./test/fixtures/str-ends-with/"));
-      assert(0 == fs_exists("./test/fixtures/str-ends-with/package.json"));
-      assert(0 == fs_exists("./test/fixtures/str-ends-with/str-ends-with.h"));
-      assert(0 == fs_exists("./test/fixtures/str-ends-with/str-ends-with.c"));
-      assert(0 == fs_exists("./test/fixtures/str-starts-with/"));
-      assert(0 == fs_exists("./test/fixtures/str-starts-with/package.json"));
-      assert(0 == fs_exists("./test/fixtures/str-starts-with/str-starts-with.h"));
-      assert(0 == fs_exists("./test/fixtures/str-starts-with/str-starts-with.c"));
+      assert(0 == fs_exists(DEPS "str-ends-with/"));
+      assert(0 == fs_exists(DEPS "str-ends-with/package.json"));
+      assert(0 == fs_exists(DEPS "str-ends-with/str-ends-with.h"));
+      assert(0 == fs_exists(DEPS "str-ends-with/str-ends-with.c"));
+      assert(0 == fs_exists(DEPS "str-starts-with/"));
+      assert(0 == fs_exists(DEPS "str-starts-with/package.json"));
+      assert(0 == fs_exists(DEPS "str-starts-with/str-starts-with.h"));
+      assert(0 == fs_exists(DEPS "str-starts-with/str-starts-with.c"));
       clib_package_free(pkg);
-      rimraf("./test/fixtures");
+      rimraf(DEPS);
     }
 
     it("should handle unresolved packages") {
       char json[] =
         "{"
         "  \"dependencies\": {"
-        "    \"linenoise\": \"*\","
-        "    \"stephenmathieson/substr.c\": \"*\","
-        "    \"stephenmathieson/emtter.c\": \"*\""
+        "    \"foo/linenoise\": \"*\","
+        "    \"foo/substr\": \"*\","
+        "    \"foo/emtter\": \"*\""
         "  }"
         "}";
 
-      clib_package_t *pkg = clib_package_new(json, 0);
+      clib_package_t *pkg = clib_package_new(json, 0, ctx);
       assert(pkg);
 
-      int r = clib_package_install_dependencies(pkg, "./test/fixtures/", 0);
+      int r = clib_package_install_dependencies(pkg, DEPS, 0);
       // should fail
       assert(-1 == r);
 
-      assert(0 == fs_exists("./test/fixtures/linenoise/package.json"));
-      assert(0 == fs_exists("./test/fixtures/substr/package.json"));
-      assert(-1 == fs_exists("./test/fixtures/emtter/"));
+      assert(0 == fs_exists(DEPS "linenoise/package.json"));
+      assert(0 == fs_exists(DEPS "substr/package.json"));
+      assert(-1 == fs_exists(DEPS "emtter/"));
 
       clib_package_free(pkg);
-      rimraf("./test/fixtures");
+      rimraf(DEPS);
     }
   }
 
+  clib_package_ctx_free(ctx);
+  clib_package_transport_free(memory);
   return assert_failures();
 }
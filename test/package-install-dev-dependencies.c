@@ -1,38 +1,51 @@
-
+#include <stdlib.h>
 #include "describe/describe.h"
 #include "rimraf/rimraf.h"
 #include "fs/fs.h"
 #include "clib-package.h"
+#include "helpers.h"
+
+#define DEPS "./test/fixtures/"
 
 int
 main() {
+  clib_package_ctx_t *ctx = clib_package_ctx_new("{ \"api_endpoints\": [\"" API "\"] }");
+  clib_package_transport_t *memory = clib_package_transport_memory();
+
+  // trim -(development)-> describe -> assertion-macros
+  add_package(memory, "trim", "\"development\": { \"foo/describe\": \"1.0.0\" }", "trim.c", "int x;\n", NULL);
+  add_package(memory, "describe", "\"dependencies\": { \"foo/assertion-macros\": \"1.0.0\" }"
+    , "describe.h", "int x;\n", NULL);
+  add_package(memory, "assertion-macros", NULL, "assertion-macros.h", "int x;\n", NULL);
+  clib_package_set_transport(ctx, memory);
+
   describe("clib_package_install_development") {
     it("should return -1 when given a bad package") {
       assert(-1 == clib_package_install_development(NULL, "./deps", 0));
     }
 
     it("should return -1 when given a bad dir") {
-      clib_package_t *pkg = clib_package_new_from_slug("stephenmathieson/mkdirp.c", 0);
+      clib_package_t *pkg = clib_package_new_from_slug("foo/trim", 0, ctx);
       assert(pkg);
       assert(-1 == clib_package_install_development(pkg, NULL, 0));
       clib_package_free(pkg);
     }
 
     it("should install the package's development dependencies") {
-      clib_package_t *pkg = clib_package_new_from_slug("stephenmathieson/trim.c@0.0.2", 0);
+      clib_package_t *pkg = clib_package_new_from_slug("foo/trim", 0, ctx);
       assert(pkg);
-      assert(0 == clib_package_install_development(pkg, "./test/fixtures", 0));
-      assert(0 == fs_exists("./test/fixtures/describe"));
-      assert(0 == fs_exists("./test/fixtures/describe/describe.h"));
-      assert(0 == fs_exists("./test/fixtures/describe/package.json"));
-      assert(0 == fs_exists(
-        "./test/fixtures/assertion-macros/assertion-macros.h"
-      ));
-      assert(0 == fs_exists("./test/fixtures/assertion-macros/package.json"));
-      rimraf("./test/fixtures");
+      assert(0 == clib_package_install_development(pkg, DEPS, 0));
+      assert(0 == fs_exists(DEPS "describe"));
+      assert(0 == fs_exists(DEPS "describe/describe.h"));
+      assert(0 == fs_exists(DEPS "describe/package.json"));
+      assert(0 == fs_exists(DEPS "assertion-macros/assertion-macros.h"));
+      assert(0 == fs_exists(DEPS "assertion-macros/package.json"));
+      rimraf(DEPS);
       clib_package_free(pkg);
     }
   }
 
+  clib_package_ctx_free(ctx);
+  clib_package_transport_free(memory);
   return assert_failures();
 }
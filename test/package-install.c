@@ -1,124 +1,82 @@
-
+#include <stdlib.h>
 #include "describe/describe.h"
 #include "rimraf/rimraf.h"
 #include "fs/fs.h"
 #include "clib-package.h"
+#include "helpers.h"
+
+#define DEPS "./test/fixtures/"
 
 int
 main() {
+  clib_package_ctx_t *ctx = clib_package_ctx_new("{ \"api_endpoints\": [\"" API "\"] }");
+  clib_package_transport_t *memory = clib_package_transport_memory();
+
+  add_package(memory, "case", NULL, "case.c", "int x;\n", "case.h", "int x;\n", NULL);
+  // mkdirp -> path-normalize
+  add_package(memory, "mkdirp", "\"dependencies\": { \"foo/path-normalize\": \"1.0.0\" }"
+    , "mkdirp.c", "int x;\n", "mkdirp.h", "int x;\n", NULL);
+  add_package(memory, "path-normalize", NULL
+    , "path-normalize.c", "int x;\n", "path-normalize.h", "int x;\n", NULL);
+  // trim only needs describe to develop
+  add_package(memory, "trim", "\"development\": { \"foo/describe\": \"1.0.0\" }"
+    , "trim.c", "int x;\n", "trim.h", "int x;\n", NULL);
+  add_package(memory, "describe", NULL, "describe.h", "int x;\n", NULL);
+  clib_package_set_transport(ctx, memory);
+
   describe("clib_package_install") {
     it("should return -1 when given a bad package") {
       assert(-1 == clib_package_install(NULL, "./deps", 0));
     }
 
     it("should install the pkg in its own directory") {
-      clib_package_t *pkg = clib_package_new_from_slug("stephenmathieson/case.c@0.1.0", 0);
-      assert(pkg);
-      assert(0 == clib_package_install(pkg, "./test/fixtures/", 0));
-      assert(0 == fs_exists("./test/fixtures/"));
-      assert(0 == fs_exists("./test/fixtures/case"));
-      clib_package_free(pkg);
-      rimraf("./test/fixtures/");
+      assert(0 == install(ctx, "foo/case", DEPS));
+      assert(0 == fs_exists(DEPS));
+      assert(0 == fs_exists(DEPS "case"));
+      rimraf(DEPS);
     }
 
     it("should install the package's package.json") {
-      clib_package_t *pkg = clib_package_new_from_slug("stephenmathieson/case.c@0.1.0", 0);
-      assert(pkg);
-      assert(0 == clib_package_install(pkg, "./test/fixtures/", 0));
-      assert(0 == fs_exists("./test/fixtures/case/package.json"));
-      clib_package_free(pkg);
-      rimraf("./test/fixtures/");
+      assert(0 == install(ctx, "foo/case", DEPS));
+      assert(0 == fs_exists(DEPS "case/package.json"));
+      rimraf(DEPS);
     }
 
     it("should install the package's sources") {
-      clib_package_t *pkg = clib_package_new_from_slug("stephenmathieson/case.c@0.1.0", 0);
-      assert(pkg);
-      assert(0 == clib_package_install(pkg, "./test/fixtures/", 0));
-      assert(0 == fs_exists("./test/fixtures/case/case.c"));
-      assert(0 == fs_exists("./test/fixtures/case/case.h"));
-      clib_package_free(pkg);
-      rimraf("./test/fixtures");
+      assert(0 == install(ctx, "foo/case", DEPS));
+      assert(0 == fs_exists(DEPS "case/case.c"));
+      assert(0 == fs_exists(DEPS "case/case.h"));
+      rimraf(DEPS);
     }
 
     it("should install the package's dependencies") {
-      clib_package_t *pkg = clib_package_new_from_slug("stephenmathieson/mkdirp.c@master", 0);
-      assert(pkg);
-      assert(0 == clib_package_install(pkg, "./test/fixtures/", 0));
-      assert(0 == fs_exists("./test/fixtures/path-normalize/"));
-      assert(0 == fs_exists("./test/fixtures/path-normalize/package.json"));
-      assert(0 == fs_exists("./test/fixtures/path-normalize/path-normalize.c"));
-      assert(0 == fs_exists("./test/fixtures/path-normalize/path-normalize.h"));
-      clib_package_free(pkg);
-      rimraf("./test/fixtures");
+      assert(0 == install(ctx, "foo/mkdirp", DEPS));
+      assert(0 == fs_exists(DEPS "path-normalize/"));
+      assert(0 == fs_exists(DEPS "path-normalize/package.json"));
+      assert(0 == fs_exists(DEPS "path-normalize/path-normalize.c"));
+      assert(0 == fs_exists(DEPS "path-normalize/path-normalize.h"));
+      rimraf(DEPS);
     }
 
     it("should not install the package's development dependencies") {
-      clib_package_t *pkg = clib_package_new_from_slug("stephenmathieson/trim.c@0.0.2", 0);
-      assert(pkg);
-      assert(0 == clib_package_install(pkg, "./test/fixtures/", 0));
-      assert(-1 == fs_exists("./test/fixtures/describe/"));
-      assert(-1 == fs_exists("./test/fixtures/describe/package.json"));
-      assert(-1 == fs_exists("./test/fixtures/describe/describe.h"));
-      assert(-1 == fs_exists("./test/fixtures/describe/assertion-macros.h"));
-      clib_package_free(pkg);
-      rimraf("./test/fixtures");
+      assert(0 == install(ctx, "foo/trim", DEPS));
+      assert(0 == fs_exists(DEPS "trim/trim.c"));
+      assert(-1 == fs_exists(DEPS "describe/"));
+      assert(-1 == fs_exists(DEPS "describe/package.json"));
+      assert(-1 == fs_exists(DEPS "describe/describe.h"));
+      rimraf(DEPS);
     }
 
-    it("should install itself") {
-      clib_package_t *pkg = clib_package_new_from_slug("stephenmathieson/clib-package", 0);
-      assert(pkg);
-      assert(0 == clib_package_install(pkg, "./test/fixtures/", 0));
-      assert(0 == fs_exists("./test/fixtures/"));
-
-      assert(0 == fs_exists("./test/fixtures/clib-package/"));
-      assert(0 == fs_exists("./test/fixtures/clib-package/package.json"));
-      assert(0 == fs_exists("./test/fixtures/clib-package/clib-package.c"));
-      assert(0 == fs_exists("./test/fixtures/clib-package/clib-package.h"));
-
-      assert(0 == fs_exists("./test/fixtures/http-get/"));
-      assert(0 == fs_exists("./test/fixtures/http-get/package.json"));
-      assert(0 == fs_exists("./test/fixtures/http-get/http-get.c"));
-      assert(0 == fs_exists("./test/fixtures/http-get/http-get.h"));
-
-      assert(0 == fs_exists("./test/fixtures/list/"));
-      assert(0 == fs_exists("./test/fixtures/list/package.json"));
-      assert(0 == fs_exists("./test/fixtures/list/list.c"));
-      assert(0 == fs_exists("./test/fixtures/list/list.h"));
-
-      assert(0 == fs_exists("./test/fixtures/mkdirp/"));
-      assert(0 == fs_exists("./test/fixtures/mkdirp/package.json"));
-      assert(0 == fs_exists("./test/fixtures/mkdirp/mkdirp.c"));
-      assert(0 == fs_exists("./test/fixtures/mkdirp/mkdirp.h"));
-
-      assert(0 == fs_exists("./test/fixtures/parson/"));
-      assert(0 == fs_exists("./test/fixtures/parson/package.json"));
-      assert(0 == fs_exists("./test/fixtures/parson/parson.c"));
-      assert(0 == fs_exists("./test/fixtures/parson/parson.h"));
-
-      assert(0 == fs_exists("./test/fixtures/path-join/"));
-      assert(0 == fs_exists("./test/fixtures/path-join/package.json"));
-      assert(0 == fs_exists("./test/fixtures/path-join/path-join.c"));
-      assert(0 == fs_exists("./test/fixtures/path-join/path-join.h"));
-
-      assert(0 == fs_exists("./test/fixtures/path-normalize/"));
-      assert(0 == fs_exists("./test/fixtures/path-normalize/package.json"));
-      assert(0 == fs_exists("./test/fixtures/path-normalize/path-normalize.c"));
-      assert(0 == fs_exists("./test/fixtures/path-normalize/path-normalize.h"));
-
-      assert(0 == fs_exists("./test/fixtures/str-ends-with/"));
-      assert(0 == fs_exists("./test/fixtures/str-ends-with/package.json"));
-      assert(0 == fs_exists("./test/fixtures/str-ends-with/str-ends-with.c"));
-      assert(0 == fs_exists("./test/fixtures/str-ends-with/str-ends-with.h"));
-
-      assert(0 == fs_exists("./test/fixtures/str-starts-with/"));
-      assert(0 == fs_exists("./test/fixtures/str-starts-with/package.json"));
-      assert(0 == fs_exists("./test/fixtures/str-starts-with/str-starts-with.c"));
-      assert(0 == fs_exists("./test/fixtures/str-starts-with/str-starts-with.h"));
-
-      clib_package_free(pkg);
-      rimraf("./test/fixtures");
+    it("should fail when a source cannot be fetched") {
+      add_status(memory, RAW "case/master/case.h", 404, "");
+      assert(-1 == install(ctx, "foo/case", DEPS));
+      assert(-1 == fs_exists(DEPS "case"));
+      add(memory, RAW "case/master/case.h", "int x;\n");
+      rimraf(DEPS);
     }
   }
 
+  clib_package_ctx_free(ctx);
+  clib_package_transport_free(memory);
   return assert_failures();
 }
@@ -0,0 +1,49 @@
+
+#include <string.h>
+#include "describe/describe.h"
+#include "clib-package.h"
+
+int
+main() {
+  clib_package_ctx_t *ctx = clib_package_ctx_new(NULL);
+
+  describe("clib_package_memory_peak") {
+    char json[] =
+      "{"
+      "  \"name\": \"foo\","
+      "  \"version\": \"1.0.0\","
+      "  \"repo\": \"foobar/foo\","
+      "  \"src\": [\"foo.h\", \"foo.c\"]"
+      "}";
+
+    it("should account for parsing a package") {
+      clib_package_t *pkg = clib_package_new(json, 0, ctx);
+      assert(pkg);
+      assert(clib_package_memory_peak(ctx) >= strlen(json));
+      clib_package_free(pkg);
+    }
+
+    it("should still parse when a package exceeds the budget") {
+      clib_package_set_memory_budget(ctx, 16);
+      clib_package_t *pkg = clib_package_new(json, 0, ctx);
+      assert(pkg);
+      assert_str_equal("foo", pkg->name);
+      clib_package_free(pkg);
+      clib_package_set_memory_budget(ctx, 0);
+    }
+
+    it("should keep sessions apart") {
+      clib_package_ctx_t *other = clib_package_ctx_new("{ \"memory_budget\": 16 }");
+      assert(other);
+      assert(0 == clib_package_memory_peak(other));
+      clib_package_t *pkg = clib_package_new(json, 0, other);
+      assert(pkg);
+      assert(clib_package_memory_peak(other) >= strlen(json));
+      clib_package_free(pkg);
+      clib_package_ctx_free(other);
+    }
+  }
+
+  clib_package_ctx_free(ctx);
+  return assert_failures();
+}
@@ -0,0 +1,87 @@
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "describe/describe.h"
+#include "fs/fs.h"
+#include "rimraf/rimraf.h"
+#include "clib-package.h"
+#include "helpers.h"
+
+#define MIRROR "./test/fixtures/mirror"
+#define DEPS "./test/fixtures/deps/"
+
+int
+main() {
+  clib_package_ctx_t *online = clib_package_ctx_new("{ \"api_endpoints\": [\"" API "\"] }");
+  clib_package_ctx_t *offline = clib_package_ctx_new("{ \"api_endpoints\": [\"" API "\"],"
+    " \"offline\": \"" MIRROR "\" }");
+  clib_package_transport_t *memory = clib_package_transport_memory();
+  clib_package_stats_t stats;
+
+  add_package(memory, "baz", "\"dependencies\": { \"foo/qux\": \"master\" }", "baz.c", "int x;\n", NULL);
+  add_package(memory, "qux", NULL, "qux.c", "int x;\n", NULL);
+  // a contents response pointing out of the mirror
+  add_package(memory, "evil", NULL, "evil.c", "int x;\n", NULL);
+  add(memory, API "repos/foo/evil/contents/evil.c?ref=master"
+    , "{ \"download_url\": \"https://raw.test/foo/evil/../../../../escape\" }");
+  add(memory, "https://raw.test/foo/evil/../../../../escape", "int x;\n");
+  clib_package_set_transport(online, memory);
+  // offline wins over a transport set on the session
+  clib_package_set_transport(offline, memory);
+
+  describe("clib_package_mirror_export") {
+    it("should write the graph of the roots into the mirror") {
+      const char *slugs[] = { "foo/baz" };
+      assert(0 == clib_package_mirror_export(MIRROR, slugs, 1, online, NULL));
+      assert(0 == fs_exists(MIRROR "/api.test/repos/foo/baz.body"));
+      assert(0 == fs_exists(MIRROR "/raw.test/foo/qux/master/qux.c.body"));
+      assert(-1 == fs_exists(MIRROR "/.export"));
+    }
+
+    it("should not write outside the mirror") {
+      const char *slugs[] = { "foo/evil" };
+      clib_package_mirror_export(MIRROR, slugs, 1, online, NULL);
+      assert(0 == fs_exists(MIRROR "/api.test/repos/foo/evil.body"));
+      assert(-1 == fs_exists("./test/fixtures/escape.body"));
+    }
+
+    it("should fail on a root it cannot resolve") {
+      const char *slugs[] = { "foo/nope" };
+      assert(-1 == clib_package_mirror_export(MIRROR, slugs, 1, online, NULL));
+    }
+  }
+
+  describe("clib_package_set_offline") {
+    it("should install from the mirror alone") {
+      clib_package_t *pkg = clib_package_new_from_slug("foo/baz", 0, offline);
+      assert(pkg);
+      assert(0 == clib_package_install(pkg, DEPS, 0));
+      clib_package_free(pkg);
+      assert(0 == fs_exists(DEPS "baz/baz.c"));
+      assert(0 == fs_exists(DEPS "qux/qux.c"));
+    }
+
+    it("should fail at once on a miss") {
+      clib_package_stats_reset(offline);
+      assert(NULL == clib_package_new_from_slug("foo/nope", 0, offline));
+      clib_package_stats(offline, &stats);
+      assert(1 == stats.requests);
+      assert(0 == stats.retries);
+    }
+
+    it("should go back online") {
+      assert(0 == clib_package_set_offline(offline, NULL));
+      clib_package_t *pkg = clib_package_new_from_slug("foo/qux", 0, offline);
+      assert(pkg);
+      clib_package_free(pkg);
+    }
+  }
+
+  rimraf(MIRROR);
+  rimraf(DEPS);
+  clib_package_ctx_free(online);
+  clib_package_ctx_free(offline);
+  clib_package_transport_free(memory);
+  return assert_failures();
+}
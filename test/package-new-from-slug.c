@@ -1,49 +1,76 @@
-
+#include <stdlib.h>
 #include "describe/describe.h"
 #include "clib-package.h"
+#include "helpers.h"
 
 int
 main() {
+  clib_package_ctx_t *ctx = clib_package_ctx_new("{ \"api_endpoints\": [\"" API "\"] }");
+  clib_package_transport_t *memory = clib_package_transport_memory();
+
+  add(memory, API "repos/foo/case", "{}");
+  add_manifest(memory, "case", "0.1.0"
+    , "{ \"name\": \"case\", \"version\": \"0.1.0\", \"repo\": \"foo/case\","
+      " \"license\": \"MIT\", \"description\": \"String case conversion utility\","
+      " \"src\": [\"case.c\", \"case.h\"] }");
+  add(memory, API "repos/foo/mkdirp", "{}");
+  add_manifest(memory, "mkdirp", "0.0.1"
+    , "{ \"name\": \"mkdirp\", \"version\": \"0.1.5\", \"repo\": \"foo/mkdirp\" }");
+  add_manifest(memory, "mkdirp", "0.1.5"
+    , "{ \"name\": \"mkdirp\", \"version\": \"0.1.5\", \"repo\": \"foo/mkdirp\" }");
+  add(memory, API "repos/foo/str-replace", "{}");
+  add_manifest(memory, "str-replace", "8ca90fb"
+    , "{\n"
+      "  \"name\": \"str-replace\",\n"
+      "  \"version\": \"0.0.3\",\n"
+      "  \"repo\": \"foo/str-replace\",\n"
+      "  \"src\": [\n"
+      "    \"src/str-replace.c\",\n"
+      "    \"src/str-replace.h\"\n"
+      "  ]\n"
+      "}\n");
+  clib_package_set_transport(ctx, memory);
+
   describe("clib_package_new_from_slug") {
     it("should return NULL when given a bad slug") {
-      assert(NULL == clib_package_new_from_slug(NULL, 0));
+      assert(NULL == clib_package_new_from_slug(NULL, 0, ctx));
     }
 
     it("should return NULL when given a slug missing a name") {
-      assert(NULL == clib_package_new_from_slug("author/@version", 0));
+      assert(NULL == clib_package_new_from_slug("author/@version", 0, ctx));
     }
 
     it("should return NULL when given slug which doesn't resolve") {
-      assert(NULL == clib_package_new_from_slug("abc11234", 0));
+      assert(NULL == clib_package_new_from_slug("abc11234", 0, ctx));
     }
 
     it("should build the correct package") {
-      clib_package_t *pkg = clib_package_new_from_slug("stephenmathieson/case.c@0.1.0", 0);
+      clib_package_t *pkg = clib_package_new_from_slug("foo/case@0.1.0", 0, ctx);
       assert(pkg);
       assert_str_equal("case", pkg->name);
       assert_str_equal("0.1.0", pkg->version);
-      assert_str_equal("stephenmathieson/case.c", pkg->repo);
+      assert_str_equal("foo/case", pkg->repo);
       assert_str_equal("MIT", pkg->license);
       assert_str_equal("String case conversion utility", pkg->description);
       clib_package_free(pkg);
     }
 
     it("should force package version numbers") {
-      clib_package_t *pkg = clib_package_new_from_slug("stephenmathieson/mkdirp.c@0.0.1", 0);
+      clib_package_t *pkg = clib_package_new_from_slug("foo/mkdirp@0.0.1", 0, ctx);
       assert(pkg);
       assert_str_equal("0.0.1", pkg->version);
       clib_package_free(pkg);
     }
 
     it("should use package version if version not provided") {
-      clib_package_t *pkg = clib_package_new_from_slug("stephenmathieson/mkdirp.c", 0);
+      clib_package_t *pkg = clib_package_new_from_slug("foo/mkdirp", 0, ctx);
       assert(pkg);
       assert_str_equal("0.1.5", pkg->version);
       clib_package_free(pkg);
     }
 
     it("should save the package's json") {
-      clib_package_t *pkg = clib_package_new_from_slug("stephenmathieson/str-replace.c@8ca90fb", 0);
+      clib_package_t *pkg = clib_package_new_from_slug("foo/str-replace@8ca90fb", 0, ctx);
       assert(pkg);
       assert(pkg->json);
 
@@ -51,15 +78,10 @@ main() {
         "{\n"
         "  \"name\": \"str-replace\",\n"
         "  \"version\": \"0.0.3\",\n"
-        "  \"repo\": \"stephenmathieson/str-replace.c\",\n"
-        "  \"description\": \"String replacement in C\",\n"
-        "  \"keywords\": [ \"string\", \"replace\" ],\n"
-        "  \"license\": \"MIT\",\n"
+        "  \"repo\": \"foo/str-replace\",\n"
         "  \"src\": [\n"
         "    \"src/str-replace.c\",\n"
-        "    \"src/str-replace.h\",\n"
-        "    \"deps/occurrences.c\",\n"
-        "    \"deps/occurrences.h\"\n"
+        "    \"src/str-replace.h\"\n"
         "  ]\n"
         "}\n";
 
@@ -68,5 +90,7 @@ main() {
     }
   }
 
+  clib_package_ctx_free(ctx);
+  clib_package_transport_free(memory);
   return assert_failures();
 }
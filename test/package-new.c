@@ -24,15 +24,15 @@ main() {
       "}";
 
     it("should return NULL when given broken json") {
-      assert(NULL == clib_package_new("{", 0));
+      assert(NULL == clib_package_new("{", 0, NULL));
     }
 
     it("should return NULL when given a bad string") {
-      assert(NULL == clib_package_new(NULL, 0));
+      assert(NULL == clib_package_new(NULL, 0, NULL));
     }
 
     it("should return a clib_package when given valid json") {
-      clib_package_t *pkg = clib_package_new(json, 0);
+      clib_package_t *pkg = clib_package_new(json, 0, NULL);
       assert(pkg);
 
       assert_str_equal(json, pkg->json);
@@ -76,7 +76,7 @@ main() {
         "  \"description\": \"lots of foo\""
         "}";
 
-      clib_package_t *pkg = clib_package_new(json, 0);
+      clib_package_t *pkg = clib_package_new(json, 0, NULL);
       assert(pkg);
       clib_package_free(pkg);
     }
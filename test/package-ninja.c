@@ -0,0 +1,99 @@
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "describe/describe.h"
+#include "fs/fs.h"
+#include "parson/parson.h"
+#include "rimraf/rimraf.h"
+#include "clib-package.h"
+#include "helpers.h"
+
+#define ROOT "./test/fixtures/ninja/"
+#define DEPS ROOT "deps/"
+
+static int
+count(const char *haystack, const char *needle) {
+  int n = 0;
+  for (const char *p = haystack; (p = strstr(p, needle)); p++) n++;
+  return n;
+}
+
+int
+main() {
+  clib_package_ctx_t *ctx = clib_package_ctx_new("{ \"api_endpoints\": [\"" API "\"],"
+    " \"ninja\": true, \"compile_commands\": true }");
+  clib_package_transport_t *memory = clib_package_transport_memory();
+
+  add_package(memory, "baz", NULL, "baz.c", "int x;\n", "baz.h", "int x;\n", NULL);
+  add_package(memory, "qux", NULL, "qux.c", "int x;\n", "util.c", "int x;\n", NULL);
+  clib_package_set_transport(ctx, memory);
+  rimraf(ROOT);
+
+  describe("clib_package_set_outputs") {
+    it("should write a ninja fragment per package") {
+      assert(0 == install(ctx, "foo/baz", DEPS));
+      char *ninja = fs_read(DEPS "baz/baz.ninja");
+      assert(ninja);
+      assert(strstr(ninja, "build $builddir/deps/baz/baz.o: deps_cc $top_srcdir/deps/baz/baz.c\n"));
+      assert(strstr(ninja, "build deps_baz: phony $builddir/deps/baz/baz.o\n"));
+      assert(NULL == strstr(ninja, "baz.h"));
+      free(ninja);
+    }
+
+    it("should include every fragment from deps.ninja once") {
+      assert(0 == install(ctx, "foo/qux", DEPS));
+      assert(0 == install(ctx, "foo/qux", DEPS));
+      char *ninja = fs_read(ROOT "deps.ninja");
+      assert(ninja);
+      assert(1 == count(ninja, "rule deps_cc"));
+      assert(1 == count(ninja, "include $top_srcdir/deps/baz/baz.ninja\n"));
+      assert(1 == count(ninja, "include $top_srcdir/deps/qux/qux.ninja\n"));
+      free(ninja);
+    }
+
+    it("should merge the sources into compile_commands.json") {
+      JSON_Value *root = json_parse_file(ROOT "compile_commands.json");
+      JSON_Array *entries = json_value_get_array(root);
+      assert(entries);
+      assert(3 == json_array_get_count(entries));
+      JSON_Object *entry = json_array_get_object(entries, 0);
+      assert_str_equal("deps/baz/baz.c", json_object_get_string(entry, "file"));
+      assert(json_object_get_string(entry, "directory"));
+      assert(6 == json_array_get_count(json_object_get_array(entry, "arguments")));
+      json_value_free(root);
+    }
+
+    it("should write nothing more when off") {
+      rimraf(ROOT);
+      clib_package_set_outputs(ctx, 0);
+      assert(0 == install(ctx, "foo/baz", DEPS));
+      assert(0 == fs_exists(ROOT "deps.mk"));
+      assert(-1 == fs_exists(ROOT "deps.ninja"));
+      assert(-1 == fs_exists(ROOT "compile_commands.json"));
+      assert(-1 == fs_exists(DEPS "baz/baz.ninja"));
+    }
+
+    it("should take in packages installed before it was on") {
+      clib_package_set_outputs(ctx, CLIB_PACKAGE_OUTPUT_NINJA | CLIB_PACKAGE_OUTPUT_COMPILE_COMMANDS);
+      // up to date, so skipped
+      assert(0 == install(ctx, "foo/baz", DEPS));
+      assert(0 == fs_exists(DEPS "baz/baz.ninja"));
+      char *ninja = fs_read(ROOT "deps.ninja");
+      assert(ninja);
+      assert(1 == count(ninja, "include $top_srcdir/deps/baz/baz.ninja\n"));
+      free(ninja);
+      JSON_Value *root = json_parse_file(ROOT "compile_commands.json");
+      JSON_Array *entries = json_value_get_array(root);
+      assert(entries);
+      assert(1 == json_array_get_count(entries));
+      assert_str_equal("deps/baz/baz.c", json_object_get_string(json_array_get_object(entries, 0), "file"));
+      json_value_free(root);
+    }
+  }
+
+  rimraf(ROOT);
+  clib_package_ctx_free(ctx);
+  clib_package_transport_free(memory);
+  return assert_failures();
+}
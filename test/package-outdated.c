@@ -0,0 +1,126 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "describe/describe.h"
+#include "rimraf/rimraf.h"
+#include "clib-package.h"
+#include "helpers.h"
+
+#define DEPS "./test/fixtures/"
+#define REPO API "repos/foo/baz/"
+#define HEAD REPO "commits/master"
+
+/**
+ * Point master at `commit`, with the package.json blob `sha`
+ * of `version` there.
+ */
+
+static void
+serve_head(clib_package_transport_t *transport, const char *commit, const char *sha, const char *version) {
+  char url[256];
+  char body[256];
+  snprintf(body, sizeof(body), "{ \"sha\": \"%s\" }", commit);
+  add(transport, HEAD, body);
+  snprintf(body, sizeof(body), "{ \"download_url\": \"" RAW "baz/%s/package.json\", \"sha\": \"%s\" }", sha, sha);
+  snprintf(url, sizeof(url), REPO "contents/package.json?ref=%s", commit);
+  add(transport, url, body);
+  add(transport, REPO "contents/package.json?ref=master", body);
+  snprintf(url, sizeof(url), RAW "baz/%s/package.json", sha);
+  snprintf(body, sizeof(body)
+    , "{ \"name\": \"baz\", \"version\": \"%s\", \"repo\": \"foo/baz\" }", version);
+  add(transport, url, body);
+}
+
+static clib_package_outdated_t *
+first(list_t *outdated) {
+  assert(outdated);
+  assert(1 == outdated->len);
+  return (clib_package_outdated_t *) outdated->head->val;
+}
+
+int
+main() {
+  clib_package_ctx_t *ctx = clib_package_ctx_new("{ \"api_endpoints\": [\"" API "\"] }");
+  clib_package_transport_t *memory = clib_package_transport_memory();
+  clib_package_outdated_t *entry = NULL;
+  clib_package_stats_t stats;
+  list_t *outdated = NULL;
+
+  add(memory, API "repos/foo/baz", "{}");
+  add(memory, REPO "commits/1.0.0", "{ \"sha\": \"c100\" }");
+  serve_head(memory, "c100", "1000", "1.0.0");
+  clib_package_set_transport(ctx, memory);
+
+  assert(0 == install(ctx, "foo/baz", DEPS));
+
+  describe("clib_package_outdated") {
+    it("should report nothing while upstream is at the installed commit") {
+      clib_package_stats_reset(ctx);
+      outdated = clib_package_outdated(DEPS, ctx, NULL);
+      assert(outdated);
+      assert(0 == outdated->len);
+      list_destroy(outdated);
+      // the head and installed commits only, no package.json
+      clib_package_stats(ctx, &stats);
+      assert(2 == stats.requests);
+    }
+
+    it("should report new commits with the same version") {
+      serve_head(memory, "c101", "1000", "1.0.0");
+      clib_package_stats_reset(ctx);
+      outdated = clib_package_outdated(DEPS, ctx, NULL);
+      entry = first(outdated);
+      assert_str_equal("1.0.0", entry->latest);
+      assert(NULL == entry->error);
+      assert(!entry->newer);
+      assert(entry->changed);
+      list_destroy(outdated);
+      // the installed commit is remembered, the package.json is the installed one
+      clib_package_stats(ctx, &stats);
+      assert(2 == stats.requests);
+    }
+
+    it("should report a newer version upstream") {
+      serve_head(memory, "c110", "1100", "1.1.0");
+      outdated = clib_package_outdated(DEPS, ctx, NULL);
+      entry = first(outdated);
+      assert_str_equal("foo/baz", entry->repo);
+      assert_str_equal("1.0.0", entry->installed);
+      assert_str_equal("1.1.0", entry->latest);
+      assert(entry->newer);
+      assert(entry->changed);
+      list_destroy(outdated);
+    }
+
+    it("should answer a 304 from what it remembers") {
+      add_status(memory, HEAD, 304, "");
+      clib_package_stats_reset(ctx);
+      outdated = clib_package_outdated(DEPS, ctx, NULL);
+      assert_str_equal("1.1.0", first(outdated)->latest);
+      list_destroy(outdated);
+      clib_package_stats(ctx, &stats);
+      assert(1 == stats.requests);
+      assert(1 == stats.revalidations);
+      assert(1 == stats.not_modified);
+    }
+
+    it("should list a package it could not check with its error") {
+      add_status(memory, HEAD, 404, "");
+      outdated = clib_package_outdated(DEPS, ctx, NULL);
+      entry = first(outdated);
+      assert_str_equal("foo/baz", entry->repo);
+      assert(entry->error);
+      assert(NULL == entry->latest);
+      list_destroy(outdated);
+    }
+
+    it("should fail for a missing directory") {
+      assert(NULL == clib_package_outdated("./test/missing/", ctx, NULL));
+    }
+  }
+
+  rimraf(DEPS);
+  clib_package_ctx_free(ctx);
+  clib_package_transport_free(memory);
+  return assert_failures();
+}
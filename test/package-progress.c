@@ -0,0 +1,76 @@
+
+#include <stdio.h>
+#include <string.h>
+#include "describe/describe.h"
+#include "rimraf/rimraf.h"
+#include "clib-package.h"
+#include "helpers.h"
+
+static char events[1024];
+
+static void
+on_progress(const char *event, const char *slug, const char *detail, void *data) {
+  (void) slug;
+  (void) detail;
+  (void) data;
+  strncat(events, event, sizeof(events) - strlen(events) - 2);
+  strcat(events, " ");
+}
+
+int
+main() {
+  clib_package_ctx_t *ctx = clib_package_ctx_new("{ \"api_endpoints\": [\"" API "\"] }");
+  clib_package_transport_t *memory = clib_package_transport_memory();
+  clib_package_stats_t stats;
+
+  add_package(memory, "baz", NULL, "baz.c", "int x;\n", NULL);
+  clib_package_set_transport(ctx, memory);
+
+  describe("clib_package_set_manifest_ttl") {
+    it("should serve a second resolve from the session") {
+      clib_package_set_manifest_ttl(ctx, 60);
+      clib_package_t *pkg = clib_package_resolve("foo/baz", 0, ctx, NULL);
+      assert(pkg);
+      clib_package_free(pkg);
+
+      clib_package_stats_reset(ctx);
+      pkg = clib_package_resolve("foo/baz", 0, ctx, NULL);
+      assert(pkg);
+      assert(0 == strcmp("baz", pkg->name));
+      clib_package_stats(ctx, &stats);
+      assert(0 == stats.requests);
+      assert(1 == stats.manifest_lookups);
+      assert(1 == stats.manifest_hits);
+      clib_package_free(pkg);
+    }
+
+    it("should fetch again once disabled") {
+      clib_package_set_manifest_ttl(ctx, 0);
+      clib_package_stats_reset(ctx);
+      clib_package_t *pkg = clib_package_resolve("foo/baz", 0, ctx, NULL);
+      assert(pkg);
+      clib_package_stats(ctx, &stats);
+      assert(2 == stats.requests);
+      clib_package_free(pkg);
+    }
+  }
+
+  describe("clib_package_cancel_set_progress") {
+    it("should report each step of an install") {
+      clib_package_cancel_t *cancel = clib_package_cancel_new(0);
+      clib_package_cancel_set_progress(cancel, on_progress, NULL);
+      clib_package_t *pkg = clib_package_resolve("foo/baz", 0, ctx, cancel);
+      assert(pkg);
+      pkg->cancel = cancel;
+      assert(0 == clib_package_install(pkg, "./test/fixtures/", 0));
+      assert(0 == strcmp("resolved fetch installed ", events));
+      clib_package_free(pkg);
+      clib_package_cancel_free(cancel);
+      rimraf("./test/fixtures/");
+    }
+  }
+
+  clib_package_ctx_free(ctx);
+  clib_package_transport_free(memory);
+  return assert_failures();
+}
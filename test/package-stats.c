@@ -0,0 +1,124 @@
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "describe/describe.h"
+#include "fs/fs.h"
+#include "rimraf/rimraf.h"
+#include "clib-package.h"
+#include "helpers.h"
+
+int
+main() {
+  clib_package_ctx_t *ctx = clib_package_ctx_new("{ \"api_endpoints\": [\"" API "\"] }");
+  clib_package_transport_t *memory = clib_package_transport_memory();
+  clib_package_stats_t stats;
+
+  // bar -> baz, qux; qux -> baz
+  add_package(memory, "bar", "\"dependencies\": { \"foo/baz\": \"*\", \"foo/qux\": \"*\" }"
+    , "bar.c", "int x;\n", NULL);
+  add_package(memory, "baz", NULL, "baz.c", "int x;\n", NULL);
+  add_package(memory, "qux", "\"dependencies\": { \"foo/baz\": \"*\" }", "qux.c", "int x;\n", NULL);
+  // diamond -> left, right; left -> shared@1.0.0; right -> shared@2.0.0
+  add_package(memory, "diamond", "\"dependencies\": { \"foo/left\": \"*\", \"foo/right\": \"*\" }", NULL);
+  add_package(memory, "left", "\"dependencies\": { \"foo/shared\": \"1.0.0\" }", NULL);
+  add_package(memory, "right", "\"dependencies\": { \"foo/shared\": \"2.0.0\" }", NULL);
+  add_package(memory, "shared", NULL, "shared.c", "int x;\n", NULL);
+  add_manifest(memory, "shared", "2.0.0"
+    , "{ \"name\": \"shared\", \"version\": \"2.0.0\", \"repo\": \"foo/shared\", \"src\": [\"shared.c\"] }");
+
+  describe("clib_package_stats_bucket_ms") {
+    it("should grow four buckets per doubling") {
+      assert(0.001 == clib_package_stats_bucket_ms(0));
+      assert(0.004 == clib_package_stats_bucket_ms(3));
+      assert(0.005 == clib_package_stats_bucket_ms(4));
+      assert(0.010 == clib_package_stats_bucket_ms(8));
+      assert(2 * clib_package_stats_bucket_ms(40) == clib_package_stats_bucket_ms(44));
+    }
+  }
+
+  describe("clib_package_stats") {
+    it("should start out empty") {
+      clib_package_stats_reset(ctx);
+      clib_package_stats(ctx, &stats);
+      assert(0 == stats.requests);
+      assert(0 == stats.latency_p99_ms);
+    }
+
+    it("should count an install") {
+      clib_package_set_transport(ctx, memory);
+      clib_package_stats_reset(ctx);
+      clib_package_t *pkg = clib_package_new_from_slug("foo/bar", 0, ctx);
+      assert(pkg);
+      assert(0 == clib_package_install(pkg, "./test/fixtures/", 0));
+      clib_package_free(pkg);
+      clib_package_set_transport(ctx, NULL);
+
+      clib_package_stats(ctx, &stats);
+      assert(3 == stats.packages_resolved);
+      assert(1 == stats.packages_deduplicated);
+      assert(0 == stats.packages_failed);
+      assert(3 == stats.files_fetched);
+      assert(15 == stats.requests);
+      assert(15 == stats.requests_by_class[2]);
+      assert(0 == stats.retries);
+      assert(stats.bytes_decoded > 0);
+      // no store, and nothing to resume
+      assert(0 == stats.store_lookups);
+      assert(0 == stats.downloads_resumed);
+      assert(stats.latency_p50_ms > 0);
+      assert(stats.latency_p50_ms <= stats.latency_p95_ms);
+      assert(stats.latency_p95_ms <= stats.latency_p99_ms);
+    }
+
+    it("should count packages that are already installed") {
+      clib_package_set_transport(ctx, memory);
+      clib_package_stats_reset(ctx);
+      clib_package_t *pkg = clib_package_new_from_slug("foo/baz", 0, ctx);
+      assert(pkg);
+      assert(0 == clib_package_install(pkg, "./test/fixtures/", 0));
+      clib_package_free(pkg);
+      clib_package_set_transport(ctx, NULL);
+
+      clib_package_stats(ctx, &stats);
+      assert(1 == stats.packages_skipped);
+      assert(1 == stats.files_skipped);
+      assert(0 == stats.files_fetched);
+      rimraf("./test/fixtures");
+    }
+
+    it("should not take two versions of a package for one") {
+      clib_package_set_transport(ctx, memory);
+      clib_package_stats_reset(ctx);
+      clib_package_t *pkg = clib_package_new_from_slug("foo/diamond", 0, ctx);
+      assert(pkg);
+      assert(0 == clib_package_install(pkg, "./test/fixtures/", 0));
+      clib_package_free(pkg);
+      clib_package_set_transport(ctx, NULL);
+
+      clib_package_stats(ctx, &stats);
+      assert(0 == stats.packages_deduplicated);
+      char *json = fs_read("./test/fixtures/shared/package.json");
+      assert(json);
+      assert(strstr(json, "\"2.0.0\""));
+      free(json);
+      rimraf("./test/fixtures");
+    }
+
+    it("should count failed requests by class") {
+      clib_package_set_transport(ctx, memory);
+      clib_package_stats_reset(ctx);
+      assert(NULL == clib_package_new_from_slug("foo/missing", 0, ctx));
+      clib_package_set_transport(ctx, NULL);
+
+      clib_package_stats(ctx, &stats);
+      assert(1 == stats.requests);
+      assert(1 == stats.requests_by_class[4]);
+      assert(0 == stats.packages_resolved);
+    }
+  }
+
+  clib_package_ctx_free(ctx);
+  clib_package_transport_free(memory);
+  return assert_failures();
+}
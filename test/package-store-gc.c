@@ -0,0 +1,101 @@
+
+#define _DEFAULT_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "describe/describe.h"
+#include "fs/fs.h"
+#include "mkdirp/mkdirp.h"
+#include "rimraf/rimraf.h"
+#include "clib-package.h"
+
+#define STORE "./test/fixtures/gc-store"
+#define BLOB_SIZE 8192
+
+/**
+ * Add a blob to the store, last used `atime` seconds into
+ * the epoch.
+ */
+
+static void
+add_blob(const char *fanout, const char *name, time_t atime) {
+  char path[256];
+  char body[BLOB_SIZE + 1];
+  struct timespec times[2];
+
+  snprintf(path, sizeof(path), STORE "/%s", fanout);
+  mkdirp(path, 0777);
+  snprintf(path, sizeof(path), STORE "/%s/%s", fanout, name);
+  memset(body, 'x', BLOB_SIZE);
+  body[BLOB_SIZE] = '\0';
+  assert(-1 != fs_write(path, body));
+
+  times[0].tv_sec = atime;
+  times[0].tv_nsec = 0;
+  times[1].tv_sec = atime;
+  times[1].tv_nsec = 0;
+  assert(0 == utimensat(AT_FDCWD, path, times, 0));
+}
+
+int
+main() {
+  clib_package_ctx_t *ctx = clib_package_ctx_new("{ \"store\": \"" STORE "\" }");
+  clib_package_ctx_t *none = clib_package_ctx_new(NULL);
+  clib_package_store_stats_t stats;
+
+  add_blob("aa", "01", 100);
+  add_blob("bb", "02", 200);
+  add_blob("cc", "03", 300);
+  // linked from an installed tree, and older than all of them
+  add_blob("dd", "04", 10);
+  assert(0 == link(STORE "/dd/04", "./test/fixtures/gc-installed.c"));
+  // left behind by a crashed install
+  add_blob("cc", "05.1.1.tmp", 10);
+
+  describe("clib_package_store_gc") {
+    it("should fail without a store") {
+      assert(-1 == clib_package_store_gc(none, &stats));
+    }
+
+    it("should only report without a limit") {
+      assert(0 == clib_package_store_gc(ctx, &stats));
+      assert(4 == stats.blobs);
+      assert(0 == stats.evicted);
+      assert(1 == stats.stale);
+      assert(stats.bytes_shared > 0);
+      assert(stats.bytes_allocated >= stats.bytes);
+      assert(-1 == fs_exists(STORE "/cc/05.1.1.tmp"));
+    }
+
+    it("should evict the least recently used blobs") {
+      clib_package_set_store_limit(ctx, 2 * BLOB_SIZE);
+      assert(0 == clib_package_store_gc(ctx, &stats));
+      assert(1 == stats.evicted);
+      assert(stats.bytes_reclaimed >= BLOB_SIZE);
+      assert(-1 == fs_exists(STORE "/aa/01"));
+      assert(-1 == fs_exists(STORE "/aa"));
+      assert(0 == fs_exists(STORE "/bb/02"));
+      assert(0 == fs_exists(STORE "/cc/03"));
+    }
+
+    it("should keep blobs linked from installed trees") {
+      assert(0 == fs_exists(STORE "/dd/04"));
+    }
+
+    it("should add what it did to the session stats") {
+      clib_package_stats_t session;
+      clib_package_stats(ctx, &session);
+      assert(1 == session.cache_evicted);
+      assert(session.bytes_reclaimed >= BLOB_SIZE);
+    }
+  }
+
+  unlink("./test/fixtures/gc-installed.c");
+  rimraf(STORE);
+  clib_package_ctx_free(ctx);
+  clib_package_ctx_free(none);
+  return assert_failures();
+}
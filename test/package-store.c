@@ -0,0 +1,91 @@
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include "describe/describe.h"
+#include "fs/fs.h"
+#include "rimraf/rimraf.h"
+#include "clib-package.h"
+#include "helpers.h"
+
+// git hash-object of "int x;\n"
+#define SHA "6d1a0d47b7f73eacb962f3711df06b21ed11f7ca"
+#define BLOB "./test/fixtures/store/6d/1a0d47b7f73eacb962f3711df06b21ed11f7ca"
+// not the blob of what is served as it
+#define BAD "0123456789abcdef0123456789abcdef01234567"
+
+int
+main() {
+  clib_package_ctx_t *ctx = clib_package_ctx_new(
+    "{ \"api_endpoints\": [\"" API "\"], \"store\": \"./test/fixtures/store\" }");
+  clib_package_transport_t *memory = clib_package_transport_memory();
+  clib_package_stats_t stats;
+
+  add_package(memory, "baz", NULL, "baz.c", "int x;\n", NULL);
+  add_file(memory, "baz", "baz.c", SHA, "int x;\n");
+  add_package(memory, "qux", NULL, "qux.c", "int y;\n", NULL);
+  add_file(memory, "qux", "qux.c", BAD, "int y;\n");
+  clib_package_set_transport(ctx, memory);
+
+  describe("clib_package_set_store") {
+    it("should keep fetched files in the store") {
+      clib_package_stats_reset(ctx);
+      assert(0 == install(ctx, "foo/baz", "./test/fixtures/a/"));
+      assert(0 == fs_exists(BLOB));
+      clib_package_stats(ctx, &stats);
+      assert(1 == stats.files_fetched);
+      assert(0 == stats.files_linked);
+    }
+
+    it("should keep read-only copies, not the installed files") {
+      struct stat blob;
+      struct stat installed;
+      assert(0 == stat(BLOB, &blob));
+      assert(0 == stat("./test/fixtures/a/baz/baz.c", &installed));
+      assert(0 == (blob.st_mode & 0222));
+      assert(blob.st_ino != installed.st_ino);
+      // editing the install in place leaves the blob be
+      FILE *file = fopen("./test/fixtures/a/baz/baz.c", "w");
+      assert(file);
+      fputs("int edited;\n", file);
+      fclose(file);
+      char *contents = fs_read(BLOB);
+      assert(contents);
+      assert(0 == strcmp("int x;\n", contents));
+      free(contents);
+    }
+
+    it("should not store files that are not their blob") {
+      assert(0 == install(ctx, "foo/qux", "./test/fixtures/a/"));
+      assert(0 == fs_exists("./test/fixtures/a/qux/qux.c"));
+      assert(-1 == fs_exists("./test/fixtures/store/01/23456789abcdef0123456789abcdef01234567"));
+    }
+
+    it("should materialize stored files instead of fetching them") {
+      clib_package_stats_reset(ctx);
+      assert(0 == install(ctx, "foo/baz", "./test/fixtures/b/"));
+      clib_package_stats(ctx, &stats);
+      assert(0 == stats.files_fetched);
+      assert(1 == stats.files_linked);
+      char *contents = fs_read("./test/fixtures/b/baz/baz.c");
+      assert(contents);
+      assert(0 == strcmp("int x;\n", contents));
+      free(contents);
+    }
+
+    it("should fetch everything without a store") {
+      clib_package_set_store(ctx, NULL);
+      clib_package_stats_reset(ctx);
+      assert(0 == install(ctx, "foo/baz", "./test/fixtures/c/"));
+      clib_package_stats(ctx, &stats);
+      assert(1 == stats.files_fetched);
+      assert(0 == stats.files_linked);
+    }
+  }
+
+  rimraf("./test/fixtures/");
+  clib_package_ctx_free(ctx);
+  clib_package_transport_free(memory);
+  return assert_failures();
+}
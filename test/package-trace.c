@@ -0,0 +1,77 @@
+
+#include <string.h>
+#include "describe/describe.h"
+#include "rimraf/rimraf.h"
+#include "fs/fs.h"
+#include "parson/parson.h"
+#include "clib-package.h"
+#include "helpers.h"
+
+#define TRACE "./test/trace.json"
+
+static int
+count_events(JSON_Array *events, const char *name) {
+  int count = 0;
+  for (size_t i = 0; i < json_array_get_count(events); i++) {
+    JSON_Object *event = json_array_get_object(events, i);
+    if (0 == strcmp(name, json_object_get_string(event, "name"))) count++;
+  }
+  return count;
+}
+
+int
+main() {
+  clib_package_ctx_t *ctx = clib_package_ctx_new("{ \"api_endpoints\": [\"" API "\"] }");
+  clib_package_transport_t *memory = clib_package_transport_memory();
+
+  add_package(memory, "bar", NULL, "bar.c", "int bar(void) { return 1; }\n", NULL);
+
+  describe("clib_package_trace_open") {
+    it("should fail on an unwritable path") {
+      assert(-1 == clib_package_trace_open(ctx, "./test/missing/trace.json"));
+    }
+
+    it("should write every request and phase as a span") {
+      clib_package_set_transport(ctx, memory);
+      assert(0 == clib_package_trace_open(ctx, TRACE));
+      clib_package_t *pkg = clib_package_new_from_slug("foo/bar", 0, ctx);
+      assert(pkg);
+      assert(0 == clib_package_install(pkg, "./test/fixtures/", 0));
+      clib_package_free(pkg);
+      clib_package_trace_close(ctx);
+      clib_package_set_transport(ctx, NULL);
+
+      JSON_Value *root = json_parse_file(TRACE);
+      assert(root);
+      JSON_Array *events = json_object_get_array(json_value_get_object(root), "traceEvents");
+      assert(events);
+      assert(5 == count_events(events, "GET"));
+      assert(1 == count_events(events, "endpoint discovery"));
+      assert(1 == count_events(events, "fetch package.json"));
+      assert(1 == count_events(events, "fetch file"));
+      assert(1 == count_events(events, "write package.json"));
+      assert(1 == count_events(events, "install"));
+
+      JSON_Object *get = json_array_get_object(events, 0);
+      assert_str_equal("X", json_object_get_string(get, "ph"));
+      assert(200 == json_object_dotget_number(get, "args.status"));
+      assert(json_object_dotget_string(get, "args.url"));
+      json_value_free(root);
+      rimraf("./test/fixtures");
+      remove(TRACE);
+    }
+
+    it("should not trace once closed") {
+      clib_package_set_transport(ctx, memory);
+      clib_package_t *pkg = clib_package_new_from_slug("foo/bar", 0, ctx);
+      assert(pkg);
+      clib_package_free(pkg);
+      clib_package_set_transport(ctx, NULL);
+      assert(-1 == fs_exists(TRACE));
+    }
+  }
+
+  clib_package_ctx_free(ctx);
+  clib_package_transport_free(memory);
+  return assert_failures();
+}
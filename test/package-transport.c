@@ -0,0 +1,95 @@
+
+#include <string.h>
+#include "describe/describe.h"
+#include "rimraf/rimraf.h"
+#include "fs/fs.h"
+#include "clib-package.h"
+#include "helpers.h"
+
+
+int
+main() {
+  clib_package_ctx_t *ctx = clib_package_ctx_new("{ \"api_endpoints\": [\"" API "\"] }");
+  clib_package_transport_t *memory = clib_package_transport_memory();
+
+  add_package(memory, "bar", NULL
+    , "bar.c", "int bar(void) { return 1; }\n"
+    , "bar.h", "int bar(void);\n"
+    , NULL);
+
+  describe("clib_package_transport_memory") {
+    it("should resolve a package without the network") {
+      clib_package_set_transport(ctx, memory);
+      clib_package_t *pkg = clib_package_new_from_slug("foo/bar", 0, ctx);
+      assert(pkg);
+      assert_str_equal("bar", pkg->name);
+      assert_str_equal("1.0.0", pkg->version);
+      clib_package_free(pkg);
+      clib_package_set_transport(ctx, NULL);
+    }
+
+    it("should answer unknown urls with a 404") {
+      clib_package_set_transport(ctx, memory);
+      assert(NULL == clib_package_new_from_slug("foo/missing", 0, ctx));
+      clib_package_set_transport(ctx, NULL);
+    }
+
+    it("should only serve the session it was set on") {
+      clib_package_ctx_t *other = clib_package_ctx_new("{ \"api_endpoints\": [\"" API "\"] }");
+      clib_package_transport_t *empty = clib_package_transport_memory();
+      clib_package_set_transport(ctx, memory);
+      clib_package_set_transport(other, empty);
+      assert(NULL == clib_package_new_from_slug("foo/bar", 0, other));
+      clib_package_t *pkg = clib_package_new_from_slug("foo/bar", 0, ctx);
+      assert(pkg);
+      clib_package_free(pkg);
+      clib_package_set_transport(ctx, NULL);
+      clib_package_ctx_free(other);
+      clib_package_transport_free(empty);
+    }
+
+    it("should install the package's sources") {
+      clib_package_set_transport(ctx, memory);
+      clib_package_t *pkg = clib_package_new_from_slug("foo/bar", 0, ctx);
+      assert(pkg);
+      assert(0 == clib_package_install(pkg, "./test/fixtures/", 0));
+      assert(0 == fs_exists("./test/fixtures/bar/package.json"));
+      assert(0 == fs_exists("./test/fixtures/bar/bar.c"));
+      assert(0 == fs_exists("./test/fixtures/bar/bar.h"));
+      char *source = fs_read("./test/fixtures/bar/bar.c");
+      assert_str_equal("int bar(void) { return 1; }\n", source);
+      free(source);
+      clib_package_free(pkg);
+      rimraf("./test/fixtures");
+      clib_package_set_transport(ctx, NULL);
+    }
+  }
+
+  describe("clib_package_transport_record") {
+    it("should replay what it recorded") {
+      remove("./test/transport.record");
+      clib_package_transport_t *record = clib_package_transport_record(memory, "./test/transport.record");
+      assert(record);
+      clib_package_set_transport(ctx, record);
+      clib_package_t *pkg = clib_package_new_from_slug("foo/bar", 0, ctx);
+      assert(pkg);
+      clib_package_free(pkg);
+      clib_package_transport_free(record);
+
+      clib_package_transport_t *replay = clib_package_transport_replay("./test/transport.record");
+      assert(replay);
+      clib_package_set_transport(ctx, replay);
+      pkg = clib_package_new_from_slug("foo/bar", 0, ctx);
+      assert(pkg);
+      assert_str_equal("bar", pkg->name);
+      clib_package_free(pkg);
+      clib_package_set_transport(ctx, NULL);
+      clib_package_transport_free(replay);
+      remove("./test/transport.record");
+    }
+  }
+
+  clib_package_ctx_free(ctx);
+  clib_package_transport_free(memory);
+  return assert_failures();
+}
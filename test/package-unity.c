@@ -0,0 +1,150 @@
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "describe/describe.h"
+#include "fs/fs.h"
+#include "rimraf/rimraf.h"
+#include "clib-package.h"
+#include "helpers.h"
+
+#define ROOT "./test/fixtures/unity/"
+#define DEPS ROOT "deps/"
+
+int
+main() {
+  clib_package_ctx_t *ctx = clib_package_ctx_new("{ \"api_endpoints\": [\"" API "\"], \"unity\": true }");
+  clib_package_transport_t *memory = clib_package_transport_memory();
+
+  add_package(memory, "baz", NULL
+    , "baz.c", "#include \"baz.h\"\nstatic int helper(void) { return 1; }\nint baz(void) { return helper(); }\n"
+    , "baz.h", "int baz(void);\n"
+    , NULL);
+  add_package(memory, "qux", NULL
+    , "qux.c", "static int helper(void) { return 2; }\nint qux(void) { return helper(); }\n"
+    , "util.c", "/* static int helper; */\nstatic const char *name = \"helper\";\n"
+    , NULL);
+  add_package(memory, "quux", NULL, "quux.c", "int quux(void) { return 0; }\n", NULL);
+  add_package(memory, "enums", NULL
+    , "a.c", "enum { OK, ERR };\nint a(void) { return OK; }\n"
+    , "b.c", "enum { OK, ERR };\nint b(void) { return ERR; }\n"
+    , NULL);
+  add_package(memory, "typedefs", NULL
+    , "c.c", "typedef int (*fn)(void);\n"
+    , "d.c", "typedef long (*fn)(void);\n"
+    , NULL);
+  add_package(memory, "macros", NULL
+    , "e.c", "#define MAX 10\nint e(void) { return MAX; }\n"
+    , "f.c", "#define MAX 20\nint f(void) { return MAX; }\n"
+    , "g.c", "#define _GNU_SOURCE\n#include <string.h>\nint g(void) { return 0; }\n"
+    , NULL);
+  clib_package_set_transport(ctx, memory);
+  rimraf(ROOT);
+
+  describe("unity build") {
+    it("should compile a lone file on its own") {
+      assert(0 == install(ctx, "foo/baz", DEPS));
+      char *mk = fs_read(ROOT "deps-unity.mk");
+      assert(mk);
+      assert_str_equal("deps__a_SOURCES += deps/baz/baz.c\n", mk);
+      free(mk);
+      assert(-1 == fs_exists(ROOT "deps-unity/unity-0.c"));
+    }
+
+    it("should group small packages and leave clashing files out") {
+      assert(0 == install(ctx, "foo/qux", DEPS));
+      char *mk = fs_read(ROOT "deps-unity.mk");
+      assert(mk);
+      assert_str_equal("deps__a_SOURCES += deps-unity/unity-0.c deps/qux/qux.c\n", mk);
+      free(mk);
+      char *unit = fs_read(ROOT "deps-unity/unity-0.c");
+      assert(unit);
+      assert(strstr(unit, "#include \"../deps/baz/baz.c\"\n#include \"../deps/qux/util.c\"\n"));
+      assert(NULL == strstr(unit, "qux.c"));
+      free(unit);
+    }
+
+    it("should take in packages installed before it was on") {
+      rimraf(ROOT);
+      clib_package_set_outputs(ctx, 0);
+      assert(0 == install(ctx, "foo/baz", DEPS));
+      assert(0 == install(ctx, "foo/qux", DEPS));
+      assert(-1 == fs_exists(ROOT "deps-unity.mk"));
+      clib_package_set_outputs(ctx, CLIB_PACKAGE_OUTPUT_UNITY);
+      // up to date, so skipped
+      assert(0 == install(ctx, "foo/qux", DEPS));
+      char *mk = fs_read(ROOT "deps-unity.mk");
+      assert(mk);
+      assert_str_equal("deps__a_SOURCES += deps-unity/unity-0.c deps/qux/qux.c\n", mk);
+      free(mk);
+    }
+
+    it("should drop the files of packages that are gone") {
+      rimraf(DEPS "qux");
+      assert(0 == install(ctx, "foo/quux", DEPS));
+      char *mk = fs_read(ROOT "deps-unity.mk");
+      assert(mk);
+      assert_str_equal("deps__a_SOURCES += deps-unity/unity-0.c\n", mk);
+      free(mk);
+      char *unit = fs_read(ROOT "deps-unity/unity-0.c");
+      assert(unit);
+      assert(strstr(unit, "#include \"../deps/baz/baz.c\"\n#include \"../deps/quux/quux.c\"\n"));
+      assert(NULL == strstr(unit, "qux"));
+      free(unit);
+      char *state = fs_read(ROOT "deps-unity/.sources");
+      assert(state);
+      assert(NULL == strstr(state, "deps/qux/"));
+      free(state);
+    }
+
+    it("should leave out files declaring the same enumerators") {
+      assert(0 == install(ctx, "foo/enums", DEPS));
+      char *unit = fs_read(ROOT "deps-unity/unity-0.c");
+      assert(unit);
+      assert(strstr(unit, "#include \"../deps/enums/a.c\"\n"));
+      assert(NULL == strstr(unit, "enums/b.c"));
+      free(unit);
+      char *mk = fs_read(ROOT "deps-unity.mk");
+      assert(mk);
+      assert(strstr(mk, " deps/enums/b.c"));
+      free(mk);
+    }
+
+    it("should leave out files typedef'ing the same pointer to function") {
+      assert(0 == install(ctx, "foo/typedefs", DEPS));
+      char *unit = fs_read(ROOT "deps-unity/unity-0.c");
+      assert(unit);
+      assert(strstr(unit, "#include \"../deps/typedefs/c.c\"\n"));
+      assert(NULL == strstr(unit, "typedefs/d.c"));
+      free(unit);
+      char *mk = fs_read(ROOT "deps-unity.mk");
+      assert(mk);
+      assert(strstr(mk, " deps/typedefs/d.c"));
+      free(mk);
+    }
+
+    it("should undefine the macros of each file after it") {
+      assert(0 == install(ctx, "foo/macros", DEPS));
+      char *unit = fs_read(ROOT "deps-unity/unity-0.c");
+      assert(unit);
+      assert(strstr(unit, "#include \"../deps/macros/e.c\"\n#undef MAX\n#include \"../deps/macros/f.c\"\n#undef MAX\n"));
+      free(unit);
+    }
+
+    it("should compile a file with a feature-test macro on its own") {
+      char *unit = fs_read(ROOT "deps-unity/unity-0.c");
+      assert(unit);
+      assert(NULL == strstr(unit, "macros/g.c"));
+      free(unit);
+      char *mk = fs_read(ROOT "deps-unity.mk");
+      assert(mk);
+      assert(strstr(mk, " deps/macros/g.c"));
+      free(mk);
+    }
+  }
+
+  rimraf(ROOT);
+  clib_package_ctx_free(ctx);
+  clib_package_transport_free(memory);
+  return assert_failures();
+}
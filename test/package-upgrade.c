@@ -0,0 +1,91 @@
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "describe/describe.h"
+#include "fs/fs.h"
+#include "rimraf/rimraf.h"
+#include "clib-package.h"
+#include "helpers.h"
+
+#define DEPS "./test/fixtures/"
+
+static void
+add_version(clib_package_transport_t *transport, const char *version, const char *src) {
+  char json[256];
+  snprintf(json, sizeof(json)
+    , "{ \"name\": \"baz\", \"version\": \"%s\", \"repo\": \"foo/baz\", \"src\": [%s] }"
+    , version, src);
+  add_manifest(transport, "baz", version, json);
+}
+
+static void
+upgrade(clib_package_ctx_t *ctx) {
+  clib_package_stats_reset(ctx);
+  assert(0 == install(ctx, "foo/baz", DEPS));
+}
+
+int
+main() {
+  clib_package_ctx_t *ctx = clib_package_ctx_new("{ \"api_endpoints\": [\"" API "\"] }");
+  clib_package_transport_t *memory = clib_package_transport_memory();
+  clib_package_stats_t stats;
+
+  add(memory, API "repos/foo/baz", "{}");
+  clib_package_set_transport(ctx, memory);
+
+  describe("clib_package_install") {
+    it("should fetch every file of a first install") {
+      add_version(memory, "1.0.0", "\"a.c\", \"b.c\", \"old.c\"");
+      add_file(memory, "baz", "a.c", "a1", "int a;\n");
+      add_file(memory, "baz", "b.c", "b1", "int b;\n");
+      add_file(memory, "baz", "old.c", "01", "int old;\n");
+      upgrade(ctx);
+      clib_package_stats(ctx, &stats);
+      assert(3 == stats.files_fetched);
+      assert(0 == stats.files_unchanged);
+    }
+
+    it("should only fetch what changed on upgrade") {
+      add_version(memory, "1.1.0", "\"a.c\", \"b.c\", \"c.c\"");
+      add_file(memory, "baz", "b.c", "b2", "int b2;\n");
+      add_file(memory, "baz", "c.c", "c1", "int c;\n");
+      upgrade(ctx);
+      clib_package_stats(ctx, &stats);
+      assert(2 == stats.files_fetched);
+      assert(1 == stats.files_unchanged);
+
+      char *a = fs_read(DEPS "baz/a.c");
+      char *b = fs_read(DEPS "baz/b.c");
+      assert(a && b);
+      assert_str_equal("int a;\n", a);
+      assert_str_equal("int b2;\n", b);
+      free(a);
+      free(b);
+      assert(0 == fs_exists(DEPS "baz/c.c"));
+      assert(-1 == fs_exists(DEPS "baz/old.c"));
+    }
+
+    it("should fetch a file edited since it was installed") {
+      FILE *file = fopen(DEPS "baz/a.c", "w");
+      assert(file);
+      fputs("int patched;\n", file);
+      fclose(file);
+      add_version(memory, "1.2.0", "\"a.c\", \"b.c\", \"c.c\"");
+      upgrade(ctx);
+      clib_package_stats(ctx, &stats);
+      assert(1 == stats.files_fetched);
+      assert(2 == stats.files_unchanged);
+
+      char *a = fs_read(DEPS "baz/a.c");
+      assert(a);
+      assert_str_equal("int a;\n", a);
+      free(a);
+    }
+  }
+
+  rimraf(DEPS);
+  clib_package_ctx_free(ctx);
+  clib_package_transport_free(memory);
+  return assert_failures();
+}